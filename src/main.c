@@ -2,23 +2,43 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/sysinfo.h>
 #include <sys/termios.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/if_link.h>
+#include <linux/io_uring.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #ifndef CMD_MAX
 #define CMD_MAX 512
@@ -33,6 +53,8 @@
 #define COLOR_RED     "\033[31m"
 #define COLOR_YELLOW  "\033[33m"
 #define COLOR_GREEN   "\033[32m"
+#define COLOR_BLUE    "\033[34m"
+#define COLOR_MAGENTA "\033[35m"
 #define COLOR_CYAN    "\033[36m"
 #define COLOR_BOLD    "\033[1m"
 
@@ -41,6 +63,8 @@
 #define THRESH_CPU_CRIT  95.0
 #define THRESH_WAIT_WARN 500.0
 #define THRESH_WAIT_CRIT 1000.0
+#define THRESH_STALL_WARN 10.0  // % of the interval throttled or stalled
+#define THRESH_STALL_CRIT 25.0
 
 // Special key codes for function keys (htop-style)
 #define KEY_F1  1001
@@ -57,6 +81,10 @@
 #define KEY_DOWN  2002
 #define KEY_LEFT  2003
 #define KEY_RIGHT 2004
+#define KEY_PGUP  2005
+#define KEY_PGDN  2006
+#define KEY_HOME  2007
+#define KEY_END   2008
 
 // Mouse event structure
 typedef struct {
@@ -66,12 +94,19 @@ typedef struct {
 } mouse_event_t;
 
 #define KEY_MOUSE 3000  // Special code indicating mouse event
+#define KEY_WAKE  4000  // input_wake_fd became readable (not a key press)
 
 typedef enum {
     MODE_PROCESS = 0,
     MODE_TREE,
     MODE_NETWORK,
     MODE_STORAGE,
+    MODE_BLOCKED,
+    MODE_MEMORY,
+    MODE_TOPOLOGY,
+    MODE_CPUS,
+    MODE_IRQ,
+    MODE_PRESSURE,
     MODE_HELP
 } display_mode_t;
 
@@ -79,6 +114,7 @@ typedef enum {
 typedef struct {
     pid_t pid;
     pid_t tgid;
+    pid_t ppid;
     uint64_t key; 
 
     uint64_t syscr;
@@ -90,8 +126,12 @@ typedef struct {
     uint64_t start_time_ticks;
     uint64_t minflt;  // Minor page faults
     uint64_t majflt;  // Major page faults
+    int processor;    // CPU the task last ran on
+    int nice;
+    uint64_t migrations;  // Changes of processor seen between refreshes
     
     char state;
+    char comm[16];    // Task name, e.g. "CPU 3/KVM" for a vCPU thread
     char user[32];
 
     uint64_t mem_virt_pages;
@@ -107,9 +147,21 @@ typedef struct {
     double minflt_ps;  // Minor faults per second
     double majflt_ps;  // Major faults per second
 
+    unsigned fetched;  // FETCH_* groups read from /proc during this cycle
+    double io_time;    // When the io counters were read, 0 = never
+
     char cmd[CMD_MAX];
 } sample_t;
 
+// Field groups collected per task. Only FETCH_STAT is always read for every
+// thread; the others are read up front only when the active sort needs them
+// and otherwise fetched for the displayed rows (see fetch_details()).
+#define FETCH_STAT  0x01  // task stat: CPU, blkio wait, state, faults
+#define FETCH_IO    0x02  // task io: syscalls and bytes
+#define FETCH_MEM   0x04  // statm (per process)
+#define FETCH_IDENT 0x08  // cmdline and owner (per process)
+#define FETCH_ALL   (FETCH_STAT | FETCH_IO | FETCH_MEM | FETCH_IDENT)
+
 typedef struct {
     char name[32];
     unsigned long long rio;
@@ -146,6 +198,7 @@ typedef struct {
 typedef struct {
     char name[32];
     char operstate[16]; 
+    int ifindex;  // 0 when collected from /proc/net/dev
     
     uint64_t rx_bytes;
     uint64_t tx_bytes;
@@ -153,6 +206,11 @@ typedef struct {
     uint64_t tx_packets;
     uint64_t rx_errors;
     uint64_t tx_errors;
+    uint64_t rx_dropped;
+    uint64_t tx_dropped;
+    uint64_t rx_fifo;
+    uint64_t tx_fifo;
+    uint64_t multicast;  // Received multicast packets
 
     int vmid;
     char vm_name[64];
@@ -163,6 +221,10 @@ typedef struct {
     double tx_pps;
     double rx_errs_ps;
     double tx_errs_ps;
+    double rx_drops_ps;
+    double tx_drops_ps;
+    double fifo_ps;      // RX + TX fifo errors
+    double mcast_ps;
 } net_iface_t;
 
 typedef struct {
@@ -184,35 +246,92 @@ typedef struct {
 
 // --- Helper Functions ---
 
-static void fmt_u64_commas(char *buf, unsigned long long val) {
-    char tmp[64];
-    sprintf(tmp, "%llu", val);
-    int len = strlen(tmp);
-    int out_idx = 0;
-    int leading = len % 3;
-    if (leading == 0 && len > 0) leading = 3;
-    for(int i=0; i<len; i++) {
-        if (i > 0 && (len - i) % 3 == 0) buf[out_idx++] = ',';
-        buf[out_idx++] = tmp[i];
+static void *grow_array(void *p, size_t n, size_t elem) {
+    void *q = realloc(p, n * elem);
+    if (!q) { fprintf(stderr, "OOM\n"); exit(2); }
+    return q;
+}
+
+// glibc's qsort() mallocs a copy of any array over 1 KiB, which is every
+// refresh's worth of samples. sort_rows() merge-sorts row pointers in scratch
+// space that keeps its capacity, then moves each row once. Stable, and only
+// for the main thread.
+static struct { void **ptr; size_t cap; char *row; size_t row_cap; } sort_scratch;
+
+static void sort_rows(void *base, size_t n, size_t size, int (*cmp)(const void *, const void *)) {
+    if (n < 2) return;
+    if (n * 2 > sort_scratch.cap) {
+        sort_scratch.cap = n * 2;
+        sort_scratch.ptr = grow_array(sort_scratch.ptr, sort_scratch.cap, sizeof(void *));
+    }
+    if (size > sort_scratch.row_cap) {
+        sort_scratch.row_cap = size;
+        sort_scratch.row = grow_array(sort_scratch.row, size, 1);
+    }
+    char *rows = base;
+    void **a = sort_scratch.ptr, **b = a + n;
+    for (size_t i = 0; i < n; i++) a[i] = rows + i * size;
+
+    for (size_t w = 1; w < n; w *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * w) {
+            size_t mid = lo + w < n ? lo + w : n, hi = lo + 2 * w < n ? lo + 2 * w : n;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) b[k++] = cmp(a[j], a[i]) < 0 ? a[j++] : a[i++];
+            while (i < mid) b[k++] = a[i++];
+            while (j < hi) b[k++] = a[j++];
+        }
+        void **t = a; a = b; b = t;
+    }
+
+    // a[k] is the row that belongs in slot k: follow each cycle with one
+    // row parked in scratch
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] == rows + i * size) continue;
+        memcpy(sort_scratch.row, rows + i * size, size);
+        size_t k = i;
+        for (;;) {
+            size_t from = (size_t)((char *)a[k] - rows) / size;
+            a[k] = rows + k * size;
+            if (from == i) { memcpy(rows + k * size, sort_scratch.row, size); break; }
+            memcpy(rows + k * size, rows + from * size, size);
+            k = from;
+        }
     }
-    buf[out_idx] = '\0';
 }
 
+#ifdef DEBUG
+// make DEBUG=1 links with --wrap for the allocator entry points, so every
+// allocation is counted, including the ones glibc makes for us (opendir(),
+// getpwuid(), stdio).
+static unsigned long malloc_calls;
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t n);
+void *__wrap_malloc(size_t n) { __atomic_add_fetch(&malloc_calls, 1, __ATOMIC_RELAXED); return __real_malloc(n); }
+void *__wrap_calloc(size_t n, size_t size) { __atomic_add_fetch(&malloc_calls, 1, __ATOMIC_RELAXED); return __real_calloc(n, size); }
+void *__wrap_realloc(void *p, size_t n) { __atomic_add_fetch(&malloc_calls, 1, __ATOMIC_RELAXED); return __real_realloc(p, n); }
+#endif
+
 static void vec_init(vec_t *v) { v->data=NULL; v->len=0; v->cap=0; }
 static void vec_free(vec_t *v) { free(v->data); v->data=NULL; v->len=0; v->cap=0; }
+static void vec_clear(vec_t *v) { v->len=0; }
+static void vec_reserve(vec_t *v, size_t want) {
+    if (want <= v->cap) return;
+    size_t new_cap = v->cap ? v->cap : 4096;
+    while (new_cap < want) new_cap *= 2;
+    sample_t *p = (sample_t *)realloc(v->data, new_cap * sizeof(*p));
+    if (!p) { fprintf(stderr, "OOM\n"); exit(2); }
+    v->data = p;
+    v->cap = new_cap;
+}
 static void vec_push(vec_t *v, const sample_t *item) {
-    if (v->len == v->cap) {
-        size_t new_cap = v->cap ? v->cap * 2 : 4096;
-        sample_t *p = (sample_t *)realloc(v->data, new_cap * sizeof(*p));
-        if (!p) { fprintf(stderr, "OOM\n"); exit(2); }
-        v->data = p;
-        v->cap = new_cap;
-    }
+    if (v->len == v->cap) vec_reserve(v, v->len + 1);
     v->data[v->len++] = *item;
 }
 
 static void vec_disk_init(vec_disk_t *v) { v->data=NULL; v->len=0; v->cap=0; }
 static void vec_disk_free(vec_disk_t *v) { free(v->data); v->data=NULL; v->len=0; v->cap=0; }
+static void vec_disk_clear(vec_disk_t *v) { v->len=0; }
 static void vec_disk_push(vec_disk_t *v, const disk_sample_t *item) {
     if (v->len == v->cap) {
         size_t new_cap = v->cap ? v->cap * 2 : 64;
@@ -226,6 +345,7 @@ static void vec_disk_push(vec_disk_t *v, const disk_sample_t *item) {
 
 static void vec_net_init(vec_net_t *v) { v->data=NULL; v->len=0; v->cap=0; }
 static void vec_net_free(vec_net_t *v) { free(v->data); v->data=NULL; v->len=0; v->cap=0; }
+static void vec_net_clear(vec_net_t *v) { v->len=0; }
 static void vec_net_push(vec_net_t *v, const net_iface_t *item) {
     if (v->len == v->cap) {
         size_t new_cap = v->cap ? v->cap * 2 : 64;
@@ -237,6 +357,54 @@ static void vec_net_push(vec_net_t *v, const net_iface_t *item) {
     v->data[v->len++] = *item;
 }
 
+// --- Sample Arena ---
+// All per-cycle buffers live here for the lifetime of the program. Each
+// generation writes into the slot that does not hold the previous sample and
+// the slots are swapped by pointer afterwards, so nothing is freed or
+// re-grown between refreshes.
+typedef struct {
+    vec_t raw[2];
+    vec_net_t net[2];
+    vec_disk_t disk[2];
+    vec_t proc;
+    unsigned gen;
+} sample_arena_t;
+
+static void arena_init(sample_arena_t *a) {
+    for (int i = 0; i < 2; i++) {
+        vec_init(&a->raw[i]);
+        vec_net_init(&a->net[i]);
+        vec_disk_init(&a->disk[i]);
+    }
+    vec_init(&a->proc);
+    a->gen = 0;
+}
+
+static void arena_free(sample_arena_t *a) {
+    for (int i = 0; i < 2; i++) {
+        vec_free(&a->raw[i]);
+        vec_net_free(&a->net[i]);
+        vec_disk_free(&a->disk[i]);
+    }
+    vec_free(&a->proc);
+}
+
+static vec_t *arena_raw(sample_arena_t *a, int prev) { return &a->raw[(a->gen + (unsigned)prev) & 1]; }
+static vec_net_t *arena_net(sample_arena_t *a, int prev) { return &a->net[(a->gen + (unsigned)prev) & 1]; }
+static vec_disk_t *arena_disk(sample_arena_t *a, int prev) { return &a->disk[(a->gen + (unsigned)prev) & 1]; }
+
+// Start a new generation: the current slots become "prev" and the old prev
+// slots are emptied (capacity kept) to receive the next sample.
+static void arena_advance(sample_arena_t *a) {
+    a->gen++;
+    vec_clear(arena_raw(a, 0));
+    vec_net_clear(arena_net(a, 0));
+    vec_disk_clear(arena_disk(a, 0));
+    // Size the new slot like the one it is replacing so the thread count can
+    // fluctuate without triggering a realloc mid-collection.
+    vec_reserve(arena_raw(a, 0), arena_raw(a, 1)->len + arena_raw(a, 1)->len / 8);
+}
+
 static uint64_t make_key(pid_t tid) {
     return (uint64_t)tid; 
 }
@@ -253,6 +421,140 @@ static double now_monotonic(void) {
     return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
 
+// --- Number Formatting ---
+// Every visible cell and every exported field is a number, so a frame of a
+// few hundred rows used to be thousands of printf("%*.*f") calls. These write
+// digits straight into the caller's buffer without going through the locale
+// and format parser. Output is byte for byte what printf produces; values
+// printf would round differently (ties after the multiplication, huge or
+// non-finite values) are handed to snprintf.
+#define FMT_NUM_MAX 48  // Buffer size for any fmt_* result
+
+static size_t fmt_u64(char *out, uint64_t v) {
+    char tmp[20];
+    size_t n = 0;
+    do { tmp[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+    for (size_t i = 0; i < n; i++) out[i] = tmp[n - 1 - i];
+    out[n] = '\0';
+    return n;
+}
+
+// Same as snprintf(out, FMT_NUM_MAX, "%.*f", prec, v)
+static size_t fmt_fixed(char *out, double v, int prec) {
+    static const double p10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+    static const uint64_t p10i[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+    int neg = __builtin_signbit(v) != 0;
+    double a = neg ? -v : v;
+    double scaled = (prec >= 0 && prec <= 9) ? a * p10[prec] : 0;
+    // The product is rounded once, so only a fraction within an ulp of .5
+    // can round the other way than printf's exact decimal expansion
+    uint64_t n = (uint64_t)scaled;
+    double frac = scaled - (double)n, ulp = scaled * 0x1p-52;
+    if (prec < 0 || prec > 9 || !__builtin_isfinite(v) || scaled >= 0x1p52 ||
+        (frac - 0.5 <= ulp && 0.5 - frac <= ulp)) {
+        int len = snprintf(out, FMT_NUM_MAX, "%.*f", prec, v);
+        return len < 0 ? 0 : (size_t)len < FMT_NUM_MAX ? (size_t)len : FMT_NUM_MAX - 1;
+    }
+    n += frac > 0.5;
+
+    size_t o = 0;
+    if (neg) out[o++] = '-';
+    o += fmt_u64(out + o, n / p10i[prec]);
+    if (prec > 0) {
+        uint64_t f = n % p10i[prec];
+        out[o++] = '.';
+        for (int i = prec - 1; i >= 0; i--) { out[o + (size_t)i] = (char)('0' + f % 10); f /= 10; }
+        o += (size_t)prec;
+        out[o] = '\0';
+    }
+    return o;
+}
+
+static void fmt_u64_commas(char *buf, unsigned long long val) {
+    char tmp[24];
+    size_t len = fmt_u64(tmp, val), o = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (i > 0 && (len - i) % 3 == 0) buf[o++] = ',';
+        buf[o++] = tmp[i];
+    }
+    buf[o] = '\0';
+}
+
+static char *fmt_2d(char *p, long v) {
+    if (v >= 100) return p + fmt_u64(p, (uint64_t)v);
+    p[0] = (char)('0' + v / 10);
+    p[1] = (char)('0' + v % 10);
+    return p + 2;
+}
+
+// 1d02h above a day, 02:15:33 below
+static size_t fmt_duration(char *buf, long secs) {
+    if (secs < 0) return (size_t)snprintf(buf, FMT_NUM_MAX, "%02ld:%02ld:%02ld", secs / 3600, (secs % 3600) / 60, secs % 60);
+    long days = secs / 86400;
+    char *p = buf;
+    if (days > 0) {
+        p += fmt_u64(p, (uint64_t)days);
+        *p++ = 'd';
+        p = fmt_2d(p, (secs % 86400) / 3600);
+        *p++ = 'h';
+    } else {
+        p = fmt_2d(p, secs / 3600); *p++ = ':';
+        p = fmt_2d(p, (secs % 3600) / 60); *p++ = ':';
+        p = fmt_2d(p, secs % 60);
+    }
+    *p = '\0';
+    return (size_t)(p - buf);
+}
+
+// KiB in the largest binary unit that keeps it at or above 1: 512K, 1.5M, 24G.
+// One decimal below 10, none above.
+static size_t fmt_iec(char *out, uint64_t kib) {
+    static const char unit[] = "KMGTP";
+    double v = (double)kib;
+    int u = 0;
+    while (v >= 1024.0 && u < 4) { v /= 1024.0; u++; }
+    size_t n = fmt_fixed(out, v, (u > 0 && v < 10.0) ? 1 : 0);
+    out[n++] = unit[u];
+    out[n] = '\0';
+    return n;
+}
+
+#ifdef DEBUG
+// The fast paths must agree with printf; also shows what they save
+static void fmt_selftest(void) {
+    char a[FMT_NUM_MAX], b[FMT_NUM_MAX];
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    unsigned long bad = 0;
+    const int n = 200000;
+    double *vals = (double *)malloc((size_t)n * sizeof(double));
+    if (!vals) { fprintf(stderr, "OOM\n"); exit(2); }
+    for (int i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        // Magnitudes from 1e-4 to 1e9, some exact ties (k/8) and negatives
+        double v = (double)(x >> 11) * 0x1p-53 * 1e9 / (double)(1ull << (x % 40));
+        if (i % 7 == 0) v = (double)(x % 100000) / 8.0;
+        if (i % 11 == 0) v = -v;
+        vals[i] = v;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int prec = 0; prec <= 3; prec++) {
+            fmt_fixed(a, vals[i], prec);
+            snprintf(b, sizeof(b), "%.*f", prec, vals[i]);
+            if (strcmp(a, b) != 0 && bad++ < 5) fprintf(stderr, "DEBUG: fmt_fixed(%.17g, %d) = %s, printf %s\n", vals[i], prec, a, b);
+        }
+    }
+    double t0 = now_monotonic();
+    size_t sink = 0;
+    for (int i = 0; i < n; i++) sink += fmt_fixed(a, vals[i], 2);
+    double t1 = now_monotonic();
+    for (int i = 0; i < n; i++) sink += (size_t)snprintf(b, sizeof(b), "%.2f", vals[i]);
+    double t2 = now_monotonic();
+    fprintf(stderr, "DEBUG: fmt_fixed %lu mismatches; %d values in %.1f ms, snprintf %.1f ms (%zu)\n",
+            bad, n, (t1 - t0) * 1000.0, (t2 - t1) * 1000.0, sink);
+    free(vals);
+}
+#endif
+
 // --- Terminal Handling ---
 static struct termios orig_termios;
 static int raw_mode_enabled = 0;
@@ -321,7 +623,14 @@ static int parse_mouse_sgr(void) {
     // Parse: button;x;y
     int button = 0, x = 0, y = 0;
     if (sscanf(buf, "%d;%d;%d", &button, &x, &y) == 3) {
-        // Only handle left click (button 0) press events (ending in 'M')
+        // Wheel notches arrive as presses of buttons 64/65; otherwise only
+        // left click (button 0) press events (ending in 'M') are handled
+        if (c == 'M' && (button & 64)) {
+            last_mouse_event.button = 64 | (button & 1);
+            last_mouse_event.x = x;
+            last_mouse_event.y = y;
+            return KEY_MOUSE;
+        }
         if (c == 'M' && (button & 3) == 0) {
             last_mouse_event.button = button & 3;
             last_mouse_event.x = x;
@@ -345,6 +654,8 @@ static int parse_escape_sequence(void) {
             case 'Q': return KEY_F2;
             case 'R': return KEY_F3;
             case 'S': return KEY_F4;
+            case 'H': return KEY_HOME;
+            case 'F': return KEY_END;
             default: return 27;
         }
     } else if (c1 == '[') {
@@ -354,6 +665,13 @@ static int parse_escape_sequence(void) {
         if (c2 == 'B') return KEY_DOWN;
         if (c2 == 'C') return KEY_RIGHT;
         if (c2 == 'D') return KEY_LEFT;
+        if (c2 == 'H') return KEY_HOME;
+        if (c2 == 'F') return KEY_END;
+        // ESC [ n ~ for the editing keypad (7/8 are rxvt's Home/End)
+        if (c2 == '4' || c2 == '5' || c2 == '6' || c2 == '7' || c2 == '8') {
+            if (read_byte_timeout(50) != '~') return 27;
+            return c2 == '5' ? KEY_PGUP : c2 == '6' ? KEY_PGDN : c2 == '7' ? KEY_HOME : KEY_END;
+        }
         
         // Mouse SGR extended mode: ESC [ <
         if (c2 == '<') {
@@ -383,6 +701,10 @@ static int parse_escape_sequence(void) {
     return 27;  // Unknown escape sequence, return ESC
 }
 
+// Optional extra descriptor watched while waiting for keys, so background
+// events (link state changes) can trigger a redraw before the interval ends
+static int input_wake_fd = -1;
+
 static int wait_for_input(double seconds) {
     if (seconds < 0) seconds = 0;
     struct timeval tv;
@@ -393,10 +715,16 @@ static int wait_for_input(double seconds) {
     fd_set fds;
     FD_ZERO(&fds);
     FD_SET(STDIN_FILENO, &fds);
+    int maxfd = STDIN_FILENO;
+    if (input_wake_fd >= 0) {
+        FD_SET(input_wake_fd, &fds);
+        if (input_wake_fd > maxfd) maxfd = input_wake_fd;
+    }
 
-    int ret = select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv);
+    int ret = select(maxfd + 1, &fds, NULL, NULL, &tv);
+    if (ret > 0 && !FD_ISSET(STDIN_FILENO, &fds)) return KEY_WAKE;
     
-    if (ret > 0) {
+    if (ret > 0 && FD_ISSET(STDIN_FILENO, &fds)) {
         unsigned char c;
         if (read(STDIN_FILENO, &c, 1) == 1) {
             // Check for escape sequence (function keys, arrows)
@@ -409,6 +737,13 @@ static int wait_for_input(double seconds) {
     return 0; // Timeout or error
 }
 
+// 0 when stdout is not a terminal
+static int get_term_rows(void) {
+    struct winsize ws;
+    if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) return ws.ws_row;
+    return 0;
+}
+
 static int get_term_cols(void) {
     int cols = 120;
     if (isatty(STDOUT_FILENO)) {
@@ -428,6 +763,20 @@ static void fprint_trunc(FILE *out, const char *s, int width) {
 
 // Color helper functions
 static int color_enabled = 1;  // Global flag for color support
+static int smaps_ttl = 3;      // Refresh intervals a smaps_rollup read stays valid
+static int lazy_collect = 1;   // Read io/statm only for displayed rows unless sorting by them
+static int use_io_uring = 0;   // Batch the per-task reads through io_uring
+static char log_dir[PATH_MAX] = "";  // Background snapshot log directory (off when empty)
+static char audit_log[PATH_MAX] = "";  // Where actions are logged (default chosen at startup)
+static char group_start[16] = "";  // Group-by key of the process view at startup
+static int log_jsonl = 0;      // Log format: CSV rows, or one JSON line per snapshot
+static int log_rotate_mib = 64;
+static int log_rotate_sec = 3600;
+static int log_keep = 24;      // Log files kept, the current one included
+static char record_dir[PATH_MAX] = ".";  // Flight recorder dumps
+static int record_ring = 10;   // Refreshes kept from before a trigger
+static int record_after = 5;   // Refreshes recorded after it
+static double record_burst = 0;  // Burst sampling period for the offending process; 0 = off
 
 static const char* get_cpu_color(double cpu_pct) {
     if (!color_enabled) return "";
@@ -443,6 +792,13 @@ static const char* get_wait_color(double wait_ms) {
     return "";
 }
 
+static const char* get_stall_color(double pct) {
+    if (!color_enabled) return "";
+    if (pct >= THRESH_STALL_CRIT) return COLOR_RED;
+    if (pct >= THRESH_STALL_WARN) return COLOR_YELLOW;
+    return "";
+}
+
 static const char* get_state_color(char state) {
     if (!color_enabled) return "";
     if (state == 'D') return COLOR_RED;  // Disk wait
@@ -472,6 +828,14 @@ static void print_footer_bar(display_mode_t mode, int frozen, int cols) {
         printf("F5");
         printf("\033[0m");
         printf("Wait ");
+        printf("\033[7m");
+        printf("a");
+        printf("\033[0m");
+        printf("Act ");
+        printf("\033[7m");
+        printf("g");
+        printf("\033[0m");
+        printf("Group ");
     } else if (mode == MODE_NETWORK) {
         printf(" F1");
         printf("\033[0m");
@@ -488,6 +852,70 @@ static void print_footer_bar(display_mode_t mode, int frozen, int cols) {
         printf("F2");
         printf("\033[0m");
         printf("W_IOPS ");
+    } else if (mode == MODE_MEMORY) {
+        printf(" F2");
+        printf("\033[0m");
+        printf("MajFlt ");
+        printf("\033[7m");
+        printf("F4");
+        printf("\033[0m");
+        printf("Res ");
+        printf("\033[7m");
+        printf("a");
+        printf("\033[0m");
+        printf("Act ");
+    } else if (mode == MODE_CPUS) {
+        printf(" F2");
+        printf("\033[0m");
+        printf("Busy ");
+        printf("\033[7m");
+        printf("F7");
+        printf("\033[0m");
+        printf("SoftIRQ ");
+        printf("\033[7m");
+        printf("z");
+        printf("\033[0m");
+        printf("Compact ");
+    } else if (mode == MODE_IRQ) {
+        printf(" F2");
+        printf("\033[0m");
+        printf("Rate ");
+        printf("\033[7m");
+        printf("F5");
+        printf("\033[0m");
+        printf("VMID ");
+    } else if (mode == MODE_PRESSURE) {
+        printf(" F3");
+        printf("\033[0m");
+        printf("Throttle ");
+        printf("\033[7m");
+        printf("F5");
+        printf("\033[0m");
+        printf("IO ");
+        printf("\033[7m");
+        printf("F6");
+        printf("\033[0m");
+        printf("Mem ");
+    } else if (mode == MODE_TOPOLOGY) {
+        printf(" F1");
+        printf("\033[0m");
+        printf("Core ");
+        printf("\033[7m");
+        printf("F2");
+        printf("\033[0m");
+        printf("Load ");
+        printf("\033[7m");
+        printf("F5");
+        printf("\033[0m");
+        printf("vRun ");
+    } else if (mode == MODE_BLOCKED) {
+        printf(" F1");
+        printf("\033[0m");
+        printf("Threads ");
+        printf("\033[7m");
+        printf("F3");
+        printf("\033[0m");
+        printf("Seen ");
     }
     
     // Common keys
@@ -504,6 +932,30 @@ static void print_footer_bar(display_mode_t mode, int frozen, int cols) {
     printf("\033[0m");
     printf("Disk ");
     printf("\033[7m");
+    printf("m");
+    printf("\033[0m");
+    printf("Mem ");
+    printf("\033[7m");
+    printf("u");
+    printf("\033[0m");
+    printf("CPUs ");
+    printf("\033[7m");
+    printf("o");
+    printf("\033[0m");
+    printf("Topo ");
+    printf("\033[7m");
+    printf("i");
+    printf("\033[0m");
+    printf("IRQ ");
+    printf("\033[7m");
+    printf("v");
+    printf("\033[0m");
+    printf("Pressure ");
+    printf("\033[7m");
+    printf("b");
+    printf("\033[0m");
+    printf("Blocked ");
+    printf("\033[7m");
     printf("t");
     printf("\033[0m");
     printf("Tree ");
@@ -533,95 +985,6 @@ static void print_footer_bar(display_mode_t mode, int frozen, int cols) {
     printf("\033[0m");
 }
 
-// Handle mouse click on header row - returns sort key or 0
-// Header row is row 3 (after title and system stats)
-static int handle_header_click(int x, int y, display_mode_t mode) {
-    // Header row is line 3
-    if (y != 3) return 0;
-    
-    if (mode == MODE_PROCESS || mode == MODE_TREE) {
-        // Column positions for process view (approximate)
-        // PID: 1-10, User: 11-21, Uptime: 22-32, Res: 33-43, Shr: 44-54, Virt: 55-65
-        // R_Log: 66-76, W_Log: 77-87, Wait: 88-96, R_MiB: 97-107, W_MiB: 108-118
-        // CPU%: 119-127, State: 128-133
-        if (x >= 1 && x <= 10) return KEY_F1;    // PID
-        if (x >= 66 && x <= 76) return KEY_F3;   // R_Log
-        if (x >= 77 && x <= 87) return KEY_F4;   // W_Log
-        if (x >= 88 && x <= 96) return KEY_F5;   // Wait
-        if (x >= 97 && x <= 107) return KEY_F6;  // R_MiB
-        if (x >= 108 && x <= 118) return KEY_F7; // W_MiB
-        if (x >= 119 && x <= 127) return KEY_F2; // CPU%
-        if (x >= 128 && x <= 133) return KEY_F8; // State
-    } else if (mode == MODE_NETWORK) {
-        // Network view columns
-        // IFACE: 1-16, STATE: 17-27, RX_Mbps: 28-40, TX_Mbps: 41-53
-        if (x >= 28 && x <= 40) return KEY_F1;   // RX
-        if (x >= 41 && x <= 53) return KEY_F2;   // TX
-    } else if (mode == MODE_STORAGE) {
-        // Storage view columns
-        // DEVICE: 1-16, R_IOPS: 17-28, W_IOPS: 29-40, R_MiB/s: 41-52
-        // W_MiB/s: 53-64, R_Lat: 65-78, W_Lat: 79-92
-        if (x >= 17 && x <= 28) return KEY_F1;   // R_IOPS
-        if (x >= 29 && x <= 40) return KEY_F2;   // W_IOPS
-        if (x >= 41 && x <= 52) return KEY_F3;   // R_MiB/s
-        if (x >= 53 && x <= 64) return KEY_F4;   // W_MiB/s
-        if (x >= 65 && x <= 78) return KEY_F5;   // R_Lat
-        if (x >= 79 && x <= 92) return KEY_F6;   // W_Lat
-    }
-    return 0;
-}
-
-// Export current view to CSV
-static void export_csv(const char *mode_name, vec_t *proc_data, vec_net_t *net_data, vec_disk_t *disk_data, display_mode_t mode) {
-    char filename[128];
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    strftime(filename, sizeof(filename), "kvmtop_%Y%m%d_%H%M%S.csv", tm_info);
-    
-    FILE *f = fopen(filename, "w");
-    if (!f) {
-        return;
-    }
-    
-    if (mode == MODE_PROCESS || mode == MODE_TREE) {
-        fprintf(f, "PID,User,Uptime,Res_MiB,Shr_MiB,Virt_MiB,R_Log,W_Log,Wait_ms,R_MiB,W_MiB,CPU_pct,State,Command\n");
-        for (size_t i = 0; i < proc_data->len; i++) {
-            sample_t *s = &proc_data->data[i];
-            double res_mib = (double)s->mem_res_pages * 4096.0 / 1048576.0;
-            double shr_mib = (double)s->mem_shr_pages * 4096.0 / 1048576.0;
-            double virt_mib = (double)s->mem_virt_pages * 4096.0 / 1048576.0;
-            fprintf(f, "%d,%s,0,%.0f,%.0f,%.0f,%.0f,%.0f,%.2f,%.2f,%.2f,%.2f,%c,\"%s\"\n",
-                s->tgid, s->user, res_mib, shr_mib, virt_mib,
-                s->r_iops, s->w_iops, s->io_wait_ms, s->r_mib, s->w_mib,
-                s->cpu_pct, s->state, s->cmd);
-        }
-    } else if (mode == MODE_NETWORK) {
-        fprintf(f, "Interface,State,RX_Mbps,TX_Mbps,RX_Pkts,TX_Pkts,RX_Err,TX_Err,VMID,VM_Name\n");
-        for (size_t i = 0; i < net_data->len; i++) {
-            net_iface_t *n = &net_data->data[i];
-            fprintf(f, "%s,%s,%.2f,%.2f,%.0f,%.0f,%.0f,%.0f,%d,%s\n",
-                n->name, n->operstate, n->rx_mbps, n->tx_mbps,
-                n->rx_pps, n->tx_pps, n->rx_errs_ps, n->tx_errs_ps,
-                n->vmid, n->vm_name);
-        }
-    } else if (mode == MODE_STORAGE) {
-        fprintf(f, "Device,R_IOPS,W_IOPS,R_MiB_s,W_MiB_s,R_Lat_ms,W_Lat_ms,Util_pct\n");
-        for (size_t i = 0; i < disk_data->len; i++) {
-            disk_sample_t *d = &disk_data->data[i];
-            fprintf(f, "%s,%.2f,%.2f,%.2f,%.2f,%.4f,%.4f,%.2f\n",
-                d->name, d->r_iops, d->w_iops, d->r_mib, d->w_mib,
-                d->r_lat, d->w_lat, d->util_pct);
-        }
-    }
-    
-    fclose(f);
-    // Show message briefly - will be overwritten on next refresh
-    printf("\033[2J\033[H");
-    printf("Exported to: %s\n\nPress any key to continue...", filename);
-    fflush(stdout);
-    wait_for_input(999999);
-}
-
 // Load configuration from ~/.kvmtoprc
 static void load_config(double *interval, int *limit) {
     char path[PATH_MAX];
@@ -654,6 +1017,41 @@ static void load_config(double *interval, int *limit) {
                 if (v > 0) *limit = v;
             } else if (strcmp(key, "color") == 0) {
                 color_enabled = (strcmp(value, "on") == 0 || strcmp(value, "1") == 0);
+            } else if (strcmp(key, "lazy") == 0) {
+                lazy_collect = (strcmp(value, "on") == 0 || strcmp(value, "1") == 0);
+            } else if (strcmp(key, "audit_log") == 0) {
+                snprintf(audit_log, sizeof(audit_log), "%s", value);
+            } else if (strcmp(key, "group") == 0) {
+                snprintf(group_start, sizeof(group_start), "%.15s", value);
+            } else if (strcmp(key, "io_uring") == 0) {
+                use_io_uring = (strcmp(value, "on") == 0 || strcmp(value, "1") == 0);
+            } else if (strcmp(key, "smaps_ttl") == 0) {
+                int v = atoi(value);
+                if (v > 0) smaps_ttl = v;
+            } else if (strcmp(key, "log_dir") == 0) {
+                snprintf(log_dir, sizeof(log_dir), "%s", value);
+            } else if (strcmp(key, "log_format") == 0) {
+                log_jsonl = strcmp(value, "jsonl") == 0;
+            } else if (strcmp(key, "log_rotate_size") == 0) {
+                int v = atoi(value);
+                if (v > 0) log_rotate_mib = v;
+            } else if (strcmp(key, "log_rotate_age") == 0) {
+                int v = atoi(value);
+                if (v > 0) log_rotate_sec = v;
+            } else if (strcmp(key, "log_keep") == 0) {
+                int v = atoi(value);
+                if (v > 0) log_keep = v;
+            } else if (strcmp(key, "record_dir") == 0) {
+                snprintf(record_dir, sizeof(record_dir), "%s", value);
+            } else if (strcmp(key, "record_ring") == 0) {
+                int v = atoi(value);
+                if (v > 0) record_ring = v;
+            } else if (strcmp(key, "record_after") == 0) {
+                int v = atoi(value);
+                if (v >= 0) record_after = v;
+            } else if (strcmp(key, "record_burst") == 0) {
+                double v = strtod(value, NULL);
+                if (v >= 0.05 || v == 0) record_burst = v;
             }
         }
     }
@@ -670,40 +1068,82 @@ static void print_help_screen(void) {
     printf("    c       - Switch to Process/CPU view (main dashboard)\n");
     printf("    s       - Switch to Storage/Disk view\n");
     printf("    n       - Switch to Network view\n");
-    printf("    t       - Toggle Tree mode (show threads in process view)\n");
+    printf("    m       - Switch to Memory view (faults, swap, NUMA placement)\n");
+    printf("    u       - Switch to per-CPU view (z toggles the compact grid)\n");
+    printf("    o       - Switch to Topology view (vCPU placement per core)\n");
+    printf("    i       - Switch to Interrupts view (IRQ/softirq rates, vectors per VM)\n");
+    printf("    v       - Switch to VM Pressure view (cgroup CPU throttling, PSI stalls)\n");
+    printf("    b       - Switch to Blocked view (what D-state threads wait on)\n");
+    printf("    t       - Cycle Tree mode: threads under processes, process hierarchy, off\n");
+    printf("    g       - Cycle Group by: user, cgroup, vmid, comm, state, off\n");
+    printf("    Enter   - List the members of the selected group (Esc returns)\n");
+    printf("    p       - Toggle PSS/Swap/AnonHuge columns (from smaps_rollup)\n");
     printf("    h       - Show this help screen\n");
     printf("    e       - Export current view to CSV file\n\n");
     
     printf("  INTERACTIVE CONTROLS:\n");
     printf("    f       - Freeze/Resume display updates\n");
-    printf("    l       - Set display limit (number of entries to show)\n");
+    printf("    l       - Set display limit (most rows on one page)\n");
     printf("    r       - Set refresh interval in seconds\n");
     printf("    /       - Enter filter mode (search by PID, name, user, VM)\n");
+    printf("    a       - Act on the selected process or thread: nice, I/O class,\n");
+    printf("              CPU affinity, or pin a VM's vCPU threads 1:1 to CPUs\n");
     printf("    q       - Quit kvmtop\n\n");
+
+    printf("  SCROLLING:\n");
+    printf("    Up/Down move the selected row, PgUp/PgDn a page, Home/End to the ends;\n");
+    printf("    the mouse wheel moves it 3 rows and a click on a row selects it\n\n");
     
     printf("  SORTING (htop-style: use F1-F8, number keys 1-8, or CLICK COLUMN HEADERS):\n");
-    printf("    Press same key/click again to toggle ascending/descending order\n\n");
+    printf("    Press same key/click again to toggle ascending/descending order\n");
+    printf("    < / > step through every sortable column, including those without a key\n\n");
     
     printf("    Process View:     Network View:     Storage View:\n");
     printf("    F1/1 - PID        F1/1 - RX Mbps    F1/1 - Read IOPS\n");
     printf("    F2/2 - CPU%%       F2/2 - TX Mbps    F2/2 - Write IOPS\n");
-    printf("    F3/3 - Read Logs                    F3/3 - Read MiB/s\n");
-    printf("    F4/4 - Write Logs                   F4/4 - Write MiB/s\n");
-    printf("    F5/5 - IO Wait                      F5/5 - Read Latency\n");
-    printf("    F6/6 - Read MiB/s                   F6/6 - Write Latency\n");
-    printf("    F7/7 - Write MiB/s\n");
-    printf("    F8/8 - State\n\n");
+    printf("    F3/3 - Read Logs  F3/3 - RX Pkts    F3/3 - Read MiB/s\n");
+    printf("    F4/4 - Write Logs F4/4 - TX Pkts    F4/4 - Write MiB/s\n");
+    printf("    F5/5 - IO Wait    F5/5 - RX Errors  F5/5 - Read Latency\n");
+    printf("    F6/6 - Read MiB/s F6/6 - TX Errors  F6/6 - Write Latency\n");
+    printf("    F7/7 - Write MiB/s F7/7 - RX Drops  F7/7 - Utilization\n");
+    printf("    F8/8 - State      F8/8 - TX Drops\n");
+    printf("    Grouped:      F1/1 - Group, F2/2 - CPU%%, F3-F7 as above, F8/8 - D threads\n");
+    printf("    Memory View:  F1/1 - PID, F2/2 - MajFlt/s, F3/3 - MinFlt/s, F4/4 - Res\n");
+    printf("    Per-CPU View: F1/1 - CPU, F2/2 - Busy, F3-F8 - User, Sys, IOwait, IRQ, SoftIRQ, Steal\n");
+    printf("    Interrupts View: F1/1 - IRQ, F2/2 - Rate, F3/3 - CPUs, F4/4 - Top CPU, F5/5 - VMID\n");
+    printf("    Topology View: F1/1 - Core, F2/2 - Load, F3/3 - Run, F4/4 - vCPUs, F5/5 - vRun\n");
+    printf("    Blocked View: F1/1 - Threads, F2/2 - Procs, F3/3 - Seen, F4/4 - Ago, F5/5 - Wchan\n\n");
     
     printf("  COMMAND-LINE OPTIONS:\n");
     printf("    -i, --interval <sec>   Set refresh interval (default: 5.0)\n");
     printf("    -p, --pid <PID>        Monitor specific process ID(s)\n");
+    printf("    --daemon               Collect and publish snapshots for viewers\n");
+    printf("    --attach               View snapshots from a running --daemon\n");
+    printf("    --shm <path>           Snapshot file (default: /run/kvmtop/snapshots)\n");
+    printf("    --serve <port>         Stream VM summaries to cluster viewers\n");
+    printf("    --cluster <h[:p],...>  Merged VM table from several --serve nodes\n");
+    printf("    --log <dir>            Log every refresh in the background\n");
+    printf("    --log-format csv|jsonl Log file format (default: csv)\n");
+    printf("    --log-rotate-size <MiB>, --log-rotate-age <sec>, --log-keep <n>\n");
+    printf("    --trigger <rule>       Dump recent history when e.g. 'wait>1000 for 2 on qemu' fires\n");
+    printf("    --record-dir <dir>, --record-ring <n>, --record-after <n>, --record-burst <sec>\n");
+    printf("    --io-uring             Batch per-task reads through io_uring\n");
+    printf("    --audit-log <path>     Log of actions (default: /var/log/kvmtop-audit.log)\n");
+    printf("    --group <key>          Group processes by user, cgroup, vmid, comm or state\n");
     printf("    -v, --version          Show version information\n");
     printf("    -h, --help             Show help message\n\n");
     
     printf("  CONFIG FILE: ~/.kvmtoprc\n");
     printf("    interval=2.0           # Default refresh interval\n");
     printf("    limit=100              # Default display limit\n");
-    printf("    color=on               # Enable color output\n\n");
+    printf("    color=on               # Enable color output\n");
+    printf("    smaps_ttl=3            # Intervals to reuse smaps_rollup data\n");
+    printf("    lazy=on                # Read io/statm only for displayed rows\n");
+    printf("    io_uring=on            # Batch per-task reads through io_uring\n");
+    printf("    audit_log=<path>       # Log of actions taken with 'a'\n");
+    printf("    group=vmid             # Start the process view grouped\n");
+    printf("    log_dir=/var/log/kvmtop # Background logging (also log_format, log_rotate_size,\n");
+    printf("                           #   log_rotate_age, log_keep)\n\n");
     
     printf("  Press any key to return...");
     fflush(stdout);
@@ -711,16 +1151,245 @@ static void print_help_screen(void) {
 
 // --- File Reading Helpers ---
 
+// Plain open/read instead of stdio: fopen() mallocs a FILE and its buffer on
+// every call, which adds up to tens of thousands of allocations per cycle.
+static unsigned long file_reads = 0;  // Files opened under /proc and /sys
+
 static int read_small_file(const char *path, char *buf, size_t buflen, ssize_t *nread_out) {
-    FILE *f = fopen(path, "r");
-    if (!f) return -1;
-    size_t n = fread(buf, 1, buflen - 1, f);
-    fclose(f);
+    file_reads++;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    size_t n = 0;
+    while (n < buflen - 1) {
+        ssize_t r = read(fd, buf + n, buflen - 1 - n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        n += (size_t)r;
+    }
+    close(fd);
     buf[n] = '\0';
     if (nread_out) *nread_out = (ssize_t)n;
     return 0;
 }
 
+// --- Batched Reads ---
+// Every refresh reads the stat (and often io) file of every task: three
+// syscalls per file (open, pread, close), 60k+ per refresh on a host with 30k
+// threads. read_batch() takes a batch of such reads at once. With io_uring
+// enabled it queues the opens of the whole batch in one submission, then
+// each read hard-linked to its close in a second one, so a batch costs two
+// syscalls. Without it, or when the kernel lacks io_uring or its openat/read/
+// close opcodes (5.6+), the batch is read with plain open/pread/close.
+// io_uring is driven with raw syscalls; there is no liburing dependency.
+#define READ_BATCH 256         // Requests per batch
+#define READ_SLOT  2048        // Buffer per request; task stat and io fit easily
+
+typedef struct {
+    char path[64];
+    char *buf;                 // READ_SLOT bytes, NUL-terminated after the read
+    ssize_t len;               // Bytes read, -1 if the file could not be read
+} read_req_t;
+
+static unsigned long engine_syscalls;  // Syscalls spent in read_batch(), for DEBUG
+
+typedef struct {
+    int fd;                    // -1 = not set up yet, -2 = unavailable
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_local;         // Tail including queued but unpublished SQEs
+    void *sq_map, *cq_map, *sqe_map;
+    size_t sq_len, cq_len, sqe_len;
+} uring_t;
+
+static uring_t uring = { .fd = -1 };
+static char uring_note[80];    // Why the ring was given up, for the header
+
+static int uring_supports(int fd) {
+    const unsigned n_ops = 64;
+    struct io_uring_probe *probe = calloc(1, sizeof(*probe) + n_ops * sizeof(struct io_uring_probe_op));
+    if (!probe) return 0;
+    int ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, n_ops) == 0;
+    const int need[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+    for (size_t i = 0; ok && i < sizeof(need) / sizeof(need[0]); i++)
+        ok = need[i] <= probe->last_op && (probe->ops[need[i]].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+static void uring_close(uring_t *u) {
+    if (u->sqe_map) munmap(u->sqe_map, u->sqe_len);
+    if (u->cq_map && u->cq_map != u->sq_map) munmap(u->cq_map, u->cq_len);
+    if (u->sq_map) munmap(u->sq_map, u->sq_len);
+    if (u->fd >= 0) close(u->fd);
+    memset(u, 0, sizeof(*u));
+    u->fd = -2;
+}
+
+static int uring_init(uring_t *u) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // A batch queues at most two SQEs (read + close) per request
+    int fd = (int)syscall(__NR_io_uring_setup, 2 * READ_BATCH, &p);
+    if (fd < 0) return -1;
+    u->fd = fd;
+    if (!uring_supports(fd)) { uring_close(u); return -1; }
+
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_len > u->sq_len) u->sq_len = u->cq_len;
+        u->cq_len = u->sq_len;
+    }
+    u->sq_map = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (u->sq_map == MAP_FAILED) { u->sq_map = NULL; uring_close(u); return -1; }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_map = u->sq_map;
+    } else {
+        u->cq_map = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (u->cq_map == MAP_FAILED) { u->cq_map = NULL; uring_close(u); return -1; }
+    }
+    u->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqe_map = mmap(NULL, u->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (u->sqe_map == MAP_FAILED) { u->sqe_map = NULL; uring_close(u); return -1; }
+
+    char *sq = (char *)u->sq_map, *cq = (char *)u->cq_map;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    u->sqes = (struct io_uring_sqe *)u->sqe_map;
+    u->sq_local = *u->sq_tail;
+    return 0;
+}
+
+static struct io_uring_sqe *uring_sqe(uring_t *u, uint8_t opcode, int fd, uint64_t user_data) {
+    unsigned idx = u->sq_local++ & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    u->sq_array[idx] = idx;
+    return sqe;
+}
+
+// Submit everything queued and wait until `want` completions are reaped
+// through `reap`. Returns -1 if the ring failed; the caller then falls back.
+static int uring_run(uring_t *u, unsigned want, void (*reap)(const struct io_uring_cqe *, void *), void *ctx) {
+    __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+    unsigned to_submit = u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    while (want > 0) {
+        engine_syscalls++;
+        int r = (int)syscall(__NR_io_uring_enter, u->fd, to_submit, want, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return -1;
+        if (r > 0) to_submit -= (unsigned)r < to_submit ? (unsigned)r : to_submit;
+        unsigned head = *u->cq_head, tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail && want > 0; head++, want--) reap(&u->cqes[head & *u->cq_mask], ctx);
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+#define URING_CLOSE_TAG (1ULL << 63)
+
+typedef struct {
+    read_req_t *req;
+    int *fds;
+} uring_batch_t;
+
+static void reap_open(const struct io_uring_cqe *cqe, void *ctx) {
+    uring_batch_t *b = (uring_batch_t *)ctx;
+    b->fds[cqe->user_data] = cqe->res;
+}
+
+static void reap_read(const struct io_uring_cqe *cqe, void *ctx) {
+    uring_batch_t *b = (uring_batch_t *)ctx;
+    if (cqe->user_data & URING_CLOSE_TAG) { b->fds[cqe->user_data & ~URING_CLOSE_TAG] = -1; return; }
+    read_req_t *r = &b->req[cqe->user_data];
+    r->len = cqe->res >= 0 ? cqe->res : -1;
+    r->buf[r->len > 0 ? r->len : 0] = '\0';
+}
+
+// The ring failed part way: close the files it opened and has not closed.
+// A failed submit queues nothing, so none of these closes is still in flight.
+static void uring_batch_abort(const int *fds, size_t n) {
+    int err = errno;
+    for (size_t i = 0; i < n; i++) if (fds[i] >= 0) close(fds[i]);
+    errno = err;
+}
+
+static int uring_read_batch(uring_t *u, read_req_t *req, size_t n) {
+    int fds[READ_BATCH];
+    uring_batch_t b = { req, fds };
+    for (size_t i = 0; i < n; i++) {
+        fds[i] = -1;
+        struct io_uring_sqe *sqe = uring_sqe(u, IORING_OP_OPENAT, AT_FDCWD, i);
+        sqe->addr = (uint64_t)(uintptr_t)req[i].path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    }
+    if (uring_run(u, (unsigned)n, reap_open, &b) != 0) { uring_batch_abort(fds, n); return -1; }
+
+    unsigned want = 0;
+    for (size_t i = 0; i < n; i++) {
+        req[i].len = -1;
+        req[i].buf[0] = '\0';
+        if (fds[i] < 0) continue;
+        // Hard link: the close runs even if the read fails
+        struct io_uring_sqe *sqe = uring_sqe(u, IORING_OP_READ, fds[i], i);
+        sqe->addr = (uint64_t)(uintptr_t)req[i].buf;
+        sqe->len = READ_SLOT - 1;
+        sqe->off = 0;
+        sqe->flags = IOSQE_IO_HARDLINK;
+        uring_sqe(u, IORING_OP_CLOSE, fds[i], i | URING_CLOSE_TAG);
+        want += 2;
+    }
+    if (uring_run(u, want, reap_read, &b) != 0) { uring_batch_abort(fds, n); return -1; }
+    return 0;
+}
+
+static void pread_batch(read_req_t *req, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        read_req_t *r = &req[i];
+        r->len = -1;
+        r->buf[0] = '\0';
+        int fd = open(r->path, O_RDONLY | O_CLOEXEC);
+        engine_syscalls++;
+        if (fd < 0) continue;
+        // One pread returns the whole file when it fits, as task stat/io do
+        ssize_t got;
+        do { got = pread(fd, r->buf, READ_SLOT - 1, 0); engine_syscalls++; } while (got < 0 && errno == EINTR);
+        close(fd);
+        engine_syscalls++;
+        if (got < 0) continue;
+        r->len = got;
+        r->buf[got] = '\0';
+    }
+}
+
+// Reads up to READ_BATCH files. On return every req has len and a
+// NUL-terminated buf. Falling back to read() is noted in uring_note; stderr
+// is the terminal the frame is drawn on.
+static void read_batch(read_req_t *req, size_t n) {
+    file_reads += n;
+    if (use_io_uring && uring.fd == -1 && uring_init(&uring) != 0) {
+        uring.fd = -2;
+        snprintf(uring_note, sizeof(uring_note), "io_uring not available, using read()");
+    }
+    if (use_io_uring && uring.fd >= 0) {
+        if (uring_read_batch(&uring, req, n) == 0) return;
+        // Completions may still be outstanding; drop the ring rather than guess
+        snprintf(uring_note, sizeof(uring_note), "io_uring failed (%s), using read()", strerror(errno));
+        uring_close(&uring);
+    }
+    pread_batch(req, n);
+}
+
 static void sanitize_cmd(char out[CMD_MAX], const char *in, size_t in_len) {
     size_t o = 0;
     int prev_space = 1;
@@ -742,6 +1411,13 @@ static void sanitize_cmd(char out[CMD_MAX], const char *in, size_t in_len) {
     out[o] = '\0';
 }
 
+// VMID of a KVM/QEMU command line ("... -id 101 ..."), -1 for anything else
+static int cmd_vmid(const char *cmd) {
+    const char *id = strstr(cmd, " -id ");
+    if (!id || (!strstr(cmd, "kvm") && !strstr(cmd, "qemu"))) return -1;
+    return atoi(id + 5);
+}
+
 static int read_cmdline(pid_t pid, char out[CMD_MAX]) {
     char path[PATH_MAX], buf[8192];
     ssize_t n = 0;
@@ -775,12 +1451,9 @@ static int read_cmdline(pid_t pid, char out[CMD_MAX]) {
     return -1;
 }
 
-static int read_io_file(const char *path, uint64_t *syscr, uint64_t *syscw, uint64_t *read_bytes, uint64_t *write_bytes) {
-    FILE *f = fopen(path, "r");
-    if (!f) return -1;
-    
-    char line[256];
-    while (fgets(line, sizeof(line), f)) {
+static void parse_io_buf(char *buf, uint64_t *syscr, uint64_t *syscw, uint64_t *read_bytes, uint64_t *write_bytes) {
+    char *save = NULL;
+    for (char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
         if (strncmp(line, "syscr:", 6) == 0) {
             *syscr = strtoull(line + 6, NULL, 10);
         } else if (strncmp(line, "syscw:", 6) == 0) {
@@ -791,16 +1464,26 @@ static int read_io_file(const char *path, uint64_t *syscr, uint64_t *syscw, uint
             *write_bytes = strtoull(line + 12, NULL, 10);
         }
     }
-    fclose(f);
-    return 0;
 }
 
-static int read_proc_stat_fields(const char *path, uint64_t *cpu_jiffies_out, uint64_t *blkio_ticks_out, char *state_out, uint64_t *start_time_out, uint64_t *minflt_out, uint64_t *majflt_out) {
-    char buf[4096]; ssize_t n = 0;
+static int read_io_file(const char *path, uint64_t *syscr, uint64_t *syscw, uint64_t *read_bytes, uint64_t *write_bytes) {
+    char buf[1024]; ssize_t n = 0;
     if (read_small_file(path, buf, sizeof(buf), &n) != 0 || n <= 0) return -1;
-    
+    parse_io_buf(buf, syscr, syscw, read_bytes, write_bytes);
+    return 0;
+}
+
+// processor_out, nice_out and comm_out (16 bytes) may be NULL. buf is modified.
+static int parse_proc_stat_fields(char *buf, uint64_t *cpu_jiffies_out, uint64_t *blkio_ticks_out, char *state_out, pid_t *ppid_out, uint64_t *start_time_out, uint64_t *minflt_out, uint64_t *majflt_out, int *processor_out, int *nice_out, char *comm_out) {
     char *rparen = strrchr(buf, ')');
     if (!rparen) return -1;
+    if (comm_out) {
+        const char *lparen = strchr(buf, '(');
+        size_t len = lparen && lparen < rparen ? (size_t)(rparen - lparen - 1) : 0;
+        if (len > 15) len = 15;
+        if (len) memcpy(comm_out, lparen + 1, len);
+        comm_out[len] = '\0';
+    }
     
     char *p = rparen + 2; 
     if (*p) *state_out = *p; else *state_out = '?';
@@ -812,13 +1495,17 @@ static int read_proc_stat_fields(const char *path, uint64_t *cpu_jiffies_out, ui
     *start_time_out = 0;
     *minflt_out = 0;
     *majflt_out = 0;
+    *ppid_out = 0;
     
     while (tok) {
-        if (idx == 7) *minflt_out = strtoull(tok, NULL, 10);  // Field 10 in /proc/[pid]/stat
+        if (idx == 1) *ppid_out = (pid_t)strtol(tok, NULL, 10);  // Field 4
+        else if (idx == 7) *minflt_out = strtoull(tok, NULL, 10);  // Field 10 in /proc/[pid]/stat
         else if (idx == 9) *majflt_out = strtoull(tok, NULL, 10);  // Field 12
         else if (idx == 11) utime = strtoull(tok, NULL, 10); 
         else if (idx == 12) stime = strtoull(tok, NULL, 10);
+        else if (idx == 16 && nice_out) *nice_out = (int)strtol(tok, NULL, 10);  // Field 19
         else if (idx == 19) *start_time_out = strtoull(tok, NULL, 10);
+        else if (idx == 36 && processor_out) *processor_out = (int)strtol(tok, NULL, 10);  // Field 39
         else if (idx == 39) { 
             *blkio_ticks_out = strtoull(tok, NULL, 10);
             break; 
@@ -829,6 +1516,12 @@ static int read_proc_stat_fields(const char *path, uint64_t *cpu_jiffies_out, ui
     return 0;
 }
 
+static int read_proc_stat_fields(const char *path, uint64_t *cpu_jiffies_out, uint64_t *blkio_ticks_out, char *state_out, pid_t *ppid_out, uint64_t *start_time_out, uint64_t *minflt_out, uint64_t *majflt_out, int *processor_out, char *comm_out) {
+    char buf[4096]; ssize_t n = 0;
+    if (read_small_file(path, buf, sizeof(buf), &n) != 0 || n <= 0) return -1;
+    return parse_proc_stat_fields(buf, cpu_jiffies_out, blkio_ticks_out, state_out, ppid_out, start_time_out, minflt_out, majflt_out, processor_out, NULL, comm_out);
+}
+
 static void read_statm(pid_t pid, uint64_t *virt, uint64_t *res, uint64_t *shr) {
     char path[64];
     snprintf(path, sizeof(path), "/proc/%d/statm", pid);
@@ -843,171 +1536,684 @@ static void read_statm(pid_t pid, uint64_t *virt, uint64_t *res, uint64_t *shr)
     *virt = 0; *res = 0; *shr = 0;
 }
 
+// uid -> name cache. getpwuid() parses /etc/passwd (and allocates) on every
+// call; a host only has a handful of distinct process owners.
+#define USER_CACHE_SIZE 64
+static struct { uid_t uid; char name[32]; } user_cache[USER_CACHE_SIZE];
+static int user_cache_len = 0;
+
+static const char *lookup_user(uid_t uid) {
+    for (int i = 0; i < user_cache_len; i++) {
+        if (user_cache[i].uid == uid) return user_cache[i].name;
+    }
+    int slot = user_cache_len < USER_CACHE_SIZE ? user_cache_len++ : (int)(uid % USER_CACHE_SIZE);
+    user_cache[slot].uid = uid;
+    struct passwd *pw = getpwuid(uid);
+    if (pw) {
+        strncpy(user_cache[slot].name, pw->pw_name, sizeof(user_cache[slot].name)-1);
+        user_cache[slot].name[sizeof(user_cache[slot].name)-1] = '\0';
+    } else {
+        snprintf(user_cache[slot].name, sizeof(user_cache[slot].name), "%d", uid);
+    }
+    return user_cache[slot].name;
+}
+
 static void get_proc_user(pid_t pid, char *out, size_t size) {
     char path[64];
     snprintf(path, sizeof(path), "/proc/%d", pid);
     struct stat st;
     if (stat(path, &st) == 0) {
-        struct passwd *pw = getpwuid(st.st_uid);
-        if (pw) {
-            strncpy(out, pw->pw_name, size-1);
-            out[size-1]='\0';
-            return;
-        }
-        snprintf(out, size, "%d", st.st_uid);
+        strncpy(out, lookup_user(st.st_uid), size-1);
+        out[size-1]='\0';
     } else {
         snprintf(out, size, "?");
     }
 }
 
-static void read_operstate(const char *ifname, char *buf, size_t buflen) {
-    char path[256];
-    snprintf(path, sizeof(path), "/sys/class/net/%s/operstate", ifname);
-    ssize_t n;
-    if (read_small_file(path, buf, buflen, &n) == 0 && n > 0) {
-        if (buf[n-1] == '\n') buf[n-1] = '\0';
-    } else {
-        strncpy(buf, "?", buflen);
+// --- smaps_rollup Cache ---
+// smaps_rollup walks every VMA of the process in the kernel, which is slow for
+// VMs with tens of GiB mapped. It is only read for rows that are on screen and
+// the result is reused for smaps_ttl refreshes.
+#define SMAPS_CACHE_SIZE 1024  // Direct-mapped by TGID, must be a power of two
+
+typedef struct {
+    pid_t tgid;
+    uint64_t start_time_ticks;  // Detects PID reuse
+    unsigned fetched_gen;
+    int valid;                  // 0 = empty slot, 1 = data, -1 = not readable
+    uint64_t pss_kib;
+    uint64_t swap_kib;
+    uint64_t anon_huge_kib;
+} smaps_entry_t;
+
+static smaps_entry_t smaps_cache[SMAPS_CACHE_SIZE];
+static int smaps_reads = 1;    // 0 under --attach: the rows do not come from /proc
+
+static int read_smaps_rollup(pid_t pid, smaps_entry_t *e) {
+    char path[64], buf[4096];
+    ssize_t n = 0;
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pid);
+    if (read_small_file(path, buf, sizeof(buf), &n) != 0 || n <= 0) return -1;
+
+    e->pss_kib = e->swap_kib = e->anon_huge_kib = 0;
+    char *save = NULL;
+    for (char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        if (strncmp(line, "Pss:", 4) == 0) e->pss_kib = strtoull(line + 4, NULL, 10);
+        else if (strncmp(line, "Swap:", 5) == 0) e->swap_kib = strtoull(line + 5, NULL, 10);
+        else if (strncmp(line, "AnonHugePages:", 14) == 0) e->anon_huge_kib = strtoull(line + 14, NULL, 10);
     }
+    return 0;
 }
 
-// --- System Stats ---
+// Returns the cached smaps_rollup totals for a process, re-reading them when
+// the entry is older than smaps_ttl generations. NULL if unreadable.
+static const smaps_entry_t *smaps_lookup(pid_t tgid, uint64_t start_time_ticks, unsigned gen) {
+    if (!smaps_reads) return NULL;
+    smaps_entry_t *e = &smaps_cache[(unsigned)tgid & (SMAPS_CACHE_SIZE - 1)];
+    int fresh = e->valid != 0 && e->tgid == tgid && e->start_time_ticks == start_time_ticks &&
+                gen - e->fetched_gen < (unsigned)smaps_ttl;
+    if (!fresh) {
+        e->tgid = tgid;
+        e->start_time_ticks = start_time_ticks;
+        e->fetched_gen = gen;
+        e->valid = read_smaps_rollup(tgid, e) == 0 ? 1 : -1;
+    }
+    return e->valid > 0 ? e : NULL;
+}
 
-static int read_system_disk_iops(uint64_t *r_iops, uint64_t *w_iops) {
-    FILE *f = fopen("/proc/diskstats", "r");
-    if (!f) return -1;
-    
-    char line[512];
-    uint64_t tr = 0, tw = 0;
-    
-    while (fgets(line, sizeof(line), f)) {
-        int major, minor;
-        char name[64];
-        unsigned long long rio, rmerge, rsect, ruse;
-        unsigned long long wio, wmerge, wsect, wuse;
-        
-        if (sscanf(line, "%d %d %s %llu %llu %llu %llu %llu %llu %llu %llu",
-                   &major, &minor, name,
-                   &rio, &rmerge, &rsect, &ruse,
-                   &wio, &wmerge, &wsect, &wuse) == 11) {
-            
-            if (strncmp(name, "sd", 2) == 0 || 
-                strncmp(name, "vd", 2) == 0 ||
-                strncmp(name, "nvme", 4) == 0 ||
-                strncmp(name, "xvd", 3) == 0) {
-                tr += rio;
-                tw += wio;
+// --- NUMA Placement Cache ---
+// numa_maps, like smaps_rollup, walks every VMA and is only read for rows on
+// screen, reused for smaps_ttl refreshes. VmSwap comes from status, which is
+// cheap, and is re-read every refresh the row is shown.
+#define NUMA_NODES_MAX 16
+
+typedef struct {
+    pid_t tgid;
+    uint64_t start_time_ticks;
+    unsigned numa_gen, status_gen;
+    int numa_valid, status_valid;  // 0 = not read, 1 = data, -1 = not readable
+    int n_nodes;                   // Highest node with pages + 1
+    uint64_t node_kib[NUMA_NODES_MAX];
+    uint64_t swap_kib;
+} numa_entry_t;
+
+static numa_entry_t numa_cache[SMAPS_CACHE_SIZE];
+
+// "<addr> <policy> ... N0=12 N1=3 kernelpagesize_kB=4" per VMA. The file
+// can be megabytes for a large VM, so it is parsed in chunks.
+static int read_numa_maps(pid_t pid, numa_entry_t *e) {
+    char path[64], buf[16384];
+    snprintf(path, sizeof(path), "/proc/%d/numa_maps", pid);
+    file_reads++;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    memset(e->node_kib, 0, sizeof(e->node_kib));
+    e->n_nodes = 0;
+    size_t have = 0;
+    for (;;) {
+        ssize_t r = read(fd, buf + have, sizeof(buf) - 1 - have);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        have += (size_t)r;
+        buf[have] = '\0';
+        char *line = buf, *eol;
+        while ((eol = strchr(line, '\n')) != NULL) {
+            *eol = '\0';
+            uint64_t pages[NUMA_NODES_MAX] = { 0 }, page_kib = 4;
+            int top = 0;
+            for (char *f = strchr(line, ' '); f; f = strchr(f, ' ')) {
+                f++;
+                if (f[0] == 'N' && isdigit((unsigned char)f[1])) {
+                    char *end;
+                    unsigned long node = strtoul(f + 1, &end, 10);
+                    if (*end == '=' && node < NUMA_NODES_MAX) {
+                        pages[node] = strtoull(end + 1, NULL, 10);
+                        if ((int)node >= top) top = (int)node + 1;
+                    }
+                } else if (strncmp(f, "kernelpagesize_kB=", 18) == 0) {
+                    page_kib = strtoull(f + 18, NULL, 10);
+                }
             }
+            for (int i = 0; i < top; i++) e->node_kib[i] += pages[i] * page_kib;
+            if (top > e->n_nodes) e->n_nodes = top;
+            line = eol + 1;
         }
+        have -= (size_t)(line - buf);
+        memmove(buf, line, have);
+        // A line longer than the buffer (huge file= path) is dropped
+        if (have == sizeof(buf) - 1) have = 0;
     }
-    fclose(f);
-    *r_iops = tr;
-    *w_iops = tw;
+    close(fd);
     return 0;
 }
 
-static int read_global_cpu(global_cpu_t *cpu) {
-    FILE *f = fopen("/proc/stat", "r");
-    if (!f) return -1;
-    char line[512];
-    if (fgets(line, sizeof(line), f)) {
-        if (strncmp(line, "cpu ", 4) == 0) {
-            sscanf(line + 4, "%llu %llu %llu %llu %llu %llu %llu %llu",
-                &cpu->user, &cpu->nice, &cpu->system, &cpu->idle,
-                &cpu->iowait, &cpu->irq, &cpu->softirq, &cpu->steal);
+static int read_vmswap(pid_t pid, uint64_t *swap_kib) {
+    char path[64], buf[4096];
+    ssize_t n = 0;
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if (read_small_file(path, buf, sizeof(buf), &n) != 0 || n <= 0) return -1;
+    const char *p = strstr(buf, "\nVmSwap:");
+    *swap_kib = p ? strtoull(p + 8, NULL, 10) : 0;  // Kernel threads have none
+    return 0;
+}
+
+static numa_entry_t *numa_slot(pid_t tgid, uint64_t start_time_ticks) {
+    numa_entry_t *e = &numa_cache[(unsigned)tgid & (SMAPS_CACHE_SIZE - 1)];
+    if (e->tgid != tgid || e->start_time_ticks != start_time_ticks) {
+        memset(e, 0, sizeof(*e));
+        e->tgid = tgid;
+        e->start_time_ticks = start_time_ticks;
+    }
+    return e;
+}
+
+static const numa_entry_t *numa_lookup(pid_t tgid, uint64_t start_time_ticks, unsigned gen) {
+    if (!smaps_reads) return NULL;
+    numa_entry_t *e = numa_slot(tgid, start_time_ticks);
+    if (e->numa_valid == 0 || gen - e->numa_gen >= (unsigned)smaps_ttl) {
+        e->numa_gen = gen;
+        e->numa_valid = read_numa_maps(tgid, e) == 0 ? 1 : -1;
+    }
+    return e->numa_valid > 0 ? e : NULL;
+}
+
+static const numa_entry_t *vmswap_lookup(pid_t tgid, uint64_t start_time_ticks, unsigned gen) {
+    if (!smaps_reads) return NULL;
+    numa_entry_t *e = numa_slot(tgid, start_time_ticks);
+    if (e->status_valid == 0 || e->status_gen != gen) {
+        e->status_gen = gen;
+        e->status_valid = read_vmswap(tgid, &e->swap_kib) == 0 ? 1 : -1;
+    }
+    return e->status_valid > 0 ? e : NULL;
+}
+
+static void read_operstate(const char *ifname, char *buf, size_t buflen) {
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/operstate", ifname);
+    ssize_t n;
+    if (read_small_file(path, buf, buflen, &n) == 0 && n > 0) {
+        if (buf[n-1] == '\n') buf[n-1] = '\0';
+    } else {
+        strncpy(buf, "?", buflen);
+    }
+}
+
+// --- System Stats ---
+
+// System-wide files are opened once and re-read with pread() from offset 0,
+// which makes the kernel regenerate the seq_file contents. The buffer grows
+// to fit the file once and is then reused every cycle.
+typedef struct {
+    const char *path;
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t len;
+} proc_file_t;
+
+static proc_file_t pf_stat = { "/proc/stat", -1, NULL, 0, 0 };
+static proc_file_t pf_diskstats = { "/proc/diskstats", -1, NULL, 0, 0 };
+static proc_file_t pf_net_dev = { "/proc/net/dev", -1, NULL, 0, 0 };
+
+static int proc_file_load(proc_file_t *pf) {
+    if (pf->fd < 0) {
+        pf->fd = open(pf->path, O_RDONLY | O_CLOEXEC);
+        if (pf->fd < 0) return -1;
+    }
+    if (!pf->buf) {
+        pf->cap = 16384;
+        pf->buf = (char *)malloc(pf->cap);
+        if (!pf->buf) { fprintf(stderr, "OOM\n"); exit(2); }
+    }
+    // seq_file hands out about a page per read whatever the buffer size, so
+    // a short read is not the end: only a read of 0 is
+    size_t off = 0;
+    for (;;) {
+        if (pf->cap - 1 - off == 0) {
+            char *p = (char *)realloc(pf->buf, pf->cap * 2);
+            if (!p) { fprintf(stderr, "OOM\n"); exit(2); }
+            pf->buf = p;
+            pf->cap *= 2;
         }
+        ssize_t n = pread(pf->fd, pf->buf + off, pf->cap - 1 - off, (off_t)off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        off += (size_t)n;
     }
-    fclose(f);
+    pf->len = off;
+    pf->buf[off] = '\0';
     return 0;
 }
 
-static int collect_disks(vec_disk_t *out) {
-    FILE *f = fopen("/proc/diskstats", "r");
-    if (!f) return -1;
-    char line[512];
-    while (fgets(line, sizeof(line), f)) {
-        int major, minor;
-        char name[64];
-        unsigned long long rio, rmerge, rsect, ruse;
-        unsigned long long wio, wmerge, wsect, wuse;
-        unsigned long long inflight, io_ticks, time_in_queue;
-        if (sscanf(line, "%d %d %s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
-                   &major, &minor, name,
-                   &rio, &rmerge, &rsect, &ruse,
-                   &wio, &wmerge, &wsect, &wuse,
-                   &inflight, &io_ticks, &time_in_queue) >= 11) {
-            if (strncmp(name, "loop", 4) == 0 || strncmp(name, "ram", 3) == 0) continue;
-            
-            disk_sample_t ds; memset(&ds, 0, sizeof(ds));
-            strncpy(ds.name, name, sizeof(ds.name)-1);
-            ds.rio = rio; ds.wio = wio;
-            ds.rsect = rsect; ds.wsect = wsect;
-            ds.ruse = ruse; ds.wuse = wuse;
-            ds.inflight = inflight;
-            ds.io_ticks = io_ticks;
-            
-            // Read queue depth from sysfs
-            char sysfs_path[256];
-            snprintf(sysfs_path, sizeof(sysfs_path), "/sys/block/%s/queue/nr_requests", name);
-            FILE *qf = fopen(sysfs_path, "r");
-            if (qf) {
-                if (fscanf(qf, "%d", &ds.queue_depth) != 1) ds.queue_depth = 0;
-                fclose(qf);
-            } else {
-                ds.queue_depth = 0;
-            }
-            
-            vec_disk_push(out, &ds);
+static void proc_file_close(proc_file_t *pf) {
+    if (pf->fd >= 0) close(pf->fd);
+    free(pf->buf);
+    pf->fd = -1; pf->buf = NULL; pf->cap = pf->len = 0;
+}
+
+// Minimal in-place scanners for the space separated counters in procfs.
+// They never fail: missing fields read as 0 and a word may be empty.
+static unsigned long long scan_u64(const char **pp) {
+    const char *p = *pp;
+    while (*p == ' ' || *p == '\t') p++;
+    unsigned long long v = 0;
+    while (*p >= '0' && *p <= '9') v = v * 10 + (unsigned long long)(*p++ - '0');
+    *pp = p;
+    return v;
+}
+
+static size_t scan_word(const char **pp, const char **word) {
+    const char *p = *pp;
+    while (*p == ' ' || *p == '\t') p++;
+    *word = p;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\n') p++;
+    *pp = p;
+    return (size_t)(p - *word);
+}
+
+static const char *next_line(const char *p) {
+    const char *nl = strchr(p, '\n');
+    return nl ? nl + 1 : p + strlen(p);
+}
+
+// --- Per-CPU Statistics ---
+// The cpuN lines of /proc/stat, parsed in the same pass as the aggregate
+// line. The counter arrays are sized for the configured CPUs once and reused,
+// so hosts with hundreds of CPUs cost no allocations per refresh.
+typedef struct {
+    int cpu;
+    int online;                // Listed in /proc/stat at the last read
+    double user, system, iowait, irq, softirq, steal;  // % of the interval
+    double busy;               // Everything but idle and iowait
+} percpu_row_t;
+
+typedef struct {
+    int n;                     // Highest CPU number + 1
+    int cap;
+    global_cpu_t *cur, *prev;
+    percpu_row_t *rows;
+    int primed;                // prev holds a read
+} percpu_t;
+
+static void percpu_reserve(percpu_t *pc, int n) {
+    if (n <= pc->cap) return;
+    int cap = pc->cap ? pc->cap : (int)sysconf(_SC_NPROCESSORS_CONF);
+    while (cap < n) cap *= 2;
+    pc->cur = grow_array(pc->cur, (size_t)cap, sizeof(global_cpu_t));
+    pc->prev = grow_array(pc->prev, (size_t)cap, sizeof(global_cpu_t));
+    pc->rows = grow_array(pc->rows, (size_t)cap, sizeof(percpu_row_t));
+    memset(pc->cur + pc->cap, 0, (size_t)(cap - pc->cap) * sizeof(global_cpu_t));
+    memset(pc->prev + pc->cap, 0, (size_t)(cap - pc->cap) * sizeof(global_cpu_t));
+    pc->cap = cap;
+}
+
+static void scan_cpu_line(const char **pp, global_cpu_t *cpu) {
+    cpu->user = scan_u64(pp); cpu->nice = scan_u64(pp);
+    cpu->system = scan_u64(pp); cpu->idle = scan_u64(pp);
+    cpu->iowait = scan_u64(pp); cpu->irq = scan_u64(pp);
+    cpu->softirq = scan_u64(pp); cpu->steal = scan_u64(pp);
+}
+
+// pc may be NULL when only the aggregate is wanted
+static int read_global_cpu(global_cpu_t *cpu, percpu_t *pc) {
+    if (proc_file_load(&pf_stat) != 0) return -1;
+    const char *p = pf_stat.buf;
+    if (strncmp(p, "cpu ", 4) == 0) {
+        p += 4;
+        scan_cpu_line(&p, cpu);
+    }
+    if (!pc) return 0;
+    // Offline CPUs have no line; they read as all zero
+    if (pc->cap) memset(pc->cur, 0, (size_t)pc->cap * sizeof(global_cpu_t));
+    pc->n = 0;
+    for (p = next_line(p); strncmp(p, "cpu", 3) == 0; p = next_line(p)) {
+        p += 3;
+        if (*p < '0' || *p > '9') continue;
+        int id = (int)scan_u64(&p);
+        percpu_reserve(pc, id + 1);
+        scan_cpu_line(&p, &pc->cur[id]);
+        if (id + 1 > pc->n) pc->n = id + 1;
+    }
+    return 0;
+}
+
+static unsigned long long cpu_total(const global_cpu_t *c) {
+    return c->user + c->nice + c->system + c->idle + c->iowait + c->irq + c->softirq + c->steal;
+}
+
+// Percentages between the last two reads; the first read only primes
+static void percpu_compute(percpu_t *pc) {
+    for (int i = 0; i < pc->n; i++) {
+        const global_cpu_t *c = &pc->cur[i], *o = &pc->prev[i];
+        percpu_row_t *r = &pc->rows[i];
+        memset(r, 0, sizeof(*r));
+        r->cpu = i;
+        r->online = cpu_total(c) > 0;
+        unsigned long long total = cpu_total(c), old = cpu_total(o);
+        if (!pc->primed || !r->online || total <= old) continue;
+        double d = (double)(total - old) / 100.0;
+#define PCPU_PCT(f) ((c->f >= o->f) ? (double)(c->f - o->f) / d : 0)
+        r->user = PCPU_PCT(user) + PCPU_PCT(nice);
+        r->system = PCPU_PCT(system);
+        r->iowait = PCPU_PCT(iowait);
+        r->irq = PCPU_PCT(irq);
+        r->softirq = PCPU_PCT(softirq);
+        r->steal = PCPU_PCT(steal);
+        r->busy = 100.0 - PCPU_PCT(idle) - r->iowait;
+        if (r->busy < 0) r->busy = 0;
+#undef PCPU_PCT
+    }
+    global_cpu_t *t = pc->prev; pc->prev = pc->cur; pc->cur = t;
+    pc->primed = 1;
+}
+
+static int cmp_pcpu_cpu(const void *a, const void *b) {
+    return ((const percpu_row_t *)a)->cpu - ((const percpu_row_t *)b)->cpu;
+}
+
+static void percpu_free(percpu_t *pc) {
+    free(pc->cur);
+    free(pc->prev);
+    free(pc->rows);
+    memset(pc, 0, sizeof(*pc));
+}
+
+// /proc/diskstats keeps its device order between reads, so the previous
+// generation is checked at the same index before falling back to a scan.
+static const disk_sample_t *find_prev_disk(const vec_disk_t *prev, size_t hint, const char *name) {
+    if (!prev) return NULL;
+    if (hint < prev->len && strcmp(prev->data[hint].name, name) == 0) return &prev->data[hint];
+    for (size_t j = 0; j < prev->len; j++) {
+        if (strcmp(prev->data[j].name, name) == 0) return &prev->data[j];
+    }
+    return NULL;
+}
+
+static int collect_disks(vec_disk_t *out, const vec_disk_t *prev) {
+    if (proc_file_load(&pf_diskstats) != 0) return -1;
+    for (const char *line = pf_diskstats.buf; *line; line = next_line(line)) {
+        const char *p = line;
+        scan_u64(&p); scan_u64(&p);  // major, minor
+        const char *name;
+        size_t name_len = scan_word(&p, &name);
+        if (name_len == 0) continue;
+        if (strncmp(name, "loop", 4) == 0 || strncmp(name, "ram", 3) == 0) continue;
+
+        disk_sample_t ds; memset(&ds, 0, sizeof(ds));
+        if (name_len >= sizeof(ds.name)) name_len = sizeof(ds.name) - 1;
+        memcpy(ds.name, name, name_len);
+        ds.rio = scan_u64(&p);   scan_u64(&p);  // rmerge
+        ds.rsect = scan_u64(&p); ds.ruse = scan_u64(&p);
+        ds.wio = scan_u64(&p);   scan_u64(&p);  // wmerge
+        ds.wsect = scan_u64(&p); ds.wuse = scan_u64(&p);
+        ds.inflight = scan_u64(&p);
+        ds.io_ticks = scan_u64(&p);
+
+        // nr_requests only changes when an admin retunes the queue; reuse the
+        // value from the previous generation instead of opening sysfs again
+        const disk_sample_t *pd = find_prev_disk(prev, out->len, ds.name);
+        if (pd) {
+            ds.queue_depth = pd->queue_depth;
+        } else {
+            char sysfs_path[256], buf[32];
+            ssize_t n = 0;
+            snprintf(sysfs_path, sizeof(sysfs_path), "/sys/block/%s/queue/nr_requests", ds.name);
+            ds.queue_depth = (read_small_file(sysfs_path, buf, sizeof(buf), &n) == 0 && n > 0) ? atoi(buf) : 0;
         }
+
+        vec_disk_push(out, &ds);
     }
-    fclose(f);
     return 0;
 }
 
+// Same index-first lookup as find_prev_disk() for /proc/net/dev order
+static const net_iface_t *find_prev_net(const vec_net_t *prev, size_t hint, const char *name) {
+    if (hint < prev->len && strcmp(prev->data[hint].name, name) == 0) return &prev->data[hint];
+    for (size_t j = 0; j < prev->len; j++) {
+        if (strcmp(prev->data[j].name, name) == 0) return &prev->data[j];
+    }
+    return NULL;
+}
+
 static int collect_net_dev(vec_net_t *out) {
-    FILE *f = fopen("/proc/net/dev", "r");
-    if (!f) return -1;
-    char line[512];
-    fgets(line, sizeof(line), f);
-    fgets(line, sizeof(line), f);
+    if (proc_file_load(&pf_net_dev) != 0) return -1;
+    // Skip the two header lines
+    const char *line = next_line(next_line(pf_net_dev.buf));
 
-    while (fgets(line, sizeof(line), f)) {
-        net_iface_t ni; memset(&ni, 0, sizeof(ni));
-        char *colon = strchr(line, ':');
-        if (!colon) continue;
-        *colon = '\0';
-        
-        char *name_start = line;
-        while (isspace(*name_start)) name_start++;
-        strncpy(ni.name, name_start, sizeof(ni.name)-1);
+    for (; *line; line = next_line(line)) {
+        const char *colon = strchr(line, ':');
+        const char *eol = strchr(line, '\n');
+        if (!colon || (eol && colon > eol)) continue;
 
-        char *stats = colon + 1;
-        unsigned long long rb, rp, re, rd, rf, rfr, rc, rm;
-        unsigned long long tb, tp, te, td, tf, tco, tca, tc;
-        
-        if (sscanf(stats, "%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
-                   &rb, &rp, &re, &rd, &rf, &rfr, &rc, &rm,
-                   &tb, &tp, &te, &td, &tf, &tco, &tca, &tc) >= 10) {
-            ni.rx_bytes = rb; ni.rx_packets = rp; ni.rx_errors = re;
-            ni.tx_bytes = tb; ni.tx_packets = tp; ni.tx_errors = te;
-        }
+        net_iface_t ni; memset(&ni, 0, sizeof(ni));
+        const char *name_start = line;
+        while (*name_start == ' ') name_start++;
+        size_t name_len = (size_t)(colon - name_start);
+        if (name_len >= sizeof(ni.name)) name_len = sizeof(ni.name) - 1;
+        memcpy(ni.name, name_start, name_len);
+
+        const char *p = colon + 1;
+        ni.rx_bytes = scan_u64(&p); ni.rx_packets = scan_u64(&p); ni.rx_errors = scan_u64(&p);
+        ni.rx_dropped = scan_u64(&p); ni.rx_fifo = scan_u64(&p);
+        scan_u64(&p); scan_u64(&p);  // frame, compressed
+        ni.multicast = scan_u64(&p);
+        ni.tx_bytes = scan_u64(&p); ni.tx_packets = scan_u64(&p); ni.tx_errors = scan_u64(&p);
+        ni.tx_dropped = scan_u64(&p); ni.tx_fifo = scan_u64(&p);
 
         read_operstate(ni.name, ni.operstate, sizeof(ni.operstate));
         vec_net_push(out, &ni);
     }
-    fclose(f);
     return 0;
 }
 
+// --- rtnetlink Interface Stats ---
+// One RTM_GETLINK dump returns counters (IFLA_STATS64) and operstate for every
+// link, replacing the /proc/net/dev parse plus one sysfs open per interface.
+// A second socket subscribed to RTNLGRP_LINK reports link state changes as
+// they happen. /proc/net/dev remains the fallback if netlink is unavailable.
+static int nl_dump_fd = -1;    // Request/response socket for RTM_GETLINK
+static int nl_event_fd = -1;   // RTNLGRP_LINK notifications, non-blocking
+static int nl_failed = 0;      // Netlink unusable, stay on /proc/net/dev
+static uint32_t nl_seq = 0;
+static char nl_buf[65536];
+
+static const char *oper_names[] = {
+    "unknown", "notpresent", "down", "lowerlayerdown", "testing", "dormant", "up"
+};
+
+static const char *operstate_name(unsigned v) {
+    return v < sizeof(oper_names) / sizeof(oper_names[0]) ? oper_names[v] : "?";
+}
+
+static int netlink_open(void) {
+    nl_dump_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl_dump_fd < 0) return -1;
+    // A dump the kernel never finishes must not hang the refresh; on timeout
+    // collect_net() gives up on netlink and reads /proc/net/dev
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 500000 };
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    if (setsockopt(nl_dump_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0 ||
+        bind(nl_dump_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+        close(nl_dump_fd);
+        nl_dump_fd = -1;
+        return -1;
+    }
+
+    // Link events are optional; without them state is still refreshed by
+    // every dump
+    nl_event_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (nl_event_fd >= 0) {
+        sa.nl_groups = RTMGRP_LINK;
+        if (bind(nl_event_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+            close(nl_event_fd);
+            nl_event_fd = -1;
+        }
+    }
+    return 0;
+}
+
+static void netlink_close(void) {
+    if (nl_dump_fd >= 0) close(nl_dump_fd);
+    if (nl_event_fd >= 0) close(nl_event_fd);
+    nl_dump_fd = nl_event_fd = -1;
+}
+
+// Decode one RTM_NEWLINK message. Returns 0 if it carried a name.
+static int parse_link_msg(const struct nlmsghdr *nh, net_iface_t *ni, int *has_stats) {
+    const struct ifinfomsg *ifi = (const struct ifinfomsg *)NLMSG_DATA(nh);
+    int len = (int)nh->nlmsg_len - (int)NLMSG_LENGTH(sizeof(*ifi));
+    if (len < 0) return -1;
+
+    memset(ni, 0, sizeof(*ni));
+    ni->ifindex = ifi->ifi_index;
+    *has_stats = 0;
+    int named = 0;
+    for (const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME) {
+            snprintf(ni->name, sizeof(ni->name), "%s", (const char *)RTA_DATA(rta));
+            named = 1;
+        } else if (rta->rta_type == IFLA_OPERSTATE) {
+            snprintf(ni->operstate, sizeof(ni->operstate), "%s", operstate_name(*(const uint8_t *)RTA_DATA(rta)));
+        } else if (rta->rta_type == IFLA_STATS64 && RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats64)) {
+            struct rtnl_link_stats64 st;
+            memcpy(&st, RTA_DATA(rta), sizeof(st));  // Attribute is only 4-byte aligned
+            ni->rx_bytes = st.rx_bytes;
+            ni->tx_bytes = st.tx_bytes;
+            ni->rx_packets = st.rx_packets;
+            ni->tx_packets = st.tx_packets;
+            ni->rx_errors = st.rx_errors;
+            ni->tx_errors = st.tx_errors;
+            // Same folding as /proc/net/dev so both backends agree
+            ni->rx_dropped = st.rx_dropped + st.rx_missed_errors;
+            ni->tx_dropped = st.tx_dropped;
+            ni->rx_fifo = st.rx_fifo_errors;
+            ni->tx_fifo = st.tx_fifo_errors;
+            ni->multicast = st.multicast;
+            *has_stats = 1;
+        }
+    }
+    if (!ni->operstate[0]) snprintf(ni->operstate, sizeof(ni->operstate), "?");
+    return named ? 0 : -1;
+}
+
+static int collect_net_netlink(vec_net_t *out) {
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+    req.nh.nlmsg_type = RTM_GETLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++nl_seq;
+    req.ifi.ifi_family = AF_UNSPEC;
+    if (send(nl_dump_fd, &req, req.nh.nlmsg_len, 0) < 0) return -1;
+
+    for (;;) {
+        ssize_t n = recv(nl_dump_fd, nl_buf, sizeof(nl_buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        int len = (int)n;
+        for (struct nlmsghdr *nh = (struct nlmsghdr *)nl_buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_seq != nl_seq) continue;  // Stale reply from an interrupted dump
+            if (nh->nlmsg_type == NLMSG_DONE) return 0;
+            if (nh->nlmsg_type == NLMSG_ERROR) return -1;
+            if (nh->nlmsg_type != RTM_NEWLINK) continue;
+            net_iface_t ni;
+            int has_stats;
+            // A link without counters would show as all zeros
+            if (parse_link_msg(nh, &ni, &has_stats) == 0 && has_stats) vec_net_push(out, &ni);
+        }
+    }
+}
+
+// Apply pending RTNLGRP_LINK notifications to the interface list. Returns
+// the number of interfaces whose state changed.
+static int netlink_drain_events(vec_net_t *nets) {
+    if (nl_event_fd < 0) return 0;
+    int changed = 0;
+    for (;;) {
+        ssize_t n = recv(nl_event_fd, nl_buf, sizeof(nl_buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;  // EAGAIN: drained (ENOBUFS just means the next dump resyncs)
+        int len = (int)n;
+        for (struct nlmsghdr *nh = (struct nlmsghdr *)nl_buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type != RTM_NEWLINK && nh->nlmsg_type != RTM_DELLINK) continue;
+            net_iface_t ni;
+            int has_stats;
+            if (parse_link_msg(nh, &ni, &has_stats) != 0) continue;
+            const char *state = nh->nlmsg_type == RTM_DELLINK ? "gone" : ni.operstate;
+            for (size_t i = 0; i < nets->len; i++) {
+                if (nets->data[i].ifindex == ni.ifindex && strcmp(nets->data[i].operstate, state) != 0) {
+                    snprintf(nets->data[i].operstate, sizeof(nets->data[i].operstate), "%s", state);
+                    changed++;
+                }
+            }
+        }
+    }
+    return changed;
+}
+
+// Interface counters and state: netlink when available, /proc/net/dev otherwise
+static int collect_net(vec_net_t *out) {
+    if (!nl_failed && nl_dump_fd < 0 && netlink_open() != 0) nl_failed = 1;
+    if (!nl_failed) {
+        size_t mark = out->len;
+        if (collect_net_netlink(out) == 0) return 0;
+        out->len = mark;
+        netlink_close();
+        nl_failed = 1;
+    }
+    return collect_net_dev(out);
+}
+
+// /proc and every task directory are listed each refresh. opendir() would
+// allocate a DIR for each of them, so listings are read with getdents64()
+// into a buffer that keeps its capacity; /proc itself stays open and is
+// rewound. Entries are only valid until the next dir_scan() on the buffer.
+typedef struct {
+    char *buf;
+    size_t cap, len, pos;
+} dir_scan_t;
+
+static int dir_scan(dir_scan_t *d, int fd) {
+    d->len = d->pos = 0;
+    for (;;) {
+        if (d->cap - d->len < 4096) {
+            d->cap = d->cap ? d->cap * 2 : 65536;
+            d->buf = grow_array(d->buf, d->cap, 1);
+        }
+        ssize_t n = getdents64(fd, d->buf + d->len, d->cap - d->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) return 0;
+        d->len += (size_t)n;
+    }
+}
+
+static const char *dir_next(dir_scan_t *d) {
+    if (d->pos >= d->len) return NULL;
+    const struct dirent64 *e = (const struct dirent64 *)(d->buf + d->pos);
+    d->pos += e->d_reclen;
+    return e->d_name;
+}
+
 static void map_kvm_interfaces(vec_net_t *nets) {
-    DIR *proc = opendir("/proc");
-    if (!proc) return;
-    struct dirent *de;
+    static int proc_fd = -1;
+    static dir_scan_t procs;
+    if (proc_fd < 0) proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    else lseek(proc_fd, 0, SEEK_SET);
+    if (proc_fd < 0 || dir_scan(&procs, proc_fd) != 0) return;
     static char cmd[131072]; 
 
-    while ((de = readdir(proc)) != NULL) {
-        if (!is_numeric_str(de->d_name)) continue;
-        pid_t pid = atoi(de->d_name);
+    const char *name;
+    while ((name = dir_next(&procs)) != NULL) {
+        if (!is_numeric_str(name)) continue;
+        pid_t pid = atoi(name);
         
         char path[256];
         snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
@@ -1056,7 +2262,6 @@ static void map_kvm_interfaces(vec_net_t *nets) {
             }
         }
     }
-    closedir(proc);
 }
 
 // ... Process Collection ...
@@ -1067,256 +2272,5068 @@ static int pid_in_filter(pid_t pid, const pid_t *filter, size_t n) {
     return 0;
 }
 
-static int collect_samples(vec_t *out, const pid_t *filter_pids, size_t filter_n) {
-    DIR *proc = opendir("/proc");
-    if (!proc) { perror("opendir(/proc)"); return -1; }
-    struct dirent *de;
+static int cmp_key(const void *a, const void *b) {
+    const sample_t *x = (const sample_t *)a;
+    const sample_t *y = (const sample_t *)b;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+static const sample_t *find_prev(const vec_t *prev, uint64_t key) {
+    size_t lo = 0, hi = prev->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint64_t k = prev->data[mid].key;
+        if (k == key) return &prev->data[mid];
+        if (k < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+// Phase one of a refresh: enumerate every task and read the field groups in
+// `fetch` (stat is always read). Command line and owner are carried over from
+// the previous generation for processes that were already known.
+//
+// Enumeration only records the tasks; their stat and io files are then read
+// READ_BATCH at a time through read_batch() and parsed in place.
+static int collect_samples(vec_t *out, const vec_t *prev, unsigned fetch, const pid_t *filter_pids, size_t filter_n) {
+    static unsigned char *flat;        // 1 = no task dir, read /proc/<pid>/ directly
+    static size_t flat_cap;
+    static char *pool;                 // READ_BATCH * READ_SLOT read buffers
+    static read_req_t req[READ_BATCH];
+    if (!pool) {
+        pool = malloc((size_t)READ_BATCH * READ_SLOT);
+        if (!pool) { fprintf(stderr, "OOM\n"); exit(2); }
+        for (size_t i = 0; i < READ_BATCH; i++) req[i].buf = pool + i * READ_SLOT;
+    }
+
+    static int proc_fd = -1;
+    static dir_scan_t procs, tasks;
+    if (proc_fd < 0) proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    else lseek(proc_fd, 0, SEEK_SET);
+    if (proc_fd < 0 || dir_scan(&procs, proc_fd) != 0) { perror("/proc"); return -1; }
+    const char *name;
+    size_t base = out->len;
     
-    while ((de = readdir(proc)) != NULL) {
-        if (!is_numeric_str(de->d_name)) continue;
-        pid_t pid = (pid_t)atoi(de->d_name); // This is the TGID
+    while ((name = dir_next(&procs)) != NULL) {
+        if (!is_numeric_str(name)) continue;
+        pid_t pid = (pid_t)atoi(name); // This is the TGID
         
         // Filter by TGID (Process ID)
         if (filter_n > 0 && !pid_in_filter(pid, filter_pids, filter_n)) continue;
 
-        char cmd[CMD_MAX];
-        read_cmdline(pid, cmd);
+        // Everything that is process-wide is read once per TGID and copied
+        // into each thread's sample; statm in particular is identical for
+        // every task of a process.
+        sample_t proto; memset(&proto, 0, sizeof(proto));
+        proto.tgid = pid;
+        proto.fetched = fetch | FETCH_STAT | FETCH_IDENT;
+        const sample_t *leader = prev ? find_prev(prev, make_key(pid)) : NULL;
+        if (leader && leader->tgid != pid) leader = NULL;
+        if (leader) {
+            memcpy(proto.cmd, leader->cmd, sizeof(proto.cmd));
+            memcpy(proto.user, leader->user, sizeof(proto.user));
+        } else {
+            read_cmdline(pid, proto.cmd);
+            get_proc_user(pid, proto.user, sizeof(proto.user));
+        }
+        if (fetch & FETCH_MEM) read_statm(pid, &proto.mem_virt_pages, &proto.mem_res_pages, &proto.mem_shr_pages);
+        size_t first = out->len;
 
-        char taskdir_path[PATH_MAX];
-        snprintf(taskdir_path, sizeof(taskdir_path), "/proc/%d/task", pid);
-        DIR *taskdir = opendir(taskdir_path);
+        char taskdir_path[32];
+        snprintf(taskdir_path, sizeof(taskdir_path), "%d/task", pid);
+        int taskdir = openat(proc_fd, taskdir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (taskdir >= 0 && dir_scan(&tasks, taskdir) != 0) { close(taskdir); taskdir = -1; }
         
-        if (taskdir) {
-            struct dirent *te;
-            while ((te = readdir(taskdir)) != NULL) {
-                if (!is_numeric_str(te->d_name)) continue;
-                pid_t tid = (pid_t)atoi(te->d_name);
+        if (taskdir >= 0) {
+            const char *tname;
+            while ((tname = dir_next(&tasks)) != NULL) {
+                if (!is_numeric_str(tname)) continue;
+                pid_t tid = (pid_t)atoi(tname);
                 
-                sample_t s; memset(&s, 0, sizeof(s));
+                sample_t s = proto;
                 s.pid = tid; 
-                s.tgid = pid;
                 s.key = make_key(tid);
-                snprintf(s.cmd, sizeof(s.cmd), "%s", cmd); 
-
-                char io_path[PATH_MAX], stat_path[PATH_MAX];
-                snprintf(io_path, sizeof(io_path), "/proc/%d/task/%d/io", pid, tid);
-                snprintf(stat_path, sizeof(stat_path), "/proc/%d/task/%d/stat", pid, tid);
-                
-                read_io_file(io_path, &s.syscr, &s.syscw, &s.read_bytes, &s.write_bytes);
-                read_proc_stat_fields(stat_path, &s.cpu_jiffies, &s.blkio_ticks, &s.state, &s.start_time_ticks, &s.minflt, &s.majflt);
-                read_statm(tid, &s.mem_virt_pages, &s.mem_res_pages, &s.mem_shr_pages);
-                get_proc_user(pid, s.user, sizeof(s.user));
-
                 vec_push(out, &s);
             }
-            closedir(taskdir);
+            close(taskdir);
         } else {
             // Fallback
-            sample_t s; memset(&s, 0, sizeof(s));
+            sample_t s = proto;
             s.pid = pid; 
-            s.tgid = pid;
             s.key = make_key(pid);
-            snprintf(s.cmd, sizeof(s.cmd), "%s", cmd);
+            vec_push(out, &s);
+        }
 
-            char io_path[PATH_MAX], stat_path[PATH_MAX];
-            snprintf(io_path, sizeof(io_path), "/proc/%d/io", pid);
-            snprintf(stat_path, sizeof(stat_path), "/proc/%d/stat", pid);
-            
-            read_io_file(io_path, &s.syscr, &s.syscw, &s.read_bytes, &s.write_bytes);
-            read_proc_stat_fields(stat_path, &s.cpu_jiffies, &s.blkio_ticks, &s.state, &s.start_time_ticks, &s.minflt, &s.majflt);
-            read_statm(pid, &s.mem_virt_pages, &s.mem_res_pages, &s.mem_shr_pages);
-            get_proc_user(pid, s.user, sizeof(s.user));
+        size_t n = out->len - base;
+        if (n > flat_cap) { flat_cap = n * 2; flat = grow_array(flat, flat_cap, sizeof(*flat)); }
+        memset(flat + (first - base), taskdir >= 0 ? 0 : 1, out->len - first);
+    }
 
-            vec_push(out, &s);
+    // Read stat (and io) for every recorded task, one batch at a time
+    size_t per = (fetch & FETCH_IO) ? 2 : 1;
+    size_t chunk = READ_BATCH / per;
+    for (size_t at = base; at < out->len; at += chunk) {
+        size_t m = out->len - at < chunk ? out->len - at : chunk;
+        for (size_t i = 0; i < m; i++) {
+            const sample_t *s = &out->data[at + i];
+            const char *dir = flat[at + i - base] ? "" : "/task/";
+            char tid[16] = "";
+            if (!flat[at + i - base]) snprintf(tid, sizeof(tid), "%d", s->pid);
+            snprintf(req[i * per].path, sizeof(req[0].path), "/proc/%d%s%s/stat", s->tgid, dir, tid);
+            if (per == 2) snprintf(req[i * per + 1].path, sizeof(req[0].path), "/proc/%d%s%s/io", s->tgid, dir, tid);
+        }
+        read_batch(req, m * per);
+        for (size_t i = 0; i < m; i++) {
+            sample_t *s = &out->data[at + i];
+            read_req_t *r = &req[i * per];
+            if (r->len > 0) parse_proc_stat_fields(r->buf, &s->cpu_jiffies, &s->blkio_ticks, &s->state, &s->ppid, &s->start_time_ticks, &s->minflt, &s->majflt, &s->processor, &s->nice, s->comm);
+            if (per == 2 && r[1].len > 0) parse_io_buf(r[1].buf, &s->syscr, &s->syscw, &s->read_bytes, &s->write_bytes);
         }
     }
-    closedir(proc);
-    return 0;
-}
 
-static int cmp_key(const void *a, const void *b) {
-    const sample_t *x = (const sample_t *)a;
-    const sample_t *y = (const sample_t *)b;
-    return (x->key > y->key) - (x->key < y->key);
+    // PID reused since the last refresh, or the process called execve(),
+    // which renames it: the carried-over identity is stale. Tasks of one
+    // TGID are contiguous.
+    if (prev) {
+        for (size_t i = base; i < out->len; ) {
+            size_t end = i + 1;
+            while (end < out->len && out->data[end].tgid == out->data[i].tgid) end++;
+            pid_t pid = out->data[i].tgid;
+            const sample_t *leader = find_prev(prev, make_key(pid));
+            const sample_t *now = NULL;
+            for (size_t j = i; j < end && !now; j++) if (out->data[j].pid == pid) now = &out->data[j];
+            if (leader && leader->tgid == pid && now &&
+                (leader->start_time_ticks != now->start_time_ticks ||
+                 (now->comm[0] && strcmp(leader->comm, now->comm) != 0))) {
+                char cmd[CMD_MAX], user[sizeof(now->user)];
+                read_cmdline(pid, cmd);
+                get_proc_user(pid, user, sizeof(user));
+                for (size_t j = i; j < end; j++) {
+                    memcpy(out->data[j].cmd, cmd, sizeof(cmd));
+                    memcpy(out->data[j].user, user, sizeof(user));
+                }
+            }
+            i = end;
+        }
+    }
+    return 0;
 }
 
-static const sample_t *find_prev(const vec_t *prev, uint64_t key) {
-    size_t lo = 0, hi = prev->len;
-    while (lo < hi) {
-        size_t mid = lo + (hi - lo) / 2;
-        uint64_t k = prev->data[mid].key;
-        if (k == key) return &prev->data[mid];
-        if (k < key) lo = mid + 1;
-        else hi = mid;
+#ifdef DEBUG
+// After warm-up a refresh reuses every buffer it needs, so two more
+// collections in a row must not allocate at all. A process started in
+// between may need its owner looked up, so the best of three tries counts.
+static void collect_selftest(void) {
+    vec_t v[2];
+    vec_init(&v[0]);
+    vec_init(&v[1]);
+    unsigned long best = ULONG_MAX, mark = 0;
+    for (int i = 0; i < 9; i++) {
+        vec_t *cur = &v[i & 1], *prev = i ? &v[(i - 1) & 1] : NULL;
+        if (i >= 3 && i % 2 == 1) mark = malloc_calls;
+        vec_clear(cur);
+        collect_samples(cur, prev, FETCH_ALL, NULL, 0);
+        sort_rows(cur->data, cur->len, sizeof(sample_t), cmp_key);
+        if (i >= 3 && i % 2 == 0 && malloc_calls - mark < best) best = malloc_calls - mark;
     }
-    return NULL;
+    fprintf(stderr, "DEBUG: %lu allocations in two steady-state collections of %zu tasks\n", best, v[0].len);
+    vec_free(&v[0]);
+    vec_free(&v[1]);
 }
+#endif
 
 // --- Global Sort State ---
 static int sort_desc = 1;
 
-// Sort Comparators
-typedef enum { 
-    SORT_PID=1, SORT_CPU, SORT_LOG_R, SORT_LOG_W, SORT_WAIT, SORT_RMIB, SORT_WMIB,
-    SORT_NET_RX, SORT_NET_TX,
-    SORT_MEM_RES, SORT_MEM_SHR, SORT_MEM_VIRT, SORT_USER, SORT_UPTIME,
-    // Disk specific
-    SORT_DISK_RIO, SORT_DISK_WIO, SORT_DISK_RMIB, SORT_DISK_WMIB, SORT_DISK_RLAT, SORT_DISK_WLAT
-} sort_col_t;
+// Sort Comparators
+typedef enum { 
+    SORT_PID=1, SORT_CPU, SORT_LOG_R, SORT_LOG_W, SORT_WAIT, SORT_RMIB, SORT_WMIB,
+    SORT_NET_RX, SORT_NET_TX,
+    SORT_MEM_RES, SORT_MEM_SHR, SORT_MEM_VIRT, SORT_USER, SORT_UPTIME, SORT_STATE,
+    SORT_MINFLT, SORT_MAJFLT,
+    // Per-CPU view
+    SORT_PCPU_CPU, SORT_PCPU_BUSY, SORT_PCPU_USER, SORT_PCPU_SYS, SORT_PCPU_IOWAIT,
+    SORT_PCPU_IRQ, SORT_PCPU_SOFTIRQ, SORT_PCPU_STEAL,
+    // Network specific
+    SORT_NET_NAME, SORT_NET_RXPKT, SORT_NET_TXPKT, SORT_NET_RXERR, SORT_NET_TXERR,
+    SORT_NET_RXDROP, SORT_NET_TXDROP, SORT_NET_FIFO, SORT_NET_MCAST, SORT_NET_VMID,
+    // Disk specific
+    SORT_DISK_RIO, SORT_DISK_WIO, SORT_DISK_RMIB, SORT_DISK_WMIB, SORT_DISK_RLAT, SORT_DISK_WLAT,
+    SORT_DISK_NAME, SORT_DISK_UTIL,
+    // Cluster VM table
+    SORT_VM_NODE, SORT_VM_ID, SORT_VM_NAME, SORT_VM_CPU, SORT_VM_RES, SORT_VM_RIOPS, SORT_VM_WIOPS,
+    SORT_VM_RMIB, SORT_VM_WMIB, SORT_VM_WAIT, SORT_VM_RX, SORT_VM_TX, SORT_VM_STATE,
+    // Blocked view
+    SORT_BLK_THREADS, SORT_BLK_PROCS, SORT_BLK_SEEN, SORT_BLK_AGE, SORT_BLK_WCHAN,
+    // Topology view
+    SORT_TOPO_CORE, SORT_TOPO_LOAD, SORT_TOPO_RUN, SORT_TOPO_VCPUS, SORT_TOPO_VRUN, SORT_TOPO_MIGR,
+    // Interrupts view
+    SORT_IRQ_LABEL, SORT_IRQ_RATE, SORT_IRQ_CPUS, SORT_IRQ_TOP, SORT_IRQ_VMID,
+    SORT_NICE,
+    // VM pressure view
+    SORT_CG_VMID, SORT_CG_CPU, SORT_CG_THR, SORT_CG_CPU_SOME, SORT_CG_CPU_FULL, SORT_CG_IO_SOME, SORT_CG_IO_FULL,
+    SORT_CG_MEM_SOME, SORT_CG_MEM_FULL, SORT_CG_NAME,
+    // Grouped process view
+    SORT_GRP_LABEL, SORT_GRP_PROCS, SORT_GRP_THREADS, SORT_GRP_RES, SORT_GRP_LOG_R, SORT_GRP_LOG_W,
+    SORT_GRP_WAIT, SORT_GRP_RMIB, SORT_GRP_WMIB, SORT_GRP_CPU, SORT_GRP_RUN, SORT_GRP_BLOCKED
+} sort_col_t;
+
+// --- Column Engine ---
+// Every table view is described by one column_t array. The same descriptor
+// drives the header, each row, the TOTAL line, mouse hit-testing, sorting and
+// CSV export, so adding a column is a single table entry.
+typedef enum {
+    COL_F64,        // double at off, times scale
+    COL_U64,        // uint64_t at off, times scale
+    COL_INT,        // int/pid_t at off
+    COL_CHAR,       // Process state character at off
+    COL_STR,        // char array at off
+    COL_FN,         // double from get(); negative prints as "-"
+    COL_STRFN       // string from get_str()
+} col_kind_t;
+
+typedef enum { HL_NONE, HL_CPU, HL_WAIT, HL_STATE, HL_BAR, HL_ALERT, HL_STALL } col_hilite_t;
+
+#define COLF_LEFT        0x01  // Left-aligned
+#define COLF_FILL        0x02  // Takes the remaining terminal width (last column)
+#define COLF_TOTAL       0x04  // Summed into the TOTAL line
+#define COLF_PER_PROC    0x08  // Per-process value, blank on thread rows
+#define COLF_DURATION    0x10  // Seconds shown as 1d02h / 02:15:33
+#define COLF_DASH_NONPOS 0x20  // Values <= 0 print as "-" (e.g. VMID)
+#define COLF_QUOTE       0x40  // Quoted in CSV export
+#define COLF_NO_EXPORT   0x80
+#define COLF_OPT_SMAPS   0x100 // Only shown while smaps columns are enabled
+
+typedef struct {
+    const char *title;
+    const char *csv;           // Export header, NULL = same as title
+    int width;
+    int prec;                  // Decimals for numeric kinds
+    unsigned flags;
+    col_kind_t kind;
+    size_t off;
+    double scale;
+    double (*get)(const void *row);
+    const char *(*get_str)(const void *row);
+    sort_col_t sort;           // 0 = not sortable
+    int fkey;                  // Fn / digit key that selects this sort, 0 = none
+    unsigned fetch;            // FETCH_ groups needed for every row when sorting by it
+    col_hilite_t hilite;
+} column_t;
+
+typedef struct {
+    const column_t *cols;
+    size_t n;
+    size_t row_size;
+} table_t;
+
+// Derived-column context, refreshed before each redraw
+static long view_uptime_sec;
+static long view_hz = 100;
+static unsigned view_smaps_gen;
+
+static double get_uptime(const void *row) {
+    const sample_t *s = (const sample_t *)row;
+    long up = view_uptime_sec - (long)(s->start_time_ticks / (uint64_t)view_hz);
+    return up < 0 ? 0 : (double)up;
+}
+
+// smaps_rollup is read on demand, so these are only ever called for printed rows
+static double get_pss(const void *row) {
+    const sample_t *s = (const sample_t *)row;
+    const smaps_entry_t *sm = smaps_lookup(s->tgid, s->start_time_ticks, view_smaps_gen);
+    return sm ? (double)sm->pss_kib / 1024.0 : -1;
+}
+static double get_swap(const void *row) {
+    const sample_t *s = (const sample_t *)row;
+    const smaps_entry_t *sm = smaps_lookup(s->tgid, s->start_time_ticks, view_smaps_gen);
+    return sm ? (double)sm->swap_kib / 1024.0 : -1;
+}
+static double get_anon_huge(const void *row) {
+    const sample_t *s = (const sample_t *)row;
+    const smaps_entry_t *sm = smaps_lookup(s->tgid, s->start_time_ticks, view_smaps_gen);
+    return sm ? (double)sm->anon_huge_kib / 1024.0 : -1;
+}
+
+// numa_maps and VmSwap are likewise only read for printed rows
+static double get_vmswap(const void *row) {
+    const sample_t *s = (const sample_t *)row;
+    const numa_entry_t *e = vmswap_lookup(s->tgid, s->start_time_ticks, view_smaps_gen);
+    return e ? (double)e->swap_kib / 1024.0 : -1;
+}
+// Share of the mapped memory that is not on the process's main node
+static double get_numa_spread(const void *row) {
+    const sample_t *s = (const sample_t *)row;
+    const numa_entry_t *e = numa_lookup(s->tgid, s->start_time_ticks, view_smaps_gen);
+    if (!e || e->n_nodes < 1) return -1;
+    uint64_t total = 0, top = 0;
+    for (int i = 0; i < e->n_nodes; i++) {
+        total += e->node_kib[i];
+        if (e->node_kib[i] > top) top = e->node_kib[i];
+    }
+    return total ? 100.0 * (double)(total - top) / (double)total : 0;
+}
+static const char *get_numa_nodes(const void *row) {
+    static char buf[NUMA_NODES_MAX * 16];
+    const sample_t *s = (const sample_t *)row;
+    const numa_entry_t *e = numa_lookup(s->tgid, s->start_time_ticks, view_smaps_gen);
+    size_t o = 0;
+    buf[0] = '\0';
+    if (!e) return "-";
+    // "N0:328M N1:1.5G"; each entry fits in 16 bytes
+    for (int i = 0; i < e->n_nodes; i++) {
+        if (!e->node_kib[i]) continue;
+        if (o) buf[o++] = ' ';
+        buf[o++] = 'N';
+        o += fmt_u64(buf + o, (uint64_t)i);
+        buf[o++] = ':';
+        o += fmt_iec(buf + o, e->node_kib[i]);
+    }
+    return buf;
+}
+
+#define PAGES_MIB (4096.0 / 1048576.0)
+
+static const column_t proc_columns[] = {
+    { "PID", NULL, 10, 0, 0, COL_INT, offsetof(sample_t, pid), 1, NULL, NULL, SORT_PID, 1, 0, HL_NONE },
+    { "User", NULL, 10, 0, COLF_LEFT, COL_STR, offsetof(sample_t, user), 1, NULL, NULL, SORT_USER, 0, 0, HL_NONE },
+    { "Uptime", NULL, 10, 0, COLF_DURATION, COL_FN, 0, 1, get_uptime, NULL, SORT_UPTIME, 0, 0, HL_NONE },
+    { "Res(MiB)", "Res_MiB", 10, 0, COLF_TOTAL | COLF_PER_PROC, COL_U64, offsetof(sample_t, mem_res_pages), PAGES_MIB, NULL, NULL, SORT_MEM_RES, 0, FETCH_MEM, HL_NONE },
+    { "Shr(MiB)", "Shr_MiB", 10, 0, COLF_TOTAL | COLF_PER_PROC, COL_U64, offsetof(sample_t, mem_shr_pages), PAGES_MIB, NULL, NULL, SORT_MEM_SHR, 0, FETCH_MEM, HL_NONE },
+    { "Virt(MiB)", "Virt_MiB", 10, 0, COLF_TOTAL | COLF_PER_PROC, COL_U64, offsetof(sample_t, mem_virt_pages), PAGES_MIB, NULL, NULL, SORT_MEM_VIRT, 0, FETCH_MEM, HL_NONE },
+    { "Pss(MiB)", NULL, 10, 0, COLF_PER_PROC | COLF_OPT_SMAPS | COLF_NO_EXPORT, COL_FN, 0, 1, get_pss, NULL, 0, 0, 0, HL_NONE },
+    { "Swap(MiB)", NULL, 10, 0, COLF_PER_PROC | COLF_OPT_SMAPS | COLF_NO_EXPORT, COL_FN, 0, 1, get_swap, NULL, 0, 0, 0, HL_NONE },
+    { "AnonHP", NULL, 10, 0, COLF_PER_PROC | COLF_OPT_SMAPS | COLF_NO_EXPORT, COL_FN, 0, 1, get_anon_huge, NULL, 0, 0, 0, HL_NONE },
+    { "R_Log", NULL, 10, 0, COLF_TOTAL, COL_F64, offsetof(sample_t, r_iops), 1, NULL, NULL, SORT_LOG_R, 3, FETCH_IO, HL_NONE },
+    { "W_Log", NULL, 10, 0, COLF_TOTAL, COL_F64, offsetof(sample_t, w_iops), 1, NULL, NULL, SORT_LOG_W, 4, FETCH_IO, HL_NONE },
+    { "Wait", "Wait_ms", 8, 2, COLF_TOTAL, COL_F64, offsetof(sample_t, io_wait_ms), 1, NULL, NULL, SORT_WAIT, 5, 0, HL_WAIT },
+    { "R_MiB", NULL, 10, 2, COLF_TOTAL, COL_F64, offsetof(sample_t, r_mib), 1, NULL, NULL, SORT_RMIB, 6, FETCH_IO, HL_NONE },
+    { "W_MiB", NULL, 10, 2, COLF_TOTAL, COL_F64, offsetof(sample_t, w_mib), 1, NULL, NULL, SORT_WMIB, 7, FETCH_IO, HL_NONE },
+    { "CPU", "CPU_pct", 8, 2, COLF_TOTAL, COL_F64, offsetof(sample_t, cpu_pct), 1, NULL, NULL, SORT_CPU, 2, 0, HL_CPU },
+    { "NI", "Nice", 4, 0, 0, COL_INT, offsetof(sample_t, nice), 1, NULL, NULL, SORT_NICE, 0, 0, HL_NONE },
+    { "S", "State", 5, 0, 0, COL_CHAR, offsetof(sample_t, state), 1, NULL, NULL, SORT_STATE, 8, 0, HL_STATE },
+    { "COMMAND", "Command", 0, 0, COLF_LEFT | COLF_FILL | COLF_QUOTE, COL_STR, offsetof(sample_t, cmd), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+};
+
+static const column_t net_columns[] = {
+    { "IFACE", "Interface", 16, 0, 0, COL_STR, offsetof(net_iface_t, name), 1, NULL, NULL, SORT_NET_NAME, 0, 0, HL_NONE },
+    { "STATE", "State", 10, 0, 0, COL_STR, offsetof(net_iface_t, operstate), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "RX_Mbps", NULL, 12, 2, 0, COL_F64, offsetof(net_iface_t, rx_mbps), 1, NULL, NULL, SORT_NET_RX, 1, 0, HL_NONE },
+    { "TX_Mbps", NULL, 12, 2, 0, COL_F64, offsetof(net_iface_t, tx_mbps), 1, NULL, NULL, SORT_NET_TX, 2, 0, HL_NONE },
+    { "RX_Pkts", NULL, 11, 0, 0, COL_F64, offsetof(net_iface_t, rx_pps), 1, NULL, NULL, SORT_NET_RXPKT, 3, 0, HL_NONE },
+    { "TX_Pkts", NULL, 11, 0, 0, COL_F64, offsetof(net_iface_t, tx_pps), 1, NULL, NULL, SORT_NET_TXPKT, 4, 0, HL_NONE },
+    { "RX_Err", NULL, 10, 0, 0, COL_F64, offsetof(net_iface_t, rx_errs_ps), 1, NULL, NULL, SORT_NET_RXERR, 5, 0, HL_NONE },
+    { "TX_Err", NULL, 10, 0, 0, COL_F64, offsetof(net_iface_t, tx_errs_ps), 1, NULL, NULL, SORT_NET_TXERR, 6, 0, HL_NONE },
+    { "RX_Drop", NULL, 11, 0, 0, COL_F64, offsetof(net_iface_t, rx_drops_ps), 1, NULL, NULL, SORT_NET_RXDROP, 7, 0, HL_NONE },
+    { "TX_Drop", NULL, 11, 0, 0, COL_F64, offsetof(net_iface_t, tx_drops_ps), 1, NULL, NULL, SORT_NET_TXDROP, 8, 0, HL_NONE },
+    { "Fifo", NULL, 8, 0, 0, COL_F64, offsetof(net_iface_t, fifo_ps), 1, NULL, NULL, SORT_NET_FIFO, 0, 0, HL_NONE },
+    { "Mcast", NULL, 8, 0, 0, COL_F64, offsetof(net_iface_t, mcast_ps), 1, NULL, NULL, SORT_NET_MCAST, 0, 0, HL_NONE },
+    { "VMID", NULL, 6, 0, COLF_LEFT | COLF_DASH_NONPOS, COL_INT, offsetof(net_iface_t, vmid), 1, NULL, NULL, SORT_NET_VMID, 0, 0, HL_NONE },
+    { "VM_NAME", "VM_Name", 0, 0, COLF_LEFT | COLF_FILL, COL_STR, offsetof(net_iface_t, vm_name), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+};
+
+static const column_t disk_columns[] = {
+    { "DEVICE", "Device", 16, 0, 0, COL_STR, offsetof(disk_sample_t, name), 1, NULL, NULL, SORT_DISK_NAME, 0, 0, HL_NONE },
+    { "R_IOPS", NULL, 12, 2, 0, COL_F64, offsetof(disk_sample_t, r_iops), 1, NULL, NULL, SORT_DISK_RIO, 1, 0, HL_NONE },
+    { "W_IOPS", NULL, 12, 2, 0, COL_F64, offsetof(disk_sample_t, w_iops), 1, NULL, NULL, SORT_DISK_WIO, 2, 0, HL_NONE },
+    { "R_MiB/s", "R_MiB_s", 12, 2, 0, COL_F64, offsetof(disk_sample_t, r_mib), 1, NULL, NULL, SORT_DISK_RMIB, 3, 0, HL_NONE },
+    { "W_MiB/s", "W_MiB_s", 12, 2, 0, COL_F64, offsetof(disk_sample_t, w_mib), 1, NULL, NULL, SORT_DISK_WMIB, 4, 0, HL_NONE },
+    { "R_Lat(ms)", "R_Lat_ms", 14, 4, 0, COL_F64, offsetof(disk_sample_t, r_lat), 1, NULL, NULL, SORT_DISK_RLAT, 5, 0, HL_NONE },
+    { "W_Lat(ms)", "W_Lat_ms", 14, 4, 0, COL_F64, offsetof(disk_sample_t, w_lat), 1, NULL, NULL, SORT_DISK_WLAT, 6, 0, HL_NONE },
+    { "Util%", "Util_pct", 8, 2, 0, COL_F64, offsetof(disk_sample_t, util_pct), 1, NULL, NULL, SORT_DISK_UTIL, 7, 0, HL_NONE },
+};
+
+// Memory view: fault rates for every process, swap and NUMA placement for the
+// rows on screen
+static const column_t mem_columns[] = {
+    { "PID", NULL, 10, 0, 0, COL_INT, offsetof(sample_t, pid), 1, NULL, NULL, SORT_PID, 1, 0, HL_NONE },
+    { "User", NULL, 10, 0, COLF_LEFT, COL_STR, offsetof(sample_t, user), 1, NULL, NULL, SORT_USER, 0, 0, HL_NONE },
+    { "MajFlt/s", "MajFlt_ps", 10, 1, COLF_TOTAL, COL_F64, offsetof(sample_t, majflt_ps), 1, NULL, NULL, SORT_MAJFLT, 2, 0, HL_NONE },
+    { "MinFlt/s", "MinFlt_ps", 10, 0, COLF_TOTAL, COL_F64, offsetof(sample_t, minflt_ps), 1, NULL, NULL, SORT_MINFLT, 3, 0, HL_NONE },
+    { "Res(MiB)", "Res_MiB", 10, 0, COLF_TOTAL, COL_U64, offsetof(sample_t, mem_res_pages), PAGES_MIB, NULL, NULL, SORT_MEM_RES, 4, FETCH_MEM, HL_NONE },
+    { "Swap(MiB)", "Swap_MiB", 10, 1, 0, COL_FN, 0, 1, get_vmswap, NULL, 0, 0, 0, HL_NONE },
+    { "Spread%", "Spread_pct", 8, 1, 0, COL_FN, 0, 1, get_numa_spread, NULL, 0, 0, 0, HL_NONE },
+    { "NUMA", "NUMA_nodes", 24, 0, COLF_LEFT | COLF_QUOTE, COL_STRFN, 0, 1, NULL, get_numa_nodes, 0, 0, 0, HL_NONE },
+    { "COMMAND", "Command", 0, 0, COLF_LEFT | COLF_FILL | COLF_QUOTE, COL_STR, offsetof(sample_t, cmd), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+};
+
+// Per-CPU view. The bar is one letter per percent, u s w i q t for user,
+// system, iowait, irq, softirq and steal; HL_BAR prints it scaled and colored.
+static const char *get_pcpu_bar(const void *row) {
+    static char bar[101];
+    const percpu_row_t *r = (const percpu_row_t *)row;
+    const double part[] = { r->user, r->system, r->iowait, r->irq, r->softirq, r->steal };
+    double acc = 0;
+    int o = 0;
+    for (int k = 0; k < 6; k++) {
+        acc += part[k];
+        int end = (int)(acc + 0.5);
+        if (end > 100) end = 100;
+        while (o < end) bar[o++] = "uswiqt"[k];
+    }
+    bar[o] = '\0';
+    return bar;
+}
+
+static const column_t pcpu_columns[] = {
+    { "CPU", NULL, 5, 0, 0, COL_INT, offsetof(percpu_row_t, cpu), 1, NULL, NULL, SORT_PCPU_CPU, 1, 0, HL_NONE },
+    { "Busy%", "Busy_pct", 7, 1, 0, COL_F64, offsetof(percpu_row_t, busy), 1, NULL, NULL, SORT_PCPU_BUSY, 2, 0, HL_CPU },
+    { "User%", "User_pct", 7, 1, 0, COL_F64, offsetof(percpu_row_t, user), 1, NULL, NULL, SORT_PCPU_USER, 3, 0, HL_NONE },
+    { "Sys%", "Sys_pct", 7, 1, 0, COL_F64, offsetof(percpu_row_t, system), 1, NULL, NULL, SORT_PCPU_SYS, 4, 0, HL_NONE },
+    { "IOwait%", "IOwait_pct", 8, 1, 0, COL_F64, offsetof(percpu_row_t, iowait), 1, NULL, NULL, SORT_PCPU_IOWAIT, 5, 0, HL_NONE },
+    { "IRQ%", "IRQ_pct", 7, 1, 0, COL_F64, offsetof(percpu_row_t, irq), 1, NULL, NULL, SORT_PCPU_IRQ, 6, 0, HL_NONE },
+    { "SoftIRQ%", "SoftIRQ_pct", 9, 1, 0, COL_F64, offsetof(percpu_row_t, softirq), 1, NULL, NULL, SORT_PCPU_SOFTIRQ, 7, 0, HL_NONE },
+    { "Steal%", "Steal_pct", 7, 1, 0, COL_F64, offsetof(percpu_row_t, steal), 1, NULL, NULL, SORT_PCPU_STEAL, 8, 0, HL_NONE },
+    { "", NULL, 0, 0, COLF_LEFT | COLF_FILL | COLF_NO_EXPORT, COL_STRFN, 0, 1, NULL, get_pcpu_bar, 0, 0, 0, HL_BAR },
+};
+
+#define TABLE(cols, row) { cols, sizeof(cols) / sizeof(cols[0]), sizeof(row) }
+static const table_t proc_table = TABLE(proc_columns, sample_t);
+static const table_t net_table = TABLE(net_columns, net_iface_t);
+static const table_t disk_table = TABLE(disk_columns, disk_sample_t);
+static const table_t mem_table = TABLE(mem_columns, sample_t);
+static const table_t pcpu_table = TABLE(pcpu_columns, percpu_row_t);
+
+static int col_visible(const column_t *c, unsigned show) {
+    return !(c->flags & COLF_OPT_SMAPS) || (show & COLF_OPT_SMAPS);
+}
+
+static int col_is_text(const column_t *c) {
+    return c->kind == COL_STR || c->kind == COL_STRFN;
+}
+
+// D sorts above R and so on, so "descending" puts blocked tasks first
+static int state_rank(char s) {
+    switch (s) {
+        case 'D': return 6;
+        case 'R': return 5;
+        case 'Z': return 4;
+        case 'T': case 't': return 3;
+        case 'S': return 2;
+        case 'I': return 1;
+        default: return 0;
+    }
+}
+
+static double col_value(const column_t *c, const void *row) {
+    const char *p = (const char *)row + c->off;
+    switch (c->kind) {
+        case COL_F64: { double v; memcpy(&v, p, sizeof(v)); return v * c->scale; }
+        case COL_U64: { uint64_t v; memcpy(&v, p, sizeof(v)); return (double)v * c->scale; }
+        case COL_INT: { int v; memcpy(&v, p, sizeof(v)); return (double)v; }
+        case COL_CHAR: return (double)state_rank(*p);
+        case COL_FN: return c->get(row);
+        default: return 0;
+    }
+}
+
+static const char *col_text(const column_t *c, const void *row) {
+    if (c->kind == COL_STRFN) return c->get_str(row);
+    return (const char *)row + c->off;
+}
+
+// Width of the COLF_FILL column once every other visible column is placed
+static int table_fill_width(const table_t *t, unsigned show, int term_cols) {
+    int used = 0;
+    for (size_t i = 0; i < t->n; i++) {
+        const column_t *c = &t->cols[i];
+        if (!col_visible(c, show) || (c->flags & COLF_FILL)) continue;
+        used += c->width + 1;
+    }
+    int w = term_cols - used;
+    return w < 10 ? 10 : w;
+}
+
+static const char *bar_color(char k) {
+    switch (k) {
+        case 'u': return COLOR_GREEN;
+        case 's': return COLOR_RED;
+        case 'w': return COLOR_BLUE;
+        case 'i': return COLOR_YELLOW;
+        case 'q': return COLOR_MAGENTA;
+        case 't': return COLOR_CYAN;
+        default: return "";
+    }
+}
+
+// A 100-letter HL_BAR string squeezed into width cells: '|' in the color of
+// each letter, or the letters themselves without color
+static void print_bar(const char *bar, int width) {
+    int len = (int)strlen(bar);
+    char last = 0;
+    for (int x = 0; x < width; x++) {
+        int pos = (x * 100 + 50) / width;  // Cell centre
+        char k = pos < len ? bar[pos] : ' ';
+        if (!color_enabled || k == ' ') {
+            if (last && color_enabled) printf("%s", COLOR_RESET);
+            last = 0;
+            putchar(k);
+            continue;
+        }
+        if (k != last) printf("%s", bar_color(k));
+        last = k;
+        putchar('|');
+    }
+    if (last) printf("%s", COLOR_RESET);
+}
+
+// Cells go straight to stdout's buffer: len bytes of s space-padded to
+// width, like printf("%*s") / ("%-*s") without the format parsing
+static void put_spaces(size_t n) {
+    static const char spaces[] = "                                ";
+    while (n > 0) {
+        size_t m = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+        fwrite(spaces, 1, m, stdout);
+        n -= m;
+    }
+}
+
+static void put_padded(const char *s, size_t len, int width, int left) {
+    size_t pad = width > 0 && (size_t)width > len ? (size_t)width - len : 0;
+    if (!left) put_spaces(pad);
+    fwrite(s, 1, len, stdout);
+    if (left) put_spaces(pad);
+}
+
+// printf("%*.*s"): at most width bytes of s
+static void put_cell(const char *s, int width, int left) {
+    put_padded(s, width > 0 ? strnlen(s, (size_t)width) : 0, width, left);
+}
+
+static void print_cell_text(const column_t *c, const char *s, int width) {
+    if (c->hilite == HL_BAR) print_bar(s, width);
+    else if (c->hilite == HL_ALERT && *s && color_enabled) { fputs(COLOR_RED, stdout); put_cell(s, width, 0); fputs(COLOR_RESET, stdout); }
+    else if (c->flags & COLF_FILL) fprint_trunc(stdout, s, width);
+    else put_cell(s, width, (c->flags & COLF_LEFT) != 0);
+}
+
+static void print_table_header(const table_t *t, unsigned show, sort_col_t sort) {
+    const char *ind = sort_desc ? "v" : "^";
+    int first = 1;
+    for (size_t i = 0; i < t->n; i++) {
+        const column_t *c = &t->cols[i];
+        if (!col_visible(c, show)) continue;
+        char title[40];
+        snprintf(title, sizeof(title), "%s%.0d%s%s%s", c->fkey ? "F" : "", c->fkey, c->fkey ? " " : "",
+                 c->title, (c->sort && c->sort == sort) ? ind : "");
+        if (!first) putchar(' ');
+        first = 0;
+        if (c->flags & COLF_FILL) printf("%s", title);
+        else if (c->flags & COLF_LEFT) printf("%-*s", c->width, title);
+        else printf("%*s", c->width, title);
+    }
+    putchar('\n');
+}
+
+// Full-width separator under a table header and above its totals
+static void print_rule(int w) {
+    for (int i = 0; i < w; i++) putchar('-');
+    putchar('\n');
+}
+
+#define ROW_THREAD   0x01  // Indented thread row under its process
+#define ROW_SELECTED 0x02  // Cursor row: reverse video, cell colors off
+
+static void print_table_row(const table_t *t, unsigned show, const void *row, int fill_w, unsigned row_flags) {
+    int first = 1;
+    int colors = color_enabled;
+    if (row_flags & ROW_SELECTED) { fputs("\033[7m", stdout); color_enabled = 0; }
+    for (size_t i = 0; i < t->n; i++) {
+        const column_t *c = &t->cols[i];
+        if (!col_visible(c, show)) continue;
+        int w = (c->flags & COLF_FILL) ? fill_w : c->width;
+        if (!first) putchar(' ');
+
+        if ((row_flags & ROW_THREAD) && (c->flags & COLF_PER_PROC)) {
+            put_padded("", 0, w, 0);
+        } else if (col_is_text(c)) {
+            print_cell_text(c, col_text(c, row), w);
+        } else if (c->kind == COL_CHAR) {
+            char s = *((const char *)row + c->off);
+            if (c->hilite == HL_STATE) fputs(get_state_color(s), stdout);
+            put_padded(&s, 1, w, 0);
+            if (c->hilite == HL_STATE) fputs(reset_color(), stdout);
+        } else {
+            double v = col_value(c, row);
+            char buf[FMT_NUM_MAX + 8];
+            size_t len;
+            static const char tree[] = "  └─ ";
+            if ((row_flags & ROW_THREAD) && first) {
+                memcpy(buf, tree, sizeof(tree) - 1);
+                len = sizeof(tree) - 1 + fmt_fixed(buf + sizeof(tree) - 1, v, 0);
+            }
+            else if ((c->kind == COL_FN && v < 0) || ((c->flags & COLF_DASH_NONPOS) && v <= 0)) len = 1, buf[0] = '-';
+            else if (c->flags & COLF_DURATION) len = fmt_duration(buf, (long)v);
+            else len = fmt_fixed(buf, v, c->prec);
+
+            const char *color = c->hilite == HL_CPU ? get_cpu_color(v) : c->hilite == HL_WAIT ? get_wait_color(v) :
+                                c->hilite == HL_STALL ? get_stall_color(v) : "";
+            if (*color) fputs(color, stdout);
+            // The tree glyph is 3 bytes but one cell wide
+            int pad = ((row_flags & ROW_THREAD) && first) ? w + 4 : w;
+            put_padded(buf, len, pad, (c->flags & COLF_LEFT) != 0);
+            if (*color) fputs(reset_color(), stdout);
+        }
+        first = 0;
+    }
+    if (row_flags & ROW_SELECTED) { fputs(COLOR_RESET, stdout); color_enabled = colors; }
+    putchar('\n');
+}
+
+// TOTAL line under a table: sums of the COLF_TOTAL columns over all rows,
+// "-" where the column's data was only fetched for some of them
+static void print_table_total(const table_t *t, unsigned show, const void *rows, size_t n_rows, unsigned have_fetch) {
+    int first = 1;
+    for (size_t i = 0; i < t->n; i++) {
+        const column_t *c = &t->cols[i];
+        if (!col_visible(c, show) || (c->flags & COLF_FILL)) continue;
+        if (!first) putchar(' ');
+        if (first) {
+            put_padded("TOTAL", 5, c->width, 0);
+        } else if (!(c->flags & COLF_TOTAL)) {
+            put_padded("", 0, c->width, 0);
+        } else if (c->fetch & ~have_fetch) {
+            put_padded("-", 1, c->width, 0);
+        } else {
+            double sum = 0;
+            char buf[FMT_NUM_MAX];
+            for (size_t r = 0; r < n_rows; r++) sum += col_value(c, (const char *)rows + r * t->row_size);
+            put_padded(buf, fmt_fixed(buf, sum, c->prec), c->width, 0);
+        }
+        first = 0;
+    }
+    putchar('\n');
+}
+
+// --- Viewport ---
+// The scrolled list of a view. A frame first lists the rows that pass the
+// filter in display order, which only stores pointers, then formats just the
+// screenful from top to top + height, so the cost of a frame does not grow
+// with the number of processes. The selection is remembered by the row's key
+// (PID, TID, CPU, interface name...) and follows that row when the list is
+// re-sorted under it; without a key it keeps its position.
+typedef struct {
+    void *row;
+    unsigned flags;            // ROW_THREAD
+    int parent;                // Line of the process a thread row belongs to, or -1
+    uint64_t key;              // 0 for rows without one
+} vp_line_t;
+
+typedef struct {
+    vp_line_t *lines;
+    size_t n, cap;
+    int top, sel;              // Line indices
+    int height;                // Rows on screen in the last frame
+    uint64_t sel_key;
+} viewport_t;
+
+#define VP_WHEEL_STEP 3
+
+// Keys for rows identified by name; never 0
+static uint64_t vp_key_str(const char *s) {
+    uint64_t h = 1469598103934665603ull;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    return h | 1;
+}
+
+static void vp_begin(viewport_t *v) { v->n = 0; }
+
+static int vp_add(viewport_t *v, void *row, unsigned flags, int parent, uint64_t key) {
+    if (v->n == v->cap) {
+        v->cap = v->cap ? v->cap * 2 : 256;
+        v->lines = grow_array(v->lines, v->cap, sizeof(*v->lines));
+    }
+    v->lines[v->n] = (vp_line_t){ row, flags, parent, key };
+    return (int)v->n++;
+}
+
+// Find the selected row again and scroll just enough to keep it on screen
+static void vp_place(viewport_t *v, int height) {
+    v->height = height < 1 ? 1 : height;
+    if (v->sel_key) {
+        for (size_t i = 0; i < v->n; i++) if (v->lines[i].key == v->sel_key) { v->sel = (int)i; break; }
+    }
+    if (v->sel >= (int)v->n) v->sel = (int)v->n - 1;
+    if (v->sel < 0) v->sel = 0;
+    if (v->sel < v->top) v->top = v->sel;
+    if (v->sel >= v->top + v->height) v->top = v->sel - v->height + 1;
+    if (v->top > (int)v->n - v->height) v->top = (int)v->n - v->height;
+    if (v->top < 0) v->top = 0;
+    v->sel_key = v->n ? v->lines[v->sel].key : 0;
+}
+
+static int vp_end(const viewport_t *v) {
+    return v->top + v->height < (int)v->n ? v->top + v->height : (int)v->n;
+}
+
+static void vp_print(const viewport_t *v, const table_t *t, unsigned show, int fill_w) {
+    for (int i = v->top; i < vp_end(v); i++) {
+        const vp_line_t *l = &v->lines[i];
+        print_table_row(t, show, l->row, fill_w, l->flags | (i == v->sel ? ROW_SELECTED : 0));
+    }
+}
+
+// Move the selection; the next frame scrolls to it. The lines of the last
+// frame may point at recycled samples, so only their keys are read here.
+static void vp_move(viewport_t *v, int delta) {
+    if (!v->n) return;
+    long sel = (long)v->sel + delta;
+    if (sel >= (long)v->n) sel = (long)v->n - 1;
+    if (sel < 0) sel = 0;
+    v->sel = (int)sel;
+    v->sel_key = v->lines[sel].key;
+}
+
+// Cursor and scroll keys, the wheel and clicks on rows; 1 if handled
+static int vp_key(viewport_t *v, int c, const mouse_event_t *m, int first_y) {
+    switch (c) {
+        case KEY_UP: vp_move(v, -1); return 1;
+        case KEY_DOWN: vp_move(v, 1); return 1;
+        case KEY_PGUP: v->top -= v->height; vp_move(v, -v->height); return 1;
+        case KEY_PGDN: v->top += v->height; vp_move(v, v->height); return 1;
+        case KEY_HOME: vp_move(v, -v->sel); return 1;
+        case KEY_END: vp_move(v, (int)v->n); return 1;
+        case KEY_MOUSE:
+            if (m->button == 64) { vp_move(v, -VP_WHEEL_STEP); return 1; }
+            if (m->button == 65) { vp_move(v, VP_WHEEL_STEP); return 1; }
+            if (m->button == 0 && m->y >= first_y && m->y < first_y + v->height && v->top + m->y - first_y < (int)v->n) {
+                vp_move(v, v->top + m->y - first_y - v->sel);
+                return 1;
+            }
+            return 0;
+        default: return 0;
+    }
+}
+
+// Rows left for the scrolled list once `chrome` other lines are placed; the
+// footer takes the bottom line. Capped by the row limit, which also applies
+// when stdout is not a terminal.
+static int vp_rows(int chrome, int limit) {
+    int rows = get_term_rows();
+    int h = rows > 0 ? rows - 1 - chrome : limit;
+    if (h > limit) h = limit;
+    return h < 1 ? 1 : h;
+}
+
+static const column_t *table_find_sort(const table_t *t, sort_col_t sort) {
+    for (size_t i = 0; i < t->n; i++) if (t->cols[i].sort == sort) return &t->cols[i];
+    return NULL;
+}
+
+static sort_col_t table_fkey_sort(const table_t *t, int fkey) {
+    for (size_t i = 0; i < t->n; i++) if (t->cols[i].fkey == fkey) return t->cols[i].sort;
+    return 0;
+}
+
+// '<' / '>' step to the previous / next visible sortable column
+static sort_col_t table_step_sort(const table_t *t, unsigned show, sort_col_t cur, int dir) {
+    int at = -1;
+    for (size_t i = 0; i < t->n; i++) if (t->cols[i].sort == cur) at = (int)i;
+    for (int k = 1; k <= (int)t->n; k++) {
+        int i = ((at + dir * k) % (int)t->n + (int)t->n) % (int)t->n;
+        const column_t *c = &t->cols[i];
+        if (c->sort && col_visible(c, show)) return c->sort;
+    }
+    return cur;
+}
+
+// Selecting the current column flips direction; a new column starts with
+// the most useful direction (largest numbers, alphabetical text)
+static void table_select_sort(const table_t *t, sort_col_t *cur, sort_col_t want) {
+    if (!want) return;
+    if (*cur == want) { sort_desc = !sort_desc; return; }
+    const column_t *c = table_find_sort(t, want);
+    *cur = want;
+    sort_desc = c ? !col_is_text(c) : 1;
+}
+
+// Header row is row 3 (after title and system stats); returns the sort
+// column under the pointer or 0
+static sort_col_t handle_header_click(int x, int y, const table_t *t, unsigned show, int fill_w) {
+    if (y != 3) return 0;
+    int x0 = 1;
+    for (size_t i = 0; i < t->n; i++) {
+        const column_t *c = &t->cols[i];
+        if (!col_visible(c, show)) continue;
+        int w = (c->flags & COLF_FILL) ? fill_w : c->width;
+        if (x >= x0 && x < x0 + w) return c->sort;
+        x0 += w + 1;
+    }
+    return 0;
+}
+
+// Sorting works on a side array of keys. Numeric keys are mapped to
+// integers whose unsigned order matches the requested direction, so one
+// comparator serves every numeric column in both directions; text keys get
+// one comparator per direction. Ties keep the previous row order.
+typedef struct {
+    uint64_t key;
+    const char *str;
+    uint32_t idx;
+} sort_key_t;
+
+static uint64_t order_bits(double v) {
+    uint64_t b;
+    memcpy(&b, &v, sizeof(b));
+    return (b & (1ull << 63)) ? ~b : b | (1ull << 63);
+}
+
+static int cmp_key_num(const void *a, const void *b) {
+    const sort_key_t *x = (const sort_key_t *)a;
+    const sort_key_t *y = (const sort_key_t *)b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+static int cmp_key_str_asc(const void *a, const void *b) {
+    const sort_key_t *x = (const sort_key_t *)a;
+    const sort_key_t *y = (const sort_key_t *)b;
+    int r = strcmp(x->str, y->str);
+    return r ? r : (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+static int cmp_key_str_desc(const void *a, const void *b) {
+    const sort_key_t *x = (const sort_key_t *)a;
+    const sort_key_t *y = (const sort_key_t *)b;
+    int r = strcmp(y->str, x->str);
+    return r ? r : (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+// Display order of `rows` without moving them: row order[i] is shown i-th.
+// Used for curr_proc, which has to stay in TGID order for the lookups into
+// it. The array is reused by the next call.
+static const uint32_t *table_order(const table_t *t, sort_col_t sort, const void *rows, size_t n) {
+    static sort_key_t *keys;
+    static size_t keys_cap;
+    static uint32_t *order;
+    static size_t order_cap;
+
+    if (n > order_cap) {
+        order = grow_array(order, n, sizeof(uint32_t));
+        order_cap = n;
+    }
+    const column_t *c = table_find_sort(t, sort);
+    if (!c || n < 2) {
+        for (size_t i = 0; i < n; i++) order[i] = (uint32_t)i;
+        return order;
+    }
+    if (n > keys_cap) {
+        keys = grow_array(keys, n, sizeof(sort_key_t));
+        keys_cap = n;
+    }
+
+    const char *base = (const char *)rows;
+    int text = col_is_text(c);
+    uint64_t flip = sort_desc ? ~0ull : 0;
+    for (size_t i = 0; i < n; i++) {
+        const void *row = base + i * t->row_size;
+        keys[i].idx = (uint32_t)i;
+        if (text) keys[i].str = col_text(c, row);
+        else keys[i].key = order_bits(col_value(c, row)) ^ flip;
+    }
+    sort_rows(keys, n, sizeof(sort_key_t), text ? (sort_desc ? cmp_key_str_desc : cmp_key_str_asc) : cmp_key_num);
+    for (size_t i = 0; i < n; i++) order[i] = keys[i].idx;
+    return order;
+}
+
+static void table_sort(const table_t *t, sort_col_t sort, void *rows, size_t n) {
+    static char *scratch;
+    static size_t scratch_cap;
+
+    if (!table_find_sort(t, sort) || n < 2) return;
+    if (n * t->row_size > scratch_cap) {
+        scratch_cap = n * t->row_size;
+        scratch = grow_array(scratch, scratch_cap, 1);
+    }
+    const uint32_t *order = table_order(t, sort, rows, n);
+    const char *base = (const char *)rows;
+    for (size_t i = 0; i < n; i++) memcpy(scratch + i * t->row_size, base + order[i] * t->row_size, t->row_size);
+    memcpy(rows, scratch, n * t->row_size);
+}
+
+// --- Text Buffers ---
+// Growable byte buffer for formatted output; capacity is kept across reuse.
+typedef struct {
+    char *data;
+    size_t len, cap;
+} text_buf_t;
+
+static void tb_reserve(text_buf_t *b, size_t extra) {
+    if (b->len + extra <= b->cap) return;
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + extra) cap *= 2;
+    char *p = (char *)realloc(b->data, cap);
+    if (!p) { fprintf(stderr, "OOM\n"); exit(2); }
+    b->data = p;
+    b->cap = cap;
+}
+
+__attribute__((format(printf, 2, 3)))
+static void tb_printf(text_buf_t *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->data ? b->data + b->len : NULL, b->cap - b->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n >= b->cap - b->len) {
+        tb_reserve(b, (size_t)n + 1);
+        va_start(ap, fmt);
+        vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+    }
+    b->len += (size_t)n;
+}
+
+static void tb_putc(text_buf_t *b, char c) { tb_reserve(b, 1); b->data[b->len++] = c; }
+
+static void tb_puts(text_buf_t *b, const char *s) {
+    size_t n = strlen(s);
+    tb_reserve(b, n + 1);
+    memcpy(b->data + b->len, s, n + 1);
+    b->len += n;
+}
+
+// tb_printf(b, "%.*f", prec, v) without the format parser
+static void tb_fixed(text_buf_t *b, double v, int prec) {
+    tb_reserve(b, FMT_NUM_MAX);
+    b->len += fmt_fixed(b->data + b->len, v, prec);
+}
+
+static void tb_json_str(text_buf_t *b, const char *s) {
+    tb_putc(b, '"');
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+        if (*p == '"' || *p == '\\') { tb_putc(b, '\\'); tb_putc(b, (char)*p); }
+        else if (*p < 0x20) tb_printf(b, "\\u%04x", *p);
+        else tb_putc(b, (char)*p);
+    }
+    tb_putc(b, '"');
+}
+
+// Columns with any of the `skip` flags are left out
+static void table_csv_header(text_buf_t *b, const table_t *t, unsigned skip) {
+    int first = 1;
+    for (size_t i = 0; i < t->n; i++) {
+        const column_t *c = &t->cols[i];
+        if (c->flags & skip) continue;
+        tb_printf(b, "%s%s", first ? "" : ",", c->csv ? c->csv : c->title);
+        first = 0;
+    }
+}
+
+static void table_csv_row(text_buf_t *b, const table_t *t, const void *row, unsigned skip) {
+    int first = 1;
+    for (size_t i = 0; i < t->n; i++) {
+        const column_t *c = &t->cols[i];
+        if (c->flags & skip) continue;
+        if (!first) tb_putc(b, ',');
+        first = 0;
+        if (col_is_text(c)) {
+            if (c->flags & COLF_QUOTE) tb_putc(b, '"');
+            tb_puts(b, col_text(c, row));
+            if (c->flags & COLF_QUOTE) tb_putc(b, '"');
+        }
+        else if (c->kind == COL_CHAR) tb_putc(b, *((const char *)row + c->off));
+        else if (c->kind == COL_INT) tb_fixed(b, col_value(c, row), 0);
+        else if (c->kind == COL_FN && col_value(c, row) < 0) continue;  // Unavailable: empty field
+        else tb_fixed(b, col_value(c, row), c->prec);
+    }
+}
+
+static void table_json_row(text_buf_t *b, const table_t *t, const void *row, unsigned skip) {
+    int first = 1;
+    tb_putc(b, '{');
+    for (size_t i = 0; i < t->n; i++) {
+        const column_t *c = &t->cols[i];
+        if (c->flags & skip) continue;
+        if (!first) tb_putc(b, ',');
+        first = 0;
+        tb_json_str(b, c->csv ? c->csv : c->title);
+        tb_putc(b, ':');
+        if (col_is_text(c)) tb_json_str(b, col_text(c, row));
+        else if (c->kind == COL_CHAR) { char s[2] = { *((const char *)row + c->off), '\0' }; tb_json_str(b, s); }
+        else if (c->kind == COL_INT) tb_fixed(b, col_value(c, row), 0);
+        else if (c->kind == COL_FN && col_value(c, row) < 0) tb_puts(b, "null");
+        else tb_fixed(b, col_value(c, row), c->prec);
+    }
+    tb_putc(b, '}');
+}
+
+// `order` lists the rows in display order, NULL to write them as stored
+static void export_csv(const table_t *t, const void *rows, size_t n, const uint32_t *order) {
+    char filename[128];
+    time_t now = time(NULL);
+    struct tm *tm_info = localtime(&now);
+    strftime(filename, sizeof(filename), "kvmtop_%Y%m%d_%H%M%S.csv", tm_info);
+    
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        return;
+    }
+
+    text_buf_t b = { NULL, 0, 0 };
+    table_csv_header(&b, t, COLF_NO_EXPORT);
+    tb_putc(&b, '\n');
+    for (size_t r = 0; r < n; r++) {
+        table_csv_row(&b, t, (const char *)rows + (order ? order[r] : r) * t->row_size, COLF_NO_EXPORT);
+        tb_putc(&b, '\n');
+    }
+    fwrite(b.data, 1, b.len, f);
+    free(b.data);
+    
+    fclose(f);
+    // Show message briefly - will be overwritten on next refresh
+    printf("\033[2J\033[H");
+    printf("Exported to: %s\n\nPress any key to continue...", filename);
+    fflush(stdout);
+    wait_for_input(999999);
+}
+
+// --- Background Logging ---
+// With --log every refresh is formatted on the sampling thread and handed to a
+// writer thread through a single-producer/single-consumer ring of buffers.
+// Only the writer touches the disk, so a slow or full log volume can never
+// stall a refresh: when the writer falls behind the ring fills up and further
+// snapshots are dropped and counted instead of queued.
+#define LOG_QUEUE_SLOTS 8
+
+typedef enum { LOG_CSV, LOG_JSONL } log_format_t;
+
+typedef struct {
+    // Settings
+    char dir[PATH_MAX];
+    log_format_t format;
+    uint64_t max_bytes;        // Rotate when the current file reaches this size
+    int max_age;               // ... or is this many seconds old
+    int keep;                  // Log files kept in dir, current one included
+
+    // Queue: slots [tail, head) belong to the writer, the rest to the sampler
+    text_buf_t slot[LOG_QUEUE_SLOTS];
+    size_t head, tail;
+    int wake_fd;               // eventfd, bumped once per queued snapshot
+    int stop;
+    int running;
+    pthread_t thread;
+
+    // Writer state
+    int fd;
+    uint64_t file_bytes;
+    time_t file_opened;
+    int header_due;            // CSV header goes at the top of every file
+
+    unsigned long written, dropped, write_errors;
+} log_writer_t;
+
+typedef struct {
+    time_t mtime;
+    char name[256];
+} log_file_t;
+
+static int cmp_log_file(const void *a, const void *b) {
+    const log_file_t *x = (const log_file_t *)a;
+    const log_file_t *y = (const log_file_t *)b;
+    if (x->mtime != y->mtime) return x->mtime < y->mtime ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+static int is_log_file(const char *name) {
+    size_t n = strlen(name);
+    return strncmp(name, "kvmtop-", 7) == 0 &&
+           ((n > 4 && strcmp(name + n - 4, ".csv") == 0) || (n > 6 && strcmp(name + n - 6, ".jsonl") == 0));
+}
+
+// Delete the oldest kvmtop-* logs until at most `keep` are left
+static void log_prune(const log_writer_t *lw) {
+    DIR *d = opendir(lw->dir);
+    if (!d) return;
+    log_file_t *files = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (!is_log_file(de->d_name)) continue;
+        struct stat st;
+        if (fstatat(dirfd(d), de->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 32;
+            log_file_t *p = (log_file_t *)realloc(files, cap * sizeof(*p));
+            if (!p) break;
+            files = p;
+        }
+        files[n].mtime = st.st_mtime;
+        snprintf(files[n].name, sizeof(files[n].name), "%s", de->d_name);
+        n++;
+    }
+    if (n > (size_t)lw->keep) {
+        qsort(files, n, sizeof(log_file_t), cmp_log_file);
+        for (size_t i = 0; i + (size_t)lw->keep < n; i++) unlinkat(dirfd(d), files[i].name, 0);
+    }
+    free(files);
+    closedir(d);
+}
+
+static void log_open_next(log_writer_t *lw) {
+    if (lw->fd >= 0) close(lw->fd);
+    lw->fd = -1;
+
+    time_t now = time(NULL);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
+    char stamp[32], path[PATH_MAX + 64];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_info);
+    const char *ext = lw->format == LOG_JSONL ? "jsonl" : "csv";
+    for (int seq = 0; seq < 100 && lw->fd < 0; seq++) {
+        if (seq == 0) snprintf(path, sizeof(path), "%s/kvmtop-%s.%s", lw->dir, stamp, ext);
+        else snprintf(path, sizeof(path), "%s/kvmtop-%s-%d.%s", lw->dir, stamp, seq, ext);
+        lw->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+        if (lw->fd < 0 && errno != EEXIST) break;
+    }
+    lw->file_bytes = 0;
+    lw->file_opened = now;
+    lw->header_due = 1;
+    log_prune(lw);
+}
+
+static int log_write_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+// A CSV snapshot starts with its header line, which is only written when the
+// snapshot opens a file
+static void log_write_snapshot(log_writer_t *lw, const text_buf_t *b) {
+    if (lw->fd < 0 || lw->file_bytes >= lw->max_bytes || time(NULL) - lw->file_opened >= lw->max_age)
+        log_open_next(lw);
+    if (lw->fd < 0) { __atomic_add_fetch(&lw->write_errors, 1, __ATOMIC_RELAXED); return; }
+
+    const char *p = b->data;
+    size_t len = b->len;
+    if (lw->format == LOG_CSV) {
+        const char *nl = memchr(p, '\n', len);
+        size_t hdr = nl ? (size_t)(nl - p) + 1 : len;
+        if (!lw->header_due) { p += hdr; len -= hdr; }
+    }
+    if (log_write_all(lw->fd, p, len) != 0) {
+        // Most likely ENOSPC: count it and start a fresh file next time, which
+        // also gives retention a chance to free space
+        __atomic_add_fetch(&lw->write_errors, 1, __ATOMIC_RELAXED);
+        close(lw->fd);
+        lw->fd = -1;
+        return;
+    }
+    lw->header_due = 0;
+    lw->file_bytes += len;
+    __atomic_add_fetch(&lw->written, 1, __ATOMIC_RELAXED);
+}
+
+static void *log_writer_main(void *arg) {
+    log_writer_t *lw = (log_writer_t *)arg;
+    for (;;) {
+        uint64_t v;
+        if (read(lw->wake_fd, &v, sizeof(v)) < 0 && errno != EINTR && errno != EAGAIN) break;
+        size_t t = lw->tail;
+        size_t h = __atomic_load_n(&lw->head, __ATOMIC_ACQUIRE);
+        for (; t != h; t++) {
+            log_write_snapshot(lw, &lw->slot[t % LOG_QUEUE_SLOTS]);
+            __atomic_store_n(&lw->tail, t + 1, __ATOMIC_RELEASE);
+        }
+        if (__atomic_load_n(&lw->stop, __ATOMIC_ACQUIRE) && t == __atomic_load_n(&lw->head, __ATOMIC_ACQUIRE)) break;
+    }
+    if (lw->fd >= 0) close(lw->fd);
+    lw->fd = -1;
+    return NULL;
+}
+
+static void log_wake(log_writer_t *lw) {
+    uint64_t one = 1;
+    ssize_t w = write(lw->wake_fd, &one, sizeof(one));
+    (void)w;  // An eventfd counter cannot overflow at one bump per refresh
+}
+
+static int log_start(log_writer_t *lw) {
+    if (mkdir(lw->dir, 0755) != 0 && errno != EEXIST) return -1;
+    if (access(lw->dir, W_OK) != 0) return -1;
+    lw->fd = -1;
+    lw->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (lw->wake_fd < 0) return -1;
+    if ((errno = pthread_create(&lw->thread, NULL, log_writer_main, lw)) != 0) {
+        close(lw->wake_fd);
+        return -1;
+    }
+    lw->running = 1;
+    return 0;
+}
+
+// Finish the queued snapshots and stop the writer
+static void log_stop(log_writer_t *lw) {
+    if (!lw->running) return;
+    __atomic_store_n(&lw->stop, 1, __ATOMIC_RELEASE);
+    log_wake(lw);
+    pthread_join(lw->thread, NULL);
+    close(lw->wake_fd);
+    lw->running = 0;
+    for (int i = 0; i < LOG_QUEUE_SLOTS; i++) free(lw->slot[i].data);
+}
+
+// Format one refresh into a free slot and queue it; never waits for the writer
+static void log_snapshot(log_writer_t *lw, const vec_t *proc, double cpu_pct, const percpu_t *pc) {
+    size_t h = lw->head;
+    if (h - __atomic_load_n(&lw->tail, __ATOMIC_ACQUIRE) >= LOG_QUEUE_SLOTS) {
+        __atomic_add_fetch(&lw->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    text_buf_t *b = &lw->slot[h % LOG_QUEUE_SLOTS];
+    b->len = 0;
+
+    time_t now = time(NULL);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
+    char stamp[40];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S%z", &tm_info);
+
+    // Reading smaps_rollup for every process each refresh is too expensive
+    const unsigned skip = COLF_NO_EXPORT | COLF_OPT_SMAPS;
+    if (lw->format == LOG_JSONL) {
+        tb_printf(b, "{\"time\":\"%s\",\"cpu_pct\":%.2f,\"processes\":[", stamp, cpu_pct);
+        for (size_t i = 0; i < proc->len; i++) {
+            if (i) tb_putc(b, ',');
+            table_json_row(b, &proc_table, &proc->data[i], skip);
+        }
+        // The CSV format has one row schema, so per-CPU data is JSONL only
+        tb_printf(b, "],\"cpus\":[");
+        for (int i = 0, first = 1; i < pc->n; i++) {
+            if (!pc->rows[i].online) continue;
+            if (!first) tb_putc(b, ',');
+            first = 0;
+            table_json_row(b, &pcpu_table, &pc->rows[i], skip);
+        }
+        tb_printf(b, "]}\n");
+    } else {
+        tb_printf(b, "Time,");
+        table_csv_header(b, &proc_table, skip);
+        tb_putc(b, '\n');
+        for (size_t i = 0; i < proc->len; i++) {
+            tb_printf(b, "%s,", stamp);
+            table_csv_row(b, &proc_table, &proc->data[i], skip);
+            tb_putc(b, '\n');
+        }
+    }
+
+    __atomic_store_n(&lw->head, h + 1, __ATOMIC_RELEASE);
+    log_wake(lw);
+}
+
+static int cmp_tgid(const void *a, const void *b) {
+    const sample_t *x = (const sample_t *)a;
+    const sample_t *y = (const sample_t *)b;
+    return (x->tgid > y->tgid) - (x->tgid < y->tgid);
+}
+
+// --- Process Aggregation ---
+// Process rows are folded from their threads in the same pass that computes
+// the thread rates. collect_samples() emits each process's threads as one
+// contiguous run, so a thread either extends the last process row or starts a
+// new one; no copy of the thread list and no sort over it are needed.
+
+// Fold thread t into the process list, starting a new row when t belongs to
+// a different process than the previous thread
+static void proc_fold(vec_t *proc, const sample_t *t) {
+    sample_t *row = proc->len ? &proc->data[proc->len - 1] : NULL;
+    if (!row || row->tgid != t->tgid) {
+        vec_push(proc, t);
+        proc->data[proc->len - 1].pid = t->tgid;  // PID column shows the TGID
+        return;
+    }
+    row->cpu_pct += t->cpu_pct;
+    row->r_iops += t->r_iops;
+    row->w_iops += t->w_iops;
+    row->io_wait_ms += t->io_wait_ms;
+    row->r_mib += t->r_mib;
+    row->w_mib += t->w_mib;
+    row->minflt_ps += t->minflt_ps;
+    row->majflt_ps += t->majflt_ps;
+    row->migrations += t->migrations;
+    // The process is as stuck as its most stuck thread: any D makes it D,
+    // then R, Z, T, S, I (see state_rank())
+    if (state_rank(t->state) > state_rank(row->state)) row->state = t->state;
+}
+
+// Leave the process list sorted by TGID with one row per process. /proc lists
+// processes in PID order, so this is normally a single check; input whose
+// thread runs are split or out of order is sorted and merged here.
+static void proc_fold_finish(vec_t *proc) {
+    int sorted = 1;
+    for (size_t i = 1; i < proc->len && sorted; i++) sorted = proc->data[i - 1].tgid < proc->data[i].tgid;
+    if (sorted) return;
+
+    sort_rows(proc->data, proc->len, sizeof(sample_t), cmp_tgid);
+    size_t n = proc->len;
+    proc->len = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (proc->len == 0 || proc->data[proc->len - 1].tgid != proc->data[i].tgid) {
+            proc->data[proc->len++] = proc->data[i];
+        } else {
+            sample_t t = proc->data[i];
+            proc_fold(proc, &t);
+        }
+    }
+}
+
+// Rebuild process rows from an arbitrary thread list
+static void aggregate_by_tgid(const vec_t *src, vec_t *dst) {
+    vec_clear(dst);
+    for (size_t i = 0; i < src->len; i++) proc_fold(dst, &src->data[i]);
+    proc_fold_finish(dst);
+}
+
+// Which field groups a process sort column needs for every task up front
+static unsigned fetch_for_sort(const table_t *t, sort_col_t col) {
+    const column_t *c = table_find_sort(t, col);
+    return c ? c->fetch : 0;
+}
+
+// I/O rates are measured between the two most recent io reads of a thread,
+// which can be more than one interval apart for rows that were off screen.
+static void compute_io_rates(sample_t *c, const sample_t *p) {
+    c->r_iops = c->w_iops = c->r_mib = c->w_mib = 0;
+    if (!p || p->io_time <= 0 || c->io_time <= p->io_time) return;
+    double dt = c->io_time - p->io_time;
+    uint64_t d_scr = (c->syscr >= p->syscr) ? c->syscr - p->syscr : 0;
+    uint64_t d_scw = (c->syscw >= p->syscw) ? c->syscw - p->syscw : 0;
+    uint64_t d_rb  = (c->read_bytes >= p->read_bytes) ? c->read_bytes - p->read_bytes : 0;
+    uint64_t d_wb  = (c->write_bytes >= p->write_bytes) ? c->write_bytes - p->write_bytes : 0;
+    c->r_iops = (double)d_scr / dt;
+    c->w_iops = (double)d_scw / dt;
+    c->r_mib  = ((double)d_rb / dt) / 1048576.0;
+    c->w_mib  = ((double)d_wb / dt) / 1048576.0;
+}
+
+// Groups phase one skipped are taken from the previous generation so that a
+// later fetch still has a baseline to compute rates against.
+static void carry_over(sample_t *c, const sample_t *p) {
+    if (!p) return;
+    if (!(c->fetched & FETCH_IO)) {
+        c->syscr = p->syscr; c->syscw = p->syscw;
+        c->read_bytes = p->read_bytes; c->write_bytes = p->write_bytes;
+        c->io_time = p->io_time;
+    }
+    if (!(c->fetched & FETCH_MEM)) {
+        c->mem_virt_pages = p->mem_virt_pages;
+        c->mem_res_pages = p->mem_res_pages;
+        c->mem_shr_pages = p->mem_shr_pages;
+    }
+}
+
+// --- Delta Kernels ---
+// The per-thread counters that share the refresh interval as their time base
+// are gathered into index-matched current/previous columns and turned into
+// rates by one kernel call per counter. The x86-64 kernels work on 2 (SSE2)
+// or 4 (AVX2) lanes without branches and round exactly like the scalar loop:
+// the u64 -> double conversion is exact up to one final rounding and the
+// multiply and divide are the same IEEE operations in the same order.
+enum { CTR_CPU, CTR_BLKIO, CTR_MINFLT, CTR_MAJFLT, CTR_COUNT };
+
+typedef struct {
+    uint64_t *cur[CTR_COUNT];
+    uint64_t *prev[CTR_COUNT];
+    double *rate[CTR_COUNT];
+    size_t cap;
+} counter_soa_t;
+
+static void *alloc_lanes(void *old, size_t n, size_t elem) {
+    free(old);
+    void *p = aligned_alloc(32, (n * elem + 31) & ~(size_t)31);
+    if (!p) { fprintf(stderr, "OOM\n"); exit(2); }
+    return p;
+}
+
+static void counter_soa_reserve(counter_soa_t *s, size_t n) {
+    if (n <= s->cap) return;
+    size_t cap = s->cap ? s->cap : 4096;
+    while (cap < n) cap *= 2;
+    for (int k = 0; k < CTR_COUNT; k++) {
+        s->cur[k] = alloc_lanes(s->cur[k], cap, sizeof(uint64_t));
+        s->prev[k] = alloc_lanes(s->prev[k], cap, sizeof(uint64_t));
+        s->rate[k] = alloc_lanes(s->rate[k], cap, sizeof(double));
+    }
+    s->cap = cap;
+}
+
+static void counter_soa_free(counter_soa_t *s) {
+    for (int k = 0; k < CTR_COUNT; k++) { free(s->cur[k]); free(s->prev[k]); free(s->rate[k]); }
+    memset(s, 0, sizeof(*s));
+}
+
+// out[i] = (cur[i] - prev[i], or 0 if the counter went backwards) * mul / div
+typedef void (*delta_kernel_fn)(const uint64_t *cur, const uint64_t *prev, double *out, size_t n, double mul, double div);
+
+static void delta_rate_scalar(const uint64_t *cur, const uint64_t *prev, double *out, size_t n, double mul, double div) {
+    for (size_t i = 0; i < n; i++) {
+        uint64_t d = (cur[i] >= prev[i]) ? cur[i] - prev[i] : 0;
+        out[i] = ((double)d * mul) / div;
+    }
+}
+
+#if defined(__x86_64__)
+// Saturating a - b: the borrow out of the top bit is (~a & b) | (~(a ^ b) & d)
+static inline __m128i sat_sub_u64_sse2(__m128i a, __m128i b) {
+    __m128i d = _mm_sub_epi64(a, b);
+    __m128i borrow = _mm_or_si128(_mm_andnot_si128(a, b), _mm_andnot_si128(_mm_xor_si128(a, b), d));
+    __m128i mask = _mm_sub_epi64(_mm_setzero_si128(), _mm_srli_epi64(borrow, 63));
+    return _mm_andnot_si128(mask, d);
+}
+
+// hi * 2^32 and lo are each exact in a double; their sum rounds once, which
+// is what a scalar unsigned conversion does
+static inline __m128d u64_to_f64_sse2(__m128i x) {
+    __m128i lo = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi64x(0xFFFFFFFFLL)), _mm_set1_epi64x(0x4330000000000000LL));
+    __m128i hi = _mm_or_si128(_mm_srli_epi64(x, 32), _mm_set1_epi64x(0x4530000000000000LL));
+    __m128d h = _mm_sub_pd(_mm_castsi128_pd(hi), _mm_set1_pd(0x1.00000001p84));  // 2^84 + 2^52
+    return _mm_add_pd(h, _mm_castsi128_pd(lo));
+}
+
+static void delta_rate_sse2(const uint64_t *cur, const uint64_t *prev, double *out, size_t n, double mul, double div) {
+    const __m128d vmul = _mm_set1_pd(mul), vdiv = _mm_set1_pd(div);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i d = sat_sub_u64_sse2(_mm_load_si128((const __m128i *)(cur + i)), _mm_load_si128((const __m128i *)(prev + i)));
+        _mm_store_pd(out + i, _mm_div_pd(_mm_mul_pd(u64_to_f64_sse2(d), vmul), vdiv));
+    }
+    delta_rate_scalar(cur + i, prev + i, out + i, n - i, mul, div);
+}
+
+__attribute__((target("avx2")))
+static void delta_rate_avx2(const uint64_t *cur, const uint64_t *prev, double *out, size_t n, double mul, double div) {
+    const __m256d vmul = _mm256_set1_pd(mul), vdiv = _mm256_set1_pd(div);
+    const __m256i lo_mask = _mm256_set1_epi64x(0xFFFFFFFFLL);
+    const __m256i lo_bias = _mm256_set1_epi64x(0x4330000000000000LL);
+    const __m256i hi_bias = _mm256_set1_epi64x(0x4530000000000000LL);
+    const __m256d hi_sub = _mm256_set1_pd(0x1.00000001p84);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_load_si256((const __m256i *)(cur + i));
+        __m256i b = _mm256_load_si256((const __m256i *)(prev + i));
+        __m256i d = _mm256_sub_epi64(a, b);
+        __m256i borrow = _mm256_or_si256(_mm256_andnot_si256(a, b), _mm256_andnot_si256(_mm256_xor_si256(a, b), d));
+        d = _mm256_andnot_si256(_mm256_sub_epi64(_mm256_setzero_si256(), _mm256_srli_epi64(borrow, 63)), d);
+
+        __m256i lo = _mm256_or_si256(_mm256_and_si256(d, lo_mask), lo_bias);
+        __m256i hi = _mm256_or_si256(_mm256_srli_epi64(d, 32), hi_bias);
+        __m256d v = _mm256_add_pd(_mm256_sub_pd(_mm256_castsi256_pd(hi), hi_sub), _mm256_castsi256_pd(lo));
+        _mm256_store_pd(out + i, _mm256_div_pd(_mm256_mul_pd(v, vmul), vdiv));
+    }
+    delta_rate_scalar(cur + i, prev + i, out + i, n - i, mul, div);
+}
+#endif
+
+static delta_kernel_fn delta_rate = delta_rate_scalar;
+static const char *delta_kernel_name = "scalar";
+
+static void delta_kernel_init(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) { delta_rate = delta_rate_avx2; delta_kernel_name = "avx2"; }
+    else { delta_rate = delta_rate_sse2; delta_kernel_name = "sse2"; }
+#endif
+}
+
+#ifdef DEBUG
+// The vector kernels must agree with the scalar loop to the bit, including
+// counters that went backwards, differences that do not fit a double's
+// mantissa, and the scalar tail for every length up to one AVX2 block past
+// the first. Lanes past n must be left alone.
+static void delta_selftest(void) {
+#if defined(__x86_64__)
+    static const uint64_t edge[] = { 0, 1, 2, 0xFFFFFFFFull, 0x100000000ull, (1ull << 52) + 1, 1ull << 53,
+                                     (1ull << 53) + 1, (1ull << 53) + 3, 1ull << 63, (1ull << 63) + 1,
+                                     UINT64_MAX - 1, UINT64_MAX };
+    enum { N_EDGE = sizeof(edge) / sizeof(edge[0]), N_RAND = 64, N = N_EDGE * N_EDGE + N_RAND };
+    static uint64_t cur[N] __attribute__((aligned(32))), prev[N] __attribute__((aligned(32)));
+    static double want[N + 1], got[N + 1] __attribute__((aligned(32)));
+    // Rates as counter_soa_rates() computes them: CPU% at dt = 1.5 s and
+    // HZ = 100, I/O wait ms, faults per second over dt = 0.7 s and 1 ms
+    static const double scale[][2] = { { 100.0, 150.0 }, { 1000.0, 100.0 }, { 1.0, 0.7 }, { 1.0, 1e-3 } };
+
+    // Every ordered pair of edge values, then random counters a small
+    // distance apart in either direction
+    size_t at = 0;
+    for (int a = 0; a < N_EDGE; a++)
+        for (int b = 0; b < N_EDGE; b++) { cur[at] = edge[a]; prev[at] = edge[b]; at++; }
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    for (int i = 0; i < N_RAND; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        cur[at] = x;
+        prev[at] = x - (x >> (x % 64)) + (i & 1 ? 0 : x % 1000);
+        at++;
+    }
+
+    __builtin_cpu_init();
+    const struct { const char *name; delta_kernel_fn fn; int ok; } kernels[] = {
+        { "sse2", delta_rate_sse2, 1 },
+        { "avx2", delta_rate_avx2, __builtin_cpu_supports("avx2") },
+    };
+    const size_t lens[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, N };
+    unsigned long bad = 0, cases = 0;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!kernels[k].ok) continue;
+        for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+            for (size_t m = 0; m < sizeof(scale) / sizeof(scale[0]); m++) {
+                size_t n = lens[l];
+                memset(want, 0xA5, sizeof(want));
+                memset(got, 0xA5, sizeof(got));
+                delta_rate_scalar(cur, prev, want, n, scale[m][0], scale[m][1]);
+                kernels[k].fn(cur, prev, got, n, scale[m][0], scale[m][1]);
+                cases++;
+                if (memcmp(want, got, (n + 1) * sizeof(double)) != 0 && bad++ < 5)
+                    fprintf(stderr, "DEBUG: %s delta kernel differs from scalar at n=%zu, x%g/%g\n",
+                            kernels[k].name, n, scale[m][0], scale[m][1]);
+            }
+        }
+    }
+    fprintf(stderr, "DEBUG: delta kernels %lu mismatches in %lu cases (%s)\n", bad, cases,
+            __builtin_cpu_supports("avx2") ? "sse2, avx2" : "sse2");
+#endif
+}
+#endif
+
+// Rates for the first n gathered threads: CPU%, I/O wait and fault rates
+static void counter_soa_rates(counter_soa_t *s, size_t n, double dt, long hz) {
+    delta_rate(s->cur[CTR_CPU], s->prev[CTR_CPU], s->rate[CTR_CPU], n, 100.0, dt * (double)hz);
+    delta_rate(s->cur[CTR_BLKIO], s->prev[CTR_BLKIO], s->rate[CTR_BLKIO], n, 1000.0, (double)hz);
+    delta_rate(s->cur[CTR_MINFLT], s->prev[CTR_MINFLT], s->rate[CTR_MINFLT], n, 1.0, dt);
+    delta_rate(s->cur[CTR_MAJFLT], s->prev[CTR_MAJFLT], s->rate[CTR_MAJFLT], n, 1.0, dt);
+}
+
+// Previous sample of the thread with `key`. Threads are enumerated in roughly
+// ascending TID order and prev is sorted by key, so the next entry after the
+// last hit is tried before falling back to a binary search.
+static const sample_t *find_prev_near(const vec_t *prev, size_t *cursor, uint64_t key) {
+    size_t j = *cursor;
+    if (j < prev->len && prev->data[j].key == key) { *cursor = j + 1; return &prev->data[j]; }
+    const sample_t *p = find_prev(prev, key);
+    if (p) *cursor = (size_t)(p - prev->data) + 1;
+    return p;
+}
+
+// --- Thread Index ---
+// CSR layout over the raw thread samples, rebuilt once per refresh: the
+// threads of tgid[i] are raw->data[rows[off[i]]] .. rows[off[i] + cnt[i] - 1].
+// Tree mode and phase-two fetching look up a process's threads in
+// O(log processes + threads) instead of scanning every task.
+typedef struct {
+    pid_t *tgid;
+    uint32_t *off;
+    uint32_t *cnt;
+    size_t n, cap;
+    uint32_t *rows;
+    uint32_t *owner;           // Scratch: process index of each raw row
+    size_t rows_cap;
+} thread_index_t;
+
+static void thread_index_free(thread_index_t *ix) {
+    free(ix->tgid); free(ix->off); free(ix->cnt); free(ix->rows); free(ix->owner);
+    memset(ix, 0, sizeof(*ix));
+}
+
+// `proc` must be sorted by TGID, as aggregate_by_tgid() leaves it
+static void thread_index_build(thread_index_t *ix, const vec_t *raw, const vec_t *proc) {
+    size_t n = proc->len;
+    if (n > ix->cap) {
+        ix->tgid = grow_array(ix->tgid, n, sizeof(*ix->tgid));
+        ix->off = grow_array(ix->off, n, sizeof(*ix->off));
+        ix->cnt = grow_array(ix->cnt, n, sizeof(*ix->cnt));
+        ix->cap = n;
+    }
+    if (raw->len > ix->rows_cap) {
+        ix->rows = grow_array(ix->rows, raw->len, sizeof(*ix->rows));
+        ix->owner = grow_array(ix->owner, raw->len, sizeof(*ix->owner));
+        ix->rows_cap = raw->len;
+    }
+    ix->n = n;
+    for (size_t i = 0; i < n; i++) { ix->tgid[i] = proc->data[i].tgid; ix->cnt[i] = 0; }
+
+    // Threads arrive grouped by process, so the lookup is almost always the
+    // same as for the previous row
+    uint32_t last = UINT32_MAX;
+    for (size_t r = 0; r < raw->len; r++) {
+        pid_t tgid = raw->data[r].tgid;
+        if (last == UINT32_MAX || ix->tgid[last] != tgid) {
+            size_t lo = 0, hi = n;
+            last = UINT32_MAX;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (ix->tgid[mid] == tgid) { last = (uint32_t)mid; break; }
+                if (ix->tgid[mid] < tgid) lo = mid + 1; else hi = mid;
+            }
+        }
+        ix->owner[r] = last;
+        if (last != UINT32_MAX) ix->cnt[last]++;
+    }
+
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++) { ix->off[i] = sum; sum += ix->cnt[i]; ix->cnt[i] = 0; }
+    for (size_t r = 0; r < raw->len; r++) {
+        uint32_t o = ix->owner[r];
+        if (o != UINT32_MAX) ix->rows[ix->off[o] + ix->cnt[o]++] = (uint32_t)r;
+    }
+}
+
+// Raw row indices of tgid's threads; *count is 0 if the process is unknown
+static const uint32_t *thread_index_find(const thread_index_t *ix, pid_t tgid, size_t *count) {
+    size_t lo = 0, hi = ix->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ix->tgid[mid] == tgid) { *count = ix->cnt[mid]; return ix->rows + ix->off[mid]; }
+        if (ix->tgid[mid] < tgid) lo = mid + 1; else hi = mid;
+    }
+    *count = 0;
+    return NULL;
+}
+
+// Phase two of a refresh: read the groups phase one skipped for one process
+// row about to be shown, and fold the new thread rates back into it. Rows
+// that already have everything are skipped, so this is cheap to call on
+// every redraw.
+static void fetch_row_details(vec_t *raw, const vec_t *prev, const thread_index_t *ix, sample_t *row, double now) {
+    const unsigned want = FETCH_IO | FETCH_MEM;
+
+    if ((row->fetched & want) == want) return;
+    if (!(row->fetched & FETCH_MEM)) read_statm(row->tgid, &row->mem_virt_pages, &row->mem_res_pages, &row->mem_shr_pages);
+    if (!(row->fetched & FETCH_IO)) row->r_iops = row->w_iops = row->r_mib = row->w_mib = 0;
+
+    size_t n;
+    const uint32_t *threads = thread_index_find(ix, row->tgid, &n);
+    for (size_t j = 0; j < n; j++) {
+        sample_t *t = &raw->data[threads[j]];
+        if (!(t->fetched & FETCH_MEM)) {
+            t->mem_virt_pages = row->mem_virt_pages;
+            t->mem_res_pages = row->mem_res_pages;
+            t->mem_shr_pages = row->mem_shr_pages;
+        }
+        if (!(t->fetched & FETCH_IO)) {
+            char io_path[PATH_MAX];
+            snprintf(io_path, sizeof(io_path), "/proc/%d/task/%d/io", t->tgid, t->pid);
+            if (read_io_file(io_path, &t->syscr, &t->syscw, &t->read_bytes, &t->write_bytes) == 0) t->io_time = now;
+            compute_io_rates(t, find_prev(prev, t->key));
+            row->r_iops += t->r_iops;
+            row->w_iops += t->w_iops;
+            row->r_mib += t->r_mib;
+            row->w_mib += t->w_mib;
+        }
+        t->fetched |= want;
+    }
+    row->fetched |= want;
+}
+
+// ...for the first k rows of the sorted process list
+static void fetch_details(vec_t *raw, const vec_t *prev, const thread_index_t *ix, vec_t *proc, size_t k, double now) {
+    if (k > proc->len) k = proc->len;
+    for (size_t i = 0; i < k; i++) fetch_row_details(raw, prev, ix, &proc->data[i], now);
+}
+
+// ...for the process rows on screen and the processes of the thread rows on
+// screen
+static void fetch_visible(vec_t *raw, const vec_t *prev, const thread_index_t *ix, const viewport_t *v, double now) {
+    for (int i = v->top; i < vp_end(v); i++) {
+        const vp_line_t *l = &v->lines[i];
+        fetch_row_details(raw, prev, ix, (sample_t *)v->lines[l->parent >= 0 ? l->parent : i].row, now);
+    }
+}
+
+// Tree view helper: the threads of the process on line `parent`
+static void list_threads_for_tgid(viewport_t *v, vec_t *raw, const thread_index_t *ix, pid_t tgid, int parent) {
+    size_t n;
+    const uint32_t *rows = thread_index_find(ix, tgid, &n);
+    for (size_t i = 0; i < n; i++) {
+        sample_t *s = &raw->data[rows[i]];
+        if (s->pid != tgid) vp_add(v, s, ROW_THREAD, parent, (uint64_t)s->pid);
+    }
+}
+
+// --- Process Tree ---
+// Parent/child hierarchy from the ppid field of stat. Every row carries the
+// totals of its whole subtree, so a supervisor shows what it and everything
+// below it costs; siblings are ordered by the active sort column.
+#define TREE_NONE UINT32_MAX
+#define TREE_MAX_DEPTH 32
+
+typedef struct {
+    pid_t tgid;
+    uint32_t idx;
+} tree_ref_t;
+
+typedef struct {
+    uint32_t node, child;      // Next child of node to descend into
+    uint32_t plen;             // Prefix length for node's children
+} tree_frame_t;
+
+typedef struct {
+    vec_t rows;                // Rolled-up copies of the process rows
+    tree_ref_t *by_tgid;
+    uint32_t *parent;
+    uint32_t *child_off, *child_cnt, *children;
+    uint32_t *order;           // Breadth-first order, roots first
+    size_t n_order;
+    tree_frame_t *stack;       // Listing walk, at most one frame per row
+    uint8_t *seen;
+    size_t cap;
+} proc_tree_t;
+
+static int cmp_tree_ref(const void *a, const void *b) {
+    const tree_ref_t *x = (const tree_ref_t *)a;
+    const tree_ref_t *y = (const tree_ref_t *)b;
+    return (x->tgid > y->tgid) - (x->tgid < y->tgid);
+}
+
+static void proc_tree_free(proc_tree_t *t) {
+    vec_free(&t->rows);
+    free(t->by_tgid); free(t->parent); free(t->child_off); free(t->child_cnt); free(t->children); free(t->order);
+    free(t->stack); free(t->seen);
+    memset(t, 0, sizeof(*t));
+}
+
+// (Re)derive parent links, child lists and a breadth-first order from the
+// current row order. Children are listed in row order, so sorting the rows
+// first sorts every sibling list.
+static void proc_tree_link(proc_tree_t *t) {
+    size_t n = t->rows.len;
+    for (size_t i = 0; i < n; i++) { t->by_tgid[i].tgid = t->rows.data[i].tgid; t->by_tgid[i].idx = (uint32_t)i; }
+    sort_rows(t->by_tgid, n, sizeof(tree_ref_t), cmp_tree_ref);
+
+    for (size_t i = 0; i < n; i++) {
+        const sample_t *s = &t->rows.data[i];
+        tree_ref_t key = { s->ppid, 0 };
+        const tree_ref_t *p = s->ppid != s->tgid ?
+            (const tree_ref_t *)bsearch(&key, t->by_tgid, n, sizeof(tree_ref_t), cmp_tree_ref) : NULL;
+        t->parent[i] = p ? p->idx : TREE_NONE;
+        t->child_cnt[i] = 0;
+    }
+    for (size_t i = 0; i < n; i++) if (t->parent[i] != TREE_NONE) t->child_cnt[t->parent[i]]++;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++) { t->child_off[i] = sum; sum += t->child_cnt[i]; t->child_cnt[i] = 0; }
+    for (size_t i = 0; i < n; i++) {
+        uint32_t p = t->parent[i];
+        if (p != TREE_NONE) t->children[t->child_off[p] + t->child_cnt[p]++] = (uint32_t)i;
+    }
+
+    t->n_order = 0;
+    for (size_t i = 0; i < n; i++) if (t->parent[i] == TREE_NONE) t->order[t->n_order++] = (uint32_t)i;
+    for (size_t q = 0; q < t->n_order; q++) {
+        uint32_t u = t->order[q];
+        for (uint32_t c = 0; c < t->child_cnt[u]; c++) t->order[t->n_order++] = t->children[t->child_off[u] + c];
+    }
+}
+
+static void proc_tree_build(proc_tree_t *t, const vec_t *proc, sort_col_t sort) {
+    size_t n = proc->len;
+    vec_clear(&t->rows);
+    vec_reserve(&t->rows, n);
+    if (n) memcpy(t->rows.data, proc->data, n * sizeof(sample_t));
+    t->rows.len = n;
+    if (n > t->cap) {
+        t->by_tgid = grow_array(t->by_tgid, n, sizeof(*t->by_tgid));
+        t->parent = grow_array(t->parent, n, sizeof(*t->parent));
+        t->child_off = grow_array(t->child_off, n, sizeof(*t->child_off));
+        t->child_cnt = grow_array(t->child_cnt, n, sizeof(*t->child_cnt));
+        t->children = grow_array(t->children, n, sizeof(*t->children));
+        t->order = grow_array(t->order, n, sizeof(*t->order));
+        t->stack = grow_array(t->stack, n, sizeof(*t->stack));
+        t->seen = grow_array(t->seen, n, sizeof(*t->seen));
+        t->cap = n;
+    }
+    proc_tree_link(t);
+
+    // Fold every summable column bottom-up: walking the breadth-first order
+    // backwards visits each child before its parent
+    for (size_t q = t->n_order; q-- > 0; ) {
+        uint32_t u = t->order[q];
+        if (t->parent[u] == TREE_NONE) continue;
+        char *dst = (char *)&t->rows.data[t->parent[u]];
+        const char *src = (const char *)&t->rows.data[u];
+        for (size_t c = 0; c < proc_table.n; c++) {
+            const column_t *col = &proc_table.cols[c];
+            if (!(col->flags & COLF_TOTAL)) continue;
+            if (col->kind == COL_F64) {
+                double a, b;
+                memcpy(&a, dst + col->off, sizeof(a)); memcpy(&b, src + col->off, sizeof(b));
+                a += b;
+                memcpy(dst + col->off, &a, sizeof(a));
+            } else if (col->kind == COL_U64) {
+                uint64_t a, b;
+                memcpy(&a, dst + col->off, sizeof(a)); memcpy(&b, src + col->off, sizeof(b));
+                a += b;
+                memcpy(dst + col->off, &a, sizeof(a));
+            }
+        }
+    }
+
+    table_sort(&proc_table, sort, t->rows.data, n);
+    proc_tree_link(t);
+}
+
+// The rows are this frame's copies, so the branch prefix is written into
+// their command lines in place. Returns the prefix length for the children.
+static size_t proc_tree_emit(proc_tree_t *t, uint32_t u, char *prefix, size_t plen, int last, int depth,
+                             viewport_t *v, const char *filter) {
+    sample_t *s = &t->rows.data[u];
+
+    int match = 1;
+    if (filter[0]) {
+        char pidbuf[32];
+        snprintf(pidbuf, sizeof(pidbuf), "%d", s->tgid);
+        match = strcasestr(s->cmd, filter) || strcasestr(pidbuf, filter) || strcasestr(s->user, filter);
+    }
+    if (match) {
+        char cmd[sizeof(s->cmd)];
+        const char *branch = depth == 0 ? "" : (last ? "└─ " : "├─ ");
+        size_t bl = strlen(branch);
+        memcpy(cmd, prefix, plen);
+        memcpy(cmd + plen, branch, bl);
+        size_t cl = strnlen(s->cmd, sizeof(cmd) - 1 - plen - bl);
+        memcpy(cmd + plen + bl, s->cmd, cl);
+        cmd[plen + bl + cl] = '\0';
+        memcpy(s->cmd, cmd, plen + bl + cl + 1);
+        vp_add(v, s, 0, -1, (uint64_t)s->tgid);
+    }
+
+    // Deep chains are flattened rather than indented off the screen
+    if (depth > 0 && depth < TREE_MAX_DEPTH) {
+        const char *seg = last ? "   " : "│  ";
+        size_t sl = strlen(seg);
+        memcpy(prefix + plen, seg, sl);
+        return plen + sl;
+    }
+    return plen;
+}
+
+// Depth-first from `root` with an explicit stack, so a chain of thousands of
+// processes costs no call depth. Each row is listed at most once.
+static void proc_tree_list_from(proc_tree_t *t, uint32_t root, char *prefix, viewport_t *v, const char *filter) {
+    size_t sp = 0;
+    t->seen[root] = 1;
+    t->stack[sp++] = (tree_frame_t){ root, 0, (uint32_t)proc_tree_emit(t, root, prefix, 0, 1, 0, v, filter) };
+    while (sp) {
+        tree_frame_t *f = &t->stack[sp - 1];
+        if (f->child == t->child_cnt[f->node]) { sp--; continue; }
+        uint32_t u = t->children[t->child_off[f->node] + f->child++];
+        if (t->seen[u]) continue;
+        t->seen[u] = 1;
+        size_t next = proc_tree_emit(t, u, prefix, f->plen, f->child == t->child_cnt[f->node], (int)sp, v, filter);
+        t->stack[sp++] = (tree_frame_t){ u, 0, (uint32_t)next };
+    }
+}
+
+static void proc_tree_list(proc_tree_t *t, viewport_t *v, const char *filter) {
+    char prefix[TREE_MAX_DEPTH * 5 + 1];  // "│  " is five bytes
+    size_t n = t->rows.len;
+    if (n) memset(t->seen, 0, n);
+    for (size_t q = 0; q < t->n_order; q++) {
+        uint32_t u = t->order[q];
+        if (t->parent[u] != TREE_NONE) break;  // Roots come first in the order
+        proc_tree_list_from(t, u, prefix, v, filter);
+    }
+    // Processes whose ppid chain loops back on itself have no root; list
+    // each such loop from its first member rather than dropping it
+    for (size_t i = 0; i < n; i++)
+        if (!t->seen[i]) proc_tree_list_from(t, (uint32_t)i, prefix, v, filter);
+}
+
+// --- Group By ---
+// The process view can fold tasks by user, cgroup slice, VMID, command name
+// or state instead of by process. One pass over the thread samples, process
+// by process through the thread index, adds every task into an open-addressing
+// hash table keyed by the group label. Process-wide labels are worked out once
+// per process and the cgroup of a process is read only when it first shows
+// up; the table, the group rows and that cache keep their memory across
+// refreshes. Enter on a group lists its members (processes, or threads for
+// comm and state), Esc goes back.
+typedef enum { GROUP_OFF, GROUP_USER, GROUP_CGROUP, GROUP_VMID, GROUP_COMM, GROUP_STATE, GROUP_COUNT } group_by_t;
+static const char *const group_names[GROUP_COUNT] = { "off", "user", "cgroup", "vmid", "comm", "state" };
+
+typedef struct {
+    int procs, threads;
+    int running, blocked;      // Threads in R and D
+    uint64_t mem_res_pages;    // Once per process, in the group of its leader
+    double cpu_pct, r_iops, w_iops, io_wait_ms, r_mib, w_mib;
+    pid_t last_tgid;           // Processes are counted when their first thread arrives
+    uint64_t hash;
+    char label[64];
+} group_row_t;
+
+typedef struct {
+    pid_t tgid;
+    char label[64];
+} group_cg_t;
+
+typedef struct {
+    group_by_t by;
+    group_row_t *rows;         // Sorted for display after group_collect()
+    size_t n, cap;
+    uint32_t *slots;           // Row index + 1, 0 = free; power-of-two size
+    size_t n_slots;
+    group_cg_t *cg[2];         // cgroup of each process, sorted by TGID
+    size_t cg_n[2], cg_cap[2];
+    int cg_cur;
+    char drill[64];            // Group listed member by member, "" for the group list
+    vec_t members;
+} group_t;
+
+static const column_t group_columns[] = {
+    { "Procs", NULL, 7, 0, 0, COL_INT, offsetof(group_row_t, procs), 1, NULL, NULL, SORT_GRP_PROCS, 0, 0, HL_NONE },
+    { "Threads", NULL, 8, 0, COLF_TOTAL, COL_INT, offsetof(group_row_t, threads), 1, NULL, NULL, SORT_GRP_THREADS, 0, 0, HL_NONE },
+    { "Res(MiB)", "Res_MiB", 10, 0, COLF_TOTAL, COL_U64, offsetof(group_row_t, mem_res_pages), PAGES_MIB, NULL, NULL, SORT_GRP_RES, 0, 0, HL_NONE },
+    { "R_Log", NULL, 10, 0, COLF_TOTAL, COL_F64, offsetof(group_row_t, r_iops), 1, NULL, NULL, SORT_GRP_LOG_R, 3, 0, HL_NONE },
+    { "W_Log", NULL, 10, 0, COLF_TOTAL, COL_F64, offsetof(group_row_t, w_iops), 1, NULL, NULL, SORT_GRP_LOG_W, 4, 0, HL_NONE },
+    { "Wait", "Wait_ms", 8, 2, COLF_TOTAL, COL_F64, offsetof(group_row_t, io_wait_ms), 1, NULL, NULL, SORT_GRP_WAIT, 5, 0, HL_WAIT },
+    { "R_MiB", NULL, 10, 2, COLF_TOTAL, COL_F64, offsetof(group_row_t, r_mib), 1, NULL, NULL, SORT_GRP_RMIB, 6, 0, HL_NONE },
+    { "W_MiB", NULL, 10, 2, COLF_TOTAL, COL_F64, offsetof(group_row_t, w_mib), 1, NULL, NULL, SORT_GRP_WMIB, 7, 0, HL_NONE },
+    { "CPU", "CPU_pct", 8, 2, COLF_TOTAL, COL_F64, offsetof(group_row_t, cpu_pct), 1, NULL, NULL, SORT_GRP_CPU, 2, 0, HL_CPU },
+    { "Run", "Running", 5, 0, COLF_TOTAL, COL_INT, offsetof(group_row_t, running), 1, NULL, NULL, SORT_GRP_RUN, 0, 0, HL_NONE },
+    { "D", "Blocked", 5, 0, COLF_TOTAL, COL_INT, offsetof(group_row_t, blocked), 1, NULL, NULL, SORT_GRP_BLOCKED, 8, 0, HL_NONE },
+    { "GROUP", "Group", 0, 0, COLF_LEFT | COLF_FILL | COLF_QUOTE, COL_STR, offsetof(group_row_t, label), 1, NULL, NULL, SORT_GRP_LABEL, 1, 0, HL_NONE },
+};
+static const table_t group_table = TABLE(group_columns, group_row_t);
+
+// Index into group_names, GROUP_OFF for "", -1 for an unknown key
+static int group_parse(const char *name) {
+    if (!name[0]) return GROUP_OFF;
+    for (int i = 0; i < GROUP_COUNT; i++) if (strcmp(name, group_names[i]) == 0) return i;
+    return -1;
+}
+
+// comm and state are per thread; the other keys are the same for every
+// thread of a process
+static int group_per_thread(group_by_t by) {
+    return by == GROUP_COMM || by == GROUP_STATE;
+}
+
+// "/user.slice/user-1000.slice/session-3.scope" -> "/user.slice/user-1000.slice":
+// the path up to its innermost slice, or the whole path outside of slices
+static void group_read_cgroup(pid_t tgid, char out[64]) {
+    char path[64], buf[4096];
+    ssize_t n = 0;
+    snprintf(out, 64, "?");
+    snprintf(path, sizeof(path), "/proc/%d/cgroup", tgid);
+    if (read_small_file(path, buf, sizeof(buf), &n) != 0) return;
+    // The unified hierarchy, or systemd's own on pure v1 hosts
+    const char *line = NULL;
+    for (const char *p = buf; *p; p = next_line(p)) {
+        if (strncmp(p, "0::", 3) == 0) { line = p + 3; break; }
+        const char *s = strstr(p, ":name=systemd:");
+        if (s && s < next_line(p)) line = s + 14;
+    }
+    if (!line) return;
+    size_t len = strcspn(line, "\n"), cut = len;
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] != '/' && i + 1 != len) continue;
+        size_t end = line[i] == '/' ? i : len;
+        if (end >= 6 && strncmp(line + end - 6, ".slice", 6) == 0) cut = end;
+    }
+    if (cut == 0) cut = 1;     // The root cgroup, "/"
+    snprintf(out, 64, "%.*s", (int)cut, line);
+}
+
+// cgroup of tgid, from the previous refresh's cache where possible. Called
+// in ascending TGID order, so the old cache is walked with a cursor.
+static const char *group_cgroup(group_t *g, pid_t tgid, size_t *cursor) {
+    const group_cg_t *old = g->cg[g->cg_cur];
+    size_t n_old = g->cg_n[g->cg_cur];
+    int nxt = g->cg_cur ^ 1;
+    while (*cursor < n_old && old[*cursor].tgid < tgid) (*cursor)++;
+    if (g->cg_n[nxt] == g->cg_cap[nxt]) {
+        g->cg_cap[nxt] = g->cg_cap[nxt] ? g->cg_cap[nxt] * 2 : 1024;
+        g->cg[nxt] = grow_array(g->cg[nxt], g->cg_cap[nxt], sizeof(group_cg_t));
+    }
+    group_cg_t *e = &g->cg[nxt][g->cg_n[nxt]++];
+    if (*cursor < n_old && old[*cursor].tgid == tgid) {
+        *e = old[*cursor];
+    } else {
+        e->tgid = tgid;
+        group_read_cgroup(tgid, e->label);
+    }
+    return e->label;
+}
+
+// The group label of one task. `owner` is the first thread of the process,
+// whose command line also stands for a vhost worker's QEMU process.
+static void group_label(group_t *g, const sample_t *s, const vec_t *raw, const thread_index_t *ix,
+                        size_t *cursor, char out[64]) {
+    switch (g->by) {
+        case GROUP_USER:
+            snprintf(out, 64, "%s", s->user);
+            break;
+        case GROUP_CGROUP:
+            snprintf(out, 64, "%s", group_cgroup(g, s->tgid, cursor));
+            break;
+        case GROUP_VMID: {
+            int vmid = cmd_vmid(s->cmd);
+            // vhost-<pid> kernel threads move packets for the QEMU process <pid>
+            if (vmid <= 0 && strncmp(s->comm, "vhost-", 6) == 0 && isdigit((unsigned char)s->comm[6])) {
+                size_t n;
+                const uint32_t *rows = thread_index_find(ix, (pid_t)atoi(s->comm + 6), &n);
+                if (n) vmid = cmd_vmid(raw->data[rows[0]].cmd);
+            }
+            if (vmid > 0) snprintf(out, 64, "%d", vmid); else snprintf(out, 64, "host");
+            break;
+        }
+        case GROUP_COMM: {
+            // Runs of digits fold, so "CPU 0/KVM".."CPU 63/KVM" are one group
+            size_t o = 0;
+            for (const char *c = s->comm; *c && o + 1 < 64; c++) {
+                if (!isdigit((unsigned char)*c)) out[o++] = *c;
+                else if (o == 0 || out[o - 1] != '#') out[o++] = '#';
+            }
+            out[o] = '\0';
+            break;
+        }
+        case GROUP_STATE:
+            out[0] = s->state ? s->state : '?';
+            out[1] = '\0';
+            break;
+        default:
+            out[0] = '\0';
+    }
+}
+
+static group_row_t *group_find(group_t *g, const char *label) {
+    uint64_t h = vp_key_str(label);
+    size_t mask = g->n_slots - 1;
+    for (size_t i = (size_t)h & mask;; i = (i + 1) & mask) {
+        uint32_t slot = g->slots[i];
+        if (!slot) {
+            if (g->n == g->cap) {
+                g->cap = g->cap ? g->cap * 2 : 64;
+                g->rows = grow_array(g->rows, g->cap, sizeof(group_row_t));
+            }
+            group_row_t *r = &g->rows[g->n];
+            memset(r, 0, sizeof(*r));
+            r->hash = h;
+            r->last_tgid = -1;
+            snprintf(r->label, sizeof(r->label), "%s", label);
+            g->slots[i] = (uint32_t)++g->n;
+            return r;
+        }
+        group_row_t *r = &g->rows[slot - 1];
+        if (r->hash == h && strcmp(r->label, label) == 0) return r;
+    }
+}
+
+// Keep the table at most half full
+static void group_rehash(group_t *g) {
+    size_t want = 64;
+    while (want < g->n * 2 + 2) want *= 2;
+    if (want > g->n_slots) {
+        g->n_slots = want;
+        g->slots = grow_array(g->slots, want, sizeof(uint32_t));
+    }
+    memset(g->slots, 0, g->n_slots * sizeof(uint32_t));
+    size_t mask = g->n_slots - 1;
+    for (size_t r = 0; r < g->n; r++) {
+        size_t i = (size_t)g->rows[r].hash & mask;
+        while (g->slots[i]) i = (i + 1) & mask;
+        g->slots[i] = (uint32_t)(r + 1);
+    }
+}
+
+// Fold every thread into its group. The index must be built from raw.
+static void group_collect(group_t *g, const vec_t *raw, const thread_index_t *ix) {
+    g->n = 0;
+    g->cg_n[g->cg_cur ^ 1] = 0;
+    group_rehash(g);
+    if (g->by == GROUP_OFF) return;
+    int per_thread = group_per_thread(g->by);
+    size_t cursor = 0;
+    char label[64];
+    for (size_t p = 0; p < ix->n; p++) {
+        const uint32_t *rows = ix->rows + ix->off[p];
+        size_t n = ix->cnt[p];
+        if (!n) continue;
+        group_row_t *r = NULL;
+        if (!per_thread) {
+            group_label(g, &raw->data[rows[0]], raw, ix, &cursor, label);
+            r = group_find(g, label);
+            r->mem_res_pages += raw->data[rows[0]].mem_res_pages;
+        }
+        for (size_t j = 0; j < n; j++) {
+            const sample_t *s = &raw->data[rows[j]];
+            if (per_thread) {
+                group_label(g, s, raw, ix, &cursor, label);
+                r = group_find(g, label);
+                if (s->pid == s->tgid) r->mem_res_pages += s->mem_res_pages;
+            }
+            if (r->last_tgid != s->tgid) { r->last_tgid = s->tgid; r->procs++; }
+            r->threads++;
+            r->running += s->state == 'R';
+            r->blocked += s->state == 'D';
+            r->cpu_pct += s->cpu_pct;
+            r->r_iops += s->r_iops;
+            r->w_iops += s->w_iops;
+            r->io_wait_ms += s->io_wait_ms;
+            r->r_mib += s->r_mib;
+            r->w_mib += s->w_mib;
+            if (g->n * 2 + 2 > g->n_slots) group_rehash(g);
+        }
+    }
+    if (g->by == GROUP_CGROUP) g->cg_cur ^= 1;
+}
+
+// Members of the drilled-into group: process rows, or thread rows for the
+// per-thread keys, copied so they can be sorted like the process list
+static void group_members(group_t *g, const vec_t *proc, const vec_t *raw, const thread_index_t *ix) {
+    vec_clear(&g->members);
+    int per_thread = group_per_thread(g->by);
+    const vec_t *src = per_thread ? raw : proc;
+    char label[64];
+    for (size_t i = 0; i < src->len; i++) {
+        const sample_t *s = &src->data[i];
+        if (g->by == GROUP_CGROUP) {
+            // The cache is sorted by TGID; the rows here are not
+            const group_cg_t *c = g->cg[g->cg_cur];
+            size_t lo = 0, hi = g->cg_n[g->cg_cur];
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (c[mid].tgid < s->tgid) lo = mid + 1; else hi = mid;
+            }
+            if (lo == g->cg_n[g->cg_cur] || c[lo].tgid != s->tgid || strcmp(c[lo].label, g->drill) != 0) continue;
+        } else {
+            size_t cursor = 0;
+            group_label(g, s, raw, ix, &cursor, label);
+            if (strcmp(label, g->drill) != 0) continue;
+        }
+        vec_push(&g->members, s);
+    }
+}
+
+static void group_free(group_t *g) {
+    free(g->rows);
+    free(g->slots);
+    free(g->cg[0]);
+    free(g->cg[1]);
+    vec_free(&g->members);
+    memset(g, 0, sizeof(*g));
+}
+
+// --- Task Actions ---
+// Changes made to the selected row from the keyboard: nice, I/O priority
+// class and CPU affinity, and pinning the vCPU threads of a VM one to one onto
+// a list of CPUs. A process row acts on every thread of the process, a thread
+// row (tree mode) on that thread only. The task list is read from /proc when
+// the action runs, so threads started since the last refresh are included.
+// Each confirmed action is appended to the audit log, failed or not; when the
+// log cannot be written nothing is changed.
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+typedef enum { ACT_NICE, ACT_IOPRIO, ACT_AFFINITY, ACT_PIN_VCPUS } action_kind_t;
+
+static const char *const action_names[] = { "nice", "ioprio", "affinity", "pin-vcpus" };
+static const char *const ioprio_names[] = { "none", "rt", "be", "idle" };
+
+typedef struct {
+    action_kind_t kind;
+    pid_t tgid;
+    pid_t tid;                 // 0: every thread of tgid
+    int vmid;
+    char comm[16];
+    char arg[32];              // As typed
+    int nice;
+    int io_class, io_level;
+    cpu_set_t cpus;
+    int cpu_order[CPU_SETSIZE];  // The list in the order given, for pinning
+    int n_cpus;
+} task_action_t;
+
+// "0-3,8" -> set and list; -1 when malformed or empty
+static int cpu_list_parse(const char *s, cpu_set_t *set, int *order, int max) {
+    int n = 0;
+    CPU_ZERO(set);
+    while (*s) {
+        char *end;
+        long a = strtol(s, &end, 10), b = a;
+        if (end == s || a < 0) return -1;
+        s = end;
+        if (*s == '-') {
+            b = strtol(s + 1, &end, 10);
+            if (end == s + 1 || b < a) return -1;
+            s = end;
+        }
+        if (b >= CPU_SETSIZE) return -1;
+        for (long c = a; c <= b; c++) {
+            if (CPU_ISSET((int)c, set)) continue;
+            CPU_SET((int)c, set);
+            if (n < max) order[n++] = (int)c;
+        }
+        if (*s == ',') s++;
+        else if (*s) return -1;
+    }
+    return n ? n : -1;
+}
+
+static void cpu_set_format(const cpu_set_t *set, char *buf, size_t len) {
+    size_t o = 0;
+    buf[0] = '\0';
+    for (int c = 0; c < CPU_SETSIZE && o + 16 < len; c++) {
+        if (!CPU_ISSET(c, set)) continue;
+        int e = c;
+        while (e + 1 < CPU_SETSIZE && CPU_ISSET(e + 1, set)) e++;
+        o += (size_t)snprintf(buf + o, len - o, e > c + 1 ? "%s%d-%d" : e > c ? "%s%d,%d" : "%s%d", o ? "," : "", c, e);
+        c = e;
+    }
+}
+
+// Validate what was typed for a->kind; err gets the reason
+static int action_parse(task_action_t *a, const char *arg, char *err, size_t errlen) {
+    snprintf(a->arg, sizeof(a->arg), "%s", arg);
+    if (a->kind == ACT_NICE) {
+        char *end;
+        long v = strtol(arg, &end, 10);
+        if (end == arg || *end || v < -20 || v > 19) { snprintf(err, errlen, "nice must be -20..19"); return -1; }
+        a->nice = (int)v;
+        return 0;
+    }
+    if (a->kind == ACT_IOPRIO) {
+        // rt[/0-7], be[/0-7] or idle; the level defaults to 4 as with ionice
+        a->io_level = 4;
+        const char *slash = strchr(arg, '/');
+        size_t cl = slash ? (size_t)(slash - arg) : strlen(arg);
+        a->io_class = 0;
+        for (int c = 1; c <= 3; c++) if (strlen(ioprio_names[c]) == cl && strncmp(arg, ioprio_names[c], cl) == 0) a->io_class = c;
+        if (slash && (slash[1] < '0' || slash[1] > '7' || slash[2])) a->io_class = 0;
+        if (slash && a->io_class != 3) a->io_level = slash[1] - '0';
+        if (!a->io_class) { snprintf(err, errlen, "use rt[/0-7], be[/0-7] or idle"); return -1; }
+        if (a->io_class == 3) a->io_level = 0;
+        return 0;
+    }
+    a->n_cpus = cpu_list_parse(arg, &a->cpus, a->cpu_order, CPU_SETSIZE);
+    if (a->n_cpus < 0) { snprintf(err, errlen, "bad CPU list, e.g. 0-3,8"); return -1; }
+    return 0;
+}
+
+static void action_value(const task_action_t *a, pid_t tid, char *buf, size_t len) {
+    if (a->kind == ACT_NICE) {
+        errno = 0;
+        int v = getpriority(PRIO_PROCESS, (id_t)tid);
+        if (errno) snprintf(buf, len, "?"); else snprintf(buf, len, "%d", v);
+    } else if (a->kind == ACT_IOPRIO) {
+        long v = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid);
+        if (v < 0) snprintf(buf, len, "?");
+        else snprintf(buf, len, "%s/%ld", ioprio_names[(v >> IOPRIO_CLASS_SHIFT) & 3], v & 7);
+    } else {
+        cpu_set_t set;
+        if (sched_getaffinity(tid, sizeof(set), &set) != 0) snprintf(buf, len, "?");
+        else cpu_set_format(&set, buf, len);
+    }
+}
+
+// Prompt line for the confirmation
+static void action_describe(const task_action_t *a, char *buf, size_t len) {
+    char who[64];
+    if (a->tid) snprintf(who, sizeof(who), "thread %d (%s) of %d", a->tid, a->comm, a->tgid);
+    else snprintf(who, sizeof(who), "all threads of %d (%s)", a->tgid, a->comm);
+    switch (a->kind) {
+        case ACT_NICE: snprintf(buf, len, "Set nice %d on %s?", a->nice, who); break;
+        case ACT_IOPRIO: snprintf(buf, len, "Set I/O class %s/%d on %s?", ioprio_names[a->io_class], a->io_level, who); break;
+        case ACT_AFFINITY: snprintf(buf, len, "Limit %s to CPUs %s?", who, a->arg); break;
+        case ACT_PIN_VCPUS: snprintf(buf, len, "Pin the vCPUs of VM %d (pid %d) 1:1 to CPUs %s?", a->vmid, a->tgid, a->arg); break;
+    }
+}
+
+static void audit_default_path(void) {
+    if (audit_log[0]) return;
+    const char *home = getenv("HOME");
+    if (geteuid() == 0 || !home) snprintf(audit_log, sizeof(audit_log), "/var/log/kvmtop-audit.log");
+    else snprintf(audit_log, sizeof(audit_log), "%s/.kvmtop-audit.log", home);
+}
+
+// A process names itself, so its comm may hold quotes, newlines or other
+// control bytes. Those, bytes over 0x7e and backslashes are written as \xHH
+// to keep every action on one line with its fields intact.
+static void audit_escape(char *out, size_t size, const char *in) {
+    size_t o = 0;
+    for (; *in && o + 5 < size; in++) {
+        unsigned char c = (unsigned char)*in;
+        if (c < 0x20 || c > 0x7e || c == '"' || c == '\\') o += (size_t)snprintf(out + o, size - o, "\\x%02x", c);
+        else out[o++] = (char)c;
+    }
+    out[o] = '\0';
+}
+
+// Run a confirmed action and log it; result gets a one-line summary
+static void action_run(const task_action_t *a, char *result, size_t len) {
+    int fd = open(audit_log, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) { snprintf(result, len, "audit log %.60s: %s, nothing changed", audit_log, strerror(errno)); return; }
+
+    pid_t *tids = NULL;
+    size_t n = 0, cap = 0;
+    if (a->tid && a->kind != ACT_PIN_VCPUS) {
+        tids = grow_array(NULL, 1, sizeof(pid_t));
+        tids[n++] = a->tid;
+    } else {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task", a->tgid);
+        DIR *d = opendir(path);
+        struct dirent *de;
+        while (d && (de = readdir(d))) {
+            if (!is_numeric_str(de->d_name)) continue;
+            if (n == cap) { cap = cap ? cap * 2 : 64; tids = grow_array(tids, cap, sizeof(pid_t)); }
+            tids[n++] = (pid_t)atoi(de->d_name);
+        }
+        if (d) closedir(d);
+    }
+
+    char before[64] = "-";
+    int ok = 0, failed = 0, err = 0;
+    for (size_t i = 0; i < n; i++) {
+        int rc = 0;
+        if (a->kind == ACT_PIN_VCPUS) {
+            char path[64], comm[32];
+            ssize_t len_c = 0;
+            int vcpu;
+            snprintf(path, sizeof(path), "/proc/%d/task/%d/comm", a->tgid, tids[i]);
+            if (read_small_file(path, comm, sizeof(comm), &len_c) != 0 || sscanf(comm, "CPU %d/KVM", &vcpu) != 1) continue;
+            if (!ok && !failed) action_value(a, tids[i], before, sizeof(before));
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(a->cpu_order[vcpu % a->n_cpus], &one);
+            rc = sched_setaffinity(tids[i], sizeof(one), &one);
+        } else {
+            if (i == 0) action_value(a, tids[i], before, sizeof(before));
+            if (a->kind == ACT_NICE) rc = setpriority(PRIO_PROCESS, (id_t)tids[i], a->nice);
+            else if (a->kind == ACT_IOPRIO)
+                rc = (int)syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tids[i], (a->io_class << IOPRIO_CLASS_SHIFT) | a->io_level);
+            else rc = sched_setaffinity(tids[i], sizeof(a->cpus), &a->cpus);
+        }
+        if (rc == 0) ok++;
+        else { if (!failed) err = errno; failed++; }
+    }
+    free(tids);
+
+    if (!ok && !failed) snprintf(result, len, "%s: no %s found in pid %d", action_names[a->kind],
+                                 a->kind == ACT_PIN_VCPUS ? "vCPU threads" : "tasks", a->tgid);
+    else if (failed) snprintf(result, len, "%s %s: %d tasks changed, %d failed (%s)", action_names[a->kind], a->arg, ok, failed, strerror(err));
+    else snprintf(result, len, "%s %s: %d tasks changed", action_names[a->kind], a->arg, ok);
+
+    char stamp[32], line[512], comm[4 * sizeof(a->comm) + 1];
+    audit_escape(comm, sizeof(comm), a->comm);
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    int l = snprintf(line, sizeof(line), "%s uid=%d action=%s tgid=%d tid=%d comm=\"%s\" vmid=%d old=%s new=%s changed=%d failed=%d%s%s\n",
+                     stamp, (int)getuid(), action_names[a->kind], a->tgid, a->tid, comm, a->vmid, before, a->arg,
+                     ok, failed, failed ? " error=" : "", failed ? strerror(err) : "");
+    if (l > (int)sizeof(line) - 1) l = (int)sizeof(line) - 1;
+    if (write(fd, line, (size_t)l) != l) snprintf(result, len, "%s (audit write failed: %s)", action_names[a->kind], strerror(errno));
+    close(fd);
+}
+
+// --- Flight Recorder ---
+// Keeps the last few refreshes in memory so that when a trigger rule fires
+// the dump shows the lead-up to the event, not just its aftermath. Each rule
+// is checked against the process rows of every refresh; a rule fires when its
+// condition has held for `for` consecutive refreshes of the same process, and
+// fires again only after the condition has cleared. The dump holds the ring
+// plus the next `after` refreshes and is written by a short-lived thread so
+// that a refresh never waits for the disk.
+#define FLIGHT_MAX_RULES 8
+
+typedef enum { FM_CPU, FM_WAIT, FM_RIOPS, FM_WIOPS, FM_RMIB, FM_WMIB, FM_MINFLT, FM_MAJFLT, FM_STATE } flight_metric_t;
+
+static const struct { const char *name; flight_metric_t metric; size_t off; } flight_metrics[] = {
+    { "cpu", FM_CPU, offsetof(sample_t, cpu_pct) },
+    { "wait", FM_WAIT, offsetof(sample_t, io_wait_ms) },
+    { "riops", FM_RIOPS, offsetof(sample_t, r_iops) },
+    { "wiops", FM_WIOPS, offsetof(sample_t, w_iops) },
+    { "rmib", FM_RMIB, offsetof(sample_t, r_mib) },
+    { "wmib", FM_WMIB, offsetof(sample_t, w_mib) },
+    { "minflt", FM_MINFLT, offsetof(sample_t, minflt_ps) },
+    { "majflt", FM_MAJFLT, offsetof(sample_t, majflt_ps) },
+    { "state", FM_STATE, offsetof(sample_t, state) },
+};
+
+typedef struct {
+    char text[128];            // As given, for the dump header
+    flight_metric_t metric;
+    size_t off;
+    char op;                   // '>', '<', 'G' (>=), 'L' (<=), '='
+    double value;
+    char state;
+    int for_n;
+    char on[64];               // Command substring; empty for any process
+    pid_t on_pid;
+
+    // Processes whose condition currently holds, sorted by TGID, with the
+    // number of consecutive refreshes. Rebuilt each refresh from the last one.
+    pid_t *st_tgid[2];
+    int *st_cnt[2];
+    size_t st_n[2], st_cap[2];
+    int st_cur;
+} flight_rule_t;
+
+// One thread as the recorder remembers it; a fraction of a sample_t
+typedef struct {
+    pid_t pid, tgid;
+    char state;
+    float cpu_pct, io_wait_ms, r_iops, w_iops, r_mib, w_mib, majflt_ps;
+} flight_rec_t;
+
+typedef struct {
+    time_t wall;
+    double mono;
+    flight_rec_t *recs;
+    size_t n, cap;
+} flight_slot_t;
+
+typedef struct {
+    pid_t tid;
+    uint64_t cpu_jiffies, blkio_ticks, majflt;
+} flight_burst_prev_t;
+
+typedef struct {
+    flight_rule_t rules[FLIGHT_MAX_RULES];
+    int n_rules;
+    char dir[PATH_MAX];
+    int ring_n, after_n;
+    double burst;              // Seconds between burst samples; 0 = off
+
+    flight_slot_t *ring;
+    unsigned long seq;         // Refreshes recorded so far
+
+    // Incident being recorded
+    text_buf_t dump;
+    int post_left;             // Refreshes still to append; 0 = idle
+    pid_t hot_tgid;
+    double fired_mono;
+
+    // Burst sampling of the offending process while post_left > 0
+    double burst_next, burst_last;
+    flight_burst_prev_t *bp;
+    size_t bp_n, bp_cap;
+
+    int writing;               // A dump thread is running
+    unsigned long dumps, dropped;
+} flight_recorder_t;
+
+static flight_recorder_t flight;
+
+// "<metric><op><value> [for <n> [intervals]] [on <pid N|pattern>]"
+static int flight_parse_rule(flight_rule_t *r, const char *text) {
+    memset(r, 0, sizeof(*r));
+    snprintf(r->text, sizeof(r->text), "%s", text);
+    r->for_n = 1;
+
+    const char *p = text;
+    while (isspace((unsigned char)*p)) p++;
+    size_t mlen = 0;
+    while (isalpha((unsigned char)p[mlen])) mlen++;
+    size_t m;
+    for (m = 0; m < sizeof(flight_metrics) / sizeof(flight_metrics[0]); m++)
+        if (strlen(flight_metrics[m].name) == mlen && strncasecmp(p, flight_metrics[m].name, mlen) == 0) break;
+    if (m == sizeof(flight_metrics) / sizeof(flight_metrics[0])) return -1;
+    r->metric = flight_metrics[m].metric;
+    r->off = flight_metrics[m].off;
+    p += mlen;
+    while (isspace((unsigned char)*p)) p++;
+
+    if (p[0] == '>' && p[1] == '=') { r->op = 'G'; p += 2; }
+    else if (p[0] == '<' && p[1] == '=') { r->op = 'L'; p += 2; }
+    else if (p[0] == '=' && p[1] == '=') { r->op = '='; p += 2; }
+    else if (*p == '>' || *p == '<' || *p == '=') r->op = *p++;
+    else return -1;
+    while (isspace((unsigned char)*p)) p++;
+
+    if (r->metric == FM_STATE) {
+        if (r->op != '=' || !isalpha((unsigned char)*p)) return -1;
+        r->state = (char)toupper((unsigned char)*p++);
+    } else {
+        char *end;
+        r->value = strtod(p, &end);
+        if (end == p) return -1;
+        p = end;
+    }
+
+    char word[64];
+    int len;
+    while (sscanf(p, " %63s%n", word, &len) == 1) {
+        p += len;
+        if (strcasecmp(word, "for") == 0) {
+            if (sscanf(p, " %d%n", &r->for_n, &len) != 1 || r->for_n < 1) return -1;
+            p += len;
+            // Optional unit word
+            const char *q = p;
+            while (isspace((unsigned char)*q)) q++;
+            if (strncasecmp(q, "interval", 8) == 0) { p = q + 8; if (*p == 's') p++; }
+        } else if (strcasecmp(word, "on") == 0) {
+            if (sscanf(p, " %63s%n", word, &len) != 1) return -1;
+            p += len;
+            if (strcasecmp(word, "pid") == 0) {
+                if (sscanf(p, " %d%n", &r->on_pid, &len) != 1) return -1;
+                p += len;
+            } else {
+                snprintf(r->on, sizeof(r->on), "%s", word);
+            }
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int flight_cond(const flight_rule_t *r, const sample_t *s) {
+    if (r->metric == FM_STATE) return s->state == r->state;
+    double v;
+    memcpy(&v, (const char *)s + r->off, sizeof(v));
+    switch (r->op) {
+        case '>': return v > r->value;
+        case '<': return v < r->value;
+        case 'G': return v >= r->value;
+        case 'L': return v <= r->value;
+        default: return v == r->value;
+    }
+}
+
+static int flight_start(flight_recorder_t *f) {
+    if (f->n_rules == 0) return 0;
+    if (f->ring_n < 1) f->ring_n = 1;
+    f->ring = (flight_slot_t *)calloc((size_t)f->ring_n, sizeof(flight_slot_t));
+    if (!f->ring) { fprintf(stderr, "OOM\n"); exit(2); }
+    if (mkdir(f->dir, 0755) != 0 && errno != EEXIST) return -1;
+    return access(f->dir, W_OK);
+}
+
+static void flight_free(flight_recorder_t *f) {
+    // A running dump thread owns its buffer and frees it itself
+    for (int i = 0; f->ring && i < f->ring_n; i++) free(f->ring[i].recs);
+    free(f->ring);
+    for (int i = 0; i < f->n_rules; i++)
+        for (int k = 0; k < 2; k++) { free(f->rules[i].st_tgid[k]); free(f->rules[i].st_cnt[k]); }
+    free(f->dump.data);
+    free(f->bp);
+}
+
+static const char *proc_cmd(const vec_t *proc, pid_t tgid) {
+    sample_t key;
+    key.tgid = tgid;
+    const sample_t *s = (const sample_t *)bsearch(&key, proc->data, proc->len, sizeof(sample_t), cmp_tgid);
+    return s ? s->cmd : "";
+}
+
+// Threads of the offending process are always dumped; elsewhere only threads
+// that were doing or waiting for something, to keep dumps of big hosts small
+static void flight_append_slot(flight_recorder_t *f, const flight_slot_t *s, const char *kind, const vec_t *proc) {
+    struct tm tm_info;
+    localtime_r(&s->wall, &tm_info);
+    char stamp[40];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S%z", &tm_info);
+    for (size_t i = 0; i < s->n; i++) {
+        const flight_rec_t *r = &s->recs[i];
+        if (r->tgid != f->hot_tgid && r->cpu_pct <= 0 && r->io_wait_ms <= 0 && r->state != 'D' && r->state != 'R') continue;
+        tb_printf(&f->dump, "%s,%.3f,%s,%d,%d,%c,%.2f,%.0f,%.0f,%.0f,%.2f,%.2f,%.2f,",
+                  stamp, s->mono - f->fired_mono, kind, r->pid, r->tgid, r->state, r->cpu_pct, r->io_wait_ms,
+                  r->r_iops, r->w_iops, r->r_mib, r->w_mib, r->majflt_ps);
+        tb_json_str(&f->dump, proc_cmd(proc, r->tgid));
+        tb_putc(&f->dump, '\n');
+    }
+}
+
+static void *flight_write_main(void *arg) {
+    flight_recorder_t *f = &flight;
+    text_buf_t *b = (text_buf_t *)arg;
+    char path[PATH_MAX + 256], stamp[32];
+    time_t now = time(NULL);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_info);
+    int fd = -1;
+    for (int seq = 0; seq < 100 && fd < 0; seq++) {
+        if (seq == 0) snprintf(path, sizeof(path), "%s/kvmtop-flight-%s.csv", f->dir, stamp);
+        else snprintf(path, sizeof(path), "%s/kvmtop-flight-%s-%d.csv", f->dir, stamp, seq);
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0 && errno != EEXIST) break;
+    }
+    if (fd < 0 || log_write_all(fd, b->data, b->len) != 0) __atomic_add_fetch(&f->dropped, 1, __ATOMIC_RELAXED);
+    else __atomic_add_fetch(&f->dumps, 1, __ATOMIC_RELAXED);
+    if (fd >= 0) close(fd);
+    free(b->data);
+    free(b);
+    __atomic_store_n(&f->writing, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Hand the finished dump to a writer thread; the recorder starts a new buffer
+static void flight_finish(flight_recorder_t *f) {
+    f->post_left = 0;
+    f->burst_next = 0;
+    if (__atomic_load_n(&f->writing, __ATOMIC_ACQUIRE)) {
+        // The previous dump is still being written: count this one as lost
+        __atomic_add_fetch(&f->dropped, 1, __ATOMIC_RELAXED);
+        f->dump.len = 0;
+        return;
+    }
+    text_buf_t *b = (text_buf_t *)malloc(sizeof(*b));
+    if (!b) { fprintf(stderr, "OOM\n"); exit(2); }
+    *b = f->dump;
+    memset(&f->dump, 0, sizeof(f->dump));
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t th;
+    __atomic_store_n(&f->writing, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&th, &attr, flight_write_main, b) != 0) {
+        __atomic_store_n(&f->writing, 0, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&f->dropped, 1, __ATOMIC_RELAXED);
+        free(b->data);
+        free(b);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static void flight_fire(flight_recorder_t *f, const flight_rule_t *r, const sample_t *s, const vec_t *proc, double now) {
+    if (f->post_left > 0) {
+        tb_printf(&f->dump, "# also fired at %+.3fs: %s on pid %d\n", now - f->fired_mono, r->text, s->tgid);
+        return;
+    }
+    f->hot_tgid = s->tgid;
+    f->fired_mono = now;
+    f->dump.len = 0;
+
+    time_t wall = time(NULL);
+    struct tm tm_info;
+    localtime_r(&wall, &tm_info);
+    char stamp[40];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S%z", &tm_info);
+    tb_printf(&f->dump, "# kvmtop %s flight recorder\n# rule: %s\n# fired: %s on pid %d ", KVM_VERSION, r->text, stamp, s->tgid);
+    tb_json_str(&f->dump, s->cmd);
+    size_t have = f->seq < (unsigned long)f->ring_n ? (size_t)f->seq : (size_t)f->ring_n;
+    tb_printf(&f->dump, "\n# samples: %zu before and including the trigger, %d after%s\n", have, f->after_n,
+              f->burst > 0 ? ", plus burst samples of the process" : "");
+    tb_printf(&f->dump, "Time,Offset_s,Kind,PID,TGID,State,CPU_pct,Wait_ms,R_Log,W_Log,R_MiB,W_MiB,MajFlt_ps,Command\n");
+
+    // Oldest first; the newest slot is the refresh that fired
+    for (size_t i = have; i-- > 0; ) {
+        const flight_slot_t *sl = &f->ring[(f->seq - 1 - i) % (unsigned long)f->ring_n];
+        flight_append_slot(f, sl, i == 0 ? "trigger" : "before", proc);
+    }
+
+    f->post_left = f->after_n;
+    f->bp_n = 0;
+    if (f->burst > 0) { f->burst_last = 0; f->burst_next = now; }
+    if (f->post_left == 0) flight_finish(f);
+}
+
+// Record one refresh and check the rules against it. `proc` must be sorted by
+// TGID (as right after aggregation).
+static void flight_observe(flight_recorder_t *f, const vec_t *raw, const vec_t *proc, double now) {
+    if (!f->ring) return;
+    flight_slot_t *sl = &f->ring[f->seq % (unsigned long)f->ring_n];
+    if (raw->len > sl->cap) {
+        free(sl->recs);
+        sl->cap = raw->len + raw->len / 8;
+        sl->recs = (flight_rec_t *)malloc(sl->cap * sizeof(flight_rec_t));
+        if (!sl->recs) { fprintf(stderr, "OOM\n"); exit(2); }
+    }
+    for (size_t i = 0; i < raw->len; i++) {
+        const sample_t *s = &raw->data[i];
+        flight_rec_t *r = &sl->recs[i];
+        r->pid = s->pid; r->tgid = s->tgid; r->state = s->state;
+        r->cpu_pct = (float)s->cpu_pct; r->io_wait_ms = (float)s->io_wait_ms;
+        r->r_iops = (float)s->r_iops; r->w_iops = (float)s->w_iops;
+        r->r_mib = (float)s->r_mib; r->w_mib = (float)s->w_mib;
+        r->majflt_ps = (float)s->majflt_ps;
+    }
+    sl->n = raw->len;
+    sl->wall = time(NULL);
+    sl->mono = now;
+    f->seq++;
+
+    if (f->post_left > 0) {
+        flight_append_slot(f, sl, "after", proc);
+        if (--f->post_left == 0) flight_finish(f);
+    }
+
+    for (int k = 0; k < f->n_rules; k++) {
+        flight_rule_t *r = &f->rules[k];
+        int old = r->st_cur, cur = !old;
+        if (proc->len > r->st_cap[cur]) {
+            r->st_cap[cur] = proc->len;
+            r->st_tgid[cur] = grow_array(r->st_tgid[cur], proc->len, sizeof(pid_t));
+            r->st_cnt[cur] = grow_array(r->st_cnt[cur], proc->len, sizeof(int));
+        }
+        size_t n = 0, j = 0;
+        for (size_t i = 0; i < proc->len; i++) {
+            const sample_t *s = &proc->data[i];
+            if (r->on_pid && s->tgid != r->on_pid) continue;
+            if (!flight_cond(r, s)) continue;
+            if (r->on[0] && !strcasestr(s->cmd, r->on)) continue;
+            while (j < r->st_n[old] && r->st_tgid[old][j] < s->tgid) j++;
+            int cnt = (j < r->st_n[old] && r->st_tgid[old][j] == s->tgid) ? r->st_cnt[old][j] + 1 : 1;
+            r->st_tgid[cur][n] = s->tgid;
+            r->st_cnt[cur][n] = cnt;
+            n++;
+            if (cnt == r->for_n) flight_fire(f, r, s, proc, now);
+        }
+        r->st_n[cur] = n;
+        r->st_cur = cur;
+    }
+}
+
+// Seconds until the next burst sample is due, or -1 if none is pending
+static double flight_burst_wait(const flight_recorder_t *f, double now) {
+    if (f->post_left == 0 || f->burst <= 0 || f->burst_next <= 0) return -1;
+    double w = f->burst_next - now;
+    return w > 0 ? w : 0;
+}
+
+// Sample the stat of every thread of the offending process and append the
+// rates since the previous burst sample to the dump
+static void flight_burst_sample(flight_recorder_t *f, long hz, double now) {
+    f->burst_next = now + f->burst;
+    char dir_path[64];
+    snprintf(dir_path, sizeof(dir_path), "/proc/%d/task", f->hot_tgid);
+    DIR *d = opendir(dir_path);
+    if (!d) { f->burst_next = 0; return; }  // Process is gone
+
+    double dt = f->burst_last > 0 ? now - f->burst_last : 0;
+    time_t wall = time(NULL);
+    struct tm tm_info;
+    localtime_r(&wall, &tm_info);
+    char stamp[40];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S%z", &tm_info);
+
+    size_t old_n = f->bp_n;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (!is_numeric_str(de->d_name)) continue;
+        pid_t tid = (pid_t)atoi(de->d_name);
+        char path[96];
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", f->hot_tgid, tid);
+        uint64_t cpu, blkio, start, minflt, majflt;
+        char state;
+        pid_t ppid;
+        if (read_proc_stat_fields(path, &cpu, &blkio, &state, &ppid, &start, &minflt, &majflt, NULL, NULL) != 0) continue;
+
+        // Threads come back in the same order, so the previous entry is
+        // usually at the same index
+        size_t pos = f->bp_n - old_n;
+        const flight_burst_prev_t *p = (pos < old_n && f->bp[pos].tid == tid) ? &f->bp[pos] : NULL;
+        for (size_t i = 0; i < old_n && !p; i++) if (f->bp[i].tid == tid) p = &f->bp[i];
+        if (p && dt > 0) {
+            uint64_t d_cpu = cpu >= p->cpu_jiffies ? cpu - p->cpu_jiffies : 0;
+            uint64_t d_blk = blkio >= p->blkio_ticks ? blkio - p->blkio_ticks : 0;
+            uint64_t d_maj = majflt >= p->majflt ? majflt - p->majflt : 0;
+            tb_printf(&f->dump, "%s,%.3f,burst,%d,%d,%c,%.2f,%.0f,,,,,%.2f,\n", stamp, now - f->fired_mono, tid, f->hot_tgid, state,
+                      ((double)d_cpu * 100.0) / (dt * (double)hz), ((double)d_blk * 1000.0) / (double)hz, (double)d_maj / dt);
+        }
+        if (f->bp_n == f->bp_cap) {
+            f->bp_cap = f->bp_cap ? f->bp_cap * 2 : 64;
+            f->bp = grow_array(f->bp, f->bp_cap, sizeof(*f->bp));
+        }
+        f->bp[f->bp_n++] = (flight_burst_prev_t){ tid, cpu, blkio, majflt };
+    }
+    closedir(d);
+    // Keep only this round as the baseline for the next one
+    memmove(f->bp, f->bp + old_n, (f->bp_n - old_n) * sizeof(*f->bp));
+    f->bp_n -= old_n;
+    f->burst_last = now;
+}
+
+// Flush a recording that is still collecting and give a running dump thread
+// a moment to finish before the process exits
+static void flight_close(flight_recorder_t *f) {
+    if (f->post_left > 0) {
+        tb_printf(&f->dump, "# kvmtop exited with %d refreshes still to record\n", f->post_left);
+        flight_finish(f);
+    }
+    for (int i = 0; i < 200 && __atomic_load_n(&f->writing, __ATOMIC_ACQUIRE); i++) usleep(10000);
+    flight_free(f);
+}
+
+// --- Blocked Threads ---
+// What the threads in uninterruptible sleep (state D) are waiting for. Only
+// those threads are looked at: their wchan and, as root, their kernel stack.
+// Identical stacks are counted together across threads, processes and VMs, so
+// an NFS hang, a dm/LVM lock and a saturated disk queue show up as separate
+// rows at once.
+#define BLOCKED_KEEP 30        // Refreshes a cleared stack stays listed
+
+typedef struct {
+    uint64_t hash;
+    int threads;               // Threads blocked here in the last refresh
+    int procs;                 // Processes those threads belong to
+    unsigned long seen;        // Refreshes in which the stack appeared
+    int age;                   // Refreshes since it last appeared
+    pid_t last_tgid;
+    char wchan[48];
+    char who[128];             // VMs and processes, first come first listed
+    char stack[1024];          // Function names, innermost first
+} blocked_row_t;
+
+typedef struct {
+    blocked_row_t *rows;
+    size_t n, cap;
+    uint32_t *slots;           // Open-addressed hash of row index + 1
+    size_t n_slots;
+    int total;                 // D threads in the last refresh
+    int have_stacks;           // Kernel stacks were readable
+} blocked_view_t;
+
+static const column_t blocked_columns[] = {
+    { "Threads", NULL, 8, 0, 0, COL_INT, offsetof(blocked_row_t, threads), 1, NULL, NULL, SORT_BLK_THREADS, 1, 0, HL_NONE },
+    { "Procs", NULL, 6, 0, 0, COL_INT, offsetof(blocked_row_t, procs), 1, NULL, NULL, SORT_BLK_PROCS, 2, 0, HL_NONE },
+    { "Seen", NULL, 6, 0, 0, COL_U64, offsetof(blocked_row_t, seen), 1, NULL, NULL, SORT_BLK_SEEN, 3, 0, HL_NONE },
+    { "Ago", NULL, 4, 0, 0, COL_INT, offsetof(blocked_row_t, age), 1, NULL, NULL, SORT_BLK_AGE, 4, 0, HL_NONE },
+    { "WCHAN", "Wchan", 24, 0, COLF_LEFT, COL_STR, offsetof(blocked_row_t, wchan), 1, NULL, NULL, SORT_BLK_WCHAN, 5, 0, HL_NONE },
+    { "WHO", "Who", 24, 0, COLF_LEFT | COLF_QUOTE, COL_STR, offsetof(blocked_row_t, who), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "STACK", "Stack", 0, 0, COLF_LEFT | COLF_FILL | COLF_QUOTE, COL_STR, offsetof(blocked_row_t, stack), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+};
+static const table_t blocked_table = TABLE(blocked_columns, blocked_row_t);
+
+static uint64_t fnv1a(const char *s, uint64_t h) {
+    for (; *s; s++) { h ^= (unsigned char)*s; h *= 0x100000001b3ULL; }
+    return h;
+}
+
+// Scheduler and syscall-entry frames are on every blocked stack and say
+// nothing about the cause
+static int blocked_frame_is_noise(const char *fn, size_t len) {
+    static const char *const noise[] = {
+        "__schedule", "schedule", "schedule_timeout", "schedule_preempt_disabled",
+        "do_syscall_64", "entry_SYSCALL_64_after_hwframe", "__x64_sys_", "x64_sys_call",
+    };
+    for (size_t i = 0; i < sizeof(noise) / sizeof(noise[0]); i++) {
+        size_t nl = strlen(noise[i]);
+        if (noise[i][nl - 1] == '_' ? (len >= nl && strncmp(fn, noise[i], nl) == 0)
+                                    : (len == nl && strncmp(fn, noise[i], nl) == 0)) return 1;
+    }
+    return 0;
+}
+
+// "[<0>] io_schedule+0x12/0x40" lines -> "io_schedule < folio_wait_bit < ..."
+static void blocked_parse_stack(const char *buf, char *out, size_t out_len) {
+    size_t o = 0;
+    out[0] = '\0';
+    for (const char *line = buf; *line; ) {
+        const char *eol = strchr(line, '\n');
+        if (!eol) eol = line + strlen(line);
+        const char *fn = strchr(line, ']');
+        fn = (fn && fn < eol) ? fn + 1 : line;
+        while (fn < eol && *fn == ' ') fn++;
+        size_t len = strcspn(fn, "+ \n");
+        if (fn + len > eol) len = (size_t)(eol - fn);
+        if (len > 0 && !blocked_frame_is_noise(fn, len)) {
+            int w = snprintf(out + o, out_len - o, "%s%.*s", o ? " < " : "", (int)len, fn);
+            if (w < 0 || (size_t)w >= out_len - o) break;
+            o += (size_t)w;
+        }
+        line = *eol ? eol + 1 : eol;
+    }
+}
+
+// "vm 101" for a VM, otherwise the program name
+static void blocked_who(const char *cmd, char *out, size_t out_len) {
+    int vmid = cmd_vmid(cmd);
+    if (vmid >= 0) { snprintf(out, out_len, "vm %d", vmid); return; }
+    size_t len = strcspn(cmd, " ");
+    const char *slash = memrchr(cmd, '/', len);
+    const char *base = slash ? slash + 1 : cmd;
+    snprintf(out, out_len, "%.*s", (int)(len - (size_t)(base - cmd)), base);
+}
+
+// Point the hash at the rows again. The slot table keeps its size.
+static void blocked_rehash(blocked_view_t *v) {
+    memset(v->slots, 0, v->n_slots * sizeof(uint32_t));
+    for (size_t i = 0; i < v->n; i++) {
+        size_t s = v->rows[i].hash & (v->n_slots - 1);
+        while (v->slots[s]) s = (s + 1) & (v->n_slots - 1);
+        v->slots[s] = (uint32_t)i + 1;
+    }
+}
+
+static blocked_row_t *blocked_find(blocked_view_t *v, uint64_t hash, const char *wchan, const char *stack) {
+    if (v->n * 2 >= v->n_slots) {
+        v->n_slots = v->n_slots ? v->n_slots * 2 : 64;
+        v->slots = grow_array(v->slots, v->n_slots, sizeof(uint32_t));
+        blocked_rehash(v);
+    }
+    size_t s = hash & (v->n_slots - 1);
+    for (; v->slots[s]; s = (s + 1) & (v->n_slots - 1)) {
+        blocked_row_t *r = &v->rows[v->slots[s] - 1];
+        if (r->hash == hash && strcmp(r->wchan, wchan) == 0 && strcmp(r->stack, stack) == 0) return r;
+    }
+    if (v->n == v->cap) {
+        v->cap = v->cap ? v->cap * 2 : 32;
+        v->rows = grow_array(v->rows, v->cap, sizeof(blocked_row_t));
+    }
+    blocked_row_t *r = &v->rows[v->n];
+    memset(r, 0, sizeof(*r));
+    r->hash = hash;
+    r->age = -1;
+    snprintf(r->wchan, sizeof(r->wchan), "%s", wchan);
+    snprintf(r->stack, sizeof(r->stack), "%s", stack);
+    v->slots[s] = (uint32_t)++v->n;
+    return r;
+}
+
+// Look at the D threads of this refresh. `proc` must be sorted by TGID. Only
+// called while the view is shown: nothing is read for it otherwise.
+static void blocked_collect(blocked_view_t *v, const vec_t *raw, const vec_t *proc) {
+    // Age out stacks that have not been seen for a while. Sorting for display
+    // moves the rows, so the hash is rebuilt from them each refresh.
+    size_t keep = 0;
+    for (size_t i = 0; i < v->n; i++) {
+        blocked_row_t *r = &v->rows[i];
+        r->age++;
+        r->threads = r->procs = 0;
+        r->last_tgid = 0;
+        if (r->age <= BLOCKED_KEEP) v->rows[keep++] = *r;
+    }
+    v->n = keep;
+    if (v->n_slots) blocked_rehash(v);
+
+    v->total = 0;
+    v->have_stacks = 0;
+    int can_stack = geteuid() == 0;
+    for (size_t i = 0; i < raw->len; i++) {
+        const sample_t *t = &raw->data[i];
+        if (t->state != 'D') continue;
+        v->total++;
+
+        char path[96], buf[4096], wchan[48] = "", stack[1024] = "";
+        ssize_t n;
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/wchan", t->tgid, t->pid);
+        if (read_small_file(path, wchan, sizeof(wchan), &n) != 0 || strcmp(wchan, "0") == 0) wchan[0] = '\0';
+        if (can_stack) {
+            snprintf(path, sizeof(path), "/proc/%d/task/%d/stack", t->tgid, t->pid);
+            if (read_small_file(path, buf, sizeof(buf), &n) == 0 && n > 0) {
+                blocked_parse_stack(buf, stack, sizeof(stack));
+                v->have_stacks = 1;
+            }
+        }
+        if (!wchan[0] && !stack[0]) snprintf(wchan, sizeof(wchan), "?");
+
+        blocked_row_t *r = blocked_find(v, fnv1a(stack, fnv1a(wchan, 0xcbf29ce484222325ULL)), wchan, stack);
+        if (r->age != 0) { r->age = 0; r->seen++; }
+        r->threads++;
+        if (r->last_tgid != t->tgid) {
+            r->last_tgid = t->tgid;
+            r->procs++;
+            char who[64];
+            blocked_who(proc_cmd(proc, t->tgid), who, sizeof(who));
+            size_t wl = strlen(who), have = strlen(r->who);
+            const char *hit = strstr(r->who, who);
+            int dup = hit && (hit[wl] == '\0' || hit[wl] == ',') && (hit == r->who || hit[-1] == ' ');
+            if (!dup && have + wl + 3 < sizeof(r->who))
+                snprintf(r->who + have, sizeof(r->who) - have, "%s%s", have ? ", " : "", who);
+        }
+    }
+}
+
+static void blocked_free(blocked_view_t *v) {
+    free(v->rows);
+    free(v->slots);
+    memset(v, 0, sizeof(*v));
+}
+
+// --- CPU Topology ---
+// Where the threads ran, per physical core. Each task's stat reports the CPU
+// it last ran on; the sysfs topology groups CPUs into cores and packages.
+// vCPU threads ("CPU n/KVM") are listed per core so bad pinning and noisy
+// neighbours show up, and a core is flagged when more vCPUs were runnable on
+// it than it has hardware threads.
+typedef struct {
+    int idx;                   // Core number across the host, in sysfs order
+    int pkg;
+    int core_id;
+    char cpus[24];             // Logical CPUs: the SMT siblings
+    int n_sib;
+    double load_pct;           // CPU% of the tasks that last ran here, per sibling
+    int runnable;              // Tasks in state R last seen here
+    int vcpus;                 // vCPU threads last seen here
+    int vcpus_runnable;
+    char vms[128];             // VM:vCPU list, e.g. "101:0,1 102:3"
+} topo_core_t;
+
+typedef struct {
+    int vmid;
+    int vcpu;
+    pid_t tid;
+    int cpu;
+    int core;                  // topo_core_t.idx, -1 if the CPU is unknown
+    double cpu_pct;
+    char state;
+    uint64_t migrations;
+} topo_vcpu_t;
+
+typedef struct {
+    int n_cpus;                // Highest CPU number + 1
+    int *core_of;              // Logical CPU -> index into cores, -1 offline
+    topo_core_t *cores;
+    size_t n_cores;
+    topo_vcpu_t *vcpus;
+    size_t n_vcpus, vcpus_cap;
+    int over;                  // Oversubscribed cores
+} topology_t;
+
+static const char *get_topo_over(const void *row) {
+    const topo_core_t *c = (const topo_core_t *)row;
+    return c->vcpus_runnable > c->n_sib ? "OVER" : "";
+}
+
+static double get_vcpu_core(const void *row) {
+    return ((const topo_vcpu_t *)row)->core;  // -1 prints as "-"
+}
+
+static const column_t topo_columns[] = {
+    { "Core", NULL, 6, 0, 0, COL_INT, offsetof(topo_core_t, idx), 1, NULL, NULL, SORT_TOPO_CORE, 1, 0, HL_NONE },
+    { "Pkg", NULL, 4, 0, 0, COL_INT, offsetof(topo_core_t, pkg), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "CPUs", NULL, 10, 0, COLF_LEFT | COLF_QUOTE, COL_STR, offsetof(topo_core_t, cpus), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "Load%", "Load_pct", 8, 1, 0, COL_F64, offsetof(topo_core_t, load_pct), 1, NULL, NULL, SORT_TOPO_LOAD, 2, 0, HL_CPU },
+    { "Run", NULL, 5, 0, 0, COL_INT, offsetof(topo_core_t, runnable), 1, NULL, NULL, SORT_TOPO_RUN, 3, 0, HL_NONE },
+    { "vCPUs", NULL, 6, 0, 0, COL_INT, offsetof(topo_core_t, vcpus), 1, NULL, NULL, SORT_TOPO_VCPUS, 4, 0, HL_NONE },
+    { "vRun", NULL, 5, 0, 0, COL_INT, offsetof(topo_core_t, vcpus_runnable), 1, NULL, NULL, SORT_TOPO_VRUN, 5, 0, HL_NONE },
+    { "Over", NULL, 5, 0, 0, COL_STRFN, 0, 1, NULL, get_topo_over, 0, 0, 0, HL_NONE },
+    { "VM:vCPU", "VM_vCPU", 0, 0, COLF_LEFT | COLF_FILL | COLF_QUOTE, COL_STR, offsetof(topo_core_t, vms), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+};
+static const table_t topo_table = TABLE(topo_columns, topo_core_t);
+
+static const column_t vcpu_columns[] = {
+    { "VMID", NULL, 6, 0, 0, COL_INT, offsetof(topo_vcpu_t, vmid), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "vCPU", NULL, 5, 0, 0, COL_INT, offsetof(topo_vcpu_t, vcpu), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "TID", NULL, 8, 0, 0, COL_INT, offsetof(topo_vcpu_t, tid), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "CPU", NULL, 5, 0, 0, COL_INT, offsetof(topo_vcpu_t, cpu), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "Core", NULL, 5, 0, 0, COL_FN, 0, 1, get_vcpu_core, NULL, 0, 0, 0, HL_NONE },
+    { "CPU%", "CPU_pct", 8, 1, 0, COL_F64, offsetof(topo_vcpu_t, cpu_pct), 1, NULL, NULL, 0, 0, 0, HL_CPU },
+    { "S", "State", 3, 0, 0, COL_CHAR, offsetof(topo_vcpu_t, state), 1, NULL, NULL, 0, 0, 0, HL_STATE },
+    { "Migrations", NULL, 0, 0, COLF_LEFT | COLF_FILL, COL_U64, offsetof(topo_vcpu_t, migrations), 1, NULL, NULL, SORT_TOPO_MIGR, 0, 0, HL_NONE },
+};
+static const table_t vcpu_table = TABLE(vcpu_columns, topo_vcpu_t);
+
+static int read_sysfs_int(const char *path, int *out) {
+    char buf[32];
+    ssize_t n;
+    if (read_small_file(path, buf, sizeof(buf), &n) != 0 || n <= 0) return -1;
+    *out = atoi(buf);
+    return 0;
+}
+
+static int cmp_topo_cpu(const void *a, const void *b) {
+    const int *x = (const int *)a, *y = (const int *)b;
+    if (x[1] != y[1]) return x[1] - y[1];  // Package
+    if (x[2] != y[2]) return x[2] - y[2];  // Core
+    return x[0] - y[0];                    // CPU
+}
+
+// Group the online CPUs into cores. Called when the view is entered, so CPU
+// hotplug is picked up then.
+static void topology_load(topology_t *t) {
+    t->n_cpus = 0;
+    t->n_cores = 0;
+    DIR *d = opendir("/sys/devices/system/cpu");
+    if (!d) return;
+    int (*cpu)[3] = NULL;      // {cpu, package, core_id}
+    size_t n = 0, cap = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strncmp(de->d_name, "cpu", 3) != 0 || !is_numeric_str(de->d_name + 3)) continue;
+        int id = atoi(de->d_name + 3), pkg, core;
+        char path[320];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/%s/topology/physical_package_id", de->d_name);
+        if (read_sysfs_int(path, &pkg) != 0) continue;  // Offline
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/%s/topology/core_id", de->d_name);
+        if (read_sysfs_int(path, &core) != 0) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            cpu = grow_array(cpu, cap, sizeof(*cpu));
+        }
+        cpu[n][0] = id; cpu[n][1] = pkg; cpu[n][2] = core;
+        n++;
+        if (id + 1 > t->n_cpus) t->n_cpus = id + 1;
+    }
+    closedir(d);
+    if (n) qsort(cpu, n, sizeof(*cpu), cmp_topo_cpu);
+
+    t->core_of = grow_array(t->core_of, (size_t)t->n_cpus + 1, sizeof(int));
+    t->cores = grow_array(t->cores, n + 1, sizeof(topo_core_t));
+    for (int i = 0; i < t->n_cpus; i++) t->core_of[i] = -1;
+    for (size_t i = 0; i < n; i++) {
+        topo_core_t *c = t->n_cores ? &t->cores[t->n_cores - 1] : NULL;
+        if (!c || c->pkg != cpu[i][1] || c->core_id != cpu[i][2]) {
+            c = &t->cores[t->n_cores];
+            memset(c, 0, sizeof(*c));
+            c->idx = (int)t->n_cores++;
+            c->pkg = cpu[i][1];
+            c->core_id = cpu[i][2];
+        }
+        size_t len = strlen(c->cpus);
+        snprintf(c->cpus + len, sizeof(c->cpus) - len, "%s%d", len ? "," : "", cpu[i][0]);
+        c->n_sib++;
+        t->core_of[cpu[i][0]] = (int)(c - t->cores);
+    }
+    free(cpu);
+}
+
+static int cmp_topo_idx(const void *a, const void *b) {
+    return ((const topo_core_t *)a)->idx - ((const topo_core_t *)b)->idx;
+}
+
+static int cmp_vcpu_migrations(const void *a, const void *b) {
+    const topo_vcpu_t *x = (const topo_vcpu_t *)a, *y = (const topo_vcpu_t *)b;
+    if (x->migrations != y->migrations) return x->migrations < y->migrations ? 1 : -1;
+    if (x->vmid != y->vmid) return x->vmid - y->vmid;
+    return x->vcpu - y->vcpu;
+}
+
+// Where every task last ran. vCPU threads end up ordered by migrations.
+// Thread rows carry their process's command line, so the VM is found without
+// a lookup into the process list, whatever order that is in.
+static void topology_update(topology_t *t, const vec_t *raw) {
+    // core_of indexes rows in load order; display sorting moves them
+    sort_rows(t->cores, t->n_cores, sizeof(topo_core_t), cmp_topo_idx);
+    for (size_t i = 0; i < t->n_cores; i++) {
+        topo_core_t *c = &t->cores[i];
+        c->load_pct = 0;
+        c->runnable = c->vcpus = c->vcpus_runnable = 0;
+        c->vms[0] = '\0';
+    }
+    t->n_vcpus = 0;
+    pid_t vm_tgid = 0;
+    int vmid = -1;
+    for (size_t i = 0; i < raw->len; i++) {
+        const sample_t *s = &raw->data[i];
+        int ci = (s->processor >= 0 && s->processor < t->n_cpus) ? t->core_of[s->processor] : -1;
+        topo_core_t *c = ci >= 0 ? &t->cores[ci] : NULL;
+        if (c) {
+            c->load_pct += s->cpu_pct;
+            if (s->state == 'R') c->runnable++;
+        }
+
+        int vcpu;
+        if (sscanf(s->comm, "CPU %d/KVM", &vcpu) != 1) continue;
+        if (s->tgid != vm_tgid) {
+            vm_tgid = s->tgid;
+            vmid = cmd_vmid(s->cmd);
+        }
+        if (t->n_vcpus == t->vcpus_cap) {
+            t->vcpus_cap = t->vcpus_cap ? t->vcpus_cap * 2 : 64;
+            t->vcpus = grow_array(t->vcpus, t->vcpus_cap, sizeof(topo_vcpu_t));
+        }
+        topo_vcpu_t *v = &t->vcpus[t->n_vcpus++];
+        v->vmid = vmid;
+        v->vcpu = vcpu;
+        v->tid = s->pid;
+        v->cpu = s->processor;
+        v->core = c ? c->idx : -1;
+        v->cpu_pct = s->cpu_pct;
+        v->state = s->state;
+        v->migrations = s->migrations;
+        if (!c) continue;
+        c->vcpus++;
+        if (s->state == 'R') c->vcpus_runnable++;
+        size_t len = strlen(c->vms);
+        if (len + 16 < sizeof(c->vms)) snprintf(c->vms + len, sizeof(c->vms) - len, "%s%d:%d", len ? " " : "", vmid, vcpu);
+    }
+    t->over = 0;
+    for (size_t i = 0; i < t->n_cores; i++) {
+        topo_core_t *c = &t->cores[i];
+        if (c->n_sib) c->load_pct /= c->n_sib;
+        if (c->vcpus_runnable > c->n_sib) t->over++;
+    }
+    sort_rows(t->vcpus, t->n_vcpus, sizeof(topo_vcpu_t), cmp_vcpu_migrations);
+}
+
+// One cell per core, shaded by load: a heatmap of the host in a few lines
+static void topology_print_heat(const topology_t *t, int cols) {
+    static const char *const shade[] = { "·", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+    int pkg = -1, x = 0;
+    for (size_t i = 0; i < t->n_cores; i++) {
+        const topo_core_t *c = &t->cores[i];
+        if (c->pkg != pkg || x >= cols - 1) {
+            if (pkg != -1) putchar('\n');
+            x = printf(c->pkg != pkg ? "Pkg %-3d " : "        ", c->pkg);
+            pkg = c->pkg;
+        }
+        double load = c->load_pct > 100 ? 100 : c->load_pct;
+        int level = load <= 0 ? 0 : 1 + (int)(load / 100.0 * 7.999);
+        const char *color = c->vcpus_runnable > c->n_sib ? (color_enabled ? COLOR_RED : "") : get_cpu_color(load);
+        printf("%s%s%s", color, shade[level], *color ? reset_color() : "");
+        x++;
+    }
+    if (pkg != -1) putchar('\n');
+}
+
+// Lines topology_print_heat() takes
+static int topology_heat_lines(const topology_t *t, int cols) {
+    int pkg = -1, x = 0, lines = 0;
+    for (size_t i = 0; i < t->n_cores; i++) {
+        if (t->cores[i].pkg != pkg || x >= cols - 1) { lines++; x = 8; pkg = t->cores[i].pkg; }
+        x++;
+    }
+    return lines;
+}
+
+static void topology_free(topology_t *t) {
+    free(t->core_of);
+    free(t->cores);
+    free(t->vcpus);
+    memset(t, 0, sizeof(*t));
+}
+
+#ifdef DEBUG
+static int cmp_cpu_pct_desc(const void *a, const void *b) {
+    double x = ((const sample_t *)a)->cpu_pct, y = ((const sample_t *)b)->cpu_pct;
+    return (x < y) - (x > y);
+}
+
+// Two VMs and a bystander, their threads sorted by CPU% first so the VMs
+// interleave: every vCPU must still be credited to its own VM.
+static void topology_selftest(void) {
+    static const struct { pid_t tgid; int vmid; const char *cmd; } procs[] = {
+        { 300, 101, "/usr/bin/kvm -id 101 -name web" },
+        { 310, -1, "bash" },
+        { 320, 102, "/usr/bin/qemu-system-x86_64 -name db -id 102" },
+    };
+    vec_t raw;
+    vec_init(&raw);
+    for (int i = 0; i < 12; i++) {
+        sample_t s;
+        memset(&s, 0, sizeof(s));
+        s.tgid = procs[i % 3].tgid;
+        s.pid = 1000 + i;
+        s.processor = -1;
+        s.cpu_pct = (double)((i * 7) % 12);
+        snprintf(s.cmd, sizeof(s.cmd), "%s", procs[i % 3].cmd);
+        if (procs[i % 3].vmid > 0) snprintf(s.comm, sizeof(s.comm), "CPU %d/KVM", i / 3);
+        else snprintf(s.comm, sizeof(s.comm), "bash");
+        vec_push(&raw, &s);
+    }
+    sort_rows(raw.data, raw.len, sizeof(sample_t), cmp_cpu_pct_desc);
+
+    topology_t t;
+    memset(&t, 0, sizeof(t));
+    topology_update(&t, &raw);
+    int bad = 0;
+    for (size_t i = 0; i < t.n_vcpus; i++)
+        if (t.vcpus[i].vmid != procs[(t.vcpus[i].tid - 1000) % 3].vmid) bad++;
+    fprintf(stderr, "DEBUG: topology %d of %zu vCPUs credited to the wrong VM\n", bad, t.n_vcpus);
+    topology_free(&t);
+    vec_free(&raw);
+}
+#endif
+
+// --- Interrupts ---
+// /proc/interrupts and /proc/softirqs, diffed per CPU. Both have one counter
+// column per CPU, so on big hosts they are hundreds of KiB: they are re-read
+// through proc_file_t and parsed in place into counter arrays that only grow
+// when a vector or CPU appears. vfio vectors are attributed to the VM whose
+// QEMU process holds the device's IOMMU group open; emulated and vhost
+// devices interrupt the guest through eventfds and have no host vector. A CPU
+// that takes device or network/block softirq load while a vCPU is pinned to
+// it alone is flagged.
+#define IRQ_COLLIDE_RATE  1000.0  // Device IRQs + NET_RX/NET_TX/BLOCK per second
+#define IRQ_RESOLVE_EVERY 30      // Refreshes between VMID lookups
+
+typedef struct {
+    char label[16];            // "35", "LOC", "NET_RX"
+    char desc[96];             // Chip, hwirq and handler names as listed
+    int vmid;                  // -1 none, -2 not looked up yet
+    int soft;                  // From /proc/softirqs
+    double rate;               // Per second, all CPUs
+    int top_cpu;               // CPU that took most of them, -1 if none
+    double top_pct;            // Its share of rate
+    int n_cpus;                // CPUs that took any
+    int collide;               // top_cpu is a collision CPU
+} irq_row_t;
+
+typedef struct {
+    proc_file_t pf;
+    int n_cols;
+    int *col_cpu;              // Counter column -> CPU number
+    size_t cols_cap;
+    irq_row_t *rows[2];        // Current and previous parse, in file order
+    uint64_t *cnt[2];          // n_cols counters per row
+    size_t n[2], rows_cap, cnt_cap;
+    int cur;
+    int primed;                // The previous parse has the same columns
+} irq_file_t;
+
+typedef struct {
+    int cpu;
+    int online;                // Has a column in /proc/interrupts
+    double dev, arch;          // Device vectors / per-CPU architecture IRQs, per second
+    double net_rx, net_tx, block, soft;
+    char pinned[48];           // vCPUs whose affinity is this CPU only, "101:0 102:3"
+    int collide;
+} irq_cpu_t;
+
+typedef struct {
+    irq_file_t hard, softf;
+    irq_row_t *view;           // Rows of both files, sorted for display
+    size_t n_view, view_cap;
+    irq_cpu_t *cpus;           // Indexed by CPU number, sorted for display
+    int n_cpus, cpus_cap;
+    double t_last;
+    unsigned refreshes;
+    int pinned, collisions;
+} irqstat_t;
+
+static double get_irq_top(const void *row) {
+    return ((const irq_row_t *)row)->top_cpu;  // -1 prints as "-"
+}
+
+static const char *get_irq_collide(const void *row) {
+    return ((const irq_row_t *)row)->collide ? "vCPU" : "";
+}
+
+static const char *get_irqcpu_collide(const void *row) {
+    return ((const irq_cpu_t *)row)->collide ? "COLLIDE" : "";
+}
+
+static const column_t irq_columns[] = {
+    { "IRQ", NULL, 8, 0, COLF_LEFT, COL_STR, offsetof(irq_row_t, label), 1, NULL, NULL, SORT_IRQ_LABEL, 1, 0, HL_NONE },
+    { "Rate/s", "Rate_per_s", 10, 0, 0, COL_F64, offsetof(irq_row_t, rate), 1, NULL, NULL, SORT_IRQ_RATE, 2, 0, HL_NONE },
+    { "CPUs", NULL, 5, 0, 0, COL_INT, offsetof(irq_row_t, n_cpus), 1, NULL, NULL, SORT_IRQ_CPUS, 3, 0, HL_NONE },
+    { "Top", "Top_CPU", 5, 0, 0, COL_FN, 0, 1, get_irq_top, NULL, SORT_IRQ_TOP, 4, 0, HL_NONE },
+    { "Top%", "Top_pct", 6, 0, 0, COL_F64, offsetof(irq_row_t, top_pct), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "VMID", NULL, 6, 0, COLF_DASH_NONPOS, COL_INT, offsetof(irq_row_t, vmid), 1, NULL, NULL, SORT_IRQ_VMID, 5, 0, HL_NONE },
+    { "Pin", "Collides", 4, 0, 0, COL_STRFN, 0, 1, NULL, get_irq_collide, 0, 0, 0, HL_ALERT },
+    { "Name", NULL, 0, 0, COLF_LEFT | COLF_FILL | COLF_QUOTE, COL_STR, offsetof(irq_row_t, desc), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+};
+static const table_t irq_table = TABLE(irq_columns, irq_row_t);
+
+static const column_t irqcpu_columns[] = {
+    { "CPU", NULL, 5, 0, 0, COL_INT, offsetof(irq_cpu_t, cpu), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "Dev/s", NULL, 9, 0, 0, COL_F64, offsetof(irq_cpu_t, dev), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "Arch/s", NULL, 9, 0, 0, COL_F64, offsetof(irq_cpu_t, arch), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "NET_RX/s", NULL, 9, 0, 0, COL_F64, offsetof(irq_cpu_t, net_rx), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "NET_TX/s", NULL, 9, 0, 0, COL_F64, offsetof(irq_cpu_t, net_tx), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "BLOCK/s", NULL, 9, 0, 0, COL_F64, offsetof(irq_cpu_t, block), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "Soft/s", NULL, 9, 0, 0, COL_F64, offsetof(irq_cpu_t, soft), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "", NULL, 7, 0, 0, COL_STRFN, 0, 1, NULL, get_irqcpu_collide, 0, 0, 0, HL_ALERT },
+    { "Pinned vCPUs", NULL, 0, 0, COLF_LEFT | COLF_FILL, COL_STR, offsetof(irq_cpu_t, pinned), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+};
+static const table_t irqcpu_table = TABLE(irqcpu_columns, irq_cpu_t);
+
+static void irq_file_reserve(irq_file_t *f, size_t rows) {
+    if (rows > f->rows_cap) {
+        f->rows_cap = rows * 2;
+        for (int b = 0; b < 2; b++) f->rows[b] = grow_array(f->rows[b], f->rows_cap, sizeof(irq_row_t));
+    }
+    size_t need = f->rows_cap * (size_t)f->n_cols;
+    if (need > f->cnt_cap) {
+        f->cnt_cap = need;
+        for (int b = 0; b < 2; b++) f->cnt[b] = grow_array(f->cnt[b], f->cnt_cap, sizeof(uint64_t));
+    }
+}
+
+// Parse the whole file into the current buffers
+static int irq_file_parse(irq_file_t *f) {
+    if (proc_file_load(&f->pf) != 0) return -1;
+    const char *p = f->pf.buf, *eol = next_line(p);
+
+    // Header: one "CPUn" per counter column
+    int n_cols = 0, same = 1;
+    for (;;) {
+        while (*p == ' ') p++;
+        if (p >= eol || strncmp(p, "CPU", 3) != 0) break;
+        p += 3;
+        int cpu = (int)scan_u64(&p);
+        if ((size_t)n_cols == f->cols_cap) {
+            f->cols_cap = f->cols_cap ? f->cols_cap * 2 : 64;
+            f->col_cpu = grow_array(f->col_cpu, f->cols_cap, sizeof(int));
+        }
+        if (n_cols >= f->n_cols || f->col_cpu[n_cols] != cpu) same = 0;
+        f->col_cpu[n_cols++] = cpu;
+    }
+    if (n_cols != f->n_cols) same = 0;
+    f->n_cols = n_cols;
+    f->cur ^= 1;
+    if (!same) f->primed = 0;   // CPU hotplug: no delta this time
+
+    size_t n = 0;
+    for (p = eol; *p; p = eol) {
+        eol = next_line(p);
+        const char *colon = memchr(p, ':', (size_t)(eol - p));
+        if (!colon) continue;
+        while (*p == ' ') p++;
+        size_t len = (size_t)(colon - p);
+        // ERR and MIS are single host-wide counters
+        if ((len == 3 && (strncmp(p, "ERR", 3) == 0 || strncmp(p, "MIS", 3) == 0))) continue;
+        irq_file_reserve(f, n + 1);
+        irq_row_t *r = &f->rows[f->cur][n];
+        if (len >= sizeof(r->label)) len = sizeof(r->label) - 1;
+        memcpy(r->label, p, len);
+        r->label[len] = '\0';
+
+        uint64_t *v = f->cnt[f->cur] + n * (size_t)n_cols;
+        const char *q = colon + 1;
+        int k = 0;
+        for (; k < n_cols; k++) {
+            while (*q == ' ') q++;
+            if (*q < '0' || *q > '9') break;
+            v[k] = scan_u64(&q);
+        }
+        for (; k < n_cols; k++) v[k] = 0;
+
+        // The rest of the line, runs of blanks folded
+        size_t o = 0;
+        for (; q < eol && *q != '\n' && o + 1 < sizeof(r->desc); q++) {
+            if (*q == ' ' || *q == '\t') {
+                if (o && r->desc[o - 1] != ' ') r->desc[o++] = ' ';
+            } else {
+                r->desc[o++] = *q;
+            }
+        }
+        while (o && r->desc[o - 1] == ' ') o--;
+        r->desc[o] = '\0';
+        n++;
+    }
+    f->n[f->cur] = n;
+    return 0;
+}
+
+static irq_cpu_t *irq_cpu(irqstat_t *st, int cpu) {
+    if (cpu < 0) return NULL;
+    if (cpu >= st->cpus_cap) {
+        int cap = st->cpus_cap ? st->cpus_cap : 64;
+        while (cap <= cpu) cap *= 2;
+        st->cpus = grow_array(st->cpus, (size_t)cap, sizeof(irq_cpu_t));
+        memset(st->cpus + st->cpus_cap, 0, (size_t)(cap - st->cpus_cap) * sizeof(irq_cpu_t));
+        st->cpus_cap = cap;
+    }
+    for (int i = st->n_cpus; i <= cpu; i++) st->cpus[i].cpu = i;
+    if (cpu >= st->n_cpus) st->n_cpus = cpu + 1;
+    return &st->cpus[cpu];
+}
+
+// Rates of the current parse against the previous one. A vector keeps the
+// index it had unless the list changed, so the same index is tried first.
+static int irq_file_delta(irqstat_t *st, irq_file_t *f, int soft, double dt) {
+    int resolve = 0;
+    const irq_row_t *old = f->rows[f->cur ^ 1];
+    size_t n_old = f->n[f->cur ^ 1];
+    for (size_t i = 0; i < f->n[f->cur]; i++) {
+        irq_row_t *r = &f->rows[f->cur][i];
+        size_t j = i;
+        if (j >= n_old || strcmp(old[j].label, r->label) != 0)
+            for (j = 0; j < n_old && strcmp(old[j].label, r->label) != 0; j++) ;
+        r->soft = soft;
+        r->vmid = soft ? -1 : j < n_old ? old[j].vmid : -2;
+        if (soft) snprintf(r->desc, sizeof(r->desc), "softirq");
+        if (r->vmid == -2) resolve = 1;
+        r->rate = r->top_pct = 0;
+        r->top_cpu = -1;
+        r->n_cpus = 0;
+        r->collide = 0;
+        if (!f->primed || j >= n_old || dt <= 0) continue;
+
+        const uint64_t *c = f->cnt[f->cur] + i * (size_t)f->n_cols;
+        const uint64_t *o = f->cnt[f->cur ^ 1] + j * (size_t)f->n_cols;
+        int dev = isdigit((unsigned char)r->label[0]);
+        double top = 0;
+        for (int k = 0; k < f->n_cols; k++) {
+            if (c[k] <= o[k]) continue;
+            double rate = (double)(c[k] - o[k]) / dt;
+            irq_cpu_t *pc = irq_cpu(st, f->col_cpu[k]);
+            r->rate += rate;
+            r->n_cpus++;
+            if (rate > top) { top = rate; r->top_cpu = f->col_cpu[k]; }
+            if (!soft) {
+                if (dev) pc->dev += rate; else pc->arch += rate;
+            } else {
+                pc->soft += rate;
+                if (strcmp(r->label, "NET_RX") == 0) pc->net_rx += rate;
+                else if (strcmp(r->label, "NET_TX") == 0) pc->net_tx += rate;
+                else if (strcmp(r->label, "BLOCK") == 0) pc->block += rate;
+            }
+        }
+        if (r->rate > 0) r->top_pct = 100.0 * top / r->rate;
+    }
+    return resolve;
+}
+
+// VMs holding /dev/vfio/<group> open, as {group, vmid} pairs
+static size_t irq_vfio_groups(const vec_t *proc, int (**out)[2]) {
+    size_t n = 0, cap = 0;
+    for (size_t i = 0; i < proc->len; i++) {
+        int vmid = cmd_vmid(proc->data[i].cmd);
+        if (vmid <= 0) continue;
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/fd", proc->data[i].tgid);
+        DIR *d = opendir(path);
+        if (!d) continue;
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            char link[330], target[64];
+            snprintf(link, sizeof(link), "%s/%s", path, de->d_name);
+            ssize_t len = readlink(link, target, sizeof(target) - 1);
+            if (len < 11) continue;
+            target[len] = '\0';
+            if (strncmp(target, "/dev/vfio/", 10) != 0 || !isdigit((unsigned char)target[10])) continue;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 16;
+                *out = grow_array(*out, cap, sizeof(**out));
+            }
+            (*out)[n][0] = atoi(target + 10);
+            (*out)[n][1] = vmid;
+            n++;
+        }
+        closedir(d);
+    }
+    return n;
+}
+
+// vfio handlers are named after the device: "vfio-msix[3](0000:3b:00.1)".
+// Copies the PCI address out; -1 if the name has none.
+static int irq_vfio_addr(const char *desc, char *addr, size_t size) {
+    const char *v = strstr(desc, "vfio-");
+    const char *open = v ? strchr(v, '(') : NULL;
+    const char *close = open ? strchr(open, ')') : NULL;
+    if (!close || close - open < 2 || (size_t)(close - open) > size || memchr(open, '/', (size_t)(close - open))) return -1;
+    snprintf(addr, size, "%.*s", (int)(close - open - 1), open + 1);
+    return 0;
+}
+
+static int irq_vfio_vmid(const char *desc, int (*groups)[2], size_t n_groups) {
+    char addr[32], path[128], target[128];
+    if (irq_vfio_addr(desc, addr, sizeof(addr)) != 0) return -1;
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/iommu_group", addr);
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len <= 0) return -1;
+    target[len] = '\0';
+    const char *slash = strrchr(target, '/');
+    int group = atoi(slash ? slash + 1 : target);
+    for (size_t i = 0; i < n_groups; i++) if (groups[i][0] == group) return groups[i][1];
+    return -1;
+}
+
+static void irq_resolve(irq_file_t *f, const vec_t *proc) {
+    int (*groups)[2] = NULL;
+    size_t n_groups = 0;
+    int have_groups = 0;
+    for (size_t i = 0; i < f->n[f->cur]; i++) {
+        irq_row_t *r = &f->rows[f->cur][i];
+        r->vmid = -1;
+        if (strstr(r->desc, "vfio-")) {
+            if (!have_groups) { n_groups = irq_vfio_groups(proc, &groups); have_groups = 1; }
+            r->vmid = irq_vfio_vmid(r->desc, groups, n_groups);
+        }
+    }
+    free(groups);
+}
+
+// vCPU threads whose affinity is a single CPU. The VM comes from the thread
+// rows' command line, as in topology_update().
+static void irq_pinned(irqstat_t *st, const vec_t *raw) {
+    pid_t vm_tgid = 0;
+    int vmid = -1;
+    st->pinned = 0;
+    for (size_t i = 0; i < raw->len; i++) {
+        const sample_t *s = &raw->data[i];
+        int vcpu;
+        if (sscanf(s->comm, "CPU %d/KVM", &vcpu) != 1) continue;
+        cpu_set_t set;
+        if (sched_getaffinity(s->pid, sizeof(set), &set) != 0 || CPU_COUNT(&set) != 1) continue;
+        int cpu = 0;
+        while (cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &set)) cpu++;
+        if (s->tgid != vm_tgid) {
+            vm_tgid = s->tgid;
+            vmid = cmd_vmid(s->cmd);
+        }
+        irq_cpu_t *pc = irq_cpu(st, cpu);
+        size_t len = strlen(pc->pinned);
+        if (len + 16 < sizeof(pc->pinned)) snprintf(pc->pinned + len, sizeof(pc->pinned) - len, "%s%d:%d", len ? " " : "", vmid, vcpu);
+        st->pinned++;
+    }
+}
+
+static int cmp_irq_cpu_load(const void *a, const void *b) {
+    const irq_cpu_t *x = (const irq_cpu_t *)a, *y = (const irq_cpu_t *)b;
+    if (x->online != y->online) return y->online - x->online;
+    if (x->collide != y->collide) return y->collide - x->collide;
+    double lx = x->dev + x->net_rx + x->net_tx + x->block, ly = y->dev + y->net_rx + y->net_tx + y->block;
+    if (lx != ly) return lx < ly ? 1 : -1;
+    return x->cpu - y->cpu;
+}
+
+// Once per refresh while the view is shown. The first call only primes.
+static void irqstat_collect(irqstat_t *st, const vec_t *raw, const vec_t *proc) {
+    if (!st->hard.pf.path) {
+        st->hard.pf = (proc_file_t){ "/proc/interrupts", -1, NULL, 0, 0 };
+        st->softf.pf = (proc_file_t){ "/proc/softirqs", -1, NULL, 0, 0 };
+    }
+    double now = now_monotonic(), dt = now - st->t_last;
+    int ok_hard = irq_file_parse(&st->hard) == 0;
+    int ok_soft = irq_file_parse(&st->softf) == 0;
+    st->t_last = now;
+
+    // CPU slots are rebuilt in number order; display sorting moved them
+    if (st->cpus_cap) memset(st->cpus, 0, (size_t)st->cpus_cap * sizeof(irq_cpu_t));
+    st->n_cpus = 0;
+    for (int k = 0; ok_hard && k < st->hard.n_cols; k++) irq_cpu(st, st->hard.col_cpu[k])->online = 1;
+
+    int resolve = 0;
+    if (ok_hard) resolve |= irq_file_delta(st, &st->hard, 0, dt);
+    if (ok_soft) irq_file_delta(st, &st->softf, 1, dt);
+    if (ok_hard && (resolve || st->refreshes % IRQ_RESOLVE_EVERY == 0)) irq_resolve(&st->hard, proc);
+    st->refreshes++;
+    st->hard.primed = ok_hard;
+    st->softf.primed = ok_soft;
+
+    irq_pinned(st, raw);
+    st->collisions = 0;
+    for (int i = 0; i < st->n_cpus; i++) {
+        irq_cpu_t *pc = &st->cpus[i];
+        pc->collide = pc->online && pc->pinned[0] && pc->dev + pc->net_rx + pc->net_tx + pc->block >= IRQ_COLLIDE_RATE;
+        st->collisions += pc->collide;
+    }
+
+    st->n_view = 0;
+    irq_file_t *files[2] = { &st->hard, &st->softf };
+    for (int fi = 0; fi < 2; fi++) {
+        irq_file_t *f = files[fi];
+        for (size_t i = 0; (fi ? ok_soft : ok_hard) && i < f->n[f->cur]; i++) {
+            irq_row_t *r = &f->rows[f->cur][i];
+            // Only sources that feed the collision count are flagged
+            int counted = r->soft ? (strcmp(r->label, "NET_RX") == 0 || strcmp(r->label, "NET_TX") == 0 || strcmp(r->label, "BLOCK") == 0)
+                                  : isdigit((unsigned char)r->label[0]);
+            r->collide = counted && r->top_cpu >= 0 && r->top_cpu < st->n_cpus && st->cpus[r->top_cpu].collide;
+            if (st->n_view == st->view_cap) {
+                st->view_cap = st->view_cap ? st->view_cap * 2 : 256;
+                st->view = grow_array(st->view, st->view_cap, sizeof(irq_row_t));
+            }
+            st->view[st->n_view++] = *r;
+        }
+    }
+    sort_rows(st->cpus, (size_t)st->n_cpus, sizeof(irq_cpu_t), cmp_irq_cpu_load);
+}
+
+// Entering the view: the next refresh measures from now
+static void irqstat_prime(irqstat_t *st, const vec_t *raw, const vec_t *proc) {
+    st->hard.primed = st->softf.primed = 0;
+    irqstat_collect(st, raw, proc);
+}
+
+static void irqstat_free(irqstat_t *st) {
+    irq_file_t *files[2] = { &st->hard, &st->softf };
+    for (int fi = 0; fi < 2; fi++) {
+        irq_file_t *f = files[fi];
+        if (f->pf.path) proc_file_close(&f->pf);
+        free(f->col_cpu);
+        for (int b = 0; b < 2; b++) { free(f->rows[b]); free(f->cnt[b]); }
+    }
+    free(st->view);
+    free(st->cpus);
+    memset(st, 0, sizeof(*st));
+}
+
+#ifdef DEBUG
+// /proc/interrupts as a host with a passed-through NIC lists it, read twice
+// from a scratch file: the vfio vector must parse, rate and name its device,
+// and the guest-side virtio vector must not be credited to any VM.
+static void irq_selftest(void) {
+    static const char *const text[2] = {
+        "           CPU0       CPU1       CPU2       CPU3       \n"
+        "  0:         44          0          0          0   IO-APIC   2-edge      timer\n"
+        " 58:          0      20000          0          0   PCI-MSIX-0000:00:03.0   1-edge      virtio0-input.0\n"
+        "147:          0          0     123456          0   IR-PCI-MSIX-0000:3b:00.1    3-edge      vfio-msix[3](0000:3b:00.1)\n"
+        "NMI:          1          2          3          4   Non-maskable interrupts\n"
+        "LOC:     100000     200000     300000     400000   Local timer interrupts\n"
+        "ERR:          0\n"
+        "MIS:          0\n",
+        "           CPU0       CPU1       CPU2       CPU3       \n"
+        "  0:         44          0          0          0   IO-APIC   2-edge      timer\n"
+        " 58:          0      20100          0          0   PCI-MSIX-0000:00:03.0   1-edge      virtio0-input.0\n"
+        "147:          0          0     128456          0   IR-PCI-MSIX-0000:3b:00.1    3-edge      vfio-msix[3](0000:3b:00.1)\n"
+        "NMI:          1          2          3          4   Non-maskable interrupts\n"
+        "LOC:     101000     201000     301000     401000   Local timer interrupts\n"
+        "ERR:          0\n"
+        "MIS:          0\n",
+    };
+    char path[] = "/tmp/kvmtop-irq-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return;
+    irqstat_t st;
+    memset(&st, 0, sizeof(st));
+    st.hard.pf = (proc_file_t){ path, -1, NULL, 0, 0 };
+    int bad = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, text[pass], strlen(text[pass]), 0) != (ssize_t)strlen(text[pass]) ||
+            irq_file_parse(&st.hard) != 0) { bad++; break; }
+        irq_file_delta(&st, &st.hard, 0, 1.0);
+        st.hard.primed = 1;
+    }
+    vec_t none;
+    vec_init(&none);
+    irq_resolve(&st.hard, &none);
+    const irq_row_t *rows = st.hard.rows[st.hard.cur];
+    char addr[32] = "";
+    if (st.hard.n_cols != 4 || st.hard.n[st.hard.cur] != 5) bad++;
+    else {
+        const irq_row_t *vfio = &rows[2], *virtio = &rows[1];
+        if (strcmp(vfio->label, "147") != 0 || vfio->rate != 5000 || vfio->top_cpu != 2 || vfio->n_cpus != 1) bad++;
+        if (strcmp(vfio->desc, "IR-PCI-MSIX-0000:3b:00.1 3-edge vfio-msix[3](0000:3b:00.1)") != 0) bad++;
+        if (irq_vfio_addr(vfio->desc, addr, sizeof(addr)) != 0 || strcmp(addr, "0000:3b:00.1") != 0) bad++;
+        if (virtio->vmid != -1 || virtio->rate != 100 || strcmp(rows[4].label, "LOC") != 0 || rows[4].n_cpus != 4) bad++;
+    }
+    fprintf(stderr, "DEBUG: interrupts parse %d mismatches (vfio device %s)\n", bad, addr[0] ? addr : "-");
+    unlink(path);
+    close(fd);
+    irqstat_free(&st);
+}
+#endif
+
+// --- VM Pressure ---
+// CFS throttling and pressure stall information (PSI) per VM cgroup. A VM
+// at its cpu.max quota can look idle in CPU% while its vCPUs sit throttled,
+// and a VM stalled on memory reclaim or I/O shows little CPU at all; both
+// are only visible in the cgroup's cpu.stat and *.pressure files. The
+// cgroup of each QEMU process is looked up once, when the VM first shows
+// up, and its four files are kept open and re-read with pread(), so a
+// refresh costs four syscalls per VM. cgroup v1 hosts have no PSI; their
+// throttling counters come from the v1 cpu controller.
+#define CG_QUOTA_EVERY 30      // Refreshes between cpu.max re-reads
+
+enum { PSI_CPU, PSI_IO, PSI_MEM, PSI_N };
+static const char *const psi_names[PSI_N] = { "cpu", "io", "memory" };
+
+typedef struct {
+    int vmid;
+    pid_t tgid;
+    char name[64];
+    double cpu_pct;            // Of the QEMU process, as in the process view
+    double quota;              // CPUs allowed by the quota, -1 unlimited
+    double thr_ps;             // CFS periods throttled per second
+    double thr_pct;            // Share of the periods that were throttled
+    double thr_ms;             // Throttled time per second, summed over CPUs
+    double stall[PSI_N][2];    // some/full stall, % of the interval; -1 unavailable
+    char cgroup[96];
+} cg_row_t;
+
+typedef struct {
+    pid_t tgid;
+    int vmid;
+    int fd_stat;               // cpu.stat, v2 or the v1 cpu controller
+    int fd_psi[PSI_N];
+    int have_thr, have_psi[PSI_N];  // Previous read gave the counters
+    uint64_t periods, throttled, throttled_us;
+    uint64_t psi[PSI_N][2];    // some/full total=, microseconds
+    double quota;
+    char quota_path[160];      // cpu.max, or cpu.cfs_quota_us on v1
+    char cgroup[96];
+} cg_vm_t;
+
+typedef struct {
+    pid_t tgid;
+    int vmid;
+    uint32_t idx;              // Row in the process list
+} cg_pick_t;
+
+typedef struct {
+    int ready;
+    char root2[128];           // cgroup2 mount, "" if none
+    char root_cpu[128];        // v1 cpu controller mount, "" if none
+    cg_vm_t *vms[2];           // Current and previous refresh, sorted by TGID
+    size_t n[2], cap[2];
+    int cur;
+    cg_pick_t *pick;           // The VMs of the process list, sorted by TGID
+    size_t pick_cap;
+    cg_row_t *rows;            // Sorted for display
+    size_t n_rows, rows_cap;
+    int host_fd[PSI_N];
+    int host_have[PSI_N];
+    uint64_t host_psi[PSI_N][2];
+    double host_stall[PSI_N][2];
+    double t_last;
+    unsigned refreshes;
+    int throttled;             // VMs throttled in the last interval
+} cgstat_t;
+
+static double get_cg_quota(const void *row) { return ((const cg_row_t *)row)->quota; }
+static double get_cg_thr_ps(const void *row) { return ((const cg_row_t *)row)->thr_ps; }
+static double get_cg_thr_pct(const void *row) { return ((const cg_row_t *)row)->thr_pct; }
+static double get_cg_thr_ms(const void *row) { return ((const cg_row_t *)row)->thr_ms; }
+static double get_cg_cpu_some(const void *row) { return ((const cg_row_t *)row)->stall[PSI_CPU][0]; }
+static double get_cg_cpu_full(const void *row) { return ((const cg_row_t *)row)->stall[PSI_CPU][1]; }
+static double get_cg_io_some(const void *row) { return ((const cg_row_t *)row)->stall[PSI_IO][0]; }
+static double get_cg_io_full(const void *row) { return ((const cg_row_t *)row)->stall[PSI_IO][1]; }
+static double get_cg_mem_some(const void *row) { return ((const cg_row_t *)row)->stall[PSI_MEM][0]; }
+static double get_cg_mem_full(const void *row) { return ((const cg_row_t *)row)->stall[PSI_MEM][1]; }
+
+static const column_t cg_columns[] = {
+    { "VMID", NULL, 8, 0, 0, COL_INT, offsetof(cg_row_t, vmid), 1, NULL, NULL, SORT_CG_VMID, 1, 0, HL_NONE },
+    { "PID", NULL, 8, 0, 0, COL_INT, offsetof(cg_row_t, tgid), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+    { "CPU%", "CPU_pct", 8, 1, 0, COL_F64, offsetof(cg_row_t, cpu_pct), 1, NULL, NULL, SORT_CG_CPU, 2, 0, HL_CPU },
+    { "Quota", "Quota_CPUs", 6, 2, 0, COL_FN, 0, 1, get_cg_quota, NULL, 0, 0, 0, HL_NONE },
+    { "Thr/s", "Throttled_per_s", 7, 1, 0, COL_FN, 0, 1, get_cg_thr_ps, NULL, 0, 0, 0, HL_NONE },
+    { "Thr%", "Throttled_pct", 8, 1, 0, COL_FN, 0, 1, get_cg_thr_pct, NULL, SORT_CG_THR, 3, 0, HL_STALL },
+    { "ThrMs/s", "Throttled_ms_per_s", 8, 1, 0, COL_FN, 0, 1, get_cg_thr_ms, NULL, 0, 0, 0, HL_NONE },
+    { "CPU_s%", "CPU_some_pct", 10, 1, 0, COL_FN, 0, 1, get_cg_cpu_some, NULL, SORT_CG_CPU_SOME, 4, 0, HL_STALL },
+    { "CPU_f%", "CPU_full_pct", 7, 1, 0, COL_FN, 0, 1, get_cg_cpu_full, NULL, SORT_CG_CPU_FULL, 0, 0, HL_STALL },
+    { "IO_s%", "IO_some_pct", 9, 1, 0, COL_FN, 0, 1, get_cg_io_some, NULL, SORT_CG_IO_SOME, 5, 0, HL_STALL },
+    { "IO_f%", "IO_full_pct", 7, 1, 0, COL_FN, 0, 1, get_cg_io_full, NULL, SORT_CG_IO_FULL, 0, 0, HL_STALL },
+    { "MEM_s%", "MEM_some_pct", 10, 1, 0, COL_FN, 0, 1, get_cg_mem_some, NULL, SORT_CG_MEM_SOME, 6, 0, HL_STALL },
+    { "MEM_f%", "MEM_full_pct", 7, 1, 0, COL_FN, 0, 1, get_cg_mem_full, NULL, SORT_CG_MEM_FULL, 0, 0, HL_STALL },
+    { "Name", "VM_Name", 16, 0, COLF_LEFT | COLF_QUOTE, COL_STR, offsetof(cg_row_t, name), 1, NULL, NULL, SORT_CG_NAME, 0, 0, HL_NONE },
+    { "Cgroup", NULL, 0, 0, COLF_LEFT | COLF_FILL | COLF_QUOTE, COL_STR, offsetof(cg_row_t, cgroup), 1, NULL, NULL, 0, 0, 0, HL_NONE },
+};
+static const table_t cg_table = TABLE(cg_columns, cg_row_t);
+
+// Whole small file at offset 0 into buf; length or -1
+static ssize_t cg_pread(int fd, char *buf, size_t len) {
+    if (fd < 0) return -1;
+    file_reads++;
+    ssize_t n;
+    do n = pread(fd, buf, len - 1, 0); while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+// "some avg10=0.00 avg60=0.00 avg300=0.00 total=1234\nfull ..." -> totals.
+// cpu.pressure has no "full" line before 5.13; it then reads as 0.
+static int psi_parse(const char *buf, uint64_t total[2]) {
+    int found = 0;
+    total[0] = total[1] = 0;
+    for (const char *p = buf; *p; p = next_line(p)) {
+        int full = strncmp(p, "full", 4) == 0;
+        if (!full && strncmp(p, "some", 4) != 0) continue;
+        const char *t = strstr(p, "total=");
+        if (!t) continue;
+        t += 6;
+        total[full] = scan_u64(&t);
+        found = 1;
+    }
+    return found ? 0 : -1;
+}
+
+// Stall % of the interval from two reads of the same file
+static void psi_delta(int fd, int *have, uint64_t prev[2], double out[2], double dt) {
+    char buf[256];
+    uint64_t now[2];
+    out[0] = out[1] = -1;
+    if (cg_pread(fd, buf, sizeof(buf)) < 0 || psi_parse(buf, now) != 0) { *have = 0; return; }
+    if (*have && dt > 0)
+        for (int k = 0; k < 2; k++) out[k] = now[k] >= prev[k] ? (double)(now[k] - prev[k]) / (dt * 1e4) : 0;
+    prev[0] = now[0]; prev[1] = now[1];
+    *have = 1;
+}
+
+// cgroup2 and v1 cpu controller mount points from mountinfo
+static void cg_find_mounts(cgstat_t *st) {
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (!f) return;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        // id parent dev root mountpoint options [tags] - fstype source superoptions
+        char mnt[128], fstype[32], super[256];
+        const char *sep = strstr(line, " - ");
+        if (!sep || sscanf(line, "%*s %*s %*s %*s %127s", mnt) != 1) continue;
+        if (sscanf(sep + 3, "%31s %*s %255s", fstype, super) != 2) continue;
+        if (strcmp(fstype, "cgroup2") == 0 && !st->root2[0]) {
+            snprintf(st->root2, sizeof(st->root2), "%s", mnt);
+        } else if (strcmp(fstype, "cgroup") == 0 && !st->root_cpu[0]) {
+            char *save = NULL;
+            for (char *o = strtok_r(super, ",", &save); o; o = strtok_r(NULL, ",", &save))
+                if (strcmp(o, "cpu") == 0) snprintf(st->root_cpu, sizeof(st->root_cpu), "%s", mnt);
+        }
+    }
+    fclose(f);
+}
+
+static int cg_open(const char *dir, const char *file) {
+    char path[PATH_MAX];
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", dir, file) >= sizeof(path)) return -1;
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// CPUs allowed by cpu.max ("200000 100000", "max 100000") or the v1 pair
+static double cg_read_quota(const char *path) {
+    char buf[64];
+    ssize_t n = 0;
+    long long quota = -1, period = 0;
+    if (!path[0] || read_small_file(path, buf, sizeof(buf), &n) != 0 || n <= 0) return -1;
+    if (strstr(path, "cfs_quota_us")) {
+        char ppath[PATH_MAX];
+        snprintf(ppath, sizeof(ppath), "%.*scfs_period_us", (int)(strlen(path) - strlen("cfs_quota_us")), path);
+        quota = atoll(buf);
+        if (read_small_file(ppath, buf, sizeof(buf), &n) == 0) period = atoll(buf);
+    } else if (strncmp(buf, "max", 3) != 0 && sscanf(buf, "%lld %lld", &quota, &period) != 2) {
+        return -1;
+    }
+    return quota > 0 && period > 0 ? (double)quota / (double)period : -1;
+}
+
+// First sight of a VM: find its cgroups and open the files
+static void cg_vm_open(cgstat_t *st, cg_vm_t *v, pid_t tgid, int vmid) {
+    memset(v, 0, sizeof(*v));
+    v->tgid = tgid;
+    v->vmid = vmid;
+    v->fd_stat = -1;
+    for (int k = 0; k < PSI_N; k++) v->fd_psi[k] = -1;
+    v->quota = -1;
+
+    char path[64], buf[4096], dir[PATH_MAX];
+    ssize_t n = 0;
+    snprintf(path, sizeof(path), "/proc/%d/cgroup", tgid);
+    if (read_small_file(path, buf, sizeof(buf), &n) != 0) return;
+
+    // "0::/qemu.slice/101.scope" on v2, "4:cpu,cpuacct:/..." for v1 controllers
+    const char *v2 = NULL, *v1cpu = NULL;
+    size_t v2_len = 0, v1_len = 0;
+    for (const char *p = buf; *p; p = next_line(p)) {
+        const char *c1 = strchr(p, ':'), *eol = next_line(p);
+        const char *c2 = c1 ? strchr(c1 + 1, ':') : NULL;
+        if (!c2 || c2 >= eol) continue;
+        size_t len = (size_t)(eol - c2 - 1);
+        if (len && c2[len] == '\n') len--;
+        if (c2 == c1 + 1) { v2 = c2 + 1; v2_len = len; continue; }
+        for (const char *o = c1 + 1; o < c2; ) {
+            size_t w = strcspn(o, ",:");
+            if (w == 3 && strncmp(o, "cpu", 3) == 0) { v1cpu = c2 + 1; v1_len = len; }
+            o += w + 1;
+        }
+    }
+
+    if (v2 && st->root2[0]) {
+        snprintf(v->cgroup, sizeof(v->cgroup), "%.*s", (int)v2_len, v2);
+        snprintf(dir, sizeof(dir), "%s%.*s", st->root2, (int)v2_len, v2);
+        for (int k = 0; k < PSI_N; k++) {
+            char file[32];
+            snprintf(file, sizeof(file), "%s.pressure", psi_names[k]);
+            v->fd_psi[k] = cg_open(dir, file);
+        }
+        // Without the cpu controller cpu.stat has no throttling counters
+        v->fd_stat = cg_open(dir, "cpu.stat");
+        snprintf(v->quota_path, sizeof(v->quota_path), "%.140s/cpu.max", dir);
+    }
+    if (v1cpu && st->root_cpu[0]) {
+        snprintf(dir, sizeof(dir), "%s%.*s", st->root_cpu, (int)v1_len, v1cpu);
+        if (!v->cgroup[0]) snprintf(v->cgroup, sizeof(v->cgroup), "%.*s", (int)v1_len, v1cpu);
+        int fd = cg_open(dir, "cpu.stat");
+        if (fd >= 0) {
+            if (v->fd_stat >= 0) close(v->fd_stat);
+            v->fd_stat = fd;
+            snprintf(v->quota_path, sizeof(v->quota_path), "%.140s/cpu.cfs_quota_us", dir);
+        }
+    }
+    v->quota = cg_read_quota(v->quota_path);
+}
+
+static void cg_vm_close(cg_vm_t *v) {
+    if (v->fd_stat >= 0) close(v->fd_stat);
+    v->fd_stat = -1;
+    for (int k = 0; k < PSI_N; k++) {
+        if (v->fd_psi[k] >= 0) close(v->fd_psi[k]);
+        v->fd_psi[k] = -1;
+    }
+}
+
+// Throttling counters of one refresh into r
+static void cg_vm_throttle(cg_vm_t *v, cg_row_t *r, double dt) {
+    char buf[512];
+    uint64_t periods = 0, throttled = 0, us = 0;
+    int found = 0;
+    r->thr_ps = r->thr_pct = r->thr_ms = -1;
+    if (cg_pread(v->fd_stat, buf, sizeof(buf)) < 0) { v->have_thr = 0; return; }
+    for (const char *p = buf; *p; p = next_line(p)) {
+        const char *w;
+        size_t len = scan_word(&p, &w);
+        if (len == 10 && strncmp(w, "nr_periods", 10) == 0) periods = scan_u64(&p);
+        else if (len == 12 && strncmp(w, "nr_throttled", 12) == 0) throttled = scan_u64(&p), found = 1;
+        else if (len == 14 && strncmp(w, "throttled_usec", 14) == 0) us = scan_u64(&p);
+        else if (len == 14 && strncmp(w, "throttled_time", 14) == 0) us = scan_u64(&p) / 1000;  // v1: ns
+    }
+    if (!found) { v->have_thr = 0; return; }
+    if (v->have_thr && dt > 0 && periods >= v->periods && throttled >= v->throttled && us >= v->throttled_us) {
+        uint64_t dp = periods - v->periods, dthr = throttled - v->throttled;
+        r->thr_ps = (double)dthr / dt;
+        r->thr_pct = dp ? 100.0 * (double)dthr / (double)dp : 0;
+        r->thr_ms = (double)(us - v->throttled_us) / 1000.0 / dt;
+    }
+    v->periods = periods;
+    v->throttled = throttled;
+    v->throttled_us = us;
+    v->have_thr = 1;
+}
+
+static int cmp_cg_pick(const void *a, const void *b) {
+    const cg_pick_t *x = (const cg_pick_t *)a, *y = (const cg_pick_t *)b;
+    return (x->tgid > y->tgid) - (x->tgid < y->tgid);
+}
+
+// Once per refresh while the view is shown, with proc in any order. The
+// first call only primes.
+static void cgstat_collect(cgstat_t *st, const vec_t *proc) {
+    if (!st->ready) {
+        cg_find_mounts(st);
+        for (int k = 0; k < PSI_N; k++) {
+            char path[32];
+            snprintf(path, sizeof(path), "/proc/pressure/%s", psi_names[k]);
+            st->host_fd[k] = open(path, O_RDONLY | O_CLOEXEC);
+        }
+        // Four descriptors per VM stay open; allow as many as the hard limit
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+        st->ready = 1;
+    }
+    double now = now_monotonic(), dt = now - st->t_last;
+    st->t_last = now;
+    for (int k = 0; k < PSI_N; k++) psi_delta(st->host_fd[k], &st->host_have[k], st->host_psi[k], st->host_stall[k], dt);
+
+    // The VMs of the process list, by TGID whatever order the list is in
+    size_t n_pick = 0;
+    for (size_t i = 0; i < proc->len; i++) {
+        int vmid = cmd_vmid(proc->data[i].cmd);
+        if (vmid <= 0) continue;
+        if (n_pick == st->pick_cap) {
+            st->pick_cap = st->pick_cap ? st->pick_cap * 2 : 64;
+            st->pick = grow_array(st->pick, st->pick_cap, sizeof(cg_pick_t));
+        }
+        st->pick[n_pick++] = (cg_pick_t){ proc->data[i].tgid, vmid, (uint32_t)i };
+    }
+    sort_rows(st->pick, n_pick, sizeof(cg_pick_t), cmp_cg_pick);
+
+    // Merge them into the TGID-sorted VM list: VMs seen before keep their
+    // descriptors, new ones are opened, gone ones closed
+    cg_vm_t *old = st->vms[st->cur];
+    size_t n_old = st->n[st->cur], j = 0;
+    int nxt = st->cur ^ 1;
+    st->n[nxt] = 0;
+    st->n_rows = 0;
+    st->throttled = 0;
+    int requota = st->refreshes % CG_QUOTA_EVERY == 0;
+    for (size_t i = 0; i < n_pick; i++) {
+        const sample_t *s = &proc->data[st->pick[i].idx];
+        int vmid = st->pick[i].vmid;
+        while (j < n_old && (old[j].tgid < s->tgid || (old[j].tgid == s->tgid && old[j].vmid != vmid))) cg_vm_close(&old[j++]);
+        if (st->n[nxt] == st->cap[nxt]) {
+            st->cap[nxt] = st->cap[nxt] ? st->cap[nxt] * 2 : 64;
+            st->vms[nxt] = grow_array(st->vms[nxt], st->cap[nxt], sizeof(cg_vm_t));
+        }
+        cg_vm_t *v = &st->vms[nxt][st->n[nxt]++];
+        if (j < n_old && old[j].tgid == s->tgid && old[j].vmid == vmid) {
+            *v = old[j++];
+            if (requota) v->quota = cg_read_quota(v->quota_path);
+        } else {
+            cg_vm_open(st, v, s->tgid, vmid);
+        }
+
+        if (st->n_rows == st->rows_cap) {
+            st->rows_cap = st->rows_cap ? st->rows_cap * 2 : 64;
+            st->rows = grow_array(st->rows, st->rows_cap, sizeof(cg_row_t));
+        }
+        cg_row_t *r = &st->rows[st->n_rows++];
+        r->vmid = vmid;
+        r->tgid = s->tgid;
+        r->cpu_pct = s->cpu_pct;
+        r->quota = v->quota;
+        r->name[0] = '\0';
+        const char *name = strstr(s->cmd, " -name ");
+        if (name) {
+            name += 7;
+            size_t len = strcspn(name, " ,");
+            if (len >= sizeof(r->name)) len = sizeof(r->name) - 1;
+            memcpy(r->name, name, len);
+            r->name[len] = '\0';
+        }
+        memcpy(r->cgroup, v->cgroup, sizeof(r->cgroup));
+        cg_vm_throttle(v, r, dt);
+        for (int k = 0; k < PSI_N; k++) psi_delta(v->fd_psi[k], &v->have_psi[k], v->psi[k], r->stall[k], dt);
+        if (r->thr_ps > 0) st->throttled++;
+    }
+    while (j < n_old) cg_vm_close(&old[j++]);
+    st->cur = nxt;
+    st->refreshes++;
+}
+
+// Entering the view: the next refresh measures from now
+static void cgstat_prime(cgstat_t *st, const vec_t *proc) {
+    cg_vm_t *v = st->vms[st->cur];
+    for (size_t i = 0; i < st->n[st->cur]; i++) {
+        v[i].have_thr = 0;
+        for (int k = 0; k < PSI_N; k++) v[i].have_psi[k] = 0;
+    }
+    for (int k = 0; k < PSI_N; k++) st->host_have[k] = 0;
+    cgstat_collect(st, proc);
+}
+
+static void cgstat_free(cgstat_t *st) {
+    for (size_t i = 0; i < st->n[st->cur]; i++) cg_vm_close(&st->vms[st->cur][i]);
+    for (int k = 0; st->ready && k < PSI_N; k++) if (st->host_fd[k] >= 0) close(st->host_fd[k]);
+    free(st->vms[0]);
+    free(st->vms[1]);
+    free(st->pick);
+    free(st->rows);
+    memset(st, 0, sizeof(*st));
+}
+
+// --- Shared Snapshot Ring ---
+// In --daemon mode one collector publishes every refresh into a ring of
+// snapshot slots in an mmap'd file; --attach viewers map the same file
+// read-only and render from it without touching /proc. Each slot is guarded
+// by a seqlock: the collector never waits for readers, and a reader that
+// raced with a write simply retries on the newest slot. A viewer that stalls
+// or crashes cannot affect the collector because it never writes.
+#define SHM_DEFAULT_PATH "/run/kvmtop/snapshots"
+#define SHM_MAGIC   0x6b766d74u  // "kvmt"
+#define SHM_VERSION 1
+#define SHM_SLOTS   4
+#define SHM_HDR_SIZE 4096
+
+// Thread records are stored without cmd (the last member of sample_t); the
+// viewer copies it back from the owning process record.
+#define SHM_THREAD_REC ((size_t)offsetof(sample_t, cmd))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sample_size;      // sizeof() checks: viewer must match the collector build
+    uint32_t net_size;
+    uint32_t disk_size;
+    uint32_t slot_count;
+    uint64_t slot_size;        // Bytes per slot, including shm_slot_t
+    uint32_t retired;          // Set once the file has been replaced by a larger one
+    int32_t daemon_pid;
+    uint64_t published;        // Snapshots written so far; newest is in slot (published-1) % slot_count
+} shm_header_t;
+
+typedef struct {
+    uint64_t seq;              // Odd while the collector is writing this slot
+    double wall_time;          // time() of the sample, to detect a stalled collector
+    double interval;
+    double global_cpu_percent;
+    int32_t system_threads;
+    uint32_t cycle_fetch;
+    uint64_t n_raw, n_proc, n_net, n_disk;
+} shm_slot_t;
+
+typedef struct {
+    char path[PATH_MAX];
+    int fd;
+    void *map;
+    size_t map_len;
+    ino_t ino;
+    uint64_t seen;             // Viewer: last snapshot number rendered
+} shm_ring_t;
+
+static shm_header_t *shm_hdr(const shm_ring_t *r) { return (shm_header_t *)r->map; }
+
+static shm_slot_t *shm_slot(const shm_ring_t *r, uint64_t idx) {
+    return (shm_slot_t *)((char *)r->map + SHM_HDR_SIZE + idx * shm_hdr(r)->slot_size);
+}
+
+static size_t shm_payload_size(size_t n_raw, size_t n_proc, size_t n_net, size_t n_disk) {
+    return sizeof(shm_slot_t) + n_raw * SHM_THREAD_REC + n_proc * sizeof(sample_t) +
+           n_net * sizeof(net_iface_t) + n_disk * sizeof(disk_sample_t);
+}
+
+// Collector: (re)create the ring with room for `need` bytes per slot. The new
+// file is built under a temporary name and renamed into place, so a viewer
+// never maps a half-initialized header.
+static int shm_create(shm_ring_t *r, size_t need) {
+    size_t slot_size = (need + need / 2 + 4095) & ~(size_t)4095;  // 50% headroom
+    size_t len = SHM_HDR_SIZE + SHM_SLOTS * slot_size;
+
+    char dir[PATH_MAX], tmp[PATH_MAX + 8];
+    snprintf(dir, sizeof(dir), "%s", r->path);
+    char *slash = strrchr(dir, '/');
+    if (slash && slash != dir) { *slash = '\0'; mkdir(dir, 0755); }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", r->path);
+
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, (off_t)len) != 0) { close(fd); unlink(tmp); return -1; }
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) { close(fd); unlink(tmp); return -1; }
+
+    shm_header_t *h = (shm_header_t *)map;
+    h->magic = SHM_MAGIC;
+    h->version = SHM_VERSION;
+    h->sample_size = sizeof(sample_t);
+    h->net_size = sizeof(net_iface_t);
+    h->disk_size = sizeof(disk_sample_t);
+    h->slot_count = SHM_SLOTS;
+    h->slot_size = slot_size;
+    h->daemon_pid = (int32_t)getpid();
+    h->published = 0;
+
+    if (rename(tmp, r->path) != 0) { munmap(map, len); close(fd); unlink(tmp); return -1; }
+
+    // Point viewers of the previous file at the new one
+    if (r->map) {
+        __atomic_store_n(&shm_hdr(r)->retired, 1, __ATOMIC_RELEASE);
+        munmap(r->map, r->map_len);
+        close(r->fd);
+    }
+    r->fd = fd;
+    r->map = map;
+    r->map_len = len;
+    return 0;
+}
+
+static int shm_publish(shm_ring_t *r, const vec_t *raw, const vec_t *proc, const vec_net_t *net,
+                       const vec_disk_t *disk, double interval, double cpu_pct, int threads, unsigned fetch) {
+    size_t need = shm_payload_size(raw->len, proc->len, net->len, disk->len);
+    if ((!r->map || need > shm_hdr(r)->slot_size) && shm_create(r, need) != 0) return -1;
+
+    shm_header_t *h = shm_hdr(r);
+    uint64_t num = h->published;
+    shm_slot_t *s = shm_slot(r, num % h->slot_count);
+
+    uint64_t seq = s->seq;
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    s->wall_time = (double)time(NULL);
+    s->interval = interval;
+    s->global_cpu_percent = cpu_pct;
+    s->system_threads = threads;
+    s->cycle_fetch = fetch;
+    s->n_raw = raw->len; s->n_proc = proc->len; s->n_net = net->len; s->n_disk = disk->len;
+    char *p = (char *)(s + 1);
+    for (size_t i = 0; i < raw->len; i++, p += SHM_THREAD_REC) memcpy(p, &raw->data[i], SHM_THREAD_REC);
+    if (proc->len) memcpy(p, proc->data, proc->len * sizeof(sample_t));
+    p += proc->len * sizeof(sample_t);
+    if (net->len) memcpy(p, net->data, net->len * sizeof(net_iface_t));
+    p += net->len * sizeof(net_iface_t);
+    if (disk->len) memcpy(p, disk->data, disk->len * sizeof(disk_sample_t));
+
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->published, num + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void shm_detach(shm_ring_t *r) {
+    if (r->map) munmap(r->map, r->map_len);
+    if (r->fd >= 0) close(r->fd);
+    r->map = NULL;
+    r->fd = -1;
+}
+
+// Viewer: map the ring read-only and validate that it came from this build
+static int shm_attach(shm_ring_t *r) {
+    shm_detach(r);
+    int fd = open(r->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SHM_HDR_SIZE) { close(fd); return -1; }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) { close(fd); return -1; }
+    const shm_header_t *h = (const shm_header_t *)map;
+    if (h->magic != SHM_MAGIC || h->version != SHM_VERSION || h->sample_size != sizeof(sample_t) ||
+        h->net_size != sizeof(net_iface_t) || h->disk_size != sizeof(disk_sample_t) ||
+        SHM_HDR_SIZE + h->slot_count * h->slot_size > (uint64_t)st.st_size) {
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    if (__atomic_load_n(&h->retired, __ATOMIC_ACQUIRE)) {
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        errno = ESTALE;
+        return -1;
+    }
+    r->fd = fd;
+    r->map = map;
+    r->map_len = (size_t)st.st_size;
+    r->ino = st.st_ino;
+    return 0;
+}
+
+// Viewer: the file was outgrown by the collector, or a restarted collector
+// created a new one under the same path
+static int shm_replaced(const shm_ring_t *r) {
+    if (!r->map || __atomic_load_n(&shm_hdr(r)->retired, __ATOMIC_ACQUIRE)) return 1;
+    struct stat st;
+    return stat(r->path, &st) == 0 && st.st_ino != r->ino;
+}
+
+// Viewer: has the collector published anything newer than what we showed?
+static int shm_has_newer(const shm_ring_t *r) {
+    struct stat st;
+    if (!r->map) return stat(r->path, &st) == 0;  // Collector came back
+    if (shm_replaced(r)) return 1;
+    uint64_t num = __atomic_load_n(&shm_hdr(r)->published, __ATOMIC_ACQUIRE);
+    return num != 0 && num != r->seen;
+}
+
+// Viewer: seconds since the newest snapshot was published
+static double shm_age(const shm_ring_t *r) {
+    if (!r->map) return 1e9;
+    const shm_header_t *h = shm_hdr(r);
+    uint64_t num = __atomic_load_n(&h->published, __ATOMIC_ACQUIRE);
+    if (num == 0) return 0;
+    return (double)time(NULL) - shm_slot(r, (num - 1) % h->slot_count)->wall_time;
+}
+
+// Viewer: copy the newest complete snapshot into the local buffers. Returns
+// 0 on success, -1 if no consistent snapshot could be read.
+static int shm_read_latest(shm_ring_t *r, vec_t *raw, vec_t *proc, vec_net_t *net, vec_disk_t *disk,
+                           double *cpu_pct, int *threads, unsigned *fetch, double *interval) {
+    if (shm_replaced(r) && shm_attach(r) != 0) return -1;
+    for (int attempt = 0; attempt < 8; attempt++) {
+        const shm_header_t *h = shm_hdr(r);
+        uint64_t num = __atomic_load_n(&h->published, __ATOMIC_ACQUIRE);
+        if (num == 0) return -1;
+        shm_slot_t *s = shm_slot(r, (num - 1) % h->slot_count);
+
+        uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        size_t n_raw = s->n_raw, n_proc = s->n_proc, n_net = s->n_net, n_disk = s->n_disk;
+        if (shm_payload_size(n_raw, n_proc, n_net, n_disk) > h->slot_size) continue;  // Torn counts
+
+        vec_clear(raw); vec_reserve(raw, n_raw);
+        vec_clear(proc); vec_reserve(proc, n_proc);
+        vec_net_clear(net);
+        vec_disk_clear(disk);
+        const char *p = (const char *)(s + 1);
+        for (size_t i = 0; i < n_raw; i++, p += SHM_THREAD_REC) {
+            memcpy(&raw->data[i], p, SHM_THREAD_REC);
+            raw->data[i].cmd[0] = '\0';
+        }
+        raw->len = n_raw;
+        if (n_proc) memcpy(proc->data, p, n_proc * sizeof(sample_t));
+        proc->len = n_proc;
+        p += n_proc * sizeof(sample_t);
+        for (size_t i = 0; i < n_net; i++, p += sizeof(net_iface_t)) vec_net_push(net, (const net_iface_t *)p);
+        for (size_t i = 0; i < n_disk; i++, p += sizeof(disk_sample_t)) vec_disk_push(disk, (const disk_sample_t *)p);
+        *cpu_pct = s->global_cpu_percent;
+        *threads = s->system_threads;
+        *fetch = s->cycle_fetch;
+        *interval = s->interval;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) continue;  // Overwritten meanwhile
+
+        // Process records are published sorted by TGID; give threads their command back
+        for (size_t i = 0; i < n_raw; i++) {
+            const sample_t *owner = (const sample_t *)bsearch(&raw->data[i], proc->data, proc->len, sizeof(sample_t), cmp_tgid);
+            if (owner) memcpy(raw->data[i].cmd, owner->cmd, sizeof(owner->cmd));
+        }
+        r->seen = num;
+        return 0;
+    }
+    return -1;
+}
+
+// --- Cluster Stream ---
+// --serve PORT streams one frame per interval to every connected viewer:
+// a host summary plus one record per VM. --cluster connects to several
+// servers at once and merges their VM tables. All integers on the wire are
+// little-endian and fixed width; rates are scaled to integers so a frame is
+// a few dozen bytes per VM.
+//
+//   frame:  'K' 'T' version:u8 type:u8 payload_len:u32
+//   host:   interval_ms:u32 cpu_x100:u16 threads:u16 ram_total:u32 ram_used:u32
+//           swap_total:u32 swap_used:u32 (MiB) vm_count:u16 name_len:u8 name
+//   vm:     vmid:i32 pid:i32 state:u8 cpu_x100:u32 res_mib:u32 r_iops:u32 w_iops:u32
+//           r_kib:u32 w_kib:u32 wait_x100:u32 rx_kbit:u32 tx_kbit:u32 name_len:u8 name
+#define WIRE_VERSION 1
+#define WIRE_SNAPSHOT 1
+#define WIRE_HDR_LEN 8
+#define WIRE_MAX_FRAME (1u << 20)
+#define SERVE_DEFAULT_PORT 7634
+#define SERVE_MAX_CLIENTS 32
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} wire_buf_t;
+
+static void wire_reserve(wire_buf_t *b, size_t extra) {
+    if (b->len + extra <= b->cap) return;
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + extra) cap *= 2;
+    uint8_t *p = (uint8_t *)realloc(b->data, cap);
+    if (!p) { fprintf(stderr, "OOM\n"); exit(2); }
+    b->data = p;
+    b->cap = cap;
+}
+
+static void wire_u8(wire_buf_t *b, uint8_t v) { wire_reserve(b, 1); b->data[b->len++] = v; }
+static void wire_u16(wire_buf_t *b, uint16_t v) { wire_reserve(b, 2); for (int i = 0; i < 2; i++) b->data[b->len++] = (uint8_t)(v >> (8 * i)); }
+static void wire_u32(wire_buf_t *b, uint32_t v) { wire_reserve(b, 4); for (int i = 0; i < 4; i++) b->data[b->len++] = (uint8_t)(v >> (8 * i)); }
+static void wire_str(wire_buf_t *b, const char *s) {
+    size_t n = strlen(s);
+    if (n > 255) n = 255;
+    wire_u8(b, (uint8_t)n);
+    wire_reserve(b, n);
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+
+// Clamp a non-negative double into a scaled u32 field
+static uint32_t wire_scale(double v, double scale) {
+    v *= scale;
+    if (!(v > 0)) return 0;
+    if (v > 4294967295.0) return UINT32_MAX;
+    return (uint32_t)(v + 0.5);
+}
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    int bad;                   // Set when a read ran past the end
+} wire_rd_t;
+
+static uint32_t rd_uint(wire_rd_t *r, int bytes) {
+    if (r->end - r->p < bytes) { r->bad = 1; r->p = r->end; return 0; }
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++) v |= (uint32_t)r->p[i] << (8 * i);
+    r->p += bytes;
+    return v;
+}
+
+static void rd_str(wire_rd_t *r, char *out, size_t out_size) {
+    size_t n = rd_uint(r, 1);
+    if ((size_t)(r->end - r->p) < n) { r->bad = 1; r->p = r->end; n = 0; }
+    size_t keep = n < out_size - 1 ? n : out_size - 1;
+    memcpy(out, r->p, keep);
+    out[keep] = '\0';
+    r->p += n;
+}
+
+typedef struct {
+    uint32_t interval_ms;
+    double cpu_pct;
+    int threads;
+    uint32_t ram_total, ram_used, swap_total, swap_used;
+    char name[64];
+} host_summary_t;
+
+typedef struct {
+    int vmid;
+    pid_t pid;
+    char state;
+    double cpu_pct;
+    double res_mib;
+    double r_iops, w_iops, r_mib, w_mib, wait_ms;
+    double rx_mbps, tx_mbps;
+    char name[64];
+    int node;                  // Cluster viewer: index into the node list
+} vm_summary_t;
+
+// Serialize this host's current interval as one snapshot frame
+static void wire_encode_snapshot(wire_buf_t *b, double interval, double cpu_pct, int threads,
+                                 const vec_t *proc, const vec_net_t *net) {
+    b->len = 0;
+    wire_u8(b, 'K'); wire_u8(b, 'T'); wire_u8(b, WIRE_VERSION); wire_u8(b, WIRE_SNAPSHOT);
+    wire_u32(b, 0);  // Payload length, patched below
+
+    static double page_mib;  // statm counts pages
+    if (page_mib == 0) page_mib = (double)sysconf(_SC_PAGESIZE) / 1048576.0;
+    struct sysinfo si;
+    sysinfo(&si);
+    uint64_t unit = si.mem_unit;
+    uint64_t ram_total = (uint64_t)si.totalram * unit / 1048576;
+    uint64_t ram_used = ram_total - (uint64_t)si.freeram * unit / 1048576 - (uint64_t)si.bufferram * unit / 1048576;
+    uint64_t swap_total = (uint64_t)si.totalswap * unit / 1048576;
+    uint64_t swap_used = swap_total - (uint64_t)si.freeswap * unit / 1048576;
+    char host[64] = "";
+    gethostname(host, sizeof(host) - 1);
+
+    // VMs are the qemu/kvm processes carrying a Proxmox "-id N"
+    uint16_t count = 0;
+    for (size_t i = 0; i < proc->len && count < UINT16_MAX; i++)
+        if (cmd_vmid(proc->data[i].cmd) >= 0) count++;
+
+    wire_u32(b, wire_scale(interval, 1000.0));
+    wire_u16(b, (uint16_t)wire_scale(cpu_pct, 100.0));
+    wire_u16(b, (uint16_t)threads);
+    wire_u32(b, (uint32_t)ram_total); wire_u32(b, (uint32_t)ram_used);
+    wire_u32(b, (uint32_t)swap_total); wire_u32(b, (uint32_t)swap_used);
+    wire_u16(b, count);
+    wire_str(b, host);
+
+    for (size_t i = 0; i < proc->len && count > 0; i++) {
+        const sample_t *s = &proc->data[i];
+        int vmid = cmd_vmid(s->cmd);
+        if (vmid < 0) continue;
+        count--;
+
+        char name[64] = "";
+        const char *name_ptr = strstr(s->cmd, " -name ");
+        if (name_ptr) {
+            name_ptr += 7;
+            size_t n = strcspn(name_ptr, " ,");
+            if (n >= sizeof(name)) n = sizeof(name) - 1;
+            memcpy(name, name_ptr, n);
+            name[n] = '\0';
+        }
+
+        double rx = 0, tx = 0;
+        for (size_t j = 0; j < net->len; j++) {
+            if (net->data[j].vmid != vmid) continue;
+            rx += net->data[j].rx_mbps;
+            tx += net->data[j].tx_mbps;
+        }
 
-// Helper macro for numeric comparison
-#define CMP_NUM(a, b) (sort_desc ? ((a) < (b) ? 1 : ((a) > (b) ? -1 : 0)) : ((a) > (b) ? 1 : ((a) < (b) ? -1 : 0)))
+        wire_u32(b, (uint32_t)vmid);
+        wire_u32(b, (uint32_t)s->tgid);
+        wire_u8(b, (uint8_t)s->state);
+        wire_u32(b, wire_scale(s->cpu_pct, 100.0));
+        wire_u32(b, wire_scale((double)s->mem_res_pages * page_mib, 1.0));
+        wire_u32(b, wire_scale(s->r_iops, 1.0));
+        wire_u32(b, wire_scale(s->w_iops, 1.0));
+        wire_u32(b, wire_scale(s->r_mib, 1024.0));
+        wire_u32(b, wire_scale(s->w_mib, 1024.0));
+        wire_u32(b, wire_scale(s->io_wait_ms, 100.0));
+        wire_u32(b, wire_scale(rx, 1000.0));
+        wire_u32(b, wire_scale(tx, 1000.0));
+        wire_str(b, name);
+    }
 
-static int cmp_pid(const void *a, const void *b) {
-    const sample_t *x = (const sample_t *)a;
-    const sample_t *y = (const sample_t *)b;
-    return CMP_NUM(x->pid, y->pid); 
+    uint32_t payload = (uint32_t)(b->len - WIRE_HDR_LEN);
+    for (int i = 0; i < 4; i++) b->data[4 + i] = (uint8_t)(payload >> (8 * i));
 }
-static int cmp_cpu(const void *a, const void *b) {
-    const sample_t *x = (const sample_t *)a;
-    const sample_t *y = (const sample_t *)b;
-    return CMP_NUM(x->cpu_pct, y->cpu_pct);
+
+// Decode a snapshot payload; VM records are appended to *vms (grown as needed)
+static int wire_decode_snapshot(const uint8_t *payload, size_t len, host_summary_t *host,
+                                vm_summary_t **vms, size_t *vm_cap, size_t *vm_n) {
+    wire_rd_t r = { payload, payload + len, 0 };
+    host->interval_ms = rd_uint(&r, 4);
+    host->cpu_pct = rd_uint(&r, 2) / 100.0;
+    host->threads = (int)rd_uint(&r, 2);
+    host->ram_total = rd_uint(&r, 4); host->ram_used = rd_uint(&r, 4);
+    host->swap_total = rd_uint(&r, 4); host->swap_used = rd_uint(&r, 4);
+    size_t count = rd_uint(&r, 2);
+    rd_str(&r, host->name, sizeof(host->name));
+    if (r.bad) return -1;
+
+    if (*vm_cap < count) {
+        vm_summary_t *p = (vm_summary_t *)realloc(*vms, count * sizeof(*p));
+        if (!p) { fprintf(stderr, "OOM\n"); exit(2); }
+        *vms = p;
+        *vm_cap = count;
+    }
+    *vm_n = 0;
+    for (size_t i = 0; i < count; i++) {
+        vm_summary_t *v = &(*vms)[i];
+        v->vmid = (int32_t)rd_uint(&r, 4);
+        v->pid = (pid_t)(int32_t)rd_uint(&r, 4);
+        v->state = (char)rd_uint(&r, 1);
+        v->cpu_pct = rd_uint(&r, 4) / 100.0;
+        v->res_mib = rd_uint(&r, 4);
+        v->r_iops = rd_uint(&r, 4);
+        v->w_iops = rd_uint(&r, 4);
+        v->r_mib = rd_uint(&r, 4) / 1024.0;
+        v->w_mib = rd_uint(&r, 4) / 1024.0;
+        v->wait_ms = rd_uint(&r, 4) / 100.0;
+        v->rx_mbps = rd_uint(&r, 4) / 1000.0;
+        v->tx_mbps = rd_uint(&r, 4) / 1000.0;
+        rd_str(&r, v->name, sizeof(v->name));
+        if (r.bad) return -1;
+    }
+    *vm_n = count;
+    return 0;
 }
-static int cmp_logr(const void *a, const void *b) {
-    const sample_t *x = (const sample_t *)a;
-    const sample_t *y = (const sample_t *)b;
-    return CMP_NUM(x->r_iops, y->r_iops);
+
+// Server side. Every client has its own output buffer; the collector only
+// ever does non-blocking sends from it. A client that has not drained the
+// previous frame skips the new one, and one that falls too far behind is
+// dropped, so a slow viewer can never hold up collection.
+typedef struct {
+    int fd;
+    wire_buf_t out;
+    size_t sent;               // Bytes of out already written
+    int skipped;               // Consecutive frames skipped while backed up
+} serve_client_t;
+
+static int serve_fd = -1;
+static serve_client_t serve_clients[SERVE_MAX_CLIENTS];
+
+static int serve_open(int port) {
+    for (int i = 0; i < SERVE_MAX_CLIENTS; i++) serve_clients[i].fd = -1;
+
+    // Dual-stack where possible, plain IPv4 otherwise
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1, zero = 0;
+    if (fd >= 0) {
+        struct sockaddr_in6 a6;
+        memset(&a6, 0, sizeof(a6));
+        a6.sin6_family = AF_INET6;
+        a6.sin6_port = htons((uint16_t)port);
+        a6.sin6_addr = in6addr_any;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        if (bind(fd, (struct sockaddr *)&a6, sizeof(a6)) != 0) { close(fd); fd = -1; }
+    }
+    if (fd < 0) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        struct sockaddr_in a4;
+        memset(&a4, 0, sizeof(a4));
+        a4.sin_family = AF_INET;
+        a4.sin_port = htons((uint16_t)port);
+        a4.sin_addr.s_addr = htonl(INADDR_ANY);
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, (struct sockaddr *)&a4, sizeof(a4)) != 0) { close(fd); return -1; }
+    }
+    if (listen(fd, 16) != 0) { close(fd); return -1; }
+    serve_fd = fd;
+    return 0;
 }
-static int cmp_logw(const void *a, const void *b) {
-    const sample_t *x = (const sample_t *)a;
-    const sample_t *y = (const sample_t *)b;
-    return CMP_NUM(x->w_iops, y->w_iops);
+
+static void serve_drop(serve_client_t *c) {
+    close(c->fd);
+    c->fd = -1;
+    c->out.len = 0;
+    c->sent = 0;
 }
-static int cmp_wait(const void *a, const void *b) {
-    const sample_t *x = (const sample_t *)a;
-    const sample_t *y = (const sample_t *)b;
-    return CMP_NUM(x->io_wait_ms, y->io_wait_ms);
+
+static void serve_close(void) {
+    for (int i = 0; i < SERVE_MAX_CLIENTS; i++) {
+        if (serve_clients[i].fd >= 0) serve_drop(&serve_clients[i]);
+        free(serve_clients[i].out.data);
+        serve_clients[i].out.data = NULL;
+    }
+    if (serve_fd >= 0) close(serve_fd);
+    serve_fd = -1;
 }
-static int cmp_rmib(const void *a, const void *b) {
-    const sample_t *x = (const sample_t *)a;
-    const sample_t *y = (const sample_t *)b;
-    return CMP_NUM(x->r_mib, y->r_mib);
+
+static void serve_flush(serve_client_t *c) {
+    while (c->sent < c->out.len) {
+        ssize_t n = send(c->fd, c->out.data + c->sent, c->out.len - c->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) { c->sent += (size_t)n; continue; }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n < 0 && errno == EINTR) continue;
+        serve_drop(c);
+        return;
+    }
+    c->out.len = 0;
+    c->sent = 0;
 }
-static int cmp_wmib(const void *a, const void *b) {
-    const sample_t *x = (const sample_t *)a;
-    const sample_t *y = (const sample_t *)b;
-    return CMP_NUM(x->w_mib, y->w_mib);
+
+static void serve_broadcast(const wire_buf_t *frame) {
+    for (int i = 0; i < SERVE_MAX_CLIENTS; i++) {
+        serve_client_t *c = &serve_clients[i];
+        if (c->fd < 0) continue;
+        if (c->out.len > 0) {
+            // Still busy with an older frame: skip this one, give up eventually
+            if (++c->skipped > 10) serve_drop(c);
+            continue;
+        }
+        c->skipped = 0;
+        wire_reserve(&c->out, frame->len);
+        memcpy(c->out.data, frame->data, frame->len);
+        c->out.len = frame->len;
+        c->sent = 0;
+        serve_flush(c);
+    }
 }
-static int cmp_net_rx(const void *a, const void *b) {
-    const net_iface_t *x = (const net_iface_t *)a;
-    const net_iface_t *y = (const net_iface_t *)b;
-    return CMP_NUM(x->rx_mbps, y->rx_mbps);
+
+// Wait up to `seconds`, accepting new viewers and draining pending output
+static void serve_wait(double seconds) {
+    fd_set rfds, wfds;
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_SET(serve_fd, &rfds);
+    int maxfd = serve_fd;
+    for (int i = 0; i < SERVE_MAX_CLIENTS; i++) {
+        int fd = serve_clients[i].fd;
+        if (fd < 0) continue;
+        FD_SET(fd, &rfds);  // Readable means the viewer hung up (it never sends)
+        if (serve_clients[i].out.len > 0) FD_SET(fd, &wfds);
+        if (fd > maxfd) maxfd = fd;
+    }
+    struct timeval tv = { (long)seconds, (long)((seconds - (double)(long)seconds) * 1e6) };
+    if (select(maxfd + 1, &rfds, &wfds, NULL, &tv) <= 0) return;
+
+    for (int i = 0; i < SERVE_MAX_CLIENTS; i++) {
+        serve_client_t *c = &serve_clients[i];
+        if (c->fd < 0) continue;
+        if (FD_ISSET(c->fd, &rfds)) {
+            char junk[256];
+            ssize_t n = recv(c->fd, junk, sizeof(junk), MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) { serve_drop(c); continue; }
+        }
+        if (FD_ISSET(c->fd, &wfds)) serve_flush(c);
+    }
+
+    if (FD_ISSET(serve_fd, &rfds)) {
+        int fd;
+        while ((fd = accept4(serve_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            int slot = -1;
+            for (int i = 0; i < SERVE_MAX_CLIENTS; i++) if (serve_clients[i].fd < 0) { slot = i; break; }
+            if (slot < 0) { close(fd); continue; }
+            serve_clients[slot].fd = fd;
+            serve_clients[slot].skipped = 0;
+        }
+    }
 }
-static int cmp_net_tx(const void *a, const void *b) {
-    const net_iface_t *x = (const net_iface_t *)a;
-    const net_iface_t *y = (const net_iface_t *)b;
-    return CMP_NUM(x->tx_mbps, y->tx_mbps);
+
+// Viewer side: one non-blocking connection per node
+typedef enum { NODE_DOWN, NODE_CONNECTING, NODE_UP } node_state_t;
+
+typedef struct {
+    char label[64];            // As given on the command line
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int resolved;
+    int fd;
+    node_state_t state;
+    wire_buf_t in;
+    double last_frame;         // now_monotonic() of the last complete frame
+    double retry_at;
+    host_summary_t host;
+    vm_summary_t *vms;
+    size_t vm_n, vm_cap;
+} cluster_node_t;
+
+// A node name from /etc/hosts, which Proxmox keeps for every cluster node.
+// getaddrinfo() would make the static binary load the host's NSS libraries
+// at runtime, so names are not looked up anywhere else.
+static int hosts_lookup(const char *name, char *addr, size_t len) {
+    FILE *f = fopen("/etc/hosts", "r");
+    if (!f) return -1;
+    char line[512];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "#\n")] = '\0';
+        char *save = NULL, *ip = strtok_r(line, " \t", &save);
+        for (char *w; ip && (w = strtok_r(NULL, " \t", &save)) != NULL; ) {
+            if (strcasecmp(w, name) == 0) { snprintf(addr, len, "%s", ip); found = 1; break; }
+        }
+    }
+    fclose(f);
+    return found ? 0 : -1;
 }
-static int cmp_disk_rio(const void *a, const void *b) {
-    const disk_sample_t *x = (const disk_sample_t *)a;
-    const disk_sample_t *y = (const disk_sample_t *)b;
-    return CMP_NUM(x->r_iops, y->r_iops);
+
+static int node_addr(cluster_node_t *n, const char *ip, int port) {
+    struct sockaddr_in *in4 = (struct sockaddr_in *)&n->addr;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&n->addr;
+    memset(&n->addr, 0, sizeof(n->addr));
+    if (inet_pton(AF_INET, ip, &in4->sin_addr) == 1) {
+        in4->sin_family = AF_INET;
+        in4->sin_port = htons((uint16_t)port);
+        n->addr_len = sizeof(*in4);
+    } else if (inet_pton(AF_INET6, ip, &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons((uint16_t)port);
+        n->addr_len = sizeof(*in6);
+    } else {
+        return -1;
+    }
+    return 0;
 }
-static int cmp_disk_wio(const void *a, const void *b) {
-    const disk_sample_t *x = (const disk_sample_t *)a;
-    const disk_sample_t *y = (const disk_sample_t *)b;
-    return CMP_NUM(x->w_iops, y->w_iops);
+
+// Addresses are resolved once up front so a slow lookup cannot stall redraws later
+static void node_resolve(cluster_node_t *n, const char *spec) {
+    char host[256];
+    snprintf(host, sizeof(host), "%s", spec);
+    snprintf(n->label, sizeof(n->label), "%s", spec);
+    int port = SERVE_DEFAULT_PORT;
+
+    char *h = host;
+    char *colon = NULL;
+    if (host[0] == '[') {                    // [v6addr]:port
+        char *close_br = strchr(host, ']');
+        if (close_br) { *close_br = '\0'; h = host + 1; if (close_br[1] == ':') colon = close_br + 1; }
+    } else if (strchr(host, ':') == strrchr(host, ':')) {
+        colon = strchr(host, ':');             // host:port, but not a bare v6 address
+    }
+    if (colon) {
+        *colon = '\0';
+        char *end;
+        long p = strtol(colon + 1, &end, 10);
+        if (*end || p < 1 || p > 65535) { fprintf(stderr, "kvmtop: bad port in %s\n", spec); return; }
+        port = (int)p;
+    }
+
+    if (node_addr(n, h, port) != 0) {
+        char ip[INET6_ADDRSTRLEN] = "";
+        if (hosts_lookup(h, ip, sizeof(ip)) != 0 && strcasecmp(h, "localhost") == 0) snprintf(ip, sizeof(ip), "127.0.0.1");
+        if (!ip[0] || node_addr(n, ip, port) != 0) {
+            fprintf(stderr, "kvmtop: cannot resolve %s (not an address or in /etc/hosts)\n", spec);
+            return;
+        }
+    }
+    n->resolved = 1;
 }
-static int cmp_disk_rmib(const void *a, const void *b) {
-    const disk_sample_t *x = (const disk_sample_t *)a;
-    const disk_sample_t *y = (const disk_sample_t *)b;
-    return CMP_NUM(x->r_mib, y->r_mib);
+
+static void node_disconnect(cluster_node_t *n, double now) {
+    if (n->fd >= 0) close(n->fd);
+    n->fd = -1;
+    n->state = NODE_DOWN;
+    n->in.len = 0;
+    n->retry_at = now + 2.0;
 }
-static int cmp_disk_wmib(const void *a, const void *b) {
-    const disk_sample_t *x = (const disk_sample_t *)a;
-    const disk_sample_t *y = (const disk_sample_t *)b;
-    return CMP_NUM(x->w_mib, y->w_mib);
+
+static void node_connect(cluster_node_t *n, double now) {
+    if (!n->resolved) return;
+    n->fd = socket(n->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (n->fd < 0) { node_disconnect(n, now); return; }
+    if (connect(n->fd, (struct sockaddr *)&n->addr, n->addr_len) == 0) n->state = NODE_UP;
+    else if (errno == EINPROGRESS) n->state = NODE_CONNECTING;
+    else node_disconnect(n, now);
 }
-static int cmp_disk_rlat(const void *a, const void *b) {
-    const disk_sample_t *x = (const disk_sample_t *)a;
-    const disk_sample_t *y = (const disk_sample_t *)b;
-    return CMP_NUM(x->r_lat, y->r_lat);
+
+// Read whatever is available and keep the newest complete frame
+static void node_read(cluster_node_t *n, double now) {
+    for (;;) {
+        wire_reserve(&n->in, 65536);
+        ssize_t got = recv(n->fd, n->in.data + n->in.len, n->in.cap - n->in.len, MSG_DONTWAIT);
+        if (got > 0) { n->in.len += (size_t)got; continue; }
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        node_disconnect(n, now);
+        return;
+    }
+
+    size_t off = 0;
+    while (n->in.len - off >= WIRE_HDR_LEN) {
+        const uint8_t *f = n->in.data + off;
+        uint32_t len = (uint32_t)f[4] | (uint32_t)f[5] << 8 | (uint32_t)f[6] << 16 | (uint32_t)f[7] << 24;
+        if (f[0] != 'K' || f[1] != 'T' || f[2] != WIRE_VERSION || len > WIRE_MAX_FRAME) {
+            node_disconnect(n, now);
+            return;
+        }
+        if (n->in.len - off < WIRE_HDR_LEN + len) break;
+        if (f[3] == WIRE_SNAPSHOT &&
+            wire_decode_snapshot(f + WIRE_HDR_LEN, len, &n->host, &n->vms, &n->vm_cap, &n->vm_n) == 0)
+            n->last_frame = now;
+        off += WIRE_HDR_LEN + len;
+    }
+    memmove(n->in.data, n->in.data + off, n->in.len - off);
+    n->in.len -= off;
 }
-static int cmp_disk_wlat(const void *a, const void *b) {
-    const disk_sample_t *x = (const disk_sample_t *)a;
-    const disk_sample_t *y = (const disk_sample_t *)b;
-    return CMP_NUM(x->w_lat, y->w_lat);
+
+static const cluster_node_t *cluster_nodes_view;  // Node list behind vm_summary_t.node
+static sort_col_t cluster_sort = SORT_VM_CPU;
+
+static const char *get_vm_node(const void *row) {
+    return cluster_nodes_view[((const vm_summary_t *)row)->node].label;
 }
 
-static int cmp_tgid(const void *a, const void *b) {
-    const sample_t *x = (const sample_t *)a;
-    const sample_t *y = (const sample_t *)b;
-    return (x->tgid > y->tgid) - (x->tgid < y->tgid);
+static const column_t cluster_columns[] = {
+    { "NODE", "Node", 20, 0, COLF_LEFT, COL_STRFN, 0, 1, NULL, get_vm_node, SORT_VM_NODE, 1, 0, HL_NONE },
+    { "VMID", NULL, 8, 0, 0, COL_INT, offsetof(vm_summary_t, vmid), 1, NULL, NULL, SORT_VM_ID, 2, 0, HL_NONE },
+    { "VM_NAME", "VM_Name", 20, 0, COLF_LEFT, COL_STR, offsetof(vm_summary_t, name), 1, NULL, NULL, SORT_VM_NAME, 0, 0, HL_NONE },
+    { "CPU", "CPU_pct", 8, 2, 0, COL_F64, offsetof(vm_summary_t, cpu_pct), 1, NULL, NULL, SORT_VM_CPU, 3, 0, HL_CPU },
+    { "Res(MiB)", "Res_MiB", 12, 0, 0, COL_F64, offsetof(vm_summary_t, res_mib), 1, NULL, NULL, SORT_VM_RES, 4, 0, HL_NONE },
+    { "R_IOPS", NULL, 9, 0, 0, COL_F64, offsetof(vm_summary_t, r_iops), 1, NULL, NULL, SORT_VM_RIOPS, 0, 0, HL_NONE },
+    { "W_IOPS", NULL, 9, 0, 0, COL_F64, offsetof(vm_summary_t, w_iops), 1, NULL, NULL, SORT_VM_WIOPS, 0, 0, HL_NONE },
+    { "R_MiB", NULL, 9, 2, 0, COL_F64, offsetof(vm_summary_t, r_mib), 1, NULL, NULL, SORT_VM_RMIB, 0, 0, HL_NONE },
+    { "W_MiB", NULL, 9, 2, 0, COL_F64, offsetof(vm_summary_t, w_mib), 1, NULL, NULL, SORT_VM_WMIB, 0, 0, HL_NONE },
+    { "Wait", "Wait_ms", 9, 2, 0, COL_F64, offsetof(vm_summary_t, wait_ms), 1, NULL, NULL, SORT_VM_WAIT, 5, 0, HL_WAIT },
+    { "RX_Mbps", NULL, 11, 2, 0, COL_F64, offsetof(vm_summary_t, rx_mbps), 1, NULL, NULL, SORT_VM_RX, 6, 0, HL_NONE },
+    { "TX_Mbps", NULL, 11, 2, 0, COL_F64, offsetof(vm_summary_t, tx_mbps), 1, NULL, NULL, SORT_VM_TX, 7, 0, HL_NONE },
+    { "S", "State", 5, 0, 0, COL_CHAR, offsetof(vm_summary_t, state), 1, NULL, NULL, SORT_VM_STATE, 0, 0, HL_STATE },
+};
+static const table_t cluster_table = TABLE(cluster_columns, vm_summary_t);
+
+static void cluster_render(cluster_node_t *nodes, size_t n_nodes, vm_summary_t **merged, size_t *merged_cap,
+                           const char *filter_str, int in_filter_mode, double now) {
+    int cols = get_term_cols();
+    printf("\033[2J\033[H");
+
+    size_t up = 0, total_vms = 0;
+    for (size_t i = 0; i < n_nodes; i++) {
+        if (nodes[i].state == NODE_UP) up++;
+        total_vms += nodes[i].vm_n;
+    }
+    char left[128], right[160];
+    snprintf(left, sizeof(left), "kvmtop %s", KVM_VERSION);
+    if (in_filter_mode) snprintf(right, sizeof(right), "FILTER: %s_", filter_str);
+    else snprintf(right, sizeof(right), "CLUSTER %zu/%zu nodes up | [1-7,<,>] Sort | [/] Filter | [q] Quit", up, n_nodes);
+    int pad = cols - (int)strlen(left) - (int)strlen(right);
+    if (pad < 1) pad = 1;
+    printf("%s%*s%s\n", left, pad, "", right);
+
+    // Per-host summary
+    printf("%-20s %-16s %-6s %8s %8s %20s %5s\n", "NODE", "HOST", "STATE", "CPU%", "Threads", "RAM(MiB)", "VMs");
+    print_rule(cols);
+    for (size_t i = 0; i < n_nodes; i++) {
+        const cluster_node_t *n = &nodes[i];
+        // A node that stops sending is stale even if the socket is still open
+        double limit = n->host.interval_ms ? 3.0 * n->host.interval_ms / 1000.0 + 1.0 : 10.0;
+        const char *st = n->state == NODE_CONNECTING ? "CONN" : n->state == NODE_DOWN ? "DOWN" :
+                         (n->last_frame == 0 ? "WAIT" : (now - n->last_frame > limit ? "STALE" : "UP"));
+        char ram[40] = "-";
+        if (n->last_frame > 0) snprintf(ram, sizeof(ram), "%u / %u", n->host.ram_used, n->host.ram_total);
+        printf("%-20.20s %-16.16s %-6s %8.2f %8d %20s %5zu\n", n->label, n->last_frame > 0 ? n->host.name : "-",
+               st, n->host.cpu_pct, n->host.threads, ram, n->vm_n);
+    }
+    putchar('\n');
+
+    // Merged VM table
+    if (*merged_cap < total_vms) {
+        vm_summary_t *p = (vm_summary_t *)realloc(*merged, total_vms * sizeof(*p));
+        if (!p) { fprintf(stderr, "OOM\n"); exit(2); }
+        *merged = p;
+        *merged_cap = total_vms;
+    }
+    size_t m = 0;
+    for (size_t i = 0; i < n_nodes; i++) {
+        for (size_t j = 0; j < nodes[i].vm_n; j++) {
+            (*merged)[m] = nodes[i].vms[j];
+            (*merged)[m].node = (int)i;
+            m++;
+        }
+    }
+    cluster_nodes_view = nodes;
+    table_sort(&cluster_table, cluster_sort, *merged, m);
+
+    print_table_header(&cluster_table, 0, cluster_sort);
+    print_rule(cols);
+    for (size_t i = 0; i < m; i++) {
+        const vm_summary_t *v = &(*merged)[i];
+        char vmid[16];
+        snprintf(vmid, sizeof(vmid), "%d", v->vmid);
+        if (filter_str[0] && !strcasestr(nodes[v->node].label, filter_str) && !strcasestr(vmid, filter_str) &&
+            !strcasestr(v->name, filter_str)) continue;
+        print_table_row(&cluster_table, 0, v, 0, 0);
+    }
+    fflush(stdout);
 }
 
-// Aggregate threads into process-level stats
-static void aggregate_by_tgid(const vec_t *src, vec_t *dst) {
-    vec_init(dst);
-    // 1. Deep copy
-    for (size_t i=0; i<src->len; i++) {
-        vec_push(dst, &src->data[i]);
+static int run_cluster(const char *spec) {
+    size_t n_nodes = 1;
+    for (const char *p = spec; *p; p++) if (*p == ',') n_nodes++;
+    cluster_node_t *nodes = (cluster_node_t *)calloc(n_nodes, sizeof(*nodes));
+    if (!nodes) { fprintf(stderr, "OOM\n"); exit(2); }
+
+    char *list = strdup(spec), *save = NULL;
+    size_t k = 0;
+    for (char *tok = strtok_r(list, ",", &save); tok && k < n_nodes; tok = strtok_r(NULL, ",", &save)) {
+        nodes[k].fd = -1;
+        node_resolve(&nodes[k], tok);
+        k++;
     }
-    
-    // 2. Sort by TGID
-    qsort(dst->data, dst->len, sizeof(sample_t), cmp_tgid);
-
-    // 3. Merge adjacent with same TGID
-    size_t write_idx = 0;
-    if (dst->len > 0) {
-        for (size_t i = 1; i < dst->len; i++) {
-            if (dst->data[write_idx].tgid == dst->data[i].tgid) {
-                // Merge i into write_idx
-                dst->data[write_idx].cpu_pct += dst->data[i].cpu_pct;
-                dst->data[write_idx].r_iops += dst->data[i].r_iops;
-                dst->data[write_idx].w_iops += dst->data[i].w_iops;
-                dst->data[write_idx].io_wait_ms += dst->data[i].io_wait_ms;
-                dst->data[write_idx].r_mib += dst->data[i].r_mib;
-                dst->data[write_idx].w_mib += dst->data[i].w_mib;
-                
-                dst->data[write_idx].pid = dst->data[write_idx].tgid; 
-                dst->data[write_idx].state = dst->data[i].state; 
+    n_nodes = k;
+    free(list);
+
+    vm_summary_t *merged = NULL;
+    size_t merged_cap = 0;
+    char filter_str[64] = {0};
+    int in_filter_mode = 0;
+    double last_render = 0;
+    int dirty = 1;
+
+    enable_raw_mode();
+    for (;;) {
+        double now = now_monotonic();
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(STDIN_FILENO, &rfds);
+        int maxfd = STDIN_FILENO;
+        for (size_t i = 0; i < n_nodes; i++) {
+            cluster_node_t *n = &nodes[i];
+            if (n->state == NODE_DOWN && now >= n->retry_at) node_connect(n, now);
+            if (n->fd < 0) continue;
+            if (n->state == NODE_CONNECTING) FD_SET(n->fd, &wfds);
+            else FD_SET(n->fd, &rfds);
+            if (n->fd > maxfd) maxfd = n->fd;
+        }
+
+        // Wake at least every 500ms so staleness and reconnects are noticed
+        struct timeval tv = { 0, 500000 };
+        int ret = select(maxfd + 1, &rfds, &wfds, NULL, &tv);
+        now = now_monotonic();
+        if (ret > 0) {
+            for (size_t i = 0; i < n_nodes; i++) {
+                cluster_node_t *n = &nodes[i];
+                if (n->fd < 0) continue;
+                if (n->state == NODE_CONNECTING && FD_ISSET(n->fd, &wfds)) {
+                    int err = 0;
+                    socklen_t el = sizeof(err);
+                    getsockopt(n->fd, SOL_SOCKET, SO_ERROR, &err, &el);
+                    if (err) node_disconnect(n, now); else n->state = NODE_UP;
+                    dirty = 1;
+                } else if (n->state == NODE_UP && FD_ISSET(n->fd, &rfds)) {
+                    double before = n->last_frame;
+                    node_read(n, now);
+                    if (n->last_frame != before || n->state != NODE_UP) dirty = 1;
+                }
+            }
+        }
+
+        if (ret > 0 && FD_ISSET(STDIN_FILENO, &rfds)) {
+            int c = wait_for_input(0);
+            if (in_filter_mode) {
+                if (c == 27) { in_filter_mode = 0; filter_str[0] = '\0'; }
+                else if (c == 127 || c == 8) { size_t len = strlen(filter_str); if (len > 0) filter_str[len-1] = '\0'; }
+                else if (c == '\n' || c == '\r') in_filter_mode = 0;
+                else if (c > 0 && c < 256 && isprint(c)) {
+                    size_t len = strlen(filter_str);
+                    if (len < sizeof(filter_str)-1) { filter_str[len] = (char)c; filter_str[len+1] = '\0'; }
+                }
+                dirty = 1;
+            } else if (c == 'q' || c == 'Q') {
+                break;
+            } else if (c == '/') {
+                in_filter_mode = 1;
+                dirty = 1;
             } else {
-                write_idx++;
-                dst->data[write_idx] = dst->data[i];
-                dst->data[write_idx].pid = dst->data[i].tgid; // Ensure PID column shows TGID
+                sort_col_t want = 0;
+                if (c >= '1' && c <= '9') want = table_fkey_sort(&cluster_table, c - '0');
+                else if (c >= KEY_F1 && c <= KEY_F10) want = table_fkey_sort(&cluster_table, c - KEY_F1 + 1);
+                else if (c == '<' || c == '>') want = table_step_sort(&cluster_table, 0, cluster_sort, c == '<' ? -1 : 1);
+                if (want) {
+                    table_select_sort(&cluster_table, &cluster_sort, want);
+                    dirty = 1;
+                }
             }
         }
-        dst->len = write_idx + 1;
-    }
-}
 
-// Tree view helper
-static void print_threads_for_tgid(const vec_t *raw, pid_t tgid, int pidw, int cpuw, int iopsw, int waitw, int mibw, int statew, int cmdw) {
-    for (size_t i = 0; i < raw->len; i++) {
-        const sample_t *s = &raw->data[i];
-        if (s->tgid == tgid && s->pid != tgid) { 
-            char pidbuf[32];
-            snprintf(pidbuf, sizeof(pidbuf), "  └─ %d", s->pid); // Indent
-            
-            printf("%*s %*.*f %*.0f %*.0f %*.*f %*.*f %*.*f %*c ",
-                pidw, pidbuf,
-                cpuw, 2, s->cpu_pct,
-                iopsw, s->r_iops,
-                iopsw, s->w_iops,
-                waitw, 2, s->io_wait_ms,
-                mibw, 2, s->r_mib,
-                mibw, 2, s->w_mib,
-                statew, s->state);
-            fprint_trunc(stdout, s->cmd, cmdw);
-            putchar('\n');
+        // Coalesce bursts of frames from many nodes into one redraw
+        if (dirty && now - last_render >= 0.2) {
+            cluster_render(nodes, n_nodes, &merged, &merged_cap, filter_str, in_filter_mode, now);
+            last_render = now;
+            dirty = 0;
+        } else if (now - last_render >= 1.0) {
+            dirty = 1;
         }
     }
-}
+    disable_raw_mode();
 
-int main(int argc, char **argv) {
-    if (geteuid() != 0) {
-        fprintf(stderr, "Warning: Not running as root. IO stats will be unavailable for other users' processes.\n");
-        sleep(2);
+    for (size_t i = 0; i < n_nodes; i++) {
+        if (nodes[i].fd >= 0) close(nodes[i].fd);
+        free(nodes[i].in.data);
+        free(nodes[i].vms);
     }
+    free(nodes);
+    free(merged);
+    return 0;
+}
+
+static volatile sig_atomic_t daemon_stop = 0;
+static void daemon_signal(int sig) { (void)sig; daemon_stop = 1; }
+
+typedef enum { RUN_INTERACTIVE, RUN_DAEMON, RUN_ATTACH } run_mode_t;
 
+// Baseline to first frame. Long enough for CPU% to resolve at HZ=100 (25
+// ticks), short enough that the first screen appears with real numbers.
+#define BOOTSTRAP_SEC 0.25
+
+// 't' cycles: flat list, threads under each process, process hierarchy
+typedef enum { TREE_OFF, TREE_THREADS, TREE_PROCS } tree_mode_t;
+
+int main(int argc, char **argv) {
+    // A frame is hundreds of small writes; each one is flushed as a whole
+    // once it is complete, so don't let a line-buffered tty split it
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+#ifdef DEBUG
+    fmt_selftest();
+    collect_selftest();
+    delta_selftest();
+    topology_selftest();
+    irq_selftest();
+#endif
     double interval = 5.0; 
     int display_limit = 50;
-    int show_tree = 0;
+    tree_mode_t tree_mode = TREE_OFF;
+    int show_smaps = 0;
     int frozen = 0;
     char filter_str[64] = {0};
     int in_filter_mode = 0;
@@ -1326,6 +7343,12 @@ int main(int argc, char **argv) {
     
     int in_refresh_mode = 0;
     char refresh_str[16] = {0};
+
+    int in_action_mode = 0;    // 1: pick the action, 2: type its value, 3: confirm
+    char action_str[32] = {0};
+    char action_msg[160] = "";  // Outcome of the last action, shown in the header
+    task_action_t action;
+    memset(&action, 0, sizeof(action));
     
     // Load configuration file (overrides defaults)
     load_config(&interval, &display_limit);
@@ -1340,9 +7363,36 @@ int main(int argc, char **argv) {
         {"pid", required_argument, NULL, 'p'},
         {"help", no_argument, NULL, 'h'},
         {"version", no_argument, NULL, 'v'},
+        {"daemon", no_argument, NULL, 1000},
+        {"attach", no_argument, NULL, 1001},
+        {"shm", required_argument, NULL, 1002},
+        {"serve", required_argument, NULL, 1003},
+        {"cluster", required_argument, NULL, 1004},
+        {"log", required_argument, NULL, 1005},
+        {"log-format", required_argument, NULL, 1006},
+        {"log-rotate-size", required_argument, NULL, 1007},
+        {"log-rotate-age", required_argument, NULL, 1008},
+        {"log-keep", required_argument, NULL, 1009},
+        {"trigger", required_argument, NULL, 1010},
+        {"record-dir", required_argument, NULL, 1011},
+        {"record-ring", required_argument, NULL, 1012},
+        {"record-after", required_argument, NULL, 1013},
+        {"record-burst", required_argument, NULL, 1014},
+        {"io-uring", no_argument, NULL, 1015},
+        {"audit-log", required_argument, NULL, 1016},
+        {"group", required_argument, NULL, 1017},
         {0, 0, 0, 0}
     };
 
+    run_mode_t run_mode = RUN_INTERACTIVE;
+    int publish_shm = 0;
+    int serve_port = 0;
+    const char *cluster_spec = NULL;
+    shm_ring_t ring;
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+    snprintf(ring.path, sizeof(ring.path), "%s", SHM_DEFAULT_PATH);
+
     int opt;
     while ((opt = getopt_long(argc, argv, "i:p:hv", long_opts, NULL)) != -1) {
         switch (opt) {
@@ -1359,58 +7409,231 @@ int main(int argc, char **argv) {
             case 'v':
                 printf("kvmtop %s\n", KVM_VERSION);
                 return 0;
+            case 1000: run_mode = RUN_DAEMON; publish_shm = 1; break;
+            case 1001: run_mode = RUN_ATTACH; break;
+            case 1002: snprintf(ring.path, sizeof(ring.path), "%s", optarg); break;
+            case 1003:
+                serve_port = atoi(optarg);
+                if (serve_port <= 0 || serve_port > 65535) return 2;
+                run_mode = RUN_DAEMON;
+                break;
+            case 1004: cluster_spec = optarg; break;
+            case 1005: snprintf(log_dir, sizeof(log_dir), "%s", optarg); break;
+            case 1006:
+                if (strcmp(optarg, "csv") != 0 && strcmp(optarg, "jsonl") != 0) return 2;
+                log_jsonl = strcmp(optarg, "jsonl") == 0;
+                break;
+            case 1007: log_rotate_mib = atoi(optarg); if (log_rotate_mib <= 0) return 2; break;
+            case 1008: log_rotate_sec = atoi(optarg); if (log_rotate_sec <= 0) return 2; break;
+            case 1009: log_keep = atoi(optarg); if (log_keep <= 0) return 2; break;
+            case 1010:
+                if (flight.n_rules == FLIGHT_MAX_RULES || flight_parse_rule(&flight.rules[flight.n_rules], optarg) != 0) {
+                    fprintf(stderr, "kvmtop: bad or too many --trigger rules: %s\n", optarg);
+                    return 2;
+                }
+                flight.n_rules++;
+                break;
+            case 1011: snprintf(record_dir, sizeof(record_dir), "%s", optarg); break;
+            case 1012: record_ring = atoi(optarg); if (record_ring <= 0) return 2; break;
+            case 1013: record_after = atoi(optarg); if (record_after < 0) return 2; break;
+            case 1014: record_burst = strtod(optarg, NULL); if (record_burst < 0.05) return 2; break;
+            case 1015: use_io_uring = 1; break;
+            case 1016: snprintf(audit_log, sizeof(audit_log), "%s", optarg); break;
+            case 1017:
+                if (group_parse(optarg) < 0) return 2;
+                snprintf(group_start, sizeof(group_start), "%s", optarg);
+                break;
             case 'h': default: return 0;
         }
     }
 
-    long hz = sysconf(_SC_CLK_TCK);
-    vec_t prev, curr_raw, curr_proc;
-    vec_init(&prev); vec_init(&curr_raw); vec_init(&curr_proc);
-    
-    vec_net_t prev_net, curr_net;
-    vec_net_init(&prev_net); vec_net_init(&curr_net);
+    // The cluster view only talks to --serve instances on other hosts
+    if (cluster_spec) return run_cluster(cluster_spec);
+    audit_default_path();
+
+    // A viewer only reads the ring, so the collector's privileges are what count
+    // Interactive sessions show this in the header rather than delay startup
+    int not_root = run_mode != RUN_ATTACH && geteuid() != 0;
+    if (not_root && run_mode == RUN_DAEMON)
+        fprintf(stderr, "Warning: Not running as root. IO stats will be unavailable for other users' processes.\n");
+
+    if (run_mode == RUN_DAEMON) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = daemon_signal;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        lazy_collect = 0;  // Viewers may sort by any column
+        if (serve_port && serve_open(serve_port) != 0) {
+            fprintf(stderr, "kvmtop: cannot listen on port %d: %s\n", serve_port, strerror(errno));
+            return 1;
+        }
+    } else if (run_mode == RUN_ATTACH) {
+        // Everything comes from the ring; nothing may touch /proc
+        lazy_collect = 0;
+        smaps_reads = 0;
+        if (shm_attach(&ring) != 0) {
+            fprintf(stderr, "kvmtop: cannot attach to %s: %s\n", ring.path,
+                    errno == EPROTO ? "written by an incompatible kvmtop build" : strerror(errno));
+            return 1;
+        }
+    }
+
+    // The writer thread owns the disk; refreshes only queue formatted snapshots
+    static log_writer_t logw;
+    if (log_dir[0]) {
+        snprintf(logw.dir, sizeof(logw.dir), "%s", log_dir);
+        logw.format = log_jsonl ? LOG_JSONL : LOG_CSV;
+        logw.max_bytes = (uint64_t)log_rotate_mib << 20;
+        logw.max_age = log_rotate_sec;
+        logw.keep = log_keep;
+        if (log_start(&logw) != 0) {
+            fprintf(stderr, "kvmtop: cannot log to %s: %s\n", log_dir, strerror(errno));
+            return 1;
+        }
+        lazy_collect = 0;  // Logged rows need every column
+    }
+
+    snprintf(flight.dir, sizeof(flight.dir), "%s", record_dir);
+    flight.ring_n = record_ring;
+    flight.after_n = record_after;
+    flight.burst = run_mode == RUN_ATTACH ? 0 : record_burst;  // Bursts read /proc
+    if (flight_start(&flight) != 0) {
+        fprintf(stderr, "kvmtop: cannot write flight recordings to %s: %s\n", flight.dir, strerror(errno));
+        return 1;
+    }
 
-    vec_disk_t prev_disk, curr_disk;
-    vec_disk_init(&prev_disk); vec_disk_init(&curr_disk);
+    long hz = sysconf(_SC_CLK_TCK);
+    sample_arena_t arena;
+    arena_init(&arena);
+    vec_t *prev, *curr_raw, *curr_proc = &arena.proc;
+    thread_index_t tindex;
+    memset(&tindex, 0, sizeof(tindex));
+    proc_tree_t ptree;
+    memset(&ptree, 0, sizeof(ptree));
+    blocked_view_t blocked;
+    memset(&blocked, 0, sizeof(blocked));
+    topology_t topo;
+    memset(&topo, 0, sizeof(topo));
+    irqstat_t irqs;
+    memset(&irqs, 0, sizeof(irqs));
+    cgstat_t cgs;
+    memset(&cgs, 0, sizeof(cgs));
+    group_t group;
+    memset(&group, 0, sizeof(group));
+    group.by = group_parse(group_start) < 0 ? GROUP_OFF : (group_by_t)group_parse(group_start);
+    // cgroups are read from /proc/<pid>/cgroup, which attached viewers leave alone
+    if (group.by == GROUP_CGROUP && run_mode == RUN_ATTACH) group.by = GROUP_OFF;
+    percpu_t pcpu;
+    memset(&pcpu, 0, sizeof(pcpu));
+    viewport_t views[MODE_HELP + 1];  // Scroll position and selection of each view
+    memset(views, 0, sizeof(views));
+    int pcpu_compact = -1;     // -1: compact once there are more than 64 CPUs
+    counter_soa_t ctr;
+    memset(&ctr, 0, sizeof(ctr));
+    delta_kernel_init();
+    vec_net_t *prev_net, *curr_net;
+    vec_disk_t *prev_disk, *curr_disk;
 
     // Global CPU Stats
     global_cpu_t prev_cpu, curr_cpu;
     memset(&prev_cpu, 0, sizeof(prev_cpu));
     memset(&curr_cpu, 0, sizeof(curr_cpu));
-    read_global_cpu(&prev_cpu);
+    double t_prev = now_monotonic();
+    if (run_mode == RUN_ATTACH) goto baseline_done;
 
-    printf("Initializing (wait %.0fs)...\n", interval);
-    
-    if (collect_samples(&prev, filter, filter_n) != 0) return 1;
-    collect_net_dev(&prev_net);
-    collect_disks(&prev_disk);
+    read_global_cpu(&prev_cpu, &pcpu);
+    percpu_compute(&pcpu);
 
-    qsort(prev.data, prev.len, sizeof(sample_t), cmp_key);
-    double t_prev = now_monotonic();
+    if (publish_shm) fprintf(stderr, "kvmtop: publishing snapshots to %s every %.1fs\n", ring.path, interval);
+    if (serve_port) fprintf(stderr, "kvmtop: serving on port %d every %.1fs\n", serve_port, interval);
+    if (run_mode != RUN_DAEMON) { printf("Initializing...\n"); fflush(stdout); }
     
+    // The baseline reads everything so any row can produce rates on the
+    // first refresh, whichever sort column is picked.
+    if (collect_samples(arena_raw(&arena, 0), NULL, FETCH_ALL, filter, filter_n) != 0) return 1;
+    collect_net(arena_net(&arena, 0));
+    if (run_mode == RUN_INTERACTIVE) input_wake_fd = nl_event_fd;
+    collect_disks(arena_disk(&arena, 0), NULL);
+
+    t_prev = now_monotonic();
+    for (size_t i = 0; i < arena_raw(&arena, 0)->len; i++) arena_raw(&arena, 0)->data[i].io_time = t_prev;
+    qsort(arena_raw(&arena, 0)->data, arena_raw(&arena, 0)->len, sizeof(sample_t), cmp_key);
+    arena_advance(&arena);
+
+    // The first frame is a short delta so rates show up right away; the
+    // configured interval applies from the second refresh on
+    double boot_wait = t_prev + (interval < BOOTSTRAP_SEC ? interval : BOOTSTRAP_SEC) - now_monotonic();
+    if (boot_wait > 0) {
+        struct timespec ts = { 0, (long)(boot_wait * 1e9) };
+        nanosleep(&ts, NULL);
+    }
+
+baseline_done:;
     double global_cpu_percent = 0.0;
     int system_threads = 0;
+    int attach_stale = 0;
+    wire_buf_t frame = { NULL, 0, 0 };
 
-    enable_raw_mode();
+    if (run_mode != RUN_DAEMON) enable_raw_mode();
     sort_col_t sort_col_proc = SORT_CPU;
     sort_col_t sort_col_net = SORT_NET_TX;
     sort_col_t sort_col_disk = SORT_DISK_RIO;
+    sort_col_t sort_col_blocked = SORT_BLK_THREADS;
+    sort_col_t sort_col_mem = SORT_MAJFLT;
+    sort_col_t sort_col_topo = SORT_TOPO_CORE;
+    sort_col_t sort_col_irq = SORT_IRQ_RATE;
+    sort_col_t sort_col_cg = SORT_CG_THR;
+    sort_col_t sort_col_group = SORT_GRP_CPU;
+    sort_col_t sort_col_pcpu = SORT_PCPU_CPU;
+
+    unsigned cycle_fetch = FETCH_ALL;
+    int uring_noted = 0;       // The daemon has logged uring_note
+
+#ifdef DEBUG
+    unsigned long cycles = 0, alloc_mark = 0, reads_mark = 0, syscalls_mark = 0;
+    double collect_ms = 0;
+    char debug_msg[120] = "";  // Last refresh's counters, shown in the header
+#endif
 
     while (1) {
         double t_curr = 0;
+
+        prev = arena_raw(&arena, 1); curr_raw = arena_raw(&arena, 0);
+        prev_net = arena_net(&arena, 1); curr_net = arena_net(&arena, 0);
+        prev_disk = arena_disk(&arena, 1); curr_disk = arena_disk(&arena, 0);
         
-        if (!frozen) {
-            vec_free(&curr_raw); vec_init(&curr_raw);
-            collect_samples(&curr_raw, filter, filter_n);
+        if (!frozen && run_mode == RUN_ATTACH) {
+            if (shm_read_latest(&ring, curr_raw, curr_proc, curr_net, curr_disk, &global_cpu_percent,
+                                &system_threads, &cycle_fetch, &interval) != 0) {
+                // Keep showing the last snapshot rather than an empty screen
+                vec_t tmp = *curr_raw; *curr_raw = *prev; *prev = tmp;
+                vec_net_t tmp_net = *curr_net; *curr_net = *prev_net; *prev_net = tmp_net;
+                vec_disk_t tmp_disk = *curr_disk; *curr_disk = *prev_disk; *prev_disk = tmp_disk;
+                aggregate_by_tgid(curr_raw, curr_proc);
+            }
+            // Same host as the collector: per-CPU counters are read locally
+            read_global_cpu(&curr_cpu, &pcpu);
+            percpu_compute(&pcpu);
+        } else if (!frozen) {
+            // Groups add up every task, so nothing can be left for later
+            cycle_fetch = !lazy_collect || (mode == MODE_PROCESS && group.by) ? FETCH_ALL : mode == MODE_MEMORY ? fetch_for_sort(&mem_table, sort_col_mem)
+                                                                          : fetch_for_sort(&proc_table, sort_col_proc);
+#ifdef DEBUG
+            double t_collect = now_monotonic();
+#endif
+            collect_samples(curr_raw, prev, cycle_fetch, filter, filter_n);
+#ifdef DEBUG
+            collect_ms = (now_monotonic() - t_collect) * 1000.0;
+#endif
             
-            vec_net_free(&curr_net); vec_net_init(&curr_net);
-            collect_net_dev(&curr_net);
-            map_kvm_interfaces(&curr_net);
+            collect_net(curr_net);
+            map_kvm_interfaces(curr_net);
 
-            vec_disk_free(&curr_disk); vec_disk_init(&curr_disk);
-            collect_disks(&curr_disk);
+            collect_disks(curr_disk, prev_disk);
 
-            read_global_cpu(&curr_cpu);
+            read_global_cpu(&curr_cpu, &pcpu);
+            percpu_compute(&pcpu);
             system_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
 
             t_curr = now_monotonic();
@@ -1429,41 +7652,42 @@ int main(int argc, char **argv) {
                 global_cpu_percent = 0.0;
             }
 
-            // Process Metrics
-            for (size_t i=0; i<curr_raw.len; i++) {
-                sample_t *c = &curr_raw.data[i];
-                const sample_t *p = find_prev(&prev, c->key);
-                uint64_t d_cpu=0, d_scr=0, d_scw=0, d_rb=0, d_wb=0, d_blk=0, d_minflt=0, d_majflt=0;
-                if (p) {
-                    d_cpu = (c->cpu_jiffies >= p->cpu_jiffies) ? c->cpu_jiffies - p->cpu_jiffies : 0;
-                    d_scr = (c->syscr >= p->syscr) ? c->syscr - p->syscr : 0;
-                    d_scw = (c->syscw >= p->syscw) ? c->syscw - p->syscw : 0;
-                    d_rb  = (c->read_bytes >= p->read_bytes) ? c->read_bytes - p->read_bytes : 0;
-                    d_wb  = (c->write_bytes >= p->write_bytes) ? c->write_bytes - p->write_bytes : 0;
-                    d_blk = (c->blkio_ticks >= p->blkio_ticks) ? c->blkio_ticks - p->blkio_ticks : 0;
-                    d_minflt = (c->minflt >= p->minflt) ? c->minflt - p->minflt : 0;
-                    d_majflt = (c->majflt >= p->majflt) ? c->majflt - p->majflt : 0;
-                }
-                c->cpu_pct = ((double)d_cpu * 100.0) / (dt * (double)hz);
-                c->r_iops = (double)d_scr / dt;
-                c->w_iops = (double)d_scw / dt;
-                c->r_mib  = ((double)d_rb / dt) / 1048576.0;
-                c->w_mib  = ((double)d_wb / dt) / 1048576.0;
-                c->io_wait_ms = ((double)d_blk * 1000.0) / (double)hz;
-                c->minflt_ps = (double)d_minflt / dt;
-                c->majflt_ps = (double)d_majflt / dt;
+            // Process Metrics: match each thread with its previous sample and
+            // gather the interval counters into columns (a new thread is its
+            // own baseline, so its deltas are 0), then run the delta kernels
+            // and fold the thread rates into per-process rows.
+            size_t n_threads = curr_raw->len, cursor = 0;
+            counter_soa_reserve(&ctr, n_threads);
+            for (size_t i=0; i<n_threads; i++) {
+                sample_t *c = &curr_raw->data[i];
+                const sample_t *p = find_prev_near(prev, &cursor, c->key);
+                if (c->fetched & FETCH_IO) c->io_time = t_curr;
+                carry_over(c, p);
+                compute_io_rates(c, p);
+                const sample_t *base = p ? p : c;
+                c->migrations = base->migrations + (base->processor != c->processor);
+                ctr.cur[CTR_CPU][i] = c->cpu_jiffies;     ctr.prev[CTR_CPU][i] = base->cpu_jiffies;
+                ctr.cur[CTR_BLKIO][i] = c->blkio_ticks;   ctr.prev[CTR_BLKIO][i] = base->blkio_ticks;
+                ctr.cur[CTR_MINFLT][i] = c->minflt;       ctr.prev[CTR_MINFLT][i] = base->minflt;
+                ctr.cur[CTR_MAJFLT][i] = c->majflt;       ctr.prev[CTR_MAJFLT][i] = base->majflt;
             }
+            counter_soa_rates(&ctr, n_threads, dt, hz);
+
+            vec_clear(curr_proc);
+            for (size_t i=0; i<n_threads; i++) {
+                sample_t *c = &curr_raw->data[i];
+                c->cpu_pct = ctr.rate[CTR_CPU][i];
+                c->io_wait_ms = ctr.rate[CTR_BLKIO][i];
+                c->minflt_ps = ctr.rate[CTR_MINFLT][i];
+                c->majflt_ps = ctr.rate[CTR_MAJFLT][i];
+                proc_fold(curr_proc, c);
+            }
+            proc_fold_finish(curr_proc);
 
             // Net Metrics
-            for (size_t i=0; i<curr_net.len; i++) {
-                net_iface_t *cn = &curr_net.data[i];
-                net_iface_t *pn = NULL;
-                for(size_t j=0; j<prev_net.len; j++) {
-                    if (strcmp(prev_net.data[j].name, cn->name) == 0) {
-                        pn = &prev_net.data[j];
-                        break;
-                    }
-                }
+            for (size_t i=0; i<curr_net->len; i++) {
+                net_iface_t *cn = &curr_net->data[i];
+                const net_iface_t *pn = find_prev_net(prev_net, i, cn->name);
                 if (pn) {
                     uint64_t dr = (cn->rx_bytes >= pn->rx_bytes) ? cn->rx_bytes - pn->rx_bytes : 0;
                     uint64_t dtb = (cn->tx_bytes >= pn->tx_bytes) ? cn->tx_bytes - pn->tx_bytes : 0;
@@ -1471,6 +7695,11 @@ int main(int argc, char **argv) {
                     uint64_t dp_t = (cn->tx_packets >= pn->tx_packets) ? cn->tx_packets - pn->tx_packets : 0;
                     uint64_t de_r = (cn->rx_errors >= pn->rx_errors) ? cn->rx_errors - pn->rx_errors : 0;
                     uint64_t de_t = (cn->tx_errors >= pn->tx_errors) ? cn->tx_errors - pn->tx_errors : 0;
+                    uint64_t dd_r = (cn->rx_dropped >= pn->rx_dropped) ? cn->rx_dropped - pn->rx_dropped : 0;
+                    uint64_t dd_t = (cn->tx_dropped >= pn->tx_dropped) ? cn->tx_dropped - pn->tx_dropped : 0;
+                    uint64_t d_fifo = ((cn->rx_fifo >= pn->rx_fifo) ? cn->rx_fifo - pn->rx_fifo : 0) +
+                                      ((cn->tx_fifo >= pn->tx_fifo) ? cn->tx_fifo - pn->tx_fifo : 0);
+                    uint64_t d_mc = (cn->multicast >= pn->multicast) ? cn->multicast - pn->multicast : 0;
 
                     cn->rx_mbps = ((double)dr * 8.0) / (dt * 1000000.0);
                     cn->tx_mbps = ((double)dtb * 8.0) / (dt * 1000000.0);
@@ -1478,19 +7707,17 @@ int main(int argc, char **argv) {
                     cn->tx_pps = (double)dp_t / dt;
                     cn->rx_errs_ps = (double)de_r / dt;
                     cn->tx_errs_ps = (double)de_t / dt;
+                    cn->rx_drops_ps = (double)dd_r / dt;
+                    cn->tx_drops_ps = (double)dd_t / dt;
+                    cn->fifo_ps = (double)d_fifo / dt;
+                    cn->mcast_ps = (double)d_mc / dt;
                 }
             }
 
             // Disk Metrics
-            for (size_t i=0; i<curr_disk.len; i++) {
-                disk_sample_t *cd = &curr_disk.data[i];
-                disk_sample_t *pd = NULL;
-                for(size_t j=0; j<prev_disk.len; j++) {
-                    if (strcmp(prev_disk.data[j].name, cd->name) == 0) {
-                        pd = &prev_disk.data[j];
-                        break;
-                    }
-                }
+            for (size_t i=0; i<curr_disk->len; i++) {
+                disk_sample_t *cd = &curr_disk->data[i];
+                const disk_sample_t *pd = find_prev_disk(prev_disk, i, cd->name);
                 if (pd) {
                     uint64_t drio = (cd->rio >= pd->rio) ? cd->rio - pd->rio : 0;
                     uint64_t dwio = (cd->wio >= pd->wio) ? cd->wio - pd->wio : 0;
@@ -1514,13 +7741,60 @@ int main(int argc, char **argv) {
                 }
             }
 
-            vec_free(&curr_proc); 
-            aggregate_by_tgid(&curr_raw, &curr_proc);
-            
             t_prev = t_curr;
             prev_cpu = curr_cpu;
         }
 
+        // curr_proc is still in TGID order here
+        if (!frozen) thread_index_build(&tindex, curr_raw, curr_proc);
+        if (!frozen) flight_observe(&flight, curr_raw, curr_proc, now_monotonic());
+        if (!frozen && mode == MODE_BLOCKED && run_mode != RUN_ATTACH) blocked_collect(&blocked, curr_raw, curr_proc);
+        if (!frozen && mode == MODE_IRQ) irqstat_collect(&irqs, curr_raw, curr_proc);
+        if (!frozen && mode == MODE_PRESSURE) cgstat_collect(&cgs, curr_proc);
+        if (!frozen && mode == MODE_PROCESS && group.by) group_collect(&group, curr_raw, &tindex);
+
+        if (!frozen && logw.running) {
+            struct sysinfo si;
+            sysinfo(&si);
+            view_uptime_sec = si.uptime;
+            view_hz = hz;
+            log_snapshot(&logw, curr_proc, global_cpu_percent, &pcpu);
+        }
+
+        if (run_mode == RUN_DAEMON) {
+            if (uring_note[0] && !uring_noted) {
+                fprintf(stderr, "kvmtop: %s\n", uring_note);
+                uring_noted = 1;
+            }
+            if (publish_shm && shm_publish(&ring, curr_raw, curr_proc, curr_net, curr_disk, interval,
+                                           global_cpu_percent, system_threads, cycle_fetch) != 0) {
+                fprintf(stderr, "kvmtop: cannot publish to %s: %s\n", ring.path, strerror(errno));
+                goto cleanup;
+            }
+            if (serve_port) {
+                wire_encode_snapshot(&frame, interval, global_cpu_percent, system_threads, curr_proc, curr_net);
+                serve_broadcast(&frame);
+            }
+            // Sleep out the interval; a signal cuts it short
+            double wake = t_curr + interval;
+            while (!daemon_stop) {
+                double now = now_monotonic();
+                double remain = wake - now;
+                if (remain <= 0) break;
+                double burst = flight_burst_wait(&flight, now);
+                if (burst == 0) { flight_burst_sample(&flight, hz, now); continue; }
+                if (burst > 0 && burst < remain) remain = burst;
+                if (serve_port) {
+                    serve_wait(remain);
+                    continue;
+                }
+                struct timespec ts = { (time_t)remain, (long)((remain - (double)(time_t)remain) * 1e9) };
+                nanosleep(&ts, NULL);
+            }
+            if (daemon_stop) goto cleanup;
+            goto next_cycle;
+        }
+
         int dirty = 1;
         double start_wait = now_monotonic();
 
@@ -1529,7 +7803,7 @@ int main(int argc, char **argv) {
                 printf("\033[2J\033[H"); 
                 int cols = get_term_cols();
                 
-                char left[128], right[128];
+                char left[128], right[320];
                 snprintf(left, sizeof(left), "kvmtop %s", KVM_VERSION);
                 
                 if (in_filter_mode) {
@@ -1538,12 +7812,47 @@ int main(int argc, char **argv) {
                     snprintf(right, sizeof(right), "LIMIT: %s_", limit_str);
                 } else if (in_refresh_mode) {
                     snprintf(right, sizeof(right), "REFRESH(s): %s_", refresh_str);
+                } else if (in_action_mode == 1) {
+                    snprintf(right, sizeof(right), "ACTION on %s %d (%s): [n]ice [i]o class [a]ffinity [v]CPU pin | Esc cancels",
+                             action.tid ? "thread" : "pid", action.tid ? action.tid : action.tgid, action.comm);
+                } else if (in_action_mode == 2) {
+                    static const char *const prompts[] = { "NICE (-20..19)", "I/O CLASS (rt[/0-7], be[/0-7], idle)",
+                                                           "AFFINITY (CPUs, e.g. 0-3,8)", "PIN vCPU n to the n-th CPU of (e.g. 4-7)" };
+                    snprintf(right, sizeof(right), "%s: %s_", prompts[action.kind], action_str);
+                } else if (in_action_mode == 3) {
+                    char desc[200];
+                    action_describe(&action, desc, sizeof(desc));
+                    snprintf(right, sizeof(right), "%s [y/N]", desc);
                 } else {
                     // Normal header
-                    char f_info[40] = "";
+                    char f_info[160] = "";
                     if (strlen(filter_str) > 0) snprintf(f_info, sizeof(f_info), "Filter: %s | ", filter_str);
+                    if (action_msg[0]) snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "%.100s | ", action_msg);
+                    if (mode == MODE_PROCESS && group.by) {
+                        if (group.drill[0]) snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "Group: %s=%.40s | ", group_names[group.by], group.drill);
+                        else snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "Group: %s | ", group_names[group.by]);
+                    }
                     
-                    snprintf(right, sizeof(right), "%s[r] Refresh=%.1fs | [c] CPU | [s] Storage | [n] Net | [t] Tree | [l] Limit(%d) | [f] Freeze: %s | [/] Filter | [q] Quit", 
+                    if (not_root) snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "NOT ROOT: no I/O of other users | ");
+                    if (run_mode == RUN_ATTACH) snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "%s | ", attach_stale ? "ATTACHED (STALE)" : "ATTACHED");
+                    if (flight.post_left > 0) snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "REC pid %d | ", flight.hot_tgid);
+                    else {
+                        unsigned long dumps = __atomic_load_n(&flight.dumps, __ATOMIC_RELAXED);
+                        unsigned long lost = __atomic_load_n(&flight.dropped, __ATOMIC_RELAXED);
+                        if (lost) snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "DUMPS: %lu, %lu lost | ", dumps, lost);
+                        else if (dumps) snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "DUMPS: %lu | ", dumps);
+                    }
+                    if (logw.running) {
+                        unsigned long dropped = __atomic_load_n(&logw.dropped, __ATOMIC_RELAXED);
+                        unsigned long errs = __atomic_load_n(&logw.write_errors, __ATOMIC_RELAXED);
+                        if (dropped || errs) snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "LOG: %lu dropped, %lu failed | ", dropped, errs);
+                        else snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "LOG | ");
+                    }
+                    if (uring_note[0]) snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "%s | ", uring_note);
+#ifdef DEBUG
+                    if (debug_msg[0]) snprintf(f_info + strlen(f_info), sizeof(f_info) - strlen(f_info), "%s | ", debug_msg);
+#endif
+                    snprintf(right, sizeof(right), "%s[r] Refresh=%.1fs | [c] CPU | [s] Storage | [n] Net | [b] Blocked | [m] Mem | [o] Topo | [u] CPUs | [i] IRQ | [v] Pressure | [g] Group | [t] Tree | [l] Limit(%d) | [f] Freeze: %s | [/] Filter | [q] Quit", 
                              f_info, interval, display_limit, frozen ? "ON" : "OFF");
                 }
                 
@@ -1569,236 +7878,297 @@ int main(int argc, char **argv) {
                     s_uram, s_tram, (total_ram > 0) ? ((double)used_ram / (double)total_ram * 100.0) : 0.0,
                     s_uswap, s_tswap, (total_swap > 0) ? ((double)used_swap / (double)total_swap * 100.0) : 0.0);
 
+                // Views list their rows first and print one screenful; the
+                // four lines above every table are the title, the CPU/RAM
+                // line, the column header and the rule
+                viewport_t *vp = &views[mode];
+                vp_begin(vp);
                 if (mode == MODE_NETWORK) {
-                    if (sort_col_net == SORT_NET_RX) 
-                        qsort(curr_net.data, curr_net.len, sizeof(net_iface_t), cmp_net_rx);
-                    else
-                        qsort(curr_net.data, curr_net.len, sizeof(net_iface_t), cmp_net_tx);
-
-                    int namew=16, statw=10, ratew=12, pktw=10, errw=8;
-                    const char *nsort_ind = sort_desc ? "v" : "^";
-                    char h_rx[32], h_tx[32];
-                    snprintf(h_rx, 32, "F1 RX_Mbps%s", sort_col_net == SORT_NET_RX ? nsort_ind : "");
-                    snprintf(h_tx, 32, "F2 TX_Mbps%s", sort_col_net == SORT_NET_TX ? nsort_ind : "");
-
-                    printf("%*s %*s %*s %*s %*s %*s %*s %*s %-6s %s\n",
-                        namew, "IFACE", statw, "STATE", 
-                        ratew, h_rx, ratew, h_tx,
-                        pktw, "RX_Pkts", pktw, "TX_Pkts",
-                        errw, "RX_Err", errw, "TX_Err",
-                        "VMID", "VM_NAME");
-                    for(int i=0; i<cols; i++) putchar('-'); putchar('\n');
-
-                    int count = 0;
-                    for(size_t i=0; i<curr_net.len && count < 50; i++) {
-                        net_iface_t *n = &curr_net.data[i];
-                        if (strncmp(n->name, "fw", 2) == 0 || strcmp(n->name, "lo")==0) continue;
+                    table_sort(&net_table, sort_col_net, curr_net->data, curr_net->len);
+                    int fill_w = table_fill_width(&net_table, 0, cols);
+                    print_table_header(&net_table, 0, sort_col_net);
+                    print_rule(cols);
 
-                        char vmid_buf[16] = "-";
-                        if (n->vmid > 0) snprintf(vmid_buf, sizeof(vmid_buf), "%d", n->vmid);
+                    for(size_t i=0; i<curr_net->len; i++) {
+                        net_iface_t *n = &curr_net->data[i];
+                        if (strncmp(n->name, "fw", 2) == 0 || strcmp(n->name, "lo")==0) continue;
 
                         // FILTER CHECK
                         if (strlen(filter_str) > 0) {
+                            char vmid_buf[16] = "-";
+                            if (n->vmid > 0) snprintf(vmid_buf, sizeof(vmid_buf), "%d", n->vmid);
                             if (!strcasestr(n->name, filter_str) && 
                                 !strcasestr(n->operstate, filter_str) &&
                                 !strcasestr(vmid_buf, filter_str) &&
                                 !strcasestr(n->vm_name, filter_str)) continue;
                         }
 
-                        printf("%*s %*s %*.*f %*.*f %*.*f %*.*f %*.*f %*.*f %-6s %s\n",
-                            namew, n->name, statw, n->operstate,
-                            ratew, 2, n->rx_mbps, ratew, 2, n->tx_mbps,
-                            pktw, 0, n->rx_pps, pktw, 0, n->tx_pps,
-                            errw, 0, n->rx_errs_ps, errw, 0, n->tx_errs_ps,
-                            vmid_buf, n->vm_name);
-                        count++;
+                        vp_add(vp, n, 0, -1, vp_key_str(n->name));
                     }
+                    vp_place(vp, vp_rows(4, display_limit));
+                    vp_print(vp, &net_table, 0, fill_w);
                 } else if (mode == MODE_STORAGE) {
-                    switch(sort_col_disk) {
-                        case SORT_DISK_RIO: qsort(curr_disk.data, curr_disk.len, sizeof(disk_sample_t), cmp_disk_rio); break;
-                        case SORT_DISK_WIO: qsort(curr_disk.data, curr_disk.len, sizeof(disk_sample_t), cmp_disk_wio); break;
-                        case SORT_DISK_RMIB: qsort(curr_disk.data, curr_disk.len, sizeof(disk_sample_t), cmp_disk_rmib); break;
-                        case SORT_DISK_WMIB: qsort(curr_disk.data, curr_disk.len, sizeof(disk_sample_t), cmp_disk_wmib); break;
-                        case SORT_DISK_RLAT: qsort(curr_disk.data, curr_disk.len, sizeof(disk_sample_t), cmp_disk_rlat); break;
-                        case SORT_DISK_WLAT: qsort(curr_disk.data, curr_disk.len, sizeof(disk_sample_t), cmp_disk_wlat); break;
-                        default: qsort(curr_disk.data, curr_disk.len, sizeof(disk_sample_t), cmp_disk_rio); break;
-                    }
+                    table_sort(&disk_table, sort_col_disk, curr_disk->data, curr_disk->len);
+                    int fill_w = table_fill_width(&disk_table, 0, cols);
+                    print_table_header(&disk_table, 0, sort_col_disk);
+                    print_rule(cols);
 
-                    int devw=16, iopsw=12, mibw=12, latw=14;
-                    const char *dsort_ind = sort_desc ? "v" : "^";
-                    char h_ri[32], h_wi[32], h_rm[32], h_wm[32], h_rl[32], h_wl[32];
-                    snprintf(h_ri, 32, "F1 R_IOPS%s", sort_col_disk == SORT_DISK_RIO ? dsort_ind : "");
-                    snprintf(h_wi, 32, "F2 W_IOPS%s", sort_col_disk == SORT_DISK_WIO ? dsort_ind : "");
-                    snprintf(h_rm, 32, "F3 R_MiB/s%s", sort_col_disk == SORT_DISK_RMIB ? dsort_ind : "");
-                    snprintf(h_wm, 32, "F4 W_MiB/s%s", sort_col_disk == SORT_DISK_WMIB ? dsort_ind : "");
-                    snprintf(h_rl, 32, "F5 R_Lat(ms)%s", sort_col_disk == SORT_DISK_RLAT ? dsort_ind : "");
-                    snprintf(h_wl, 32, "F6 W_Lat(ms)%s", sort_col_disk == SORT_DISK_WLAT ? dsort_ind : "");
-
-                    printf("%*s %*s %*s %*s %*s %*s %*s\n",
-                        devw, "DEVICE", iopsw, h_ri, iopsw, h_wi, mibw, h_rm, mibw, h_wm, latw, h_rl, latw, h_wl);
-                    
-                    for(int i=0; i<cols; i++) putchar('-'); putchar('\n');
-
-                    for (size_t i=0; i<curr_disk.len; i++) {
-                        const disk_sample_t *d = &curr_disk.data[i];
+                    for (size_t i=0; i<curr_disk->len; i++) {
+                        disk_sample_t *d = &curr_disk->data[i];
                         // Filter
                         if (strlen(filter_str) > 0 && !strcasestr(d->name, filter_str)) continue;
-
-                        printf("%*s %*.*f %*.*f %*.*f %*.*f %*.*f %*.*f\n",
-                            devw, d->name,
-                            iopsw, 2, d->r_iops,
-                            iopsw, 2, d->w_iops,
-                            mibw, 2, d->r_mib,
-                            mibw, 2, d->w_mib,
-                            latw, 4, d->r_lat,
-                            latw, 4, d->w_lat);
+                        vp_add(vp, d, 0, -1, vp_key_str(d->name));
                     }
-                } else { // MODE_PROCESS
-                    vec_t *view_list = &curr_proc; 
-
-                    switch(sort_col_proc) {
-                        case SORT_PID: qsort(view_list->data, view_list->len, sizeof(sample_t), cmp_pid); break;
-                        case SORT_CPU: qsort(view_list->data, view_list->len, sizeof(sample_t), cmp_cpu); break;
-                        case SORT_LOG_R: qsort(view_list->data, view_list->len, sizeof(sample_t), cmp_logr); break;
-                        case SORT_LOG_W: qsort(view_list->data, view_list->len, sizeof(sample_t), cmp_logw); break;
-                        case SORT_WAIT: qsort(view_list->data, view_list->len, sizeof(sample_t), cmp_wait); break;
-                        case SORT_RMIB: qsort(view_list->data, view_list->len, sizeof(sample_t), cmp_rmib); break;
-                        case SORT_WMIB: qsort(view_list->data, view_list->len, sizeof(sample_t), cmp_wmib); break;
-                        default: qsort(view_list->data, view_list->len, sizeof(sample_t), cmp_cpu); break;
+                    vp_place(vp, vp_rows(4, display_limit));
+                    vp_print(vp, &disk_table, 0, fill_w);
+                } else if (mode == MODE_BLOCKED) {
+                    table_sort(&blocked_table, sort_col_blocked, blocked.rows, blocked.n);
+                    int fill_w = table_fill_width(&blocked_table, 0, cols);
+                    print_table_header(&blocked_table, 0, sort_col_blocked);
+                    print_rule(cols);
+
+                    for (size_t i=0; i<blocked.n; i++) {
+                        blocked_row_t *b = &blocked.rows[i];
+                        if (strlen(filter_str) > 0 && !strcasestr(b->wchan, filter_str) &&
+                            !strcasestr(b->who, filter_str) && !strcasestr(b->stack, filter_str)) continue;
+                        vp_add(vp, b, 0, -1, b->hash | 1);
                     }
+                    vp_place(vp, vp_rows(6, display_limit));
+                    vp_print(vp, &blocked_table, 0, fill_w);
+                    print_rule(cols);
+                    if (run_mode == RUN_ATTACH) printf("Not available when attached: stacks are read from /proc");
+                    else printf("Threads in D state: %d", blocked.total);
+                    if (blocked.total && !blocked.have_stacks) printf("  (kernel stacks need root; grouped by wchan only)");
+                    printf("\n");
+                } else if (mode == MODE_CPUS && (pcpu_compact == 1 || (pcpu_compact < 0 && pcpu.n > 64))) {
+                    // Compact: a grid of small bars in CPU order, 256 CPUs in a screenful
+                    sort_rows(pcpu.rows, (size_t)pcpu.n, sizeof(percpu_row_t), cmp_pcpu_cpu);
+                    int per_line = cols / 20 > 0 ? cols / 20 : 1, x = 0;
+                    for (int i = 0; i < pcpu.n; i++) {
+                        const percpu_row_t *r = &pcpu.rows[i];
+                        if (!r->online) continue;
+                        printf("%4d ", r->cpu);
+                        print_bar(get_pcpu_bar(r), 8);
+                        printf("%s%4.0f%%%s  ", get_cpu_color(r->busy), r->busy, reset_color());
+                        if (++x % per_line == 0) putchar('\n');
+                    }
+                    if (x % per_line) putchar('\n');
+                    print_rule(cols);
+                    printf("Bar: u user  s system  w iowait  i irq  q softirq  t steal | [z] Table\n");
+                } else if (mode == MODE_CPUS) {
+                    table_sort(&pcpu_table, sort_col_pcpu, pcpu.rows, (size_t)pcpu.n);
+                    int fill_w = table_fill_width(&pcpu_table, 0, cols);
+                    print_table_header(&pcpu_table, 0, sort_col_pcpu);
+                    print_rule(cols);
+                    for (int i = 0; i < pcpu.n; i++) {
+                        if (!pcpu.rows[i].online) continue;
+                        vp_add(vp, &pcpu.rows[i], 0, -1, (uint64_t)pcpu.rows[i].cpu + 1);
+                    }
+                    vp_place(vp, vp_rows(6, display_limit));
+                    vp_print(vp, &pcpu_table, 0, fill_w);
+                    print_rule(cols);
+                    printf("Bar: u user  s system  w iowait  i irq  q softirq  t steal | [z] Compact\n");
+                } else if (mode == MODE_IRQ) {
+                    table_sort(&irq_table, sort_col_irq, irqs.view, irqs.n_view);
+                    int fill_w = table_fill_width(&irq_table, 0, cols);
+                    print_table_header(&irq_table, 0, sort_col_irq);
+                    print_rule(cols);
+
+                    for (size_t i=0; i<irqs.n_view; i++) {
+                        irq_row_t *r = &irqs.view[i];
+                        if (strlen(filter_str) > 0) {
+                            char vmid_buf[16];
+                            snprintf(vmid_buf, sizeof(vmid_buf), "%d", r->vmid);
+                            if (!strcasestr(r->label, filter_str) && !strcasestr(r->desc, filter_str) &&
+                                !(r->vmid > 0 && strcasestr(vmid_buf, filter_str))) continue;
+                        }
+                        vp_add(vp, r, 0, -1, vp_key_str(r->label));
+                    }
+                    // The per-CPU table below gets up to half of the screen
+                    int online = 0, rows = get_term_rows();
+                    for (int i=0; i<irqs.n_cpus; i++) online += irqs.cpus[i].online;
+                    int below = online < display_limit ? online : display_limit;
+                    if (rows > 0 && below > (rows - 9) / 2) below = (rows - 9) / 2 > 1 ? (rows - 9) / 2 : 1;
+                    vp_place(vp, vp_rows(8 + below, display_limit));
+                    vp_print(vp, &irq_table, 0, fill_w);
+                    print_rule(cols);
+                    printf("Vectors: %zu | Pinned vCPUs: %d | CPUs with pinned vCPUs taking >= %.0f IRQ/s: %d\n",
+                           irqs.n_view, irqs.pinned, IRQ_COLLIDE_RATE, irqs.collisions);
 
-                    // Column Widths
-                    int pidw = 10, cpuw = 8, memw = 10, userw = 10, uptimew=10, statew = 5, iopsw=10, waitw=8, mibw=10;
-                    
-                    // Headers
-                    int fixed_width = pidw + 1 + cpuw + 1 + 
-                                      memw + 1 + memw + 1 + memw + 1 + 
-                                      uptimew + 1 + userw + 1 + 
-                                      iopsw + 1 + iopsw + 1 + 
-                                      waitw + 1 + 
-                                      mibw + 1 + mibw + 1 + 
-                                      statew + 1;
-                                      
-                    int cmdw = cols - fixed_width; 
-                    if (cmdw < 10) cmdw = 10;
-
-                    // Headers with htop-style F-key labels and sort direction
-                    const char *sort_ind = sort_desc ? "v" : "^";
-                    char h_pid[20], h_cpu[20], h_rlog[20], h_wlog[20], h_wait[20], h_rmib[20], h_wmib[20];
-                    snprintf(h_pid, 20, "F1 PID%s", sort_col_proc == SORT_PID ? sort_ind : "");
-                    snprintf(h_cpu, 20, "F2 CPU%s", sort_col_proc == SORT_CPU ? sort_ind : "");
-                    snprintf(h_rlog, 20, "F3 R_Log%s", sort_col_proc == SORT_LOG_R ? sort_ind : "");
-                    snprintf(h_wlog, 20, "F4 W_Log%s", sort_col_proc == SORT_LOG_W ? sort_ind : "");
-                    snprintf(h_wait, 20, "F5 Wait%s", sort_col_proc == SORT_WAIT ? sort_ind : "");
-                    snprintf(h_rmib, 20, "F6 R_MiB%s", sort_col_proc == SORT_RMIB ? sort_ind : "");
-                    snprintf(h_wmib, 20, "F7 W_MiB%s", sort_col_proc == SORT_WMIB ? sort_ind : "");
-
-                    printf("%*s %-*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %s\n",
-                        pidw, h_pid,
-                        userw, "User",
-                        uptimew, "Uptime",
-                        memw, "Res(MiB)",
-                        memw, "Shr(MiB)",
-                        memw, "Virt(MiB)",
-                        iopsw, h_rlog,
-                        iopsw, h_wlog,
-                        waitw, h_wait,
-                        mibw, h_rmib,
-                        mibw, h_wmib,
-                        cpuw, h_cpu,
-                        statew, "F8 S",
-                        "COMMAND"
-                    );
-                    
-                    for(int i=0; i<cols; i++) putchar('-');
                     putchar('\n');
-
-                    // Calc totals
-                    double t_cpu=0, t_ri=0, t_wi=0, t_rm=0, t_wm=0, t_wt=0;
-                    double t_res=0, t_shr=0, t_virt=0;
-                    
-                    for(size_t i=0; i<curr_raw.len; i++) {
-                        t_cpu += curr_raw.data[i].cpu_pct;
-                        t_ri  += curr_raw.data[i].r_iops;
-                        t_wi  += curr_raw.data[i].w_iops;
-                        t_rm  += curr_raw.data[i].r_mib;
-                        t_wm  += curr_raw.data[i].w_mib;
-                        t_wt  += curr_raw.data[i].io_wait_ms;
-                        
-                        t_res  += (double)curr_raw.data[i].mem_res_pages * 4096.0 / 1048576.0;
-                        t_shr  += (double)curr_raw.data[i].mem_shr_pages * 4096.0 / 1048576.0;
-                        t_virt += (double)curr_raw.data[i].mem_virt_pages * 4096.0 / 1048576.0;
+                    fill_w = table_fill_width(&irqcpu_table, 0, cols);
+                    print_table_header(&irqcpu_table, 0, 0);
+                    int shown = 0;
+                    for (int i=0; i<irqs.n_cpus && shown < below; i++) {
+                        if (!irqs.cpus[i].online) continue;
+                        print_table_row(&irqcpu_table, 0, &irqs.cpus[i], fill_w, 0);
+                        shown++;
+                    }
+                } else if (mode == MODE_PRESSURE) {
+                    table_sort(&cg_table, sort_col_cg, cgs.rows, cgs.n_rows);
+                    int fill_w = table_fill_width(&cg_table, 0, cols);
+                    print_table_header(&cg_table, 0, sort_col_cg);
+                    print_rule(cols);
+
+                    for (size_t i=0; i<cgs.n_rows; i++) {
+                        cg_row_t *r = &cgs.rows[i];
+                        if (strlen(filter_str) > 0) {
+                            char vmid_buf[16];
+                            snprintf(vmid_buf, sizeof(vmid_buf), "%d", r->vmid);
+                            if (!strcasestr(vmid_buf, filter_str) && !strcasestr(r->name, filter_str) &&
+                                !strcasestr(r->cgroup, filter_str)) continue;
+                        }
+                        vp_add(vp, r, 0, -1, (uint64_t)r->tgid);
+                    }
+                    vp_place(vp, vp_rows(7, display_limit));
+                    vp_print(vp, &cg_table, 0, fill_w);
+                    print_rule(cols);
+                    printf("VMs: %zu | Throttled: %d", cgs.n_rows, cgs.throttled);
+                    if (!cgs.root2[0] && !cgs.root_cpu[0]) printf(" | no cgroup filesystem mounted");
+                    printf("\nHost pressure:");
+                    for (int k = 0; k < PSI_N; k++) {
+                        const double *h = cgs.host_stall[k];
+                        if (h[0] < 0) printf("  %s -", psi_names[k]);
+                        else if (k == PSI_CPU && h[1] <= 0) printf("  %s some %.1f%%", psi_names[k], h[0]);
+                        else printf("  %s some %.1f%% full %.1f%%", psi_names[k], h[0], h[1]);
+                    }
+                    printf("\n");
+                } else if (mode == MODE_TOPOLOGY) {
+                    if (!topo.n_cores) topology_load(&topo);
+                    topology_update(&topo, curr_raw);
+                    table_sort(&topo_table, sort_col_topo, topo.cores, topo.n_cores);
+                    int fill_w = table_fill_width(&topo_table, 0, cols);
+                    print_table_header(&topo_table, 0, sort_col_topo);
+                    print_rule(cols);
+
+                    for (size_t i=0; i<topo.n_cores; i++) {
+                        topo_core_t *tc = &topo.cores[i];
+                        if (strlen(filter_str) > 0 && !strcasestr(tc->vms, filter_str) && !strcasestr(tc->cpus, filter_str)) continue;
+                        vp_add(vp, tc, 0, -1, (uint64_t)tc->idx + 1);
+                    }
+                    // Summary, heat map and up to half of the screen for the
+                    // vCPU table below
+                    int rows = get_term_rows(), chrome = 6 + topology_heat_lines(&topo, cols);
+                    int below = topo.n_vcpus < (size_t)display_limit ? (int)topo.n_vcpus : display_limit;
+                    if (rows > 0 && below > (rows - 1 - chrome) / 2) below = (rows - 1 - chrome) / 2 > 1 ? (rows - 1 - chrome) / 2 : 1;
+                    vp_place(vp, vp_rows(chrome + (topo.n_vcpus ? 2 + below : 0), display_limit));
+                    vp_print(vp, &topo_table, 0, fill_w);
+                    print_rule(cols);
+                    printf("Cores: %zu (%d CPUs) | vCPU threads: %zu | Oversubscribed cores: %d\n",
+                           topo.n_cores, topo.n_cpus, topo.n_vcpus, topo.over);
+                    topology_print_heat(&topo, cols);
+
+                    if (topo.n_vcpus) {
+                        putchar('\n');
+                        fill_w = table_fill_width(&vcpu_table, 0, cols);
+                        print_table_header(&vcpu_table, 0, 0);
+                        int shown = 0;
+                        for (size_t i=0; i<topo.n_vcpus && shown < below; i++) {
+                            const topo_vcpu_t *v = &topo.vcpus[i];
+                            if (strlen(filter_str) > 0) {
+                                char vmid_buf[16];
+                                snprintf(vmid_buf, sizeof(vmid_buf), "%d", v->vmid);
+                                if (!strcasestr(vmid_buf, filter_str)) continue;
+                            }
+                            print_table_row(&vcpu_table, 0, v, fill_w, 0);
+                            shown++;
+                        }
+                    }
+                } else if (mode == MODE_MEMORY) {
+                    view_smaps_gen = arena.gen;
+                    const uint32_t *order = table_order(&mem_table, sort_col_mem, curr_proc->data, curr_proc->len);
+                    int fill_w = table_fill_width(&mem_table, 0, cols);
+                    print_table_header(&mem_table, 0, sort_col_mem);
+                    print_rule(cols);
+
+                    for (size_t i=0; i<curr_proc->len; i++) {
+                        sample_t *c = &curr_proc->data[order[i]];
+                        if (strlen(filter_str) > 0) {
+                            char pidbuf[32];
+                            snprintf(pidbuf, sizeof(pidbuf), "%d", c->tgid);
+                            if (!strcasestr(c->cmd, filter_str) && !strcasestr(pidbuf, filter_str) && !strcasestr(c->user, filter_str)) continue;
+                        }
+                        vp_add(vp, c, 0, -1, (uint64_t)c->tgid);
                     }
+                    vp_place(vp, vp_rows(6, display_limit));
+                    if (lazy_collect) fetch_visible(curr_raw, prev, &tindex, vp, now_monotonic());
+                    vp_print(vp, &mem_table, 0, fill_w);
+                    print_rule(cols);
+                    print_table_total(&mem_table, 0, curr_proc->data, curr_proc->len, cycle_fetch);
+                } else if (mode == MODE_PROCESS && group.by && !group.drill[0]) {
+                    table_sort(&group_table, sort_col_group, group.rows, group.n);
+                    int fill_w = table_fill_width(&group_table, 0, cols);
+                    print_table_header(&group_table, 0, sort_col_group);
+                    print_rule(cols);
+
+                    for (size_t i=0; i<group.n; i++) {
+                        group_row_t *r = &group.rows[i];
+                        if (strlen(filter_str) > 0 && !strcasestr(r->label, filter_str)) continue;
+                        vp_add(vp, r, 0, -1, r->hash | 1);
+                    }
+                    vp_place(vp, vp_rows(6, display_limit));
+                    vp_print(vp, &group_table, 0, fill_w);
+                    print_rule(cols);
+                    print_table_total(&group_table, 0, group.rows, group.n, FETCH_ALL);
+                } else { // MODE_PROCESS
+                    vec_t *view_list = curr_proc; 
+                    // Inside a group: its member processes or threads only
+                    if (group.by) {
+                        group_members(&group, curr_proc, curr_raw, &tindex);
+                        view_list = &group.members;
+                    }
+                    unsigned show = show_smaps ? COLF_OPT_SMAPS : 0;
 
-                    int limit = display_limit; 
-                    if ((size_t)limit > view_list->len) limit = view_list->len;
-                    
                     struct sysinfo si;
                     sysinfo(&si);
-                    long uptime_sec = si.uptime;
-
-                    for (int i=0; i<limit; i++) {
-                        const sample_t *c = &view_list->data[i];
-                        char pidbuf[32];
-                        snprintf(pidbuf, sizeof(pidbuf), "%d", c->tgid);
+                    view_uptime_sec = si.uptime;
+                    view_hz = hz;
+                    view_smaps_gen = arena.gen;
+
+                    const uint32_t *order = table_order(&proc_table, sort_col_proc, view_list->data, view_list->len);
+                    int fill_w = table_fill_width(&proc_table, show, cols);
+                    print_table_header(&proc_table, show, sort_col_proc);
+                    print_rule(cols);
+
+                    // Phase two: io/statm for the rows about to be printed. Subtree
+                    // totals need every process, so the hierarchy fetches them all.
+                    // A thread list repeats the memory of its process on every row
+                    unsigned have_fetch = !group.by ? cycle_fetch : group_per_thread(group.by) ? FETCH_ALL & ~FETCH_MEM : FETCH_ALL;
+                    if (group.by) {
+                        for (size_t i=0; i<view_list->len; i++) {
+                            sample_t *c = &view_list->data[order[i]];
+                            if (strlen(filter_str) > 0) {
+                                char pidbuf[32];
+                                snprintf(pidbuf, sizeof(pidbuf), "%d", c->pid);
+                                if (!strcasestr(c->cmd, filter_str) && !strcasestr(pidbuf, filter_str) && !strcasestr(c->user, filter_str)) continue;
+                            }
+                            vp_add(vp, c, 0, -1, (uint64_t)c->pid);
+                        }
+                    } else if (tree_mode == TREE_PROCS) {
+                        if (lazy_collect) fetch_details(curr_raw, prev, &tindex, view_list, view_list->len, now_monotonic());
+                        have_fetch = FETCH_ALL;
+                        proc_tree_build(&ptree, view_list, sort_col_proc);
+                        proc_tree_list(&ptree, vp, filter_str);
+                    } else for (size_t i=0; i<view_list->len; i++) {
+                        sample_t *c = &view_list->data[order[i]];
 
                         if (strlen(filter_str) > 0) {
-                             if (!strcasestr(c->cmd, filter_str) && !strcasestr(pidbuf, filter_str) && !strcasestr(c->user, filter_str)) continue;
+                            char pidbuf[32];
+                            snprintf(pidbuf, sizeof(pidbuf), "%d", c->tgid);
+                            if (!strcasestr(c->cmd, filter_str) && !strcasestr(pidbuf, filter_str) && !strcasestr(c->user, filter_str)) continue;
                         }
-                        
-                        double res_mib = (double)c->mem_res_pages * 4096.0 / 1048576.0;
-                        double shr_mib = (double)c->mem_shr_pages * 4096.0 / 1048576.0;
-                        double virt_mib = (double)c->mem_virt_pages * 4096.0 / 1048576.0;
-
-                        long proc_uptime = uptime_sec - (c->start_time_ticks / hz);
-                        char uptime_buf[32];
-                        int days = proc_uptime / 86400;
-                        int hrs = (proc_uptime % 86400) / 3600;
-                        int mins = (proc_uptime % 3600) / 60;
-                        int secs = proc_uptime % 60;
-                        if (days > 0) snprintf(uptime_buf, 32, "%dd%02dh", days, hrs);
-                        else snprintf(uptime_buf, 32, "%02d:%02d:%02d", hrs, mins, secs);
-
-                        // Print row with color coding for CPU, Wait, and State
-                        printf("%*s %-*s %*s %*.0f %*.0f %*.0f %*.0f %*.0f ",
-                            pidw, pidbuf,
-                            userw, c->user,
-                            uptimew, uptime_buf,
-                            memw, res_mib,
-                            memw, shr_mib,
-                            memw, virt_mib,
-                            iopsw, c->r_iops,
-                            iopsw, c->w_iops);
-                        // Wait with color
-                        printf("%s%*.*f%s ", get_wait_color(c->io_wait_ms), waitw, 2, c->io_wait_ms, reset_color());
-                        printf("%*.*f %*.*f ", mibw, 2, c->r_mib, mibw, 2, c->w_mib);
-                        // CPU with color
-                        printf("%s%*.*f%s ", get_cpu_color(c->cpu_pct), cpuw, 2, c->cpu_pct, reset_color());
-                        // State with color
-                        printf("%s%*c%s ", get_state_color(c->state), statew, c->state, reset_color());
-                        fprint_trunc(stdout, c->cmd, cmdw);
-                        putchar('\n');
 
-                        if (show_tree) {
-                            print_threads_for_tgid(&curr_raw, c->tgid, pidw, cpuw, iopsw, waitw, mibw, statew, cmdw);
-                        }
+                        int line = vp_add(vp, c, 0, -1, (uint64_t)c->tgid);
+                        if (tree_mode == TREE_THREADS) list_threads_for_tgid(vp, curr_raw, &tindex, c->tgid, line);
                     }
-
-                    for(int i=0; i<cols; i++) putchar('-');
-                    putchar('\n');
-                    printf("%*s %*s %*s %*.0f %*.0f %*.0f %*.0f %*.0f %*.*f %*.*f %*.*f %*.*f\n",
-                            pidw, "TOTAL",
-                            userw, "",
-                            uptimew, "",
-                            memw, t_res,
-                            memw, t_shr,
-                            memw, t_virt,
-                            iopsw, t_ri,
-                            iopsw, t_wi,
-                            waitw, 2, t_wt,
-                            mibw, 0, t_rm,
-                            mibw, 0, t_wm,
-                            cpuw, 2, t_cpu);
+                    vp_place(vp, vp_rows(6, display_limit));
+                    if (lazy_collect && tree_mode != TREE_PROCS && !group.by) fetch_visible(curr_raw, prev, &tindex, vp, now_monotonic());
+                    vp_print(vp, &proc_table, show, fill_w);
+
+                    print_rule(cols);
+                    // Lazily collected groups only exist for some rows, so a
+                    // total over them would be misleading
+                    print_table_total(&proc_table, show, view_list->data, view_list->len, have_fetch);
                 }
                 
                 // Print htop-style footer bar
@@ -1810,7 +8180,17 @@ int main(int argc, char **argv) {
 
             double elapsed = now_monotonic() - start_wait;
             double remain = interval - elapsed;
+            if (run_mode == RUN_ATTACH) {
+                // The collector sets the pace: poll the ring for a new snapshot
+                if (!frozen && shm_has_newer(&ring)) break;
+                int stale = shm_age(&ring) > 3.0 * interval + 1.0;
+                if (stale != attach_stale) { attach_stale = stale; dirty = 1; }
+                remain = 0.25;
+            }
             if (remain <= 0) break;
+            double burst = flight_burst_wait(&flight, now_monotonic());
+            if (burst == 0) { flight_burst_sample(&flight, hz, now_monotonic()); continue; }
+            if (burst > 0 && burst < remain) remain = burst;
 
             int c = wait_for_input(remain);
             // Prevent busy loop if select returns 0 immediately but remain is still large
@@ -1818,6 +8198,11 @@ int main(int argc, char **argv) {
                 usleep(50000); // 50ms sleep to be safe
             }
 
+            if (c == KEY_WAKE) {
+                if (netlink_drain_events(curr_net) > 0 && mode == MODE_NETWORK) dirty = 1;
+                continue;
+            }
+
             if (c > 0) {
                 if (in_filter_mode) {
                     if (c == 27) { // ESC
@@ -1864,6 +8249,43 @@ int main(int argc, char **argv) {
                         }
                         dirty = 1;
                     }
+                } else if (in_action_mode) {
+                    if (c == 27) {
+                        in_action_mode = 0;
+                    } else if (in_action_mode == 1) {
+                        int k = tolower(c);
+                        int kind = k == 'n' ? ACT_NICE : k == 'i' ? ACT_IOPRIO : k == 'a' ? ACT_AFFINITY : k == 'v' ? ACT_PIN_VCPUS : -1;
+                        if (kind == ACT_PIN_VCPUS && action.vmid < 0) {
+                            snprintf(action_msg, sizeof(action_msg), "pid %d is not a VM", action.tgid);
+                            in_action_mode = 0;
+                        } else if (kind >= 0) {
+                            action.kind = (action_kind_t)kind;
+                            action_str[0] = '\0';
+                            in_action_mode = 2;
+                        }
+                    } else if (in_action_mode == 2) {
+                        size_t len = strlen(action_str);
+                        if (c == 127 || c == 8) {
+                            if (len > 0) action_str[len-1] = '\0';
+                        } else if (c == '\n' || c == '\r') {
+                            char err[64];
+                            if (action_parse(&action, action_str, err, sizeof(err)) == 0) in_action_mode = 3;
+                            else { snprintf(action_msg, sizeof(action_msg), "%s", err); in_action_mode = 0; }
+                        } else if (isprint(c) && len < sizeof(action_str)-1) {
+                            action_str[len] = (char)c;
+                            action_str[len+1] = '\0';
+                        }
+                    } else {
+                        in_action_mode = 0;
+                        if (c == 'y' || c == 'Y') {
+                            action_run(&action, action_msg, sizeof(action_msg));
+                            // Take the next sample now so the change shows up
+                            if (!frozen) break;
+                        } else {
+                            snprintf(action_msg, sizeof(action_msg), "%s cancelled", action_names[action.kind]);
+                        }
+                    }
+                    dirty = 1;
                 } else if (in_refresh_mode) {
                     if (c == 27) { 
                         in_refresh_mode = 0;
@@ -1890,17 +8312,129 @@ int main(int argc, char **argv) {
                         dirty = 1;
                     }
                 } else {
+                    const table_t *view_table = mode == MODE_NETWORK ? &net_table : mode == MODE_STORAGE ? &disk_table :
+                                                mode == MODE_BLOCKED ? &blocked_table : mode == MODE_MEMORY ? &mem_table :
+                                                mode == MODE_TOPOLOGY ? &topo_table : mode == MODE_IRQ ? &irq_table :
+                                                mode == MODE_PRESSURE ? &cg_table :
+                                                mode == MODE_CPUS ? &pcpu_table :
+                                                group.by && !group.drill[0] ? &group_table : &proc_table;
+                    sort_col_t *view_sort = mode == MODE_NETWORK ? &sort_col_net : mode == MODE_STORAGE ? &sort_col_disk :
+                                            mode == MODE_BLOCKED ? &sort_col_blocked : mode == MODE_MEMORY ? &sort_col_mem :
+                                            mode == MODE_TOPOLOGY ? &sort_col_topo : mode == MODE_IRQ ? &sort_col_irq :
+                                            mode == MODE_PRESSURE ? &sort_col_cg :
+                                            mode == MODE_CPUS ? &sort_col_pcpu :
+                                            group.by && !group.drill[0] ? &sort_col_group : &sort_col_proc;
+                    unsigned view_show = (view_table == &proc_table && show_smaps) ? COLF_OPT_SMAPS : 0;
+
+                    // Rows start on line 5, under the title, CPU/RAM line, header and rule
+                    if (vp_key(&views[mode], c, &last_mouse_event, 5)) dirty = 1;
                     if (c == '/') { in_filter_mode = 1; dirty = 1; }
+                    if ((c == 'a' || c == 'A') && (mode == MODE_MEMORY || (mode == MODE_PROCESS && view_table == &proc_table)) && views[mode].n) {
+                        const viewport_t *v = &views[mode];
+                        const vp_line_t *l = &v->lines[v->sel];
+                        char path[64], cmd[CMD_MAX];
+                        ssize_t n = 0;
+                        memset(&action, 0, sizeof(action));
+                        if (mode == MODE_PROCESS && group.by) {
+                            // Group members are copies that only change when a frame is drawn
+                            const sample_t *row = l->row;
+                            action.tid = row->pid != row->tgid ? row->pid : 0;
+                            action.tgid = row->tgid;
+                        } else {
+                            action.tid = (l->flags & ROW_THREAD) ? (pid_t)l->key : 0;
+                            action.tgid = (l->flags & ROW_THREAD) ? (pid_t)v->lines[l->parent].key : (pid_t)l->key;
+                        }
+                        read_cmdline(action.tgid, cmd);
+                        action.vmid = cmd_vmid(cmd);
+                        snprintf(path, sizeof(path), "/proc/%d/task/%d/comm", action.tgid, action.tid ? action.tid : action.tgid);
+                        if (read_small_file(path, action.comm, sizeof(action.comm), &n) != 0) n = 0;
+                        while (n > 0 && (action.comm[n-1] == '\n' || action.comm[n-1] == '\0')) n--;
+                        action.comm[n] = '\0';
+                        action_msg[0] = '\0';
+                        in_action_mode = 1;
+                        dirty = 1;
+                    }
                     if (c == 'l' || c == 'L') { in_limit_mode = 1; limit_str[0]='\0'; dirty = 1; }
                     if (c == 'r' || c == 'R') { in_refresh_mode = 1; refresh_str[0]='\0'; dirty = 1; }
                     if (c == 'q' || c == 'Q') goto cleanup;
                     if (c == 'f' || c == 'F') { frozen = !frozen; dirty = 1; }
-                    if (c == 't' || c == 'T') { show_tree = !show_tree; mode = MODE_PROCESS; dirty = 1; }
+                    if ((c == 'g' || c == 'G') && run_mode != RUN_DAEMON) {
+                        group.by = (group_by_t)((group.by + 1) % GROUP_COUNT);
+                        if (group.by == GROUP_CGROUP && run_mode == RUN_ATTACH) group.by = GROUP_CGROUP + 1;
+                        group.drill[0] = '\0';
+                        views[MODE_PROCESS].sel = views[MODE_PROCESS].top = 0;
+                        views[MODE_PROCESS].sel_key = 0;
+                        // Totals for every task right away, not after the next refresh
+                        if (group.by && !frozen) {
+                            if (lazy_collect) fetch_details(curr_raw, prev, &tindex, curr_proc, curr_proc->len, now_monotonic());
+                            group_collect(&group, curr_raw, &tindex);
+                        }
+                        mode = MODE_PROCESS;
+                        dirty = 1;
+                    }
+                    if ((c == '\n' || c == '\r') && mode == MODE_PROCESS && view_table == &group_table && views[mode].n) {
+                        const viewport_t *v = &views[mode];
+                        for (size_t i = 0; i < group.n; i++) {
+                            if ((group.rows[i].hash | 1) != v->lines[v->sel].key) continue;
+                            snprintf(group.drill, sizeof(group.drill), "%s", group.rows[i].label);
+                            views[mode].sel = views[mode].top = 0;
+                            views[mode].sel_key = 0;
+                            break;
+                        }
+                        dirty = 1;
+                    }
+                    if ((c == 27 || c == 127 || c == 8) && mode == MODE_PROCESS && group.drill[0]) {
+                        group.drill[0] = '\0';
+                        views[mode].sel = views[mode].top = 0;
+                        views[mode].sel_key = 0;
+                        dirty = 1;
+                    }
+                    if (c == 't' || c == 'T') { tree_mode = (tree_mode_t)((tree_mode + 1) % 3); mode = MODE_PROCESS; dirty = 1; }
+                    if ((c == 'p' || c == 'P') && run_mode != RUN_ATTACH) { show_smaps = !show_smaps; mode = MODE_PROCESS; dirty = 1; }
                     if (c == 'n' || c == 'N') { mode = MODE_NETWORK; dirty = 1; }
                     if (c == 'c' || c == 'C') { mode = MODE_PROCESS; dirty = 1; }
                     if (c == 's' || c == 'S') { mode = MODE_STORAGE; dirty = 1; }
+                    if ((c == 'b' || c == 'B') && mode != MODE_BLOCKED) {
+                        if (run_mode != RUN_ATTACH) blocked_collect(&blocked, curr_raw, curr_proc);
+                        mode = MODE_BLOCKED;
+                        dirty = 1;
+                    }
+                    if (c == 'm' || c == 'M') { mode = MODE_MEMORY; dirty = 1; }
+                    if (c == 'o' || c == 'O') { topology_load(&topo); mode = MODE_TOPOLOGY; dirty = 1; }
+                    if (c == 'u' || c == 'U') { mode = MODE_CPUS; dirty = 1; }
+                    if ((c == 'i' || c == 'I') && mode != MODE_IRQ && run_mode != RUN_DAEMON) {
+                        irqstat_prime(&irqs, curr_raw, curr_proc);
+                        mode = MODE_IRQ;
+                        dirty = 1;
+                    }
+                    if ((c == 'v' || c == 'V') && mode != MODE_PRESSURE && run_mode != RUN_DAEMON) {
+                        cgstat_prime(&cgs, curr_proc);
+                        mode = MODE_PRESSURE;
+                        dirty = 1;
+                    }
+                    if ((c == 'z' || c == 'Z') && mode == MODE_CPUS) {
+                        pcpu_compact = !(pcpu_compact == 1 || (pcpu_compact < 0 && pcpu.n > 64));
+                        dirty = 1;
+                    }
                     if (c == 'e' || c == 'E') {
-                        export_csv("kvmtop", &curr_proc, &curr_net, &curr_disk, mode);
+                        // Export covers every process, not just the visible rows
+                        if (lazy_collect) fetch_details(curr_raw, prev, &tindex, curr_proc, curr_proc->len, now_monotonic());
+                        if (mode == MODE_NETWORK) export_csv(&net_table, curr_net->data, curr_net->len, NULL);
+                        else if (mode == MODE_STORAGE) export_csv(&disk_table, curr_disk->data, curr_disk->len, NULL);
+                        else if (mode == MODE_BLOCKED) export_csv(&blocked_table, blocked.rows, blocked.n, NULL);
+                        else if (mode == MODE_TOPOLOGY) export_csv(&topo_table, topo.cores, topo.n_cores, NULL);
+                        else if (mode == MODE_CPUS) export_csv(&pcpu_table, pcpu.rows, (size_t)pcpu.n, NULL);
+                        else if (mode == MODE_IRQ) export_csv(&irq_table, irqs.view, irqs.n_view, NULL);
+                        else if (mode == MODE_PRESSURE) export_csv(&cg_table, cgs.rows, cgs.n_rows, NULL);
+                        else if (mode == MODE_MEMORY) {
+                            view_smaps_gen = arena.gen;
+                            export_csv(&mem_table, curr_proc->data, curr_proc->len,
+                                       table_order(&mem_table, sort_col_mem, curr_proc->data, curr_proc->len));
+                        } else if (group.by && !group.drill[0]) export_csv(&group_table, group.rows, group.n, NULL);
+                        else if (group.by) export_csv(&proc_table, group.members.data, group.members.len,
+                                                      table_order(&proc_table, sort_col_proc, group.members.data, group.members.len));
+                        else export_csv(&proc_table, curr_proc->data, curr_proc->len,
+                                        table_order(&proc_table, sort_col_proc, curr_proc->data, curr_proc->len));
                         dirty = 1;
                     }
                     if (c == 'h' || c == 'H') {
@@ -1909,58 +8443,77 @@ int main(int argc, char **argv) {
                         dirty = 1;
                     }
                     
-                    // Handle mouse clicks on header row
-                    if (c == KEY_MOUSE) {
-                        int sort_key = handle_header_click(last_mouse_event.x, last_mouse_event.y, mode);
-                        if (sort_key > 0) {
-                            c = sort_key;  // Convert mouse click to sort key
-                        }
-                    }
-                    
-                    // Sorting keys - support both number keys (1-8) and function keys (F1-F8)
-                    if (mode == MODE_PROCESS) {
-                        if (c == '1' || c == KEY_F1) { if (sort_col_proc == SORT_PID) sort_desc = !sort_desc; else { sort_col_proc = SORT_PID; sort_desc = 1; } dirty = 1; }
-                        if (c == '2' || c == KEY_F2) { if (sort_col_proc == SORT_CPU) sort_desc = !sort_desc; else { sort_col_proc = SORT_CPU; sort_desc = 1; } dirty = 1; }
-                        if (c == '3' || c == KEY_F3) { if (sort_col_proc == SORT_LOG_R) sort_desc = !sort_desc; else { sort_col_proc = SORT_LOG_R; sort_desc = 1; } dirty = 1; }
-                        if (c == '4' || c == KEY_F4) { if (sort_col_proc == SORT_LOG_W) sort_desc = !sort_desc; else { sort_col_proc = SORT_LOG_W; sort_desc = 1; } dirty = 1; }
-                        if (c == '5' || c == KEY_F5) { if (sort_col_proc == SORT_WAIT) sort_desc = !sort_desc; else { sort_col_proc = SORT_WAIT; sort_desc = 1; } dirty = 1; }
-                        if (c == '6' || c == KEY_F6) { if (sort_col_proc == SORT_RMIB) sort_desc = !sort_desc; else { sort_col_proc = SORT_RMIB; sort_desc = 1; } dirty = 1; }
-                        if (c == '7' || c == KEY_F7) { if (sort_col_proc == SORT_WMIB) sort_desc = !sort_desc; else { sort_col_proc = SORT_WMIB; sort_desc = 1; } dirty = 1; }
-                        if (c == '8' || c == KEY_F8) { /* Reserved for State sorting */ dirty = 1; }
-                    } else if (mode == MODE_NETWORK) {
-                        if (c == '1' || c == KEY_F1) { if (sort_col_net == SORT_NET_RX) sort_desc = !sort_desc; else { sort_col_net = SORT_NET_RX; sort_desc = 1; } dirty = 1; }
-                        if (c == '2' || c == KEY_F2) { if (sort_col_net == SORT_NET_TX) sort_desc = !sort_desc; else { sort_col_net = SORT_NET_TX; sort_desc = 1; } dirty = 1; }
-                    } else if (mode == MODE_STORAGE) {
-                        if (c == '1' || c == KEY_F1) { if (sort_col_disk == SORT_DISK_RIO) sort_desc = !sort_desc; else { sort_col_disk = SORT_DISK_RIO; sort_desc = 1; } dirty = 1; }
-                        if (c == '2' || c == KEY_F2) { if (sort_col_disk == SORT_DISK_WIO) sort_desc = !sort_desc; else { sort_col_disk = SORT_DISK_WIO; sort_desc = 1; } dirty = 1; }
-                        if (c == '3' || c == KEY_F3) { if (sort_col_disk == SORT_DISK_RMIB) sort_desc = !sort_desc; else { sort_col_disk = SORT_DISK_RMIB; sort_desc = 1; } dirty = 1; }
-                        if (c == '4' || c == KEY_F4) { if (sort_col_disk == SORT_DISK_WMIB) sort_desc = !sort_desc; else { sort_col_disk = SORT_DISK_WMIB; sort_desc = 1; } dirty = 1; }
-                        if (c == '5' || c == KEY_F5) { if (sort_col_disk == SORT_DISK_RLAT) sort_desc = !sort_desc; else { sort_col_disk = SORT_DISK_RLAT; sort_desc = 1; } dirty = 1; }
-                        if (c == '6' || c == KEY_F6) { if (sort_col_disk == SORT_DISK_WLAT) sort_desc = !sort_desc; else { sort_col_disk = SORT_DISK_WLAT; sort_desc = 1; } dirty = 1; }
+                    // Sorting: number keys (1-8), function keys (F1-F8), '<'/'>' to step
+                    // through every sortable column, or a click on the header
+                    sort_col_t want = 0;
+                    int fkey = (c >= '1' && c <= '9') ? c - '0' : (c >= KEY_F1 && c <= KEY_F10) ? c - KEY_F1 + 1 : 0;
+                    if (fkey) want = table_fkey_sort(view_table, fkey);
+                    if (c == '<') want = table_step_sort(view_table, view_show, *view_sort, -1);
+                    if (c == '>') want = table_step_sort(view_table, view_show, *view_sort, 1);
+                    if (c == KEY_MOUSE)
+                        want = handle_header_click(last_mouse_event.x, last_mouse_event.y, view_table, view_show,
+                                                   table_fill_width(view_table, view_show, get_term_cols()));
+                    if (want) {
+                        table_select_sort(view_table, view_sort, want);
+                        dirty = 1;
                     }
                 }
             }
         }
 
+next_cycle:
         if (!frozen) {
-            qsort(curr_raw.data, curr_raw.len, sizeof(sample_t), cmp_key);
-            vec_free(&prev); prev = curr_raw; vec_init(&curr_raw);
-            vec_net_free(&prev_net); prev_net = curr_net; vec_net_init(&curr_net);
-            vec_disk_free(&prev_disk); prev_disk = curr_disk; vec_disk_init(&curr_disk);
+            sort_rows(curr_raw->data, curr_raw->len, sizeof(sample_t), cmp_key);
+            arena_advance(&arena);
+#ifdef DEBUG
+            // After warm-up the buffers are big enough; any allocation past
+            // that point means a steady-state cycle allocated. The counts go
+            // into the header, since stderr is the terminal the frame is on.
+            if (++cycles == 2) alloc_mark = malloc_calls;
+            // Compare with and without --io-uring
+            snprintf(debug_msg, sizeof(debug_msg), "DEBUG: %lu reads, %lu syscalls (%s), %.2f ms, %lu allocs",
+                     file_reads - reads_mark, engine_syscalls - syscalls_mark, uring.fd >= 0 ? "io_uring" : "read",
+                     collect_ms, cycles > 2 ? malloc_calls - alloc_mark : 0);
+            if (run_mode == RUN_DAEMON) fprintf(stderr, "%s in cycle %lu\n", debug_msg, cycles);
+            reads_mark = file_reads;
+            syscalls_mark = engine_syscalls;
+#endif
             t_prev = t_curr;
             prev_cpu = curr_cpu;
         }
     }
 
 cleanup:
-    disable_raw_mode();
-    vec_free(&prev);
-    vec_free(&curr_raw);
-    vec_free(&curr_proc);
-    vec_net_free(&prev_net);
-    vec_net_free(&curr_net);
-    vec_disk_free(&prev_disk);
-    vec_disk_free(&curr_disk);
+    if (run_mode != RUN_DAEMON) disable_raw_mode();
+    if (run_mode == RUN_DAEMON && ring.map) {
+        // Tell attached viewers this file will never be updated again
+        unlink(ring.path);
+        __atomic_store_n(&shm_hdr(&ring)->retired, 1, __ATOMIC_RELEASE);
+    }
+    shm_detach(&ring);
+    serve_close();
+    flight_close(&flight);
+    if (logw.running) {
+        log_stop(&logw);
+        fprintf(stderr, "kvmtop: logged %lu snapshots to %s (%lu dropped, %lu failed writes)\n",
+                logw.written, logw.dir, logw.dropped, logw.write_errors);
+    }
+    free(frame.data);
+    thread_index_free(&tindex);
+    proc_tree_free(&ptree);
+    for (size_t i = 0; i < sizeof(views) / sizeof(views[0]); i++) free(views[i].lines);
+    blocked_free(&blocked);
+    topology_free(&topo);
+    irqstat_free(&irqs);
+    cgstat_free(&cgs);
+    group_free(&group);
+    percpu_free(&pcpu);
+    counter_soa_free(&ctr);
+    arena_free(&arena);
+    proc_file_close(&pf_stat);
+    proc_file_close(&pf_diskstats);
+    proc_file_close(&pf_net_dev);
+    netlink_close();
     free(filter);
     return 0;
 }
\ No newline at end of file